@@ -353,6 +353,51 @@ function TEST_rados_get_with_subreadall_eio_shard_1() {
     delete_erasure_coded_pool $poolname
 }
 
+# A partial read of a chunk whose OSD is down makes clay fetch only the
+# sub-chunks needed to repair it.  When one of those sub-chunk reads fails
+# the read has to start over with whole chunks from the shards left.
+function TEST_rados_get_clay_subchunk_eio() {
+    local dir=$1
+    local objname=myobject
+    setup_osds 6 || return 1
+
+    ceph config set osd osd_ec_partial_reads true || return 1
+    local poolname=pool-clay
+    create_ec_pool $poolname true plugin=clay k=4 m=2 d=5 || return 1
+
+    local stripe_width=$(ceph osd pool ls detail --format=json | \
+        jq ".[] | select(.pool_name==\"$poolname\") | .stripe_width")
+    local chunk_size=$(expr $stripe_width / 4)
+    for marker in AAA BBB CCCC DDDD ; do
+        printf "%*s" $chunk_size $marker
+    done > $dir/ORIGINAL
+    rados --pool $poolname put $objname $dir/ORIGINAL || return 1
+
+    local -a initial_osds=($(get_osds $poolname $objname))
+    local primary=${initial_osds[0]}
+    # shard 2 is one of the helpers repairing shard 1
+    inject_eio ec data $poolname $objname $dir 2 || return 1
+
+    ceph osd set noout || return 1
+    kill_daemons $dir TERM osd.${initial_osds[1]} >&2 < /dev/null || return 1
+    ceph osd down ${initial_osds[1]} || return 1
+    wait_for_peered || return 1
+
+    # one chunk per read, with overwrites there is no need to read
+    # whole stripes
+    rados --pool $poolname -b $chunk_size get $objname $dir/COPY || return 1
+    diff $dir/ORIGINAL $dir/COPY || return 1
+    rm $dir/ORIGINAL $dir/COPY
+
+    CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.$primary) log flush || return 1
+    grep -q "sub-chunk read, restarting" $dir/osd.$primary.log || return 1
+
+    ceph osd unset noout || return 1
+    ceph config rm osd osd_ec_partial_reads
+    ceph osd pool delete $poolname $poolname --yes-i-really-really-mean-it
+    ceph osd erasure-code-profile rm myprofile
+}
+
 # Test recovery the object attr read error
 function TEST_ec_object_attr_read_error() {
     local dir=$1
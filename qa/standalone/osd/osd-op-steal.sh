@@ -0,0 +1,118 @@
+#!/usr/bin/env bash
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Library Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library Public License for more details.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7149" # git grep '\<7149\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    # a single thread per shard, and steal as soon as anything is waiting
+    CEPH_ARGS+="--osd_op_num_shards=4 --osd_op_num_threads_per_shard=1 "
+    CEPH_ARGS+="--osd_op_steal_min_queue=2 "
+    CEPH_ARGS+="--osd_op_queue=wpq "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function shard_counter_sum() {
+    local counter=$1
+
+    CEPH_ARGS='' ceph --format=json daemon $(get_asok_path osd.0) perf dump | \
+        jq "[to_entries[] | select(.key | startswith(\"osd_shard.\")) | .value.$counter] | add"
+}
+
+function TEST_steal_keeps_pg_order() {
+    local dir=$1
+
+    run_mon $dir a --osd_pool_default_size=1 || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 || return 1
+    # a single PG: all the load lands on one shard, the other three idle
+    create_pool test 1 1 || return 1
+    wait_for_clean || return 1
+
+    # ceph_test_rados fails if the writes to an object complete out of
+    # order, or if a read sees anything but what was last written
+    ceph_test_rados --pool test --max-ops 4000 --objects 8 \
+        --max-in-flight 64 --size 4000 --min-stride-size 400 \
+        --max-stride-size 800 \
+        --op read 100 --op write 100 --op append 50 || return 1
+
+    # the idle shards' threads did work the hot shard's queue
+    local stolen=$(shard_counter_sum stolen)
+    local steals=$(shard_counter_sum steals)
+    echo "stolen $stolen steals $steals"
+    test "$stolen" -gt 0 || return 1
+    test "$stolen" = "$steals" || return 1
+
+    # and only the shard with the PG was stolen from
+    local hot=$(CEPH_ARGS='' ceph --format=json daemon $(get_asok_path osd.0) perf dump | \
+        jq '[to_entries[] | select(.key | startswith("osd_shard.")) | select(.value.stolen > 0)] | length')
+    test "$hot" = 1 || return 1
+}
+
+# p99 of the op durations the OSD kept in its history
+function historic_ops_p99() {
+    CEPH_ARGS='' ceph --format=json daemon $(get_asok_path osd.0) dump_historic_ops | \
+        jq '[.ops[].duration] | sort | .[length * 99 / 100 | floor]'
+}
+
+# restart osd.0 with the given osd_op_steal_min_queue, run a write bench
+# and print the p99 op latency it saw
+function bench_p99() {
+    local dir=$1
+    local steal_min_queue=$2
+
+    kill_daemons $dir TERM osd.0 || return 1
+    activate_osd $dir 0 --osd_op_steal_min_queue=$steal_min_queue \
+        --osd_op_history_size=100000 --osd_op_history_duration=3600 || return 1
+    wait_for_clean || return 1
+    rados -p test bench 20 write -t 64 -b 4096 --no-cleanup > /dev/null || return 1
+    historic_ops_p99
+}
+
+function TEST_steal_p99() {
+    local dir=$1
+
+    run_mon $dir a --osd_pool_default_size=1 || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 || return 1
+    # more PGs than shards, so that some shards get more of the load
+    create_pool test 8 8 || return 1
+    wait_for_clean || return 1
+
+    local off
+    off=$(bench_p99 $dir 0) || return 1
+    local on
+    on=$(bench_p99 $dir 2) || return 1
+    # latencies depend on the machine, only report them
+    echo "p99 op latency: ${off}s without stealing, ${on}s with stealing"
+    test "$off" != null || return 1
+    test "$on" != null || return 1
+}
+
+main osd-op-steal "$@"
+
+# Local Variables:
+# compile-command: "cd ../.. ; make -j4 && test/osd/osd-op-steal.sh"
+# End:
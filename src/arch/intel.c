@@ -23,6 +23,9 @@ int ceph_arch_intel_ssse3 = 0;
 int ceph_arch_intel_sse3 = 0;
 int ceph_arch_intel_sse2 = 0;
 int ceph_arch_intel_aesni = 0;
+int ceph_arch_intel_avx2 = 0;
+int ceph_arch_intel_avx512f = 0;
+int ceph_arch_intel_avx512dq = 0;
 
 #ifdef __x86_64__
 #include <cpuid.h>
@@ -36,6 +39,24 @@ int ceph_arch_intel_aesni = 0;
 #define CPUID_SSE3	(1)
 #define CPUID_SSE2	(1 << 26)
 #define CPUID_AESNI (1 << 25)
+#define CPUID_OSXSAVE	(1 << 27)
+#define CPUID_AVX	(1 << 28)
+
+/* EAX=7,ECX=0: extended features in ebx */
+#define CPUID7_AVX2	(1 << 5)
+#define CPUID7_AVX512F	(1 << 16)
+#define CPUID7_AVX512DQ	(1 << 17)
+
+/* XCR0: the OS saves sse/avx state, and the avx-512 opmask/zmm state */
+#define XCR0_YMM	0x06
+#define XCR0_ZMM	0xe6
+
+static unsigned long long ceph_arch_intel_xgetbv(void)
+{
+	unsigned int lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+}
 
 int ceph_arch_intel_probe(void)
 {
@@ -66,6 +87,22 @@ int ceph_arch_intel_probe(void)
           ceph_arch_intel_aesni = 1;
   }
 
+	/* wide vector registers are only usable if the OS saves them too */
+	if ((ecx & CPUID_OSXSAVE) != 0 && (ecx & CPUID_AVX) != 0 &&
+	    __get_cpuid_max(0, NULL) >= 7) {
+		unsigned long long xcr0 = ceph_arch_intel_xgetbv();
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if ((xcr0 & XCR0_YMM) == XCR0_YMM && (ebx & CPUID7_AVX2) != 0) {
+			ceph_arch_intel_avx2 = 1;
+		}
+		if ((xcr0 & XCR0_ZMM) == XCR0_ZMM && (ebx & CPUID7_AVX512F) != 0) {
+			ceph_arch_intel_avx512f = 1;
+			if ((ebx & CPUID7_AVX512DQ) != 0) {
+				ceph_arch_intel_avx512dq = 1;
+			}
+		}
+	}
+
 	return 0;
 }
 
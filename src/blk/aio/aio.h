@@ -103,6 +103,20 @@ struct io_queue_t {
   virtual int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
 			   void *priv, int *retries) = 0;
   virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+
+  /// set up per_class io buffers in each size class from a page up to
+  /// max_len for alloc_fixed_buffer(); call after init()
+  virtual int register_fixed_buffers(unsigned per_class, unsigned max_len) {
+    return -EOPNOTSUPP;
+  }
+
+  /// allocate an io buffer the queue can use without per-io page pinning,
+  /// for the duration of a single io; returns nullptr if the queue has
+  /// none (left) of at least len bytes
+  virtual ceph::unique_leakable_ptr<ceph::buffer::raw> alloc_fixed_buffer(
+    unsigned len) {
+    return nullptr;
+  }
 };
 
 struct aio_queue_t final : public io_queue_t {
@@ -21,6 +21,7 @@
 #include <sys/file.h>
 
 #include "KernelDevice.h"
+#include "include/buffer_raw.h"
 #include "include/intarith.h"
 #include "include/types.h"
 #include "include/compat.h"
@@ -477,6 +478,25 @@ int KernelDevice::_aio_start()
       }
       return r;
     }
+    unsigned fixed_buffers =
+      cct->_conf.get_val<uint64_t>("bdev_ioring_fixed_buffers");
+    if (fixed_buffers && cct->_conf.get_val<bool>("bdev_ioring")) {
+      r = io_queue->register_fixed_buffers(
+	fixed_buffers,
+	cct->_conf.get_val<Option::size_t>("bdev_ioring_fixed_buffer_size"));
+      // not fatal, ios just keep pinning their pages
+      if (r == -EOPNOTSUPP) {
+	dout(1) << __func__ << " io_uring fixed buffers not supported,"
+		<< " continuing without them" << dendl;
+      } else if (r == -ENOMEM || r == -EPERM) {
+	derr << __func__ << " failed to register io_uring fixed buffers: "
+	     << cpp_strerror(r) << " (check RLIMIT_MEMLOCK);"
+	     << " continuing without them" << dendl;
+      } else if (r < 0) {
+	derr << __func__ << " failed to register io_uring fixed buffers: "
+	     << cpp_strerror(r) << "; continuing without them" << dendl;
+      }
+    }
     aio_thread.create("bstore_aio");
   }
   return 0;
@@ -969,8 +989,17 @@ int KernelDevice::aio_write(
 	ioc->pending_aios.push_back(aio_t(ioc, choose_fd(false, write_hint)));
 	++ioc->num_pending;
 	auto& aio = ioc->pending_aios.back();
-	bl.prepare_iov(&aio.iov);
-	aio.bl.claim_append(bl);
+	auto raw = io_queue->alloc_fixed_buffer(len);
+	if (raw) {
+	  // a copy into a registered buffer saves pinning the pages
+	  bl.begin().copy(len, raw->get_data());
+	  bl.clear();
+	  aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
+	  aio.bl.prepare_iov(&aio.iov);
+	} else {
+	  bl.prepare_iov(&aio.iov);
+	  aio.bl.claim_append(bl);
+	}
 	aio.pwritev(off, len);
 	dout(30) << aio << dendl;
 	dout(5) << __func__ << " 0x" << std::hex << off << "~" << len
@@ -1092,8 +1121,11 @@ int KernelDevice::aio_read(
     ioc->pending_aios.push_back(aio_t(ioc, fd_directs[WRITE_LIFE_NOT_SET]));
     ++ioc->num_pending;
     aio_t& aio = ioc->pending_aios.back();
-    aio.bl.push_back(
-      ceph::buffer::ptr_node::create(ceph::buffer::create_small_page_aligned(len)));
+    auto raw = io_queue->alloc_fixed_buffer(len);
+    if (!raw) {
+      raw = ceph::buffer::create_small_page_aligned(len);
+    }
+    aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
     aio.bl.prepare_iov(&aio.iov);
     aio.preadv(off, len);
     dout(30) << aio << dendl;
@@ -8,12 +8,182 @@
 #include "liburing.h"
 #include <sys/epoll.h>
 
+#include <mutex>
+
+#include "include/buffer_raw.h"
+#include "include/intarith.h"
+
+/*
+ * A pool of io buffers registered with the ring (IORING_REGISTER_BUFFERS),
+ * so that READ_FIXED/WRITE_FIXED can skip pinning user pages on every io.
+ * Buffers come in a few size classes, from a page up to the configured
+ * size, so that a small io does not take a large buffer.
+ *
+ * Registered buffers are only lent out for the duration of an io: once a
+ * read completes its data is copied out into an ordinary buffer and the
+ * slot goes back to the pool, so data cached above us never holds on to
+ * one.  Buffers keep the pool alive, as an io may still be in flight when
+ * the ring is torn down.
+ */
+class raw_ioring_fixed;
+
+struct ioring_fixed_pool {
+  struct size_class {
+    unsigned buf_size;
+    unsigned first;  ///< registration index of its first buffer
+    char *base;
+    std::vector<unsigned> free_slots;
+  };
+
+  char *base = nullptr;
+  std::vector<size_class> classes;  ///< smallest first
+  std::mutex lock;
+  std::vector<raw_ioring_fixed*> owners;  ///< by registration index
+
+  ~ioring_fixed_pool() {
+    ::free(base);
+  }
+
+  int init(unsigned per_class, unsigned max_size) {
+    max_size = p2roundup(max_size, (unsigned)CEPH_PAGE_SIZE);
+    size_t total = 0;
+    for (unsigned size = CEPH_PAGE_SIZE; ; size = std::min(size * 4, max_size)) {
+      classes.push_back(size_class{size, (unsigned)owners.size(), nullptr, {}});
+      owners.resize(owners.size() + per_class);
+      total += (size_t)per_class * size;
+      if (size == max_size)
+	break;
+    }
+    int r = ::posix_memalign((void**)&base, CEPH_PAGE_SIZE, total);
+    if (r) {
+      base = nullptr;
+      return -r;
+    }
+    char *p = base;
+    for (auto& c : classes) {
+      c.base = p;
+      p += (size_t)per_class * c.buf_size;
+      c.free_slots.reserve(per_class);
+      for (unsigned i = per_class; i > 0; --i) {
+	c.free_slots.push_back(i - 1);
+      }
+    }
+    return 0;
+  }
+
+  unsigned class_count(unsigned k) const {
+    return (k + 1 < classes.size() ? classes[k + 1].first : owners.size()) -
+      classes[k].first;
+  }
+
+  void get_iovecs(std::vector<struct iovec> *iovs) const {
+    iovs->resize(owners.size());
+    for (unsigned k = 0; k < classes.size(); ++k) {
+      auto& c = classes[k];
+      for (unsigned i = 0; i < class_count(k); ++i) {
+	(*iovs)[c.first + i].iov_base = c.base + (size_t)i * c.buf_size;
+	(*iovs)[c.first + i].iov_len = c.buf_size;
+      }
+    }
+  }
+
+  /// registration index of the buffer [p, p+len) lies in, or -1
+  int find(const void *p, size_t len) const {
+    const char *cp = static_cast<const char*>(p);
+    for (unsigned k = 0; k < classes.size(); ++k) {
+      auto& c = classes[k];
+      unsigned n = class_count(k);
+      if (cp < c.base || cp >= c.base + (size_t)n * c.buf_size) {
+	continue;
+      }
+      unsigned idx = (cp - c.base) / c.buf_size;
+      if (cp + len > c.base + (size_t)(idx + 1) * c.buf_size) {
+	return -1;
+      }
+      return c.first + idx;
+    }
+    return -1;
+  }
+
+  /// take the smallest free buffer of at least len bytes
+  char *get(unsigned len, raw_ioring_fixed *owner, unsigned *index) {
+    std::lock_guard l(lock);
+    for (auto& c : classes) {
+      if (c.buf_size < len || c.free_slots.empty()) {
+	continue;
+      }
+      unsigned slot = c.free_slots.back();
+      c.free_slots.pop_back();
+      *index = c.first + slot;
+      owners[*index] = owner;
+      return c.base + (size_t)slot * c.buf_size;
+    }
+    return nullptr;
+  }
+
+  void put(unsigned index) {
+    std::lock_guard l(lock);
+    owners[index] = nullptr;
+    for (auto c = classes.rbegin(); c != classes.rend(); ++c) {
+      if (index >= c->first) {
+	c->free_slots.push_back(index - c->first);
+	return;
+      }
+    }
+  }
+
+  raw_ioring_fixed *get_owner(unsigned index) {
+    std::lock_guard l(lock);
+    return owners[index];
+  }
+};
+
+class raw_ioring_fixed : public ceph::buffer::raw {
+  std::shared_ptr<ioring_fixed_pool> pool;
+  int index = -1;  ///< registration index, -1 once detached
+public:
+  raw_ioring_fixed(std::shared_ptr<ioring_fixed_pool> p, unsigned l)
+    : raw(l),
+      pool(std::move(p)) {}
+  ~raw_ioring_fixed() override {
+    if (index >= 0) {
+      pool->put(index);
+    } else {
+      ::free(data);
+    }
+  }
+  bool attach() {
+    unsigned i;
+    data = pool->get(len, this, &i);
+    if (!data) {
+      return false;
+    }
+    index = i;
+    return true;
+  }
+  /// move the data out of the registered buffer and give that back
+  void detach() {
+    char *c = nullptr;
+    int r = ::posix_memalign((void**)&c, CEPH_PAGE_SIZE,
+			     std::max(len, 1u));
+    ceph_assert(r == 0);
+    memcpy(c, data, len);
+    data = c;
+    pool->put(index);
+    index = -1;
+  }
+  raw* clone_empty() override {
+    return ceph::buffer::create_small_page_aligned(len).release();
+  }
+};
+
 struct ioring_data {
   struct io_uring io_uring;
   pthread_mutex_t cq_mutex;
   pthread_mutex_t sq_mutex;
   int epoll_fd = -1;
   std::map<int, int> fixed_fds_map;
+  std::shared_ptr<ioring_fixed_pool> fixed_pool;
 };
 
 static int ioring_get_cqe(struct ioring_data *d, unsigned int max,
@@ -54,7 +224,18 @@ static void init_sqe(struct ioring_data *d, struct io_uring_sqe *sqe,
 
   ceph_assert(fixed_fd != -1);
 
-  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
+  int buf_index = -1;
+  if (d->fixed_pool && io->iov.size() == 1) {
+    buf_index = d->fixed_pool->find(io->iov[0].iov_base, io->iov[0].iov_len);
+  }
+
+  if (buf_index >= 0 && io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
+    io_uring_prep_write_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+			      io->iov[0].iov_len, io->offset, buf_index);
+  else if (buf_index >= 0 && io->iocb.aio_lio_opcode == IO_CMD_PREADV)
+    io_uring_prep_read_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+			     io->iov[0].iov_len, io->offset, buf_index);
+  else if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
     io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
 			 io->iov.size(), io->offset);
   else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV)
@@ -103,6 +284,20 @@ static void build_fixed_fds_map(struct ioring_data *d,
   }
 }
 
+/* Give a completed read's registered buffer back to the pool */
+static void release_fixed_buffer(struct ioring_data *d, struct aio_t *io)
+{
+  if (io->iocb.aio_lio_opcode != IO_CMD_PREADV || io->iov.size() != 1)
+    return;
+  int index = d->fixed_pool->find(io->iov[0].iov_base, io->iov[0].iov_len);
+  if (index < 0)
+    return;
+  /* the aio still holds the buffer, so its owner is alive */
+  raw_ioring_fixed *raw = d->fixed_pool->get_owner(index);
+  if (raw)
+    raw->detach();
+}
+
 ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_) :
   d(make_unique<ioring_data>()),
   iodepth(iodepth_),
@@ -167,6 +362,7 @@ close_ring_fd:
 void ioring_queue_t::shutdown()
 {
   d->fixed_fds_map.clear();
+  d->fixed_pool.reset();
   close(d->epoll_fd);
   d->epoll_fd = -1;
   io_uring_queue_exit(&d->io_uring);
@@ -193,6 +389,12 @@ get_cqe:
   int events = ioring_get_cqe(d.get(), max, paio);
   pthread_mutex_unlock(&d->cq_mutex);
 
+  if (d->fixed_pool) {
+    for (int i = 0; i < events; ++i) {
+      release_fixed_buffer(d.get(), paio[i]);
+    }
+  }
+
   if (events == 0) {
     struct epoll_event ev;
     int ret = TEMP_FAILURE_RETRY(epoll_wait(d->epoll_fd, &ev, 1, timeout_ms));
@@ -206,6 +408,38 @@ get_cqe:
   return events;
 }
 
+int ioring_queue_t::register_fixed_buffers(unsigned per_class,
+					   unsigned max_len)
+{
+  auto pool = std::make_shared<ioring_fixed_pool>();
+  int ret = pool->init(per_class, max_len);
+  if (ret < 0)
+    return ret;
+
+  std::vector<struct iovec> iovs;
+  pool->get_iovecs(&iovs);
+  ret = io_uring_register_buffers(&d->io_uring, &iovs[0], iovs.size());
+  if (ret < 0)
+    return ret;
+
+  d->fixed_pool = std::move(pool);
+  return 0;
+}
+
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::alloc_fixed_buffer(unsigned len)
+{
+  auto pool = d->fixed_pool;
+  if (!pool)
+    return nullptr;
+  auto raw = new raw_ioring_fixed(std::move(pool), len);
+  if (!raw->attach()) {
+    delete raw;
+    return nullptr;
+  }
+  return ceph::unique_leakable_ptr<ceph::buffer::raw>(raw);
+}
+
 bool ioring_queue_t::supported()
 {
   struct io_uring ring;
@@ -253,6 +487,18 @@ int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
   ceph_assert(0);
 }
 
+int ioring_queue_t::register_fixed_buffers(unsigned per_class,
+					   unsigned max_len)
+{
+  ceph_assert(0);
+}
+
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::alloc_fixed_buffer(unsigned len)
+{
+  ceph_assert(0);
+}
+
 bool ioring_queue_t::supported()
 {
   return false;
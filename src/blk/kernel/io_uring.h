@@ -30,4 +30,7 @@ struct ioring_queue_t final : public io_queue_t {
   int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
                    void *priv, int *retries) final;
   int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+  int register_fixed_buffers(unsigned per_class, unsigned max_len) final;
+  ceph::unique_leakable_ptr<ceph::buffer::raw> alloc_fixed_buffer(
+    unsigned len) final;
 };
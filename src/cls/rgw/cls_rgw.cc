@@ -2060,28 +2060,48 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx,
 
   auto in_iter = in->cbegin();
 
-  while (!in_iter.end()) {
+  // decode the whole batch first, so that the current index entries can
+  // be read with a single omap lookup
+  struct suggested_change {
     __u8 op;
-    rgw_bucket_dir_entry cur_change;
-    rgw_bucket_dir_entry cur_disk;
+    rgw_bucket_dir_entry entry;
+    string key;
+  };
+  std::vector<suggested_change> changes;
+  std::set<string> keys;
+  while (!in_iter.end()) {
+    auto& change = changes.emplace_back();
     try {
-      decode(op, in_iter);
-      decode(cur_change, in_iter);
+      decode(change.op, in_iter);
+      decode(change.entry, in_iter);
     } catch (ceph::buffer::error& err) {
       CLS_LOG(1, "ERROR: rgw_dir_suggest_changes(): failed to decode request\n");
       return -EINVAL;
     }
+    encode_obj_index_key(change.entry.key, &change.key);
+    keys.insert(change.key);
+  }
 
-    bufferlist cur_disk_bl;
-    string cur_change_key;
-    encode_obj_index_key(cur_change.key, &cur_change_key);
-    int ret = cls_cxx_map_get_val(hctx, cur_change_key, &cur_disk_bl);
-    if (ret < 0 && ret != -ENOENT)
+  std::map<string, bufferlist> cur_disk_vals;
+  if (!keys.empty()) {
+    rc = cls_cxx_map_get_vals_by_keys(hctx, keys, &cur_disk_vals);
+    if (rc < 0) {
       return -EINVAL;
+    }
+  }
 
-    if (ret == -ENOENT) {
+  for (auto& change : changes) {
+    __u8 op = change.op;
+    rgw_bucket_dir_entry& cur_change = change.entry;
+    const string& cur_change_key = change.key;
+    rgw_bucket_dir_entry cur_disk;
+    int ret;
+
+    auto cur_disk_it = cur_disk_vals.find(cur_change_key);
+    if (cur_disk_it == cur_disk_vals.end()) {
       continue;
     }
+    bufferlist& cur_disk_bl = cur_disk_it->second;
 
     if (cur_disk_bl.length()) {
       auto cur_disk_iter = cur_disk_bl.cbegin();
@@ -2160,7 +2180,7 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx,
         break;
       } // switch(op)
     } // if (cur_disk.pending_map.empty())
-  } // while (!in_iter.end())
+  } // for (auto& change : changes)
 
   if (header_changed) {
     return write_bucket_header(hctx, &header);
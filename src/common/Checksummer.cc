@@ -0,0 +1,238 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/Checksummer.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(NON_CEPH_BUILD)
+#define HAVE_CHECKSUMMER_X86_KERNELS
+#include <immintrin.h>
+#include "arch/probe.h"
+#include "arch/intel.h"
+#endif
+
+// The multi-buffer kernels hash 8 equally sized blocks side by side, one
+// per vector lane.  They produce exactly what XXH32()/XXH64() would, so
+// they only take block sizes where that doesn't need any tail handling;
+// everything else goes through the scalar kernels.
+
+static void xxhash32_scalar(uint32_t seed, size_t len, const char* data,
+			    size_t count, uint32_t* out)
+{
+  for (size_t i = 0; i < count; ++i, data += len) {
+    out[i] = XXH32(data, len, seed);
+  }
+}
+
+static void xxhash64_scalar(uint64_t seed, size_t len, const char* data,
+			    size_t count, uint64_t* out)
+{
+  for (size_t i = 0; i < count; ++i, data += len) {
+    out[i] = XXH64(data, len, seed);
+  }
+}
+
+static const Checksummer::block_kernels_t checksummer_scalar = {
+  "scalar", xxhash32_scalar, xxhash64_scalar
+};
+
+#ifdef HAVE_CHECKSUMMER_X86_KERNELS
+
+static constexpr uint32_t XXH32_P1 = 0x9E3779B1U;
+static constexpr uint32_t XXH32_P2 = 0x85EBCA77U;
+static constexpr uint32_t XXH32_P3 = 0xC2B2AE3DU;
+
+static constexpr uint64_t XXH64_P1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t XXH64_P2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t XXH64_P3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t XXH64_P4 = 0x85EBCA77C2B2AE63ULL;
+
+#define XXH32_ROTL_AVX2(x, r)						\
+  _mm256_or_si256(_mm256_slli_epi32((x), (r)), _mm256_srli_epi32((x), 32 - (r)))
+
+__attribute__((target("avx2")))
+static inline __m256i xxh32_round_avx2(__m256i acc, __m256i in)
+{
+  acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(in, _mm256_set1_epi32(XXH32_P2)));
+  acc = XXH32_ROTL_AVX2(acc, 13);
+  return _mm256_mullo_epi32(acc, _mm256_set1_epi32(XXH32_P1));
+}
+
+// 8 blocks at a time, lane i hashes block i.  Each stripe is 16 bytes
+// (4 words) per block; we load blocks i and i + 4 into the two halves of
+// a register and transpose so that register k holds word k of all 8.
+__attribute__((target("avx2")))
+static void xxhash32_avx2(uint32_t seed, size_t len, const char* data,
+			  size_t count, uint32_t* out)
+{
+  if (len < 16 || len % 16) {
+    xxhash32_scalar(seed, len, data, count, out);
+    return;
+  }
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const char* b = data + i * len;
+    __m256i v1 = _mm256_set1_epi32(seed + XXH32_P1 + XXH32_P2);
+    __m256i v2 = _mm256_set1_epi32(seed + XXH32_P2);
+    __m256i v3 = _mm256_set1_epi32(seed);
+    __m256i v4 = _mm256_set1_epi32(seed - XXH32_P1);
+    for (size_t off = 0; off < len; off += 16) {
+      __m256i r[4];
+      for (int j = 0; j < 4; ++j) {
+	r[j] = _mm256_inserti128_si256(
+	  _mm256_castsi128_si256(
+	    _mm_loadu_si128((const __m128i*)(b + j * len + off))),
+	  _mm_loadu_si128((const __m128i*)(b + (j + 4) * len + off)), 1);
+      }
+      __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+      __m256i t1 = _mm256_unpacklo_epi32(r[2], r[3]);
+      __m256i t2 = _mm256_unpackhi_epi32(r[0], r[1]);
+      __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+      v1 = xxh32_round_avx2(v1, _mm256_unpacklo_epi64(t0, t1));
+      v2 = xxh32_round_avx2(v2, _mm256_unpackhi_epi64(t0, t1));
+      v3 = xxh32_round_avx2(v3, _mm256_unpacklo_epi64(t2, t3));
+      v4 = xxh32_round_avx2(v4, _mm256_unpackhi_epi64(t2, t3));
+    }
+    __m256i h = _mm256_add_epi32(
+      _mm256_add_epi32(XXH32_ROTL_AVX2(v1, 1), XXH32_ROTL_AVX2(v2, 7)),
+      _mm256_add_epi32(XXH32_ROTL_AVX2(v3, 12), XXH32_ROTL_AVX2(v4, 18)));
+    h = _mm256_add_epi32(h, _mm256_set1_epi32((uint32_t)len));
+    // avalanche
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(XXH32_P2));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(XXH32_P3));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    _mm256_storeu_si256((__m256i*)(out + i), h);
+  }
+  xxhash32_scalar(seed, len, data + i * len, count - i, out + i);
+}
+
+#undef XXH32_ROTL_AVX2
+
+// there is no 64 bit multiply below avx512dq, so xxhash64 needs zmm
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i xxh64_round_avx512(__m512i acc, __m512i in)
+{
+  acc = _mm512_add_epi64(acc, _mm512_mullo_epi64(in, _mm512_set1_epi64(XXH64_P2)));
+  acc = _mm512_rol_epi64(acc, 31);
+  return _mm512_mullo_epi64(acc, _mm512_set1_epi64(XXH64_P1));
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i xxh64_merge_round_avx512(__m512i h, __m512i v)
+{
+  h = _mm512_xor_si512(h, xxh64_round_avx512(_mm512_setzero_si512(), v));
+  return _mm512_add_epi64(_mm512_mullo_epi64(h, _mm512_set1_epi64(XXH64_P1)),
+			  _mm512_set1_epi64(XXH64_P4));
+}
+
+// Same layout as the xxhash32 kernel with 32 byte stripes: blocks i and
+// i + 4 share a register, then 64 bit unpacks and a cross-lane permute
+// put word k of all 8 blocks into one register.
+__attribute__((target("avx512f,avx512dq")))
+static void xxhash64_avx512(uint64_t seed, size_t len, const char* data,
+			    size_t count, uint64_t* out)
+{
+  if (len < 32 || len % 32) {
+    xxhash64_scalar(seed, len, data, count, out);
+    return;
+  }
+  const __m512i even = _mm512_setr_epi64(0, 1, 8, 9, 4, 5, 12, 13);
+  const __m512i odd = _mm512_setr_epi64(2, 3, 10, 11, 6, 7, 14, 15);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const char* b = data + i * len;
+    __m512i v1 = _mm512_set1_epi64(seed + XXH64_P1 + XXH64_P2);
+    __m512i v2 = _mm512_set1_epi64(seed + XXH64_P2);
+    __m512i v3 = _mm512_set1_epi64(seed);
+    __m512i v4 = _mm512_set1_epi64(seed - XXH64_P1);
+    for (size_t off = 0; off < len; off += 32) {
+      __m512i r[4];
+      for (int j = 0; j < 4; ++j) {
+	r[j] = _mm512_inserti64x4(
+	  _mm512_castsi256_si512(
+	    _mm256_loadu_si256((const __m256i*)(b + j * len + off))),
+	  _mm256_loadu_si256((const __m256i*)(b + (j + 4) * len + off)), 1);
+      }
+      // per 128 bit lane: {b0 w0, b1 w0}, {b0 w2, b1 w2}, {b4 w0, b5 w0}, ...
+      __m512i lo01 = _mm512_unpacklo_epi64(r[0], r[1]);
+      __m512i hi01 = _mm512_unpackhi_epi64(r[0], r[1]);
+      __m512i lo23 = _mm512_unpacklo_epi64(r[2], r[3]);
+      __m512i hi23 = _mm512_unpackhi_epi64(r[2], r[3]);
+      v1 = xxh64_round_avx512(v1, _mm512_permutex2var_epi64(lo01, even, lo23));
+      v2 = xxh64_round_avx512(v2, _mm512_permutex2var_epi64(hi01, even, hi23));
+      v3 = xxh64_round_avx512(v3, _mm512_permutex2var_epi64(lo01, odd, lo23));
+      v4 = xxh64_round_avx512(v4, _mm512_permutex2var_epi64(hi01, odd, hi23));
+    }
+    __m512i h = _mm512_add_epi64(
+      _mm512_add_epi64(_mm512_rol_epi64(v1, 1), _mm512_rol_epi64(v2, 7)),
+      _mm512_add_epi64(_mm512_rol_epi64(v3, 12), _mm512_rol_epi64(v4, 18)));
+    h = xxh64_merge_round_avx512(h, v1);
+    h = xxh64_merge_round_avx512(h, v2);
+    h = xxh64_merge_round_avx512(h, v3);
+    h = xxh64_merge_round_avx512(h, v4);
+    h = _mm512_add_epi64(h, _mm512_set1_epi64(len));
+    // avalanche
+    h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+    h = _mm512_mullo_epi64(h, _mm512_set1_epi64(XXH64_P2));
+    h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 29));
+    h = _mm512_mullo_epi64(h, _mm512_set1_epi64(XXH64_P3));
+    h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 32));
+    _mm512_storeu_si512(out + i, h);
+  }
+  xxhash64_scalar(seed, len, data + i * len, count - i, out + i);
+}
+
+static const Checksummer::block_kernels_t checksummer_avx2 = {
+  "avx2", xxhash32_avx2, xxhash64_scalar
+};
+static const Checksummer::block_kernels_t checksummer_avx512 = {
+  "avx512dq", xxhash32_avx2, xxhash64_avx512
+};
+
+#endif // HAVE_CHECKSUMMER_X86_KERNELS
+
+std::vector<const Checksummer::block_kernels_t*>
+Checksummer::available_block_kernels()
+{
+  std::vector<const block_kernels_t*> res = { &checksummer_scalar };
+#ifdef HAVE_CHECKSUMMER_X86_KERNELS
+  ceph_arch_probe();
+  if (ceph_arch_intel_avx2) {
+    res.push_back(&checksummer_avx2);
+    if (ceph_arch_intel_avx512f && ceph_arch_intel_avx512dq) {
+      res.push_back(&checksummer_avx512);
+    }
+  }
+#endif
+  return res;
+}
+
+const Checksummer::block_kernels_t& Checksummer::block_kernels()
+{
+  // the last one available is the widest
+  static const block_kernels_t* chosen = available_block_kernels().back();
+  return *chosen;
+}
+
+void Checksummer::xxhash32::calc_blocks(
+  init_value_t init_value,
+  size_t len,
+  const char *data,
+  size_t count,
+  init_value_t *out)
+{
+  block_kernels().xxhash32(init_value, len, data, count, out);
+}
+
+void Checksummer::xxhash64::calc_blocks(
+  init_value_t init_value,
+  size_t len,
+  const char *data,
+  size_t count,
+  init_value_t *out)
+{
+  block_kernels().xxhash64(init_value, len, data, count, out);
+}
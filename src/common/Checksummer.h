@@ -4,9 +4,12 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <vector>
+
 #include "include/buffer.h"
 #include "include/byteorder.h"
 #include "include/ceph_assert.h"
+#include "include/crc32c.h"
 
 #include "xxHash/xxhash.h"
 
@@ -90,6 +93,17 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t count,
+      init_value_t *out
+      ) {
+      for (size_t i = 0; i < count; ++i, data += len) {
+	out[i] = ceph_crc32c(init_value, (const unsigned char*)data, len);
+      }
+    }
   };
 
   struct crc32c_16 {
@@ -111,6 +125,17 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t count,
+      init_value_t *out
+      ) {
+      for (size_t i = 0; i < count; ++i, data += len) {
+	out[i] = ceph_crc32c(init_value, (const unsigned char*)data, len) & 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -132,6 +157,17 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t count,
+      init_value_t *out
+      ) {
+      for (size_t i = 0; i < count; ++i, data += len) {
+	out[i] = ceph_crc32c(init_value, (const unsigned char*)data, len) & 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -161,6 +197,13 @@ public:
       }
       return XXH32_digest(state);
     }
+    // several blocks at once where the cpu allows it, see Checksummer.cc
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t count,
+      init_value_t *out);
   };
 
   struct xxhash64 {
@@ -190,8 +233,28 @@ public:
       }
       return XXH64_digest(state);
     }
+    // several blocks at once where the cpu allows it, see Checksummer.cc
+    static void calc_blocks(
+      init_value_t init_value,
+      size_t len,
+      const char *data,
+      size_t count,
+      init_value_t *out);
   };
 
+  // Hash count consecutive blocks of len bytes each.  The best kernel
+  // the cpu supports is picked at startup; the others are only listed
+  // so that tests can check them against the scalar one.
+  struct block_kernels_t {
+    const char* name;
+    void (*xxhash32)(uint32_t seed, size_t len, const char* data,
+		     size_t count, uint32_t* out);
+    void (*xxhash64)(uint64_t seed, size_t len, const char* data,
+		     size_t count, uint64_t* out);
+  };
+  static std::vector<const block_kernels_t*> available_block_kernels();
+  static const block_kernels_t& block_kernels();
+
   template<class Alg>
   static int calculate(
     size_t csum_block_size,
@@ -212,24 +275,21 @@ public:
       const ceph::buffer::list &bl,
       ceph::buffer::ptr* csum_data) {
     ceph_assert(length % csum_block_size == 0);
-    size_t blocks = length / csum_block_size;
-    ceph::buffer::list::const_iterator p = bl.begin();
     ceph_assert(bl.length() >= length);
-
-    typename Alg::state_t state;
-    Alg::init(&state);
-
     ceph_assert(csum_data->length() >= (offset + length) / csum_block_size *
 	   sizeof(typename Alg::value_t));
 
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
-    }
-    Alg::fini(&state);
+    calc_batches<Alg>(
+      init_value, csum_block_size, length, bl,
+      [&](size_t first, size_t count, const typename Alg::init_value_t *v) {
+	for (size_t i = 0; i < count; ++i) {
+	  pv[first + i] = v[i];
+	}
+	return true;
+      });
     return 0;
   }
 
@@ -243,31 +303,84 @@ public:
     uint64_t *bad_csum=0
     ) {
     ceph_assert(length % csum_block_size == 0);
-    ceph::buffer::list::const_iterator p = bl.begin();
     ceph_assert(bl.length() >= length);
 
-    typename Alg::state_t state;
-    Alg::init(&state);
-
     const typename Alg::value_t *pv =
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
-    size_t pos = offset;
-    while (length > 0) {
-      typename Alg::init_value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+    int bad = -1;  // no errors
+    calc_batches<Alg>(
+      -1, csum_block_size, length, bl,
+      [&](size_t first, size_t count, const typename Alg::init_value_t *v) {
+	for (size_t i = 0; i < count; ++i) {
+	  if (pv[first + i] != v[i]) {
+	    if (bad_csum) {
+	      *bad_csum = v[i];
+	    }
+	    bad = offset + (first + i) * csum_block_size;
+	    return false;
+	  }
 	}
-	Alg::fini(&state);
-	return pos;
+	return true;
+      });
+    return bad;
+  }
+
+private:
+  // blocks checksummed per calc_blocks() call
+  static constexpr size_t BATCH_BLOCKS = 64;
+
+  // Feed the checksums of the length / csum_block_size blocks at the
+  // front of bl to f(first_block, count, values) in batches, until f
+  // returns false.  Blocks that sit in one buffer go through
+  // Alg::calc_blocks, only those spanning two buffers are streamed.
+  template<class Alg, class F>
+  static void calc_batches(
+    typename Alg::init_value_t init_value,
+    size_t csum_block_size,
+    size_t length,
+    const ceph::buffer::list &bl,
+    F&& f) {
+    typename Alg::init_value_t v[BATCH_BLOCKS];
+    typename Alg::state_t state;
+    bool have_state = false;
+    size_t blocks = length / csum_block_size;
+    size_t block = 0;
+    ceph::buffer::list::const_iterator p = bl.begin();
+    while (block < blocks) {
+      ceph::buffer::ptr cur = p.get_current_ptr();
+      size_t n = std::min<size_t>(cur.length() / csum_block_size,
+				  blocks - block);
+      if (n == 0) {
+	if (!have_state) {
+	  Alg::init(&state);
+	  have_state = true;
+	}
+	v[0] = Alg::calc(state, init_value, csum_block_size, p);
+	if (!f(block, 1, v)) {
+	  break;
+	}
+	++block;
+	continue;
+      }
+      const char *data = cur.c_str();
+      p += n * csum_block_size;
+      bool more = true;
+      while (n > 0 && more) {
+	size_t count = std::min(n, BATCH_BLOCKS);
+	Alg::calc_blocks(init_value, csum_block_size, data, count, v);
+	more = f(block, count, v);
+	data += count * csum_block_size;
+	block += count;
+	n -= count;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
+      if (!more) {
+	break;
+      }
+    }
+    if (have_state) {
+      Alg::fini(&state);
     }
-    Alg::fini(&state);
-    return -1;  // no errors
   }
 };
 
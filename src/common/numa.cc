@@ -188,6 +188,13 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size, cpu_set_t *cpu_set)
   return 0;
 }
 
+int set_cpu_affinity_thread(pthread_t thread,
+			    size_t cpu_set_size,
+			    cpu_set_t *cpu_set)
+{
+  return -pthread_setaffinity_np(thread, cpu_set_size, cpu_set);
+}
+
 #else
 int parse_cpu_set_list(const char *s,
 		       size_t *cpu_set_size,
@@ -221,4 +228,11 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size,
   return -ENOTSUP;
 }
 
+int set_cpu_affinity_thread(pthread_t thread,
+			    size_t cpu_set_size,
+			    cpu_set_t *cpu_set)
+{
+  return -ENOTSUP;
+}
+
 #endif
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <include/compat.h>
+#include <pthread.h>
 #include <sched.h>
 #include <ostream>
 #include <set>
@@ -22,3 +23,7 @@ int get_numa_node_cpu_set(int node,
 
 int set_cpu_affinity_all_threads(size_t cpu_set_size,
 				 cpu_set_t *cpu_set);
+
+int set_cpu_affinity_thread(pthread_t thread,
+			    size_t cpu_set_size,
+			    cpu_set_t *cpu_set);
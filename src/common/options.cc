@@ -2966,6 +2966,13 @@ std::vector<Option> get_global_options() {
     .set_description("")
     .add_see_also("osd_op_num_shards"),
 
+    Option("osd_op_steal_min_queue", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Let idle op threads work the queue of a shard with this many ops waiting")
+    .set_long_description("Each PG is served by one op shard, so a few busy PGs on the same shard can saturate its threads while the others idle.  Idle threads then process the ops of the shard with the longest queue, in the same per-PG order as its own threads.  0 (the default) disables this; qa/standalone/osd/osd-op-steal.sh reports the p99 op latency with and without it.")
+    .add_see_also("osd_op_num_shards"),
+
     Option("osd_skip_data_digest", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description("Do not store full-object checksums if the backend (bluestore) does its own checksums.  Only usable with all BlueStore OSDs."),
@@ -3096,6 +3103,29 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("osd_ec_parity_delta_writes", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Update parity from the changed data for small EC overwrites")
+    .set_long_description("On pools with allow_ec_overwrites and plugins "
+                          "supporting it (jerasure reed_sol_van and "
+                          "reed_sol_r6_op, isa), an overwrite of part of a "
+                          "stripe may read only the data chunks it changes "
+                          "and the parity chunks, and update the parity with "
+                          "the difference, rather than read and encode the "
+                          "whole stripe again.  Each write uses whichever "
+                          "reads and writes fewer chunks.")
+    .set_flag(Option::FLAG_RUNTIME),
+
+    Option("osd_ec_partial_reads", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Only read the EC data chunks a client read covers")
+    .set_long_description("A read of part of a stripe fetches the data "
+                          "chunks holding the requested range, or the "
+                          "fewest chunks (and sub-chunks) the plugin needs "
+                          "to rebuild them if some are unavailable, rather "
+                          "than enough chunks to decode the whole stripe.")
+    .set_flag(Option::FLAG_RUNTIME),
+
     // Only use clone_overlap for recovery if there are fewer than
     // osd_recover_clone_overlap_limit entries in the overlap set
     Option("osd_recover_clone_overlap_limit", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
@@ -3833,6 +3863,23 @@ std::vector<Option> get_global_options() {
     .set_default(1048576)
     .set_description("The number of keys required to invoke DeleteRange when deleting muliple keys."),
 
+    Option("rocksdb_tombstone_compact_threshold", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Compact a key range when an iterator skips this many tombstones in it")
+    .set_long_description("Iterators count the deleted entries rocksdb skips while they seek, and on one next/prev step in 64; a single move that skips at least this many queues the range it crossed for compaction. Deleting large omaps otherwise leaves such ranges slowing down listings until rocksdb compacts them on its own. 0, the default, disables the tracking; it costs a raised rocksdb perf level on the sampled moves, so enable it (16384 is a reasonable start) for pools with heavy omap deletes.")
+    .add_see_also("rocksdb_tombstone_compact_interval"),
+
+    Option("rocksdb_tombstone_compact_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(60)
+    .set_min(0)
+    .set_description("Minimum time (seconds) between compactions triggered by tombstones")
+    .add_see_also("rocksdb_tombstone_compact_threshold"),
+
+    Option("rocksdb_prefix_stats", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Keep latency and size statistics per key prefix")
+    .set_long_description("Gets, iterator seeks and transaction submits are accounted to the prefix (or column family shard) of the keys they touch, in a 'rocksdb_prefix_<name>' perf counter set for each of them.  They are also dumped with the rocksdb statistics.  Off by default, as it adds a clock read and counter updates to each of them."),
+
     Option("rocksdb_bloom_bits_per_key", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(20)
     .set_description("Number of bits per key to use for RocksDB's bloom filters.")
@@ -4188,6 +4235,12 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("bluefs_wal_ring_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Preallocate RocksDB WAL files in chunks of this size")
+    .set_long_description("When non-zero, BlueFS preallocates each RocksDB WAL file in chunks of this size and exposes the whole allocation as file data. Appending to the WAL then does not change the file's metadata, so a commit costs a single data write instead of a data write plus a BlueFS log update. Each chunk is zeroed before it is exposed, which costs one extra sequential write per chunk; RocksDB reads the zeros as the end of the log, so this works with any wal_recovery_mode. Recycled WAL files (recycle_log_file_num) keep their allocation and are not zeroed again: their old records are told apart by the recyclable log format. 0 disables.")
+    .add_see_also("bluestore_rocksdb_options"),
+
     Option("bluefs_allocator", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("hybrid")
     .set_enum_allowed({"bitmap", "stupid", "avl", "hybrid"})
@@ -4447,6 +4500,20 @@ std::vector<Option> get_global_options() {
     .set_description("Compression ratio required to store compressed data")
     .set_long_description("If we compress data and get less than this we discard the result and store the original uncompressed data."),
 
+    Option("bluestore_compression_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Threads compressing blobs for writes")
+    .set_long_description("The blobs of a write are compressed by these threads in parallel, the op thread takes part while it waits for them. With 0 the op thread compresses everything itself.")
+    .add_see_also("bluestore_compression_queue_max"),
+
+    Option("bluestore_compression_queue_max", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Max blobs waiting for a compression thread")
+    .set_long_description("Blobs of writes that find the queue full are written uncompressed rather than waiting.")
+    .add_see_also("bluestore_compression_threads"),
+
     Option("bluestore_extent_map_shard_max_size", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(1200)
     .set_description("Max size (bytes) for a single extent map shard before splitting"),
@@ -4518,6 +4585,13 @@ std::vector<Option> get_global_options() {
     .add_see_also("bluestore_cache_size")
     .set_description("Ratio of bluestore cache to devote to kv onode column family (rocksdb)"),
 
+    Option("bluestore_cache_meta_encoded_ratio", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(0)
+    .add_see_also("bluestore_cache_size")
+    .add_see_also("bluestore_cache_meta_ratio")
+    .set_description("Ratio of bluestore cache to devote to onodes kept in their encoded form")
+    .set_long_description("Onodes evicted from the metadata cache are kept in their compact on-disk encoding and decoded again on access instead of being read back from the kv store. 0 disables this cache tier."),
+
     Option("bluestore_cache_autotune", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(true)
     .add_see_also("bluestore_cache_size")
@@ -4544,6 +4618,52 @@ std::vector<Option> get_global_options() {
     .set_description("Allocator policy")
     .set_long_description("Allocator to use for bluestore.  Stupid should only be used for testing."),
 
+    Option("bluestore_alloc_snapshot", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Save the allocator state on clean umount and load it on the next mount instead of replaying the freelist")
+    .set_long_description("The snapshot is kept in BlueFS and is only used when no write has reached the key/value store since it was taken; otherwise the freelist is read as usual."),
+
+    Option("bluestore_alloc_init_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_description("Number of threads decoding the freelist into the allocator at mount")
+    .set_long_description("Values above 1 split the bitmap freelist into ranges that are decoded in parallel. Freelist types that can only be enumerated sequentially ignore this."),
+
+    Option("bluestore_alloc_magazines", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Number of per-thread free extent caches in front of the allocator, 0 disables them")
+    .set_long_description("Small allocations of common sizes are served from a cache picked by the allocating thread instead of taking the allocator lock. A value close to the number of op shards works best. Not used with the zoned allocator.")
+    .add_see_also({"bluestore_alloc_magazine_max_extent", "bluestore_alloc_magazine_extents"}),
+
+    Option("bluestore_alloc_magazine_max_extent", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("Largest extent kept in the allocator magazines")
+    .set_long_description("Magazines cache extents of min_alloc_size times a power of two, up to this size."),
+
+    Option("bluestore_alloc_magazine_extents", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_description("Extents of each size an allocator magazine holds at most")
+    .set_long_description("Empty magazines are refilled with half that many extents at once."),
+
+    Option("bluestore_fast_tier_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Spare block.db space used to hold copies of hot object data")
+    .set_long_description("When non-zero and the OSD has a dedicated block.db device, BlueStore reserves up to this much of it (and at most bluestore_fast_tier_max_db_ratio of its free space) as a BlueFS file at mount. Chunks of the main device that are read often are copied there by a background thread and served from it; the coldest ones are dropped when it fills up. This is a read cache, not a placement or migration tier: writes always go to the main device, which keeps the authoritative copy of every chunk, and writing a chunk drops its cached copy. Nothing about the tier is persisted, so it starts out empty on every mount. 0 disables the tier and releases its space.")
+    .add_see_also({"bluestore_fast_tier_chunk_size", "bluestore_fast_tier_promote_threshold", "bluestore_fast_tier_max_db_ratio"}),
+
+    Option("bluestore_fast_tier_chunk_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("Granularity of the fast tier, a power of two"),
+
+    Option("bluestore_fast_tier_promote_threshold", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(3)
+    .set_description("Reads of a chunk that make it hot enough for the fast tier")
+    .set_long_description("Read counts are halved every 10 seconds."),
+
+    Option("bluestore_fast_tier_max_db_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.5)
+    .set_min_max(0.0, 1.0)
+    .set_description("Largest share of free block.db space the fast tier takes at mount"),
+
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(128)
     .set_description("Block (and bits) per database key"),
@@ -4641,7 +4761,8 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_fsck_quick_fix_threads", Option::TYPE_INT, Option::LEVEL_ADVANCED)
       .set_default(2)
-      .set_description("Number of additional threads to perform quick-fix (shallow fsck) command"),
+      .set_description("Number of additional threads to perform quick-fix (shallow fsck) command")
+      .set_long_description("The object keyspace is split into ranges at collection boundaries which these threads then scan in parallel."),
 
     Option("bluestore_throttle_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
     .set_default(64_M)
@@ -4690,6 +4811,39 @@ std::vector<Option> get_global_options() {
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media")
     .add_see_also("bluestore_deferred_batch_ops"),
 
+    Option("bluestore_deferred_adaptive", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Adjust deferred write thresholds to device and kv store load")
+    .set_long_description("Shrink the size under which writes are deferred while the kv store is slow to commit or behind on compaction, and grow the deferred batch while deferred writes are slow to complete on the main device, within bounds of the configured bluestore_prefer_deferred_size and bluestore_deferred_batch_ops.")
+    .add_see_also({"bluestore_prefer_deferred_size", "bluestore_deferred_batch_ops"}),
+
+    Option("bluestore_deferred_adaptive_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1.0)
+    .set_min(.1)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("How often (seconds) the adaptive deferred policy reevaluates")
+    .add_see_also("bluestore_deferred_adaptive"),
+
+    Option("bluestore_deferred_adaptive_device_latency", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.01)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Average latency (seconds) of one deferred write aio above which the main device counts as busy")
+    .set_long_description("The latency of a deferred batch is divided by the number of aios it submitted.")
+    .add_see_also("bluestore_deferred_adaptive"),
+
+    Option("bluestore_deferred_adaptive_kv_latency", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.02)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Average kv sync latency (seconds) above which the kv store counts as busy")
+    .add_see_also("bluestore_deferred_adaptive"),
+
+    Option("bluestore_deferred_adaptive_compaction_debt", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(16_G)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Pending rocksdb compaction bytes above which the kv store counts as busy")
+    .add_see_also("bluestore_deferred_adaptive"),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -4703,6 +4857,19 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Use copy-on-write when cloning objects (versus reading and rewriting them at clone time)"),
 
+    Option("bluestore_prefetch_sequential_reads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_prefetch_max_bytes")
+    .set_description("Start prefetching after this many back-to-back sequential reads of an object (0 to disable)")
+    .set_long_description("Once a reader has been detected as sequential, following extents are read along with the requested range, coalescing physically adjacent extents into single ios, and are kept in the buffer cache for subsequent reads."),
+
+    Option("bluestore_prefetch_max_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_prefetch_sequential_reads")
+    .set_description("Maximum amount of data to prefetch ahead of a sequential reader"),
+
     Option("bluestore_default_buffered_read", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_flag(Option::FLAG_RUNTIME)
@@ -4870,6 +5037,43 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("Enables Linux io_uring API Offload submission/completion to kernel thread"),
 
+    Option("bdev_ioring_fixed_buffers", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .add_see_also("bdev_ioring")
+    .add_see_also("bdev_ioring_fixed_buffer_size")
+    .set_description("Number of io buffers of each size to register with io_uring (0 to disable)")
+    .set_long_description("Buffers come in sizes from 4K up to bdev_ioring_fixed_buffer_size, each a power of four times the last. Reads and writes that fit one are issued through it with READ_FIXED/WRITE_FIXED, so pages are not pinned and unpinned on every io; read data is copied out when the io completes and write data copied in before it is submitted. When no buffer is free, ios fall back to ordinary buffers. Registration counts against RLIMIT_MEMLOCK; if it fails, this is logged and the buffers are not used."),
+
+    Option("bdev_ioring_fixed_buffer_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .add_see_also("bdev_ioring_fixed_buffers")
+    .set_description("Size of the largest io buffers registered with io_uring"),
+
+    Option("bluestore_kv_numa_auto_affinity", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .add_see_also("bluestore_kv_numa_node")
+    .set_description("Bind the kv sync and finalize threads to the numa node of the bluestore devices, if they all share one"),
+
+    Option("bluestore_kv_numa_node", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(-1)
+    .set_flag(Option::FLAG_STARTUP)
+    .add_see_also("bluestore_kv_numa_auto_affinity")
+    .set_description("Bind the kv sync and finalize threads to this numa node (-1 for none)"),
+
+    Option("bluestore_kv_sync_target_latency", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_kv_sync_min_batch")
+    .set_description("Target kv commit latency (in seconds) for group commit")
+    .set_long_description("When non-zero, the kv sync thread may delay a commit of fewer than bluestore_kv_sync_min_batch transactions while more transactions are being prepared, as long as the wait plus the recent kv sync latency stays below this target. 0 disables group commit."),
+
+    Option("bluestore_kv_sync_min_batch", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_kv_sync_target_latency")
+    .set_description("Minimum number of transactions the kv sync thread tries to commit at once"),
+
     Option("bluestore_kv_sync_util_logging_s", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(10.0)
     .set_flag(Option::FLAG_RUNTIME)
@@ -122,10 +122,10 @@ size_t PGRecovery::start_primary_recovery_ops(
     hobject_t soid;
     version_t v = p->first;
 
-    auto it_objects = pg->get_peering_state().get_pg_log().get_log().objects.find(p->second);
-    if (it_objects != pg->get_peering_state().get_pg_log().get_log().objects.end()) {
+    auto latest =
+      pg->get_peering_state().get_pg_log().get_log().get_latest_entry(p->second);
+    if (latest) {
       // look at log!
-      pg_log_entry_t *latest = it_objects->second;
       assert(latest->is_update() || latest->is_delete());
       soid = latest->soid;
     } else {
@@ -203,6 +203,72 @@ int ErasureCode::encode(const set<int> &want_to_encode,
   return 0;
 }
 
+int ErasureCode::encode_prepare_batch(const bufferlist &raw,
+                                      unsigned stripe_count,
+                                      map<int, bufferlist> &encoded) const
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  unsigned stripe_width = raw.length() / stripe_count;
+  unsigned blocksize = get_chunk_size(stripe_width);
+  unsigned length = blocksize * stripe_count;
+
+  vector<bufferptr> chunks;
+  chunks.reserve(k + m);
+  for (unsigned int i = 0; i < k + m; i++)
+    chunks.push_back(buffer::create_aligned(length, SIMD_ALIGN));
+  // chunk i of every stripe goes next to each other in the i-th buffer
+  auto p = raw.begin();
+  for (unsigned int s = 0; s < stripe_count; s++) {
+    for (unsigned int i = 0; i < k; i++)
+      p.copy(blocksize, chunks[i].c_str() + s * blocksize);
+  }
+  for (unsigned int i = 0; i < k + m; i++)
+    encoded[chunk_index(i)].push_back(std::move(chunks[i]));
+
+  return 0;
+}
+
+int ErasureCode::encode_batch(const set<int> &want_to_encode,
+                              const bufferlist &in,
+                              unsigned stripe_count,
+                              map<int, bufferlist> *encoded)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  if (stripe_count == 0 || in.length() % stripe_count)
+    return -EINVAL;
+  unsigned stripe_width = in.length() / stripe_count;
+  if (get_chunk_size(stripe_width) * k != stripe_width)
+    return -EINVAL;
+  if (stripe_count == 1)
+    return encode(want_to_encode, in, encoded);
+
+  if (!encode_chunks_batchable()) {
+    for (unsigned int s = 0; s < stripe_count; s++) {
+      bufferlist stripe;
+      stripe.substr_of(in, s * stripe_width, stripe_width);
+      map<int, bufferlist> chunks;
+      int err = encode(want_to_encode, stripe, &chunks);
+      if (err)
+        return err;
+      for (auto &&[chunk, bl] : chunks)
+        (*encoded)[chunk].claim_append(bl);
+    }
+    return 0;
+  }
+
+  int err = encode_prepare_batch(in, stripe_count, *encoded);
+  if (err)
+    return err;
+  encode_chunks(want_to_encode, encoded);
+  for (unsigned int i = 0; i < k + m; i++) {
+    if (want_to_encode.count(i) == 0)
+      encoded->erase(i);
+  }
+  return 0;
+}
+
 int ErasureCode::_decode(const set<int> &want_to_read,
 			 const map<int, bufferlist> &chunks,
 			 map<int, bufferlist> *decoded)
@@ -346,4 +412,29 @@ int ErasureCode::decode_concat(const map<int, bufferlist> &chunks,
   }
   return r;
 }
+
+void ErasureCode::encode_delta(const bufferptr &old_data,
+                               const bufferptr &new_data,
+                               bufferptr *delta)
+{
+  ceph_assert(old_data.length() == new_data.length());
+  if (!delta->have_raw()) {
+    *delta = buffer::create_aligned(old_data.length(), SIMD_ALIGN);
+  }
+  ceph_assert(delta->length() == old_data.length());
+  // every code supporting deltas works in GF(2^w), where the
+  // difference is a xor
+  const char *o = old_data.c_str();
+  const char *n = new_data.c_str();
+  char *d = delta->c_str();
+  for (unsigned i = 0; i < old_data.length(); ++i) {
+    d[i] = o[i] ^ n[i];
+  }
+}
+
+int ErasureCode::apply_delta(const map<int, bufferptr> &in,
+                             map<int, bufferptr> *out)
+{
+  return -EOPNOTSUPP;
+}
 }
@@ -79,6 +79,15 @@ namespace ceph {
                        const bufferlist &in,
                        std::map<int, bufferlist> *encoded) override;
 
+    int encode_prepare_batch(const bufferlist &raw,
+                             unsigned stripe_count,
+                             std::map<int, bufferlist> &encoded) const;
+
+    int encode_batch(const std::set<int> &want_to_encode,
+                     const bufferlist &in,
+                     unsigned stripe_count,
+                     std::map<int, bufferlist> *encoded) override;
+
     int decode(const std::set<int> &want_to_read,
                 const std::map<int, bufferlist> &chunks,
                 std::map<int, bufferlist> *decoded, int chunk_size) override;
@@ -113,10 +122,27 @@ namespace ceph {
     int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) override;
 
+    bool supports_parity_delta() const override {
+      return false;
+    }
+
+    void encode_delta(const bufferptr &old_data,
+                      const bufferptr &new_data,
+                      bufferptr *delta) override;
+
+    int apply_delta(const std::map<int, bufferptr> &in,
+                    std::map<int, bufferptr> *out) override;
+
   protected:
     int parse(const ErasureCodeProfile &profile,
 	      std::ostream *ss);
 
+    /// true if encode_chunks() may be given chunks holding several
+    /// stripes each, see encode_batch()
+    virtual bool encode_chunks_batchable() const {
+      return false;
+    }
+
   private:
     int chunk_index(unsigned int i) const;
   };
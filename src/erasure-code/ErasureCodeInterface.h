@@ -370,6 +370,33 @@ namespace ceph {
     virtual int encode_chunks(const std::set<int> &want_to_encode,
                               std::map<int, bufferlist> *encoded) = 0;
 
+    /**
+     * Encode the **stripe_count** stripes of **in** and store the
+     * **want_to_encode** chunks in **encoded**. Each chunk holds
+     * the matching chunk of every stripe, one after the other, the
+     * way they are laid out on a shard.
+     *
+     * The length of **in** must be a multiple of **stripe_count**
+     * and a stripe must not need padding, i.e.
+     * **get_chunk_size(stripe) * get_data_chunk_count() == stripe**.
+     *
+     * Codes where a chunk is a sequence of independent byte ranges
+     * (the matrix and bitmatrix codes of jerasure and isa) encode
+     * all the stripes in a single pass over aligned buffers of
+     * **stripe_count** chunks, saving the per stripe setup. The
+     * others encode one stripe after the other.
+     *
+     * @param [in] want_to_encode chunk indexes to be encoded
+     * @param [in] in data to be encoded
+     * @param [in] stripe_count number of stripes in **in**
+     * @param [out] encoded map chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int encode_batch(const std::set<int> &want_to_encode,
+                             const bufferlist &in,
+                             unsigned stripe_count,
+                             std::map<int, bufferlist> *encoded) = 0;
+
     /**
      * Decode the **chunks** and store at least **want_to_read**
      * chunks in **decoded**.
@@ -459,6 +486,47 @@ namespace ceph {
      */
     virtual int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) = 0;
+
+    /**
+     * Return true if the coding chunks can be updated in place when
+     * some data chunks change, with **encode_delta** and
+     * **apply_delta**, instead of encoding all data chunks again.
+     * That is the case for linear codes, as long as the chunks
+     * are encoded in the order of their indexes.
+     *
+     * @return **true** if apply_delta is supported
+     */
+    virtual bool supports_parity_delta() const = 0;
+
+    /**
+     * Store in **delta** the difference between the **old_data**
+     * and **new_data** content of a data chunk, as expected by
+     * **apply_delta**. The three buffers have the same size and
+     * **delta** may be **old_data** or **new_data**.
+     *
+     * @param [in] old_data current content of the chunk
+     * @param [in] new_data content the chunk is updated to
+     * @param [out] delta difference of the two
+     */
+    virtual void encode_delta(const bufferptr &old_data,
+                              const bufferptr &new_data,
+                              bufferptr *delta) = 0;
+
+    /**
+     * Update the coding chunks in **out** for the data chunks whose
+     * deltas are in **in**, as if the data chunks had been encoded
+     * again with their new content. Both maps are keyed by chunk
+     * index, as in the output of **encode**, and all buffers have the
+     * same size. Coding chunks left out of **out** are not updated.
+     *
+     * Returns -EOPNOTSUPP unless **supports_parity_delta**.
+     *
+     * @param [in] in map data chunk indexes to deltas
+     * @param [in,out] out map coding chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int apply_delta(const std::map<int, bufferptr> &in,
+                            std::map<int, bufferptr> *out) = 0;
   };
 
   typedef std::shared_ptr<ErasureCodeInterface> ErasureCodeInterfaceRef;
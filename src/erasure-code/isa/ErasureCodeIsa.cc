@@ -132,6 +132,35 @@ ErasureCodeIsaDefault::isa_encode(char **data,
 
 // -----------------------------------------------------------------------------
 
+int
+ErasureCodeIsaDefault::apply_delta(const map<int, bufferptr> &in,
+                                   map<int, bufferptr> *out)
+{
+  for (auto &&[data, delta] : in) {
+    if (data < 0 || data >= k)
+      return -EINVAL;
+    for (auto &&[coding, chunk] : *out) {
+      if (coding < k || coding >= k + m ||
+          chunk.length() != delta.length())
+        return -EINVAL;
+      unsigned char *dst = (unsigned char*) chunk.c_str();
+      if (m == 1) {
+        // single parity stripe, see isa_encode
+        unsigned char *src = (unsigned char*) delta.c_str();
+        byte_xor(src, dst, src + delta.length());
+      } else {
+        // the tables of the coding chunk only, it is the one row updated
+        ec_encode_data_update(delta.length(), k, 1, data,
+                              encode_tbls + (coding - k) * k * 32,
+                              (unsigned char*) delta.c_str(), &dst);
+      }
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+
 bool
 ErasureCodeIsaDefault::erasure_contains(int *erasures, int i)
 {
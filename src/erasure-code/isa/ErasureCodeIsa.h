@@ -96,6 +96,12 @@ public:
 
   virtual void prepare() = 0;
 
+ protected:
+  // ec_encode_data and region_xor work byte by byte
+  bool encode_chunks_batchable() const override {
+    return true;
+  }
+
  private:
   virtual int parse(ceph::ErasureCodeProfile &profile,
                     std::ostream *ss) = 0;
@@ -145,6 +151,15 @@ public:
 
   void prepare() override;
 
+  bool supports_parity_delta() const override
+  {
+    // encode_chunks() ignores the mapping, deltas would not match it
+    return chunk_mapping.empty();
+  }
+
+  int apply_delta(const std::map<int, ceph::bufferptr> &in,
+                  std::map<int, ceph::bufferptr> *out) override;
+
  private:
   int parse(ceph::ErasureCodeProfile &profile,
             std::ostream *ss) override;
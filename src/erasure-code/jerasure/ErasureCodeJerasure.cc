@@ -39,6 +39,7 @@ using std::map;
 using std::set;
 
 using ceph::bufferlist;
+using ceph::bufferptr;
 using ceph::ErasureCodeProfile;
 
 static ostream& _prefix(std::ostream* _dout)
@@ -137,6 +138,35 @@ int ErasureCodeJerasure::decode_chunks(const set<int> &want_to_read,
   return jerasure_decode(erasures, data, coding, blocksize);
 }
 
+int ErasureCodeJerasure::matrix_apply_delta(const int *matrix,
+					    const map<int, bufferptr> &in,
+					    map<int, bufferptr> *out)
+{
+  for (auto &&[data, delta] : in) {
+    if (data < 0 || data >= k)
+      return -EINVAL;
+    for (auto &&[coding, chunk] : *out) {
+      if (coding < k || coding >= k + m ||
+	  chunk.length() != delta.length())
+	return -EINVAL;
+      // coding chunk i is the sum of matrix[i][j] * data chunk j
+      int coef = matrix[(coding - k) * k + data];
+      char *src = const_cast<char*>(delta.c_str());
+      char *dst = chunk.c_str();
+      if (coef == 1) {
+	galois_region_xor(src, dst, delta.length());
+      } else if (w == 8) {
+	galois_w08_region_multiply(src, coef, delta.length(), dst, 1);
+      } else if (w == 16) {
+	galois_w16_region_multiply(src, coef, delta.length(), dst, 1);
+      } else {
+	galois_w32_region_multiply(src, coef, delta.length(), dst, 1);
+      }
+    }
+  }
+  return 0;
+}
+
 bool ErasureCodeJerasure::is_prime(int value)
 {
   int prime55[] = {
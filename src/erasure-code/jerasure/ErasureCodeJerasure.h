@@ -77,6 +77,13 @@ public:
   static bool is_prime(int value);
 protected:
   virtual int parse(ceph::ErasureCodeProfile &profile, std::ostream *ss);
+  // every technique works on words or packets that never cross a chunk
+  bool encode_chunks_batchable() const override {
+    return true;
+  }
+  int matrix_apply_delta(const int *matrix,
+			 const std::map<int, ceph::bufferptr> &in,
+			 std::map<int, ceph::bufferptr> *out);
 };
 class ErasureCodeJerasureReedSolomonVandermonde : public ErasureCodeJerasure {
 public:
@@ -104,6 +111,14 @@ public:
                                int blocksize) override;
   unsigned get_alignment() const override;
   void prepare() override;
+  bool supports_parity_delta() const override {
+    // encode_chunks() ignores the mapping, deltas would not match it
+    return chunk_mapping.empty();
+  }
+  int apply_delta(const std::map<int, ceph::bufferptr> &in,
+		  std::map<int, ceph::bufferptr> *out) override {
+    return matrix_apply_delta(matrix, in, out);
+  }
 private:
   int parse(ceph::ErasureCodeProfile& profile, std::ostream *ss) override;
 };
@@ -134,6 +149,14 @@ public:
                                int blocksize) override;
   unsigned get_alignment() const override;
   void prepare() override;
+  bool supports_parity_delta() const override {
+    // encode_chunks() ignores the mapping, deltas would not match it
+    return chunk_mapping.empty();
+  }
+  int apply_delta(const std::map<int, ceph::bufferptr> &in,
+		  std::map<int, ceph::bufferptr> *out) override {
+    return matrix_apply_delta(matrix, in, out);
+  }
 private:
   int parse(ceph::ErasureCodeProfile& profile, std::ostream *ss) override;
 };
@@ -23,6 +23,7 @@
 #include <list>
 #include <mutex>
 #include <typeinfo>
+#include <type_traits>
 #include <boost/container/flat_set.hpp>
 #include <boost/container/flat_map.hpp>
 
@@ -151,6 +152,7 @@ namespace mempool {
   f(bluestore_alloc)		      \
   f(bluestore_cache_data)	      \
   f(bluestore_cache_onode)	      \
+  f(bluestore_cache_encoded)	      \
   f(bluestore_cache_meta)	      \
   f(bluestore_cache_other)	      \
   f(bluestore_Buffer)		      \
@@ -304,8 +306,9 @@ public:
   typedef T value_type;
   typedef value_type *pointer;
   typedef const value_type * const_pointer;
-  typedef value_type& reference;
-  typedef const value_type& const_reference;
+  // add_lvalue_reference so that boost containers may rebind to void
+  typedef std::add_lvalue_reference_t<value_type> reference;
+  typedef std::add_lvalue_reference_t<const value_type> const_reference;
   typedef std::size_t size_type;
   typedef std::ptrdiff_t difference_type;
 
@@ -387,10 +390,6 @@ public:
     p->~U();
   }
 
-  void construct(T* p, const T& val) {
-    ::new ((void *)p) T(val);
-  }
-
   template<class U, class... Args> void construct(U* p,Args&&... args) {
     ::new((void *)p) U(std::forward<Args>(args)...);
   }
@@ -453,6 +452,13 @@ public:
     using unordered_map =						\
       std::unordered_map<k,v,h,eq,pool_allocator<std::pair<const k,v>>>;\
                                                                         \
+    template<typename k, typename v,					\
+	     typename h=std::hash<k>,					\
+	     typename eq = std::equal_to<k>>				\
+    using unordered_multimap =						\
+      std::unordered_multimap<k,v,h,eq,					\
+			      pool_allocator<std::pair<const k,v>>>;	\
+                                                                        \
     inline size_t allocated_bytes() {					\
       return mempool::get_pool(id).allocated_bytes();			\
     }									\
@@ -0,0 +1,804 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * In-memory crash non-safe keyvalue db with lock-free readers
+ */
+
+#include "include/compat.h"
+#include <functional>
+#include <thread>
+#if __has_include(<filesystem>)
+#include <filesystem>
+namespace fs = std::filesystem;
+#elif __has_include(<experimental/filesystem>)
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#endif
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "common/Clock.h"
+#include "common/perf_counters.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/ceph_assert.h"
+#include "include/encoding.h"
+#include "ConcurrentMemDB.h"
+
+#define dout_context m_cct
+#define dout_subsys ceph_subsys_memdb
+#undef dout_prefix
+#define dout_prefix *_dout << "cmemdb: "
+
+using std::ostream;
+using std::string;
+
+using ceph::bufferlist;
+using ceph::bufferptr;
+using ceph::decode;
+using ceph::encode;
+
+static constexpr char KEY_DELIM = '\0';
+
+static string make_key(const string &prefix, const string &key)
+{
+  string out = prefix;
+  out.push_back(KEY_DELIM);
+  out.append(key);
+  return out;
+}
+
+static string past_prefix(const string &prefix)
+{
+  string out = prefix;
+  out.push_back(KEY_DELIM + 1);
+  return out;
+}
+
+static void split_key(const string &raw_key, string *prefix, string *key)
+{
+  size_t pos = raw_key.find(KEY_DELIM, 0);
+  ceph_assert(pos != string::npos);
+  if (prefix) {
+    *prefix = raw_key.substr(0, pos);
+  }
+  if (key) {
+    *key = raw_key.substr(pos + 1);
+  }
+}
+
+struct ConcurrentMemDB::Version {
+  const uint64_t seq;       ///< of the transaction that wrote it
+  bufferptr *const value;   ///< null if it removed the key
+  std::atomic<Version*> older = {nullptr};
+
+  Version(uint64_t seq, bufferptr *value) : seq(seq), value(value) {}
+  ~Version() {
+    delete value;
+  }
+  /// free v and everything older
+  static void destroy(Version *v) {
+    while (v) {
+      Version *o = v->older.load(std::memory_order_relaxed);
+      delete v;
+      v = o;
+    }
+  }
+};
+
+struct ConcurrentMemDB::Node {
+  const string key;
+  std::atomic<Version*> newest = {nullptr};
+  const int height;
+
+  /// the value as of transaction snap, null if the key didn't exist
+  bufferptr *value_at(uint64_t snap) const {
+    for (Version *v = newest.load(std::memory_order_acquire); v;
+	 v = v->older.load(std::memory_order_acquire)) {
+      if (v->seq <= snap) {
+	return v->value;
+      }
+    }
+    return nullptr;
+  }
+  /// the value writers see, with the pending transaction applied
+  bufferptr *latest() const {
+    Version *v = newest.load(std::memory_order_relaxed);
+    return v ? v->value : nullptr;
+  }
+  void push(Version *v) {
+    v->older.store(newest.load(std::memory_order_relaxed),
+		   std::memory_order_relaxed);
+    newest.store(v, std::memory_order_release);
+  }
+
+  Node *next(int level) const {
+    return next_[level].load(std::memory_order_acquire);
+  }
+  void set_next(int level, Node *n) {
+    next_[level].store(n, std::memory_order_release);
+  }
+
+  static Node *create(const string &key, int height) {
+    void *mem = ::operator new(
+      sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+    return new (mem) Node(key, height);
+  }
+  static void destroy(Node *n) {
+    Version::destroy(n->newest.load(std::memory_order_relaxed));
+    n->~Node();
+    ::operator delete(n);
+  }
+
+private:
+  Node(const string &key, int height)
+    : key(key), height(height) {
+    for (int i = 0; i < height; ++i) {
+      next_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  std::atomic<Node*> next_[1];  ///< height of them
+};
+
+/// keeps whatever the holder can reach from being freed, and pins the
+/// transaction it reads as of
+class ConcurrentMemDB::ReadGuard {
+  std::atomic<uint64_t> *readers;
+public:
+  uint64_t snap;
+
+  explicit ReadGuard(const ConcurrentMemDB *db) {
+    static thread_local unsigned stripe =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % EPOCH_STRIPES;
+    auto &s = db->stripes[stripe];
+    while (true) {
+      uint64_t e = db->epoch.load();
+      readers = &s.readers[e & 1];
+      readers->fetch_add(1);
+      // the writer may have moved on before it could see us
+      if (db->epoch.load() == e) {
+	break;
+      }
+      readers->fetch_sub(1);
+    }
+    // after joining the epoch: versions we may need are retired no
+    // earlier than it
+    snap = db->committed_seq.load();
+  }
+  ~ReadGuard() {
+    readers->fetch_sub(1);
+  }
+};
+
+ConcurrentMemDB::ConcurrentMemDB(CephContext *c, const string &path, void *p)
+  : m_cct(c), m_db_path(path)
+{
+  head = Node::create(string(), MAX_HEIGHT);
+}
+
+ConcurrentMemDB::~ConcurrentMemDB()
+{
+  close();
+  // nobody can be reading anymore; versions still to be trimmed go
+  // with their nodes
+  for (auto &r : retired) {
+    if (!r.version) {
+      Node::destroy(r.node);
+    }
+  }
+  retired.clear();
+  Node *n = head;
+  while (n) {
+    Node *next = n->next(0);
+    Node::destroy(n);
+    n = next;
+  }
+}
+
+ConcurrentMemDB::Node *ConcurrentMemDB::_find_ge(const string &key,
+						  Node **prev) const
+{
+  Node *x = head;
+  int level = max_height.load(std::memory_order_relaxed) - 1;
+  while (true) {
+    Node *next = x->next(level);
+    if (next && next->key < key) {
+      x = next;
+    } else {
+      if (prev) {
+	prev[level] = x;
+      }
+      if (level == 0) {
+	return next;
+      }
+      --level;
+    }
+  }
+}
+
+ConcurrentMemDB::Node *ConcurrentMemDB::_find_lt(const string &key) const
+{
+  Node *x = head;
+  int level = max_height.load(std::memory_order_relaxed) - 1;
+  while (true) {
+    Node *next = x->next(level);
+    if (next && next->key < key) {
+      x = next;
+    } else if (level == 0) {
+      return x == head ? nullptr : x;
+    } else {
+      --level;
+    }
+  }
+}
+
+ConcurrentMemDB::Node *ConcurrentMemDB::_find_last() const
+{
+  Node *x = head;
+  int level = max_height.load(std::memory_order_relaxed) - 1;
+  while (true) {
+    Node *next = x->next(level);
+    if (next) {
+      x = next;
+    } else if (level == 0) {
+      return x == head ? nullptr : x;
+    } else {
+      --level;
+    }
+  }
+}
+
+int ConcurrentMemDB::_random_height()
+{
+  int height = 1;
+  while (height < MAX_HEIGHT && rng() % 4 == 0) {
+    ++height;
+  }
+  return height;
+}
+
+void ConcurrentMemDB::_set(const string &key, bufferptr *value)
+{
+  Node *prev[MAX_HEIGHT];
+  Node *n = _find_ge(key, prev);
+  total_bytes += value->length();
+  Version *v = new Version(pending_seq, value);
+  if (n && n->key == key) {
+    bufferptr *old = n->latest();
+    if (old) {
+      total_bytes -= old->length();
+    } else {
+      ++num_keys;
+    }
+    n->push(v);
+    _retire(n, v);
+    return;
+  }
+  int height = _random_height();
+  int cur_height = max_height.load(std::memory_order_relaxed);
+  if (height > cur_height) {
+    for (int i = cur_height; i < height; ++i) {
+      prev[i] = head;
+    }
+    // readers seeing the new height early only find null links up there
+    max_height.store(height, std::memory_order_relaxed);
+  }
+  // readers skip it until the transaction is published
+  n = Node::create(key, height);
+  n->push(v);
+  for (int i = 0; i < height; ++i) {
+    n->set_next(i, prev[i]->next(i));
+    prev[i]->set_next(i, n);
+  }
+  ++num_keys;
+}
+
+void ConcurrentMemDB::_rm(Node *n)
+{
+  bufferptr *old = n->latest();
+  if (!old) {
+    return;
+  }
+  // the node is unlinked once no reader needs its older versions
+  Version *v = new Version(pending_seq, nullptr);
+  n->push(v);
+  total_bytes -= old->length();
+  --num_keys;
+  _retire(n, v);
+}
+
+void ConcurrentMemDB::_rm_range(const string &start, const string &end)
+{
+  for (Node *n = _find_ge(start, nullptr); n && n->key < end; n = n->next(0)) {
+    _rm(n);
+  }
+}
+
+void ConcurrentMemDB::_merge(const string &prefix, const string &key,
+			     bufferlist &bl)
+{
+  std::shared_ptr<MergeOperator> mop = _find_merge_op(prefix);
+  ceph_assert(mop);
+  string k = make_key(prefix, key);
+  string new_val;
+  // nothing is freed while we hold write_lock, no guard needed
+  Node *n = _find_ge(k, nullptr);
+  bufferptr *old = (n && n->key == k) ? n->latest() : nullptr;
+  if (old) {
+    mop->merge(old->c_str(), old->length(), bl.c_str(), bl.length(), &new_val);
+  } else {
+    mop->merge_nonexistent(bl.c_str(), bl.length(), &new_val);
+  }
+  _set(k, new bufferptr(new_val.c_str(), new_val.length()));
+}
+
+void ConcurrentMemDB::_publish()
+{
+  committed_seq.store(pending_seq);
+}
+
+void ConcurrentMemDB::_retire(Node *n, Version *v)
+{
+  // readers that can still see what v superseded, or still be on an
+  // unlinked n, joined this epoch or an earlier one
+  retired.push_back(retired_t{epoch.load(), n, v});
+}
+
+void ConcurrentMemDB::_trim(Node *n, Version *v)
+{
+  // every reader left sees v or something newer, nothing older
+  Version::destroy(v->older.exchange(nullptr, std::memory_order_relaxed));
+  if (!v->value && n->newest.load(std::memory_order_relaxed) == v) {
+    _unlink(n);
+  }
+}
+
+void ConcurrentMemDB::_unlink(Node *n)
+{
+  Node *prev[MAX_HEIGHT];
+  _find_ge(n->key, prev);
+  for (int i = n->height - 1; i >= 0; --i) {
+    ceph_assert(prev[i]->next(i) == n);
+    prev[i]->set_next(i, n->next(i));
+  }
+  unlink_gen.fetch_add(1, std::memory_order_release);
+  _retire(n, nullptr);
+}
+
+uint64_t ConcurrentMemDB::_epoch_readers(uint64_t e) const
+{
+  uint64_t r = 0;
+  for (auto &s : stripes) {
+    r += s.readers[e & 1].load();
+  }
+  return r;
+}
+
+void ConcurrentMemDB::_reclaim()
+{
+  if (retired.empty()) {
+    return;
+  }
+  uint64_t e = epoch.load();
+  // e + 1 shares its counters with e - 1
+  if (_epoch_readers(e - 1) == 0) {
+    epoch.store(++e);
+  }
+  while (!retired.empty() && retired.front().epoch + 2 <= e) {
+    retired_t r = retired.front();
+    retired.pop_front();
+    if (r.version) {
+      _trim(r.node, r.version);
+    } else {
+      Node::destroy(r.node);
+    }
+  }
+  logger->set(l_cmemdb_retired, retired.size());
+}
+
+std::shared_ptr<KeyValueDB::MergeOperator> ConcurrentMemDB::_find_merge_op(
+  const string &prefix)
+{
+  for (const auto& i : merge_ops) {
+    if (i.first == prefix) {
+      return i.second;
+    }
+  }
+  return nullptr;
+}
+
+int ConcurrentMemDB::set_merge_operator(
+  const string& prefix,
+  std::shared_ptr<KeyValueDB::MergeOperator> mop)
+{
+  merge_ops.push_back(std::make_pair(prefix, mop));
+  return 0;
+}
+
+string ConcurrentMemDB::_get_data_fn()
+{
+  return m_db_path + "/" + "MemDB.db";
+}
+
+void ConcurrentMemDB::_save()
+{
+  std::lock_guard l(write_lock);
+  dout(10) << __func__ << " saving to " << _get_data_fn() << dendl;
+  int fd = TEMP_FAILURE_RETRY(::open(_get_data_fn().c_str(),
+				     O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644));
+  if (fd < 0) {
+    int err = errno;
+    derr << __func__ << " failed to open " << _get_data_fn() << ": "
+	 << cpp_strerror(err) << dendl;
+    return;
+  }
+  bufferlist bl;
+  for (Node *n = head->next(0); n; n = n->next(0)) {
+    bufferptr *v = n->latest();
+    if (!v) {
+      continue;
+    }
+    encode(n->key, bl);
+    encode(*v, bl);
+  }
+  bl.write_fd(fd);
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+}
+
+int ConcurrentMemDB::_load()
+{
+  std::lock_guard l(write_lock);
+  dout(10) << __func__ << " reading " << _get_data_fn() << dendl;
+  int fd = TEMP_FAILURE_RETRY(::open(_get_data_fn().c_str(), O_RDONLY|O_CLOEXEC));
+  if (fd < 0) {
+    int err = errno;
+    derr << __func__ << " can't open " << _get_data_fn() << ": "
+	 << cpp_strerror(err) << dendl;
+    return -err;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    int err = errno;
+    derr << __func__ << " can't stat " << _get_data_fn() << ": "
+	 << cpp_strerror(err) << dendl;
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    return -err;
+  }
+  pending_seq = committed_seq + 1;
+  ssize_t bytes_done = 0;
+  while (bytes_done < st.st_size) {
+    string key;
+    bufferptr datap;
+    bytes_done += ceph::decode_file(fd, key);
+    bytes_done += ceph::decode_file(fd, datap);
+    _set(key, new bufferptr(std::move(datap)));
+  }
+  _publish();
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  return 0;
+}
+
+int ConcurrentMemDB::do_open(ostream &out, bool create)
+{
+  int r = 0;
+  if (create) {
+    if (!fs::exists(m_db_path)) {
+      std::error_code ec;
+      if (!fs::create_directory(m_db_path, ec)) {
+	derr << __func__ << " mkdir failed: " << ec.message() << dendl;
+	return -ec.value();
+      }
+      fs::permissions(m_db_path, fs::perms::owner_all);
+    }
+  } else {
+    r = _load();
+  }
+
+  PerfCountersBuilder plb(m_cct, "memdb_concurrent", l_cmemdb_first, l_cmemdb_last);
+  plb.add_u64_counter(l_cmemdb_gets, "get", "Gets");
+  plb.add_u64_counter(l_cmemdb_txns, "submit_transaction", "Submit transactions");
+  plb.add_time_avg(l_cmemdb_get_latency, "get_latency", "Get latency");
+  plb.add_time_avg(l_cmemdb_submit_latency, "submit_latency", "Submit Latency");
+  plb.add_u64(l_cmemdb_keys, "keys", "Keys");
+  plb.add_u64(l_cmemdb_retired, "retired",
+	      "Removed keys and replaced values readers may still see");
+  logger = plb.create_perf_counters();
+  m_cct->get_perfcounters_collection()->add(logger);
+  logger->set(l_cmemdb_keys, num_keys);
+  return r;
+}
+
+int ConcurrentMemDB::open(ostream &out, const string& cfs)
+{
+  if (!cfs.empty()) {
+    ceph_abort_msg("Not implemented");
+  }
+  return do_open(out, false);
+}
+
+int ConcurrentMemDB::create_and_open(ostream &out, const string& cfs)
+{
+  if (!cfs.empty()) {
+    ceph_abort_msg("Not implemented");
+  }
+  return do_open(out, true);
+}
+
+void ConcurrentMemDB::close()
+{
+  if (!logger) {
+    return;
+  }
+  _save();
+  m_cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  logger = nullptr;
+}
+
+class ConcurrentMemDB::CMDBTransactionImpl : public KeyValueDB::TransactionImpl {
+public:
+  enum op_type_t { SET, RMKEY, RM_RANGE, MERGE };
+  struct op_t {
+    op_type_t type;
+    string prefix;
+    string key;
+    string end;     ///< RM_RANGE only, raw key
+    bufferlist bl;
+  };
+  std::vector<op_t> ops;
+
+  void set(const string &prefix, const string &k,
+	   const bufferlist &bl) override {
+    ops.push_back(op_t{SET, prefix, k, {}, bl});
+  }
+  using KeyValueDB::TransactionImpl::set;
+  void rmkey(const string &prefix, const string &k) override {
+    ops.push_back(op_t{RMKEY, prefix, k, {}, {}});
+  }
+  using KeyValueDB::TransactionImpl::rmkey;
+  void rmkeys_by_prefix(const string &prefix) override {
+    ops.push_back(op_t{RM_RANGE, prefix, make_key(prefix, {}),
+		       past_prefix(prefix), {}});
+  }
+  void rm_range_keys(const string &prefix, const string &start,
+		     const string &end) override {
+    ops.push_back(op_t{RM_RANGE, prefix, make_key(prefix, start),
+		       make_key(prefix, end), {}});
+  }
+  void merge(const string &prefix, const string &key,
+	     const bufferlist &bl) override {
+    ops.push_back(op_t{MERGE, prefix, key, {}, bl});
+  }
+};
+
+KeyValueDB::Transaction ConcurrentMemDB::get_transaction()
+{
+  return std::make_shared<CMDBTransactionImpl>();
+}
+
+int ConcurrentMemDB::submit_transaction(KeyValueDB::Transaction t)
+{
+  utime_t start = ceph_clock_now();
+  auto mt = static_cast<CMDBTransactionImpl*>(t.get());
+  {
+    std::lock_guard l(write_lock);
+    // readers see none of it until _publish()
+    pending_seq = committed_seq + 1;
+    for (auto &op : mt->ops) {
+      switch (op.type) {
+      case CMDBTransactionImpl::SET:
+	_set(make_key(op.prefix, op.key),
+	     new bufferptr(op.bl.c_str(), op.bl.length()));
+	break;
+      case CMDBTransactionImpl::RMKEY:
+	{
+	  string k = make_key(op.prefix, op.key);
+	  Node *n = _find_ge(k, nullptr);
+	  if (n && n->key == k) {
+	    _rm(n);
+	  }
+	}
+	break;
+      case CMDBTransactionImpl::RM_RANGE:
+	_rm_range(op.key, op.end);
+	break;
+      case CMDBTransactionImpl::MERGE:
+	_merge(op.prefix, op.key, op.bl);
+	break;
+      }
+    }
+    _publish();
+    _reclaim();
+  }
+  logger->set(l_cmemdb_keys, num_keys);
+  logger->inc(l_cmemdb_txns);
+  logger->tinc(l_cmemdb_submit_latency, ceph_clock_now() - start);
+  return 0;
+}
+
+int ConcurrentMemDB::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  return submit_transaction(t);
+}
+
+bool ConcurrentMemDB::_get(const string &key, bufferlist *out)
+{
+  ReadGuard g(this);
+  Node *n = _find_ge(key, nullptr);
+  if (!n || n->key != key) {
+    return false;
+  }
+  bufferptr *v = n->value_at(g.snap);
+  if (!v) {
+    return false;
+  }
+  // values are never modified in place, share the buffer
+  out->append(*v);
+  return true;
+}
+
+int ConcurrentMemDB::get(const string &prefix, const string &key,
+			 bufferlist *out)
+{
+  utime_t start = ceph_clock_now();
+  int r = _get(make_key(prefix, key), out) ? 0 : -ENOENT;
+  logger->inc(l_cmemdb_gets);
+  logger->tinc(l_cmemdb_get_latency, ceph_clock_now() - start);
+  return r;
+}
+
+int ConcurrentMemDB::get(const string &prefix, const std::set<string> &keys,
+			 std::map<string, bufferlist> *out)
+{
+  utime_t start = ceph_clock_now();
+  for (const auto& k : keys) {
+    bufferlist bl;
+    if (_get(make_key(prefix, k), &bl)) {
+      out->emplace(k, std::move(bl));
+    }
+  }
+  logger->inc(l_cmemdb_gets);
+  logger->tinc(l_cmemdb_get_latency, ceph_clock_now() - start);
+  return 0;
+}
+
+class ConcurrentMemDB::CMDBWholeSpaceIteratorImpl
+  : public KeyValueDB::WholeSpaceIteratorImpl {
+  ConcurrentMemDB *db;
+  Node *cur = nullptr;   ///< only safe to follow while unlink_gen == gen
+  uint64_t gen = 0;
+  string cur_key;        ///< empty if not valid
+  bufferptr cur_value;
+
+  /// position on n, or the first node after it with a value as of
+  /// the guard's snapshot
+  int _land(Node *n, const ReadGuard &guard, uint64_t g) {
+    bufferptr *v = nullptr;
+    while (n && !(v = n->value_at(guard.snap))) {
+      n = n->next(0);
+    }
+    return _set_cur(n, v, g);
+  }
+  /// position on n, or the last node before it with a value
+  int _land_back(Node *n, const ReadGuard &guard, uint64_t g) {
+    bufferptr *v = nullptr;
+    while (n && !(v = n->value_at(guard.snap))) {
+      n = db->_find_lt(n->key);
+    }
+    return _set_cur(n, v, g);
+  }
+  int _set_cur(Node *n, bufferptr *v, uint64_t g) {
+    cur = n;
+    gen = g;
+    if (!n) {
+      cur_key.clear();
+      cur_value = bufferptr();
+      return -1;
+    }
+    cur_key = n->key;
+    cur_value = *v;
+    return 0;
+  }
+
+public:
+  explicit CMDBWholeSpaceIteratorImpl(ConcurrentMemDB *db) : db(db) {}
+
+  int seek_to_first() override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land(db->head->next(0), guard, g);
+  }
+  int seek_to_first(const string &prefix) override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land(db->_find_ge(prefix, nullptr), guard, g);
+  }
+  int seek_to_last() override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land_back(db->_find_last(), guard, g);
+  }
+  int seek_to_last(const string &prefix) override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land_back(db->_find_lt(past_prefix(prefix)), guard, g);
+  }
+  int upper_bound(const string &prefix, const string &after) override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    string k = make_key(prefix, after);
+    Node *n = db->_find_ge(k, nullptr);
+    if (n && n->key == k) {
+      n = n->next(0);
+    }
+    return _land(n, guard, g);
+  }
+  int lower_bound(const string &prefix, const string &to) override {
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land(db->_find_ge(make_key(prefix, to), nullptr), guard, g);
+  }
+  bool valid() override {
+    return !cur_key.empty();
+  }
+  int next() override {
+    if (!valid()) {
+      return -1;
+    }
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    Node *n;
+    if (g == gen) {
+      n = cur->next(0);
+    } else {
+      // cur may be gone, find our way back by key
+      n = db->_find_ge(cur_key, nullptr);
+      if (n && n->key == cur_key) {
+	n = n->next(0);
+      }
+    }
+    return _land(n, guard, g);
+  }
+  int prev() override {
+    if (!valid()) {
+      return -1;
+    }
+    ReadGuard guard(db);
+    uint64_t g = db->unlink_gen.load(std::memory_order_acquire);
+    return _land_back(db->_find_lt(cur_key), guard, g);
+  }
+  string key() override {
+    string k;
+    split_key(cur_key, nullptr, &k);
+    return k;
+  }
+  std::pair<string,string> raw_key() override {
+    string p, k;
+    split_key(cur_key, &p, &k);
+    return {p, k};
+  }
+  bool raw_key_is_prefixed(const string &prefix) override {
+    return cur_key.size() > prefix.size() &&
+      cur_key[prefix.size()] == KEY_DELIM &&
+      cur_key.compare(0, prefix.size(), prefix) == 0;
+  }
+  bufferlist value() override {
+    bufferlist bl;
+    bl.append(cur_value);
+    return bl;
+  }
+  bufferptr value_as_ptr() override {
+    return cur_value;
+  }
+  int status() override {
+    return 0;
+  }
+};
+
+KeyValueDB::WholeSpaceIterator ConcurrentMemDB::get_wholespace_iterator(
+  IteratorOpts opts)
+{
+  return std::make_shared<CMDBWholeSpaceIteratorImpl>(this);
+}
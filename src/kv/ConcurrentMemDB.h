@@ -0,0 +1,171 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * In-memory crash non-safe keyvalue db with lock-free readers
+ */
+
+#ifndef CEPH_KV_CONCURRENTMEMDB_H
+#define CEPH_KV_CONCURRENTMEMDB_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "include/buffer.h"
+#include "include/common_fwd.h"
+#include "KeyValueDB.h"
+#include "osd/osd_types.h"
+
+enum {
+  l_cmemdb_first = 34470,
+  l_cmemdb_gets,
+  l_cmemdb_txns,
+  l_cmemdb_get_latency,
+  l_cmemdb_submit_latency,
+  l_cmemdb_keys,
+  l_cmemdb_retired,
+  l_cmemdb_last,
+};
+
+/**
+ * MemDB on a concurrent skiplist.
+ *
+ * Writers are serialized by a mutex; readers and iterators never take
+ * it.  Keys are kept in a skiplist whose links are published with
+ * release stores, so a reader walking it sees either the old or the new
+ * link.  Every key holds a chain of immutable versions, newest first,
+ * each tagged with the sequence number of the transaction that wrote
+ * it; a removal is a version without a value.  A transaction is applied
+ * under a sequence number readers don't see yet and made visible all at
+ * once by publishing committed_seq, so readers, which only look at
+ * versions up to the committed_seq they started with, never see half
+ * of one.
+ *
+ * Superseded versions and removed keys are dropped, and their nodes
+ * unlinked and freed, by the writers once no reader can still hold or
+ * need them (epoch based reclamation), so writers never wait for
+ * readers either.
+ *
+ * Iterators copy the entry they are positioned on.  While nothing was
+ * unlinked in the meantime they step from the node they were on,
+ * otherwise they look their key up again; either way they see the
+ * database as of the step, like MemDB's.
+ *
+ * The file it saves on close is the same as MemDB's.
+ */
+class ConcurrentMemDB : public KeyValueDB
+{
+  static constexpr int MAX_HEIGHT = 16;
+  static constexpr int EPOCH_STRIPES = 16;
+
+  struct Node;
+  struct Version;
+  class ReadGuard;
+  class CMDBTransactionImpl;
+  class CMDBWholeSpaceIteratorImpl;
+
+  CephContext *m_cct;
+  PerfCounters *logger = nullptr;
+  std::string m_db_path;
+  std::string m_options;
+
+  Node *head;
+  std::atomic<int> max_height = {1};
+  /// bumped after every unlink, tells iterators their node may be gone
+  std::atomic<uint64_t> unlink_gen = {0};
+  /// the last transaction readers may see
+  std::atomic<uint64_t> committed_seq = {0};
+  uint64_t pending_seq = 0;  ///< the one being applied, under write_lock
+
+  // reclamation: readers count themselves in for the epoch they start
+  // in; whatever was retired in epoch e is freed once the epoch has
+  // moved on to e + 2, which it only does after all readers of e left
+  struct alignas(64) epoch_stripe_t {
+    std::atomic<uint64_t> readers[2] = {0, 0};
+  };
+  std::atomic<uint64_t> epoch = {1};
+  mutable epoch_stripe_t stripes[EPOCH_STRIPES];
+  struct retired_t {
+    uint64_t epoch;
+    Node *node;
+    Version *version;  ///< drop what it superseded; if null, node was
+		       ///< unlinked, free it
+  };
+  std::deque<retired_t> retired;  ///< oldest first
+
+  std::mutex write_lock;
+  std::minstd_rand rng;  ///< node heights, under write_lock
+  std::atomic<uint64_t> num_keys = {0};
+  std::atomic<uint64_t> total_bytes = {0};
+
+  // readers, call with a ReadGuard held
+  Node *_find_ge(const std::string &key, Node **prev) const;
+  Node *_find_lt(const std::string &key) const;
+  Node *_find_last() const;
+
+  // writers, call with write_lock held
+  int _random_height();
+  void _set(const std::string &key, ceph::bufferptr *value);
+  void _rm(Node *n);
+  void _rm_range(const std::string &start, const std::string &end);
+  void _merge(const std::string &prefix, const std::string &key,
+	      ceph::bufferlist &bl);
+  void _publish();
+  void _retire(Node *n, Version *v);
+  void _trim(Node *n, Version *v);
+  void _unlink(Node *n);
+  uint64_t _epoch_readers(uint64_t e) const;
+  void _reclaim();
+
+  bool _get(const std::string &key, ceph::bufferlist *out);
+  std::string _get_data_fn();
+  void _save();
+  int _load();
+  int do_open(std::ostream &out, bool create);
+  std::shared_ptr<MergeOperator> _find_merge_op(const std::string &prefix);
+
+public:
+  ConcurrentMemDB(CephContext *c, const std::string &path, void *p);
+  ~ConcurrentMemDB() override;
+
+  static int _test_init(const std::string& dir) { return 0; }
+
+  int init(std::string option_str="") override {
+    m_options = option_str;
+    return 0;
+  }
+  int open(std::ostream &out, const std::string& cfs="") override;
+  int create_and_open(std::ostream &out, const std::string& cfs="") override;
+  using KeyValueDB::create_and_open;
+  void close() override;
+
+  int set_merge_operator(const std::string& prefix,
+			 std::shared_ptr<MergeOperator> mop) override;
+
+  KeyValueDB::Transaction get_transaction() override;
+  int submit_transaction(Transaction) override;
+  int submit_transaction_sync(Transaction) override;
+
+  int get(const std::string &prefix, const std::set<std::string> &key,
+	  std::map<std::string, ceph::bufferlist> *out) override;
+  int get(const std::string &prefix, const std::string &key,
+	  ceph::bufferlist *out) override;
+  using KeyValueDB::get;
+
+  WholeSpaceIterator get_wholespace_iterator(IteratorOpts opts = 0) override;
+
+  uint64_t get_estimated_size(std::map<std::string,uint64_t> &extra) override {
+    return total_bytes;
+  }
+  int get_statfs(struct store_statfs_t *buf) override {
+    buf->reset();
+    buf->total = total_bytes;
+    buf->allocated = total_bytes;
+    buf->data_stored = total_bytes;
+    return 0;
+  }
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "LevelDBStore.h"
 #endif
 #include "MemDB.h"
+#include "ConcurrentMemDB.h"
 #include "RocksDBStore.h"
 
 using std::map;
@@ -28,6 +29,10 @@ KeyValueDB *KeyValueDB::create(CephContext *cct, const string& type,
     cct->check_experimental_feature_enabled("memdb")) {
     return new MemDB(cct, dir, p);
   }
+  if ((type == "memdb_concurrent") &&
+    cct->check_experimental_feature_enabled("memdb")) {
+    return new ConcurrentMemDB(cct, dir, p);
+  }
   return NULL;
 }
 
@@ -44,5 +49,8 @@ int KeyValueDB::test_init(const string& type, const string& dir)
   if (type == "memdb") {
     return MemDB::_test_init(dir);
   }
+  if (type == "memdb_concurrent") {
+    return ConcurrentMemDB::_test_init(dir);
+  }
   return -EINVAL;
 }
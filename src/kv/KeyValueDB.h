@@ -433,6 +433,11 @@ public:
     uint64_t *out) {
     return false;
   }
+
+  /// sequence number of the most recent write, or 0 if not tracked
+  virtual uint64_t get_last_sequence() {
+    return 0;
+  }
 protected:
   /// List of matching prefixes/ColumnFamilies and merge operators
   std::vector<std::pair<std::string,
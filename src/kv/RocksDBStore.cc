@@ -1187,9 +1187,24 @@ int RocksDBStore::do_open(ostream &out,
   plb.add_time_avg(l_rocksdb_write_delay_time, "rocksdb_write_delay_time", "Rocksdb write delay time");
   plb.add_time_avg(l_rocksdb_write_pre_and_post_process_time, 
       "rocksdb_write_pre_and_post_time", "total time spent on writing a record, excluding write process");
+  plb.add_u64_avg(l_rocksdb_iter_tombstones_per_seek, "iter_tombstones_per_seek",
+		  "Tombstones skipped by iterator seeks");
+  plb.add_u64_counter(l_rocksdb_iter_tombstones_skipped, "iter_tombstones_skipped",
+		      "Tombstones skipped by iterators (seeks, and one step in 64)");
+  plb.add_u64_counter(l_rocksdb_tombstone_compact, "tombstone_compact",
+		      "Ranges queued for compaction because iterators found them full of tombstones");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 
+  if (track_prefix_stats) {
+    std::lock_guard l(prefix_stats_lock);
+    for (auto& [prefix, shards] : cf_handles) {
+      for (auto h : shards.handles) {
+	cf_stats[h->GetID()] = _create_prefix_stats(h->GetName());
+      }
+    }
+  }
+
   if (compact_on_mount) {
     derr << "Compacting rocksdb store..." << dendl;
     compact();
@@ -1237,6 +1252,7 @@ void RocksDBStore::close()
     delete logger;
     logger = nullptr;
   }
+  close_prefix_stats();
 
   // Ensure db is destroyed before dependent db_cache and filterpolicy
   for (auto& p : cf_handles) {
@@ -1353,6 +1369,25 @@ int64_t RocksDBStore::estimate_prefix_size(const string& prefix,
 
 void RocksDBStore::get_statistics(Formatter *f)
 {
+  if (tombstone_compact_threshold) {
+    std::lock_guard l(tombstone_lock);
+    f->open_object_section("rocksdb_iterator_tombstones");
+    for (auto& [prefix, st] : tombstone_stats) {
+      f->open_object_section(prefix.c_str());
+      f->dump_unsigned("ops", st.ops);
+      f->dump_unsigned("skipped", st.skipped);
+      f->dump_unsigned("compactions", st.compactions);
+      if (st.compactions) {
+	f->dump_string("last_compact_start", pretty_binary_string(st.last_start));
+	f->dump_string("last_compact_end", pretty_binary_string(st.last_end));
+      }
+      f->close_section();
+    }
+    f->close_section();
+  }
+  if (track_prefix_stats) {
+    dump_prefix_stats(f);
+  }
   if (!cct->_conf->rocksdb_perf)  {
     dout(20) << __func__ << " RocksDB perf is disabled, can't probe for stats"
 	     << dendl;
@@ -1531,6 +1566,7 @@ int RocksDBStore::submit_transaction(KeyValueDB::Transaction t)
 
   utime_t lat = ceph_clock_now() - start;
   logger->tinc(l_rocksdb_submit_latency, lat);
+  static_cast<RocksDBTransactionImpl*>(t.get())->note_submitted(lat);
   
   return result;
 }
@@ -1546,6 +1582,7 @@ int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
   
   utime_t lat = ceph_clock_now() - start;
   logger->tinc(l_rocksdb_submit_sync_latency, lat);
+  static_cast<RocksDBTransactionImpl*>(t.get())->note_submitted(lat);
 
   return result;
 }
@@ -1555,6 +1592,45 @@ RocksDBStore::RocksDBTransactionImpl::RocksDBTransactionImpl(RocksDBStore *_db)
   db = _db;
 }
 
+void RocksDBStore::RocksDBTransactionImpl::note_write(
+  const string& prefix,
+  rocksdb::ColumnFamilyHandle *cf,
+  uint64_t bytes)
+{
+  if (!db->track_prefix_stats) {
+    return;
+  }
+  // transactions touch a handful of prefixes at most, each with many
+  // keys; look the stats up once per prefix
+  for (auto& w : prefix_writes) {
+    if (w.cf == cf && w.prefix == prefix) {
+      if (w.stats) {
+	++w.ops;
+	w.bytes += bytes;
+      }
+      return;
+    }
+  }
+  PerfCounters *stats = db->get_prefix_stats(prefix, cf);
+  prefix_writes.push_back({prefix, cf, stats, stats ? 1u : 0u,
+			   stats ? bytes : 0});
+}
+
+void RocksDBStore::RocksDBTransactionImpl::note_submitted(const utime_t& lat)
+{
+  for (auto& w : prefix_writes) {
+    if (!w.stats) {
+      continue;
+    }
+    w.stats->inc(l_rocksdb_prefix_writes, w.ops);
+    w.stats->inc(l_rocksdb_prefix_write_bytes, w.bytes);
+    w.stats->inc(l_rocksdb_prefix_submits);
+    w.stats->tinc(l_rocksdb_prefix_submit_latency, lat);
+    w.stats->hinc(l_rocksdb_prefix_submit_lat_bytes_hist, lat.to_nsec(),
+		  w.bytes);
+  }
+}
+
 void RocksDBStore::RocksDBTransactionImpl::put_bat(
   rocksdb::WriteBatch& bat,
   rocksdb::ColumnFamilyHandle *cf,
@@ -1582,6 +1658,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const bufferlist &to_set_bl)
 {
   auto cf = db->get_cf_handle(prefix, k);
+  note_write(prefix, cf, k.size() + to_set_bl.length());
   if (cf) {
     put_bat(bat, cf, k, to_set_bl);
   } else {
@@ -1596,6 +1673,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const bufferlist &to_set_bl)
 {
   auto cf = db->get_cf_handle(prefix, k, keylen);
+  note_write(prefix, cf, keylen + to_set_bl.length());
   if (cf) {
     string key(k, keylen);  // fixme?
     put_bat(bat, cf, key, to_set_bl);
@@ -1610,6 +1688,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
   auto cf = db->get_cf_handle(prefix, k);
+  note_write(prefix, cf, k.size());
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k));
   } else {
@@ -1622,6 +1701,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 						 size_t keylen)
 {
   auto cf = db->get_cf_handle(prefix, k, keylen);
+  note_write(prefix, cf, keylen);
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k, keylen));
   } else {
@@ -1635,6 +1715,7 @@ void RocksDBStore::RocksDBTransactionImpl::rm_single_key(const string &prefix,
 					                 const string &k)
 {
   auto cf = db->get_cf_handle(prefix, k);
+  note_write(prefix, cf, k.size());
   if (cf) {
     bat.SingleDelete(cf, k);
   } else {
@@ -1646,6 +1727,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix
 {
   auto p_iter = db->cf_handles.find(prefix);
   if (p_iter == db->cf_handles.end()) {
+    note_write(prefix, nullptr, 0);
     uint64_t cnt = db->delete_range_threshold;
     bat.SetSavePoint();
     auto it = db->get_iterator(prefix);
@@ -1665,6 +1747,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix
   } else {
     ceph_assert(p_iter->second.handles.size() >= 1);
     for (auto cf : p_iter->second.handles) {
+      note_write(prefix, cf, 0);
       uint64_t cnt = db->delete_range_threshold;
       bat.SetSavePoint();
       auto it = db->new_shard_iterator(cf);
@@ -1688,6 +1771,7 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
 {
   auto p_iter = db->cf_handles.find(prefix);
   if (p_iter == db->cf_handles.end()) {
+    note_write(prefix, nullptr, 0);
     uint64_t cnt = db->delete_range_threshold;
     bat.SetSavePoint();
     auto it = db->get_iterator(prefix);
@@ -1707,6 +1791,7 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
   } else {
     ceph_assert(p_iter->second.handles.size() >= 1);
     for (auto cf : p_iter->second.handles) {
+      note_write(prefix, cf, 0);
       uint64_t cnt = db->delete_range_threshold;
       bat.SetSavePoint();
       rocksdb::Iterator* it = db->new_shard_iterator(cf);
@@ -1733,6 +1818,7 @@ void RocksDBStore::RocksDBTransactionImpl::merge(
   const bufferlist &to_set_bl)
 {
   auto cf = db->get_cf_handle(prefix, k);
+  note_write(prefix, cf, k.size() + to_set_bl.length());
   if (cf) {
     // bufferlist::c_str() is non-constant, so we can't call c_str()
     if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
@@ -1767,45 +1853,78 @@ void RocksDBStore::RocksDBTransactionImpl::merge(
   }
 }
 
+static void note_prefix_get(PerfCounters* stats, const utime_t& lat,
+			    uint64_t bytes)
+{
+  if (!stats) {
+    return;
+  }
+  stats->inc(l_rocksdb_prefix_gets);
+  stats->inc(l_rocksdb_prefix_get_bytes, bytes);
+  stats->tinc(l_rocksdb_prefix_get_latency, lat);
+  stats->hinc(l_rocksdb_prefix_get_lat_bytes_hist, lat.to_nsec(), bytes);
+}
+
 int RocksDBStore::get(
     const string &prefix,
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
-  rocksdb::PinnableSlice value;
   utime_t start = ceph_clock_now();
+  // look all the keys up in one batch: MultiGet shares the memtable,
+  // block cache and file reads among them, even across column family
+  // shards
+  const size_t n = keys.size();
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs(n);
+  std::vector<rocksdb::Slice> key_slices(n);
+  std::vector<rocksdb::PinnableSlice> values(n);
+  std::vector<rocksdb::Status> statuses(n);
+  std::vector<string> combined_keys;
+  bool sorted = true;
+  size_t i = 0;
   if (cf_handles.count(prefix) > 0) {
+    // keys from different shards interleave
+    sorted = cf_handles[prefix].handles.size() == 1;
     for (auto& key : keys) {
-      auto cf_handle = get_cf_handle(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    cf_handle,
-			    rocksdb::Slice(key),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
-      }
-      value.Reset();
+      cfs[i] = get_cf_handle(prefix, key);
+      key_slices[i] = rocksdb::Slice(key);
+      ++i;
     }
   } else {
+    combined_keys.reserve(n);
     for (auto& key : keys) {
-      string k = combine_strings(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    default_cf,
-			    rocksdb::Slice(k),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
-      }
-      value.Reset();
+      combined_keys.push_back(combine_strings(prefix, key));
+      cfs[i] = default_cf;
+      key_slices[i] = rocksdb::Slice(combined_keys.back());
+      ++i;
+    }
+  }
+  if (n) {
+    db->MultiGet(rocksdb::ReadOptions(), n, cfs.data(), key_slices.data(),
+		 values.data(), statuses.data(), sorted);
+  }
+  // bytes read from each shard; all of them waited for the whole batch
+  std::map<rocksdb::ColumnFamilyHandle*, uint64_t> cf_bytes;
+  i = 0;
+  for (auto& key : keys) {
+    auto& status = statuses[i];
+    if (status.ok()) {
+      (*out)[key].append(values[i].data(), values[i].size());
+    } else if (status.IsIOError()) {
+      ceph_abort_msg(status.getState());
+    }
+    if (track_prefix_stats) {
+      cf_bytes[cfs[i]] += status.ok() ? values[i].size() : 0;
     }
+    ++i;
   }
   utime_t lat = ceph_clock_now() - start;
   logger->inc(l_rocksdb_gets);
   logger->tinc(l_rocksdb_get_latency, lat);
+  for (auto& [cf, bytes] : cf_bytes) {
+    note_prefix_get(get_prefix_stats(prefix, cf == default_cf ? nullptr : cf),
+		    lat, bytes);
+  }
   return 0;
 }
 
@@ -1842,6 +1961,7 @@ int RocksDBStore::get(
   utime_t lat = ceph_clock_now() - start;
   logger->inc(l_rocksdb_gets);
   logger->tinc(l_rocksdb_get_latency, lat);
+  note_prefix_get(get_prefix_stats(prefix, cf), lat, out->length());
   return r;
 }
 
@@ -1880,6 +2000,7 @@ int RocksDBStore::get(
   utime_t lat = ceph_clock_now() - start;
   logger->inc(l_rocksdb_gets);
   logger->tinc(l_rocksdb_get_latency, lat);
+  note_prefix_get(get_prefix_stats(prefix, cf), lat, out->length());
   return r;
 }
 
@@ -1985,6 +2106,286 @@ void RocksDBStore::compact_range_async(const string& start, const string& end)
     compact_thread.create("rstore_compact");
   }
 }
+
+void RocksDBStore::note_tombstones(const std::string& prefix, uint64_t skipped,
+				   const std::string& start, const std::string& end)
+{
+  {
+    std::lock_guard l(tombstone_lock);
+    auto& st = tombstone_stats[prefix];
+    ++st.ops;
+    st.skipped += skipped;
+    if (skipped < tombstone_compact_threshold ||
+	start.empty() || end.empty() || start >= end) {
+      return;
+    }
+    auto now = ceph::mono_clock::now();
+    if (now - last_tombstone_compact <
+	ceph::make_timespan(tombstone_compact_interval)) {
+      return;
+    }
+    last_tombstone_compact = now;
+    ++st.compactions;
+    st.last_start = start;
+    st.last_end = end;
+  }
+  dout(10) << __func__ << " " << skipped << " tombstones in "
+	   << pretty_binary_string(start) << " to "
+	   << pretty_binary_string(end) << ", compacting" << dendl;
+  logger->inc(l_rocksdb_tombstone_compact);
+  compact_range_async(start, end);
+}
+
+void RocksDBStore::TombstoneWatch::begin(const rocksdb::Slice& key, bool seek)
+{
+  if (!enabled() ||
+      (!seek && ++steps % step_sample != 0)) {
+    return;
+  }
+  watching = true;
+  seeking = seek;
+  // rocksdb only counts with perf level kEnableCount or above
+  if (!raised_perf_level &&
+      rocksdb::GetPerfLevel() < rocksdb::PerfLevel::kEnableCount) {
+    prev_perf_level = rocksdb::GetPerfLevel();
+    rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableCount);
+    raised_perf_level = true;
+  }
+  from.assign(key.data(), key.size());
+  skipped_before = rocksdb::get_perf_context()->internal_delete_skipped_count;
+}
+
+void RocksDBStore::TombstoneWatch::restore_perf_level()
+{
+  if (raised_perf_level) {
+    rocksdb::SetPerfLevel(prev_perf_level);
+    raised_perf_level = false;
+  }
+}
+
+void RocksDBStore::TombstoneWatch::cancel()
+{
+  watching = false;
+  restore_perf_level();
+}
+
+void RocksDBStore::TombstoneWatch::end(rocksdb::Iterator* it, bool forward)
+{
+  if (!watching) {
+    return;
+  }
+  watching = false;
+  uint64_t skipped =
+    rocksdb::get_perf_context()->internal_delete_skipped_count - skipped_before;
+  restore_perf_level();
+  if (seeking) {
+    store->logger->inc(l_rocksdb_iter_tombstones_per_seek, skipped);
+  }
+  if (skipped == 0) {
+    return;
+  }
+  store->logger->inc(l_rocksdb_iter_tombstones_skipped, skipped);
+
+  // the tombstones lie between where we started and where we stopped,
+  // within the prefix the move was in
+  std::string lo, hi;
+  if (!from.empty()) {
+    lo = cf_prefix.empty() ? from : combine_strings(cf_prefix, from);
+  }
+  if (it->Valid()) {
+    hi = cf_prefix.empty() ? it->key().ToString() :
+      combine_strings(cf_prefix, it->key().ToString());
+  }
+  if (!forward) {
+    std::swap(lo, hi);
+  }
+  std::string prefix = cf_prefix;
+  if (prefix.empty() && !from.empty() &&
+      split_key(from, &prefix, nullptr) < 0) {
+    // seek_to_first/last(prefix) start at the bare prefix or just past it
+    prefix = from;
+    if (prefix.back() == '\x01') {
+      prefix.pop_back();
+    }
+  }
+  if (prefix.empty() && it->Valid() &&
+      split_key(it->key(), &prefix, nullptr) < 0) {
+    prefix.clear();
+  }
+  if (!prefix.empty()) {
+    // keep the range to keys compact_range() can place in the prefix;
+    // a move may also have run on into a neighbouring one
+    std::string first = combine_strings(prefix, {});
+    std::string last = combine_strings(prefix, "\xff\xff\xff\xff");
+    if (lo.empty() || lo < first) {
+      lo = std::move(first);
+    }
+    if (hi.empty() || hi > last) {
+      hi = std::move(last);
+    }
+  }
+  store->note_tombstones(prefix, skipped, lo, hi);
+}
+
+// latency in nanoseconds, from a microsecond up to seconds
+static const PerfHistogramCommon::axis_config_d prefix_lat_axis_config{
+  "Latency (usec)",
+  PerfHistogramCommon::SCALE_LOG2,
+  0,
+  1000,
+  24,
+};
+
+// keys and values, in bytes
+static const PerfHistogramCommon::axis_config_d prefix_bytes_axis_config{
+  "Size (bytes)",
+  PerfHistogramCommon::SCALE_LOG2,
+  0,
+  64,
+  24,
+};
+
+PerfCounters* RocksDBStore::_create_prefix_stats(const string& name)
+{
+  ceph_assert(ceph_mutex_is_locked(prefix_stats_lock));
+  auto& stats = prefix_stats[name];
+  if (stats) {
+    return stats;
+  }
+  string pc_name = "rocksdb_prefix_";
+  for (unsigned char c : name) {
+    if (isalnum(c) || c == '-' || c == '_') {
+      pc_name.push_back(c);
+    } else {
+      char buf[4];
+      snprintf(buf, sizeof(buf), "%%%02x", c);
+      pc_name += buf;
+    }
+  }
+  dout(10) << __func__ << " " << pc_name << dendl;
+  PerfCountersBuilder plb(cct, pc_name, l_rocksdb_prefix_first,
+			  l_rocksdb_prefix_last);
+  plb.add_u64_counter(l_rocksdb_prefix_gets, "get", "Gets");
+  plb.add_u64_counter(l_rocksdb_prefix_get_bytes, "get_bytes",
+		      "Bytes read by gets", NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_time_avg(l_rocksdb_prefix_get_latency, "get_latency",
+		   "Get latency");
+  plb.add_u64_counter_histogram(
+    l_rocksdb_prefix_get_lat_bytes_hist, "get_latency_bytes_histogram",
+    prefix_lat_axis_config, prefix_bytes_axis_config,
+    "Histogram of get latency + bytes read");
+  plb.add_u64_counter(l_rocksdb_prefix_seeks, "seek", "Iterator seeks");
+  plb.add_time_avg(l_rocksdb_prefix_seek_latency, "seek_latency",
+		   "Iterator seek latency");
+  plb.add_u64_counter_histogram(
+    l_rocksdb_prefix_seek_lat_bytes_hist, "seek_latency_bytes_histogram",
+    prefix_lat_axis_config, prefix_bytes_axis_config,
+    "Histogram of iterator seek latency + bytes of the entry found");
+  plb.add_u64_counter(l_rocksdb_prefix_writes, "write",
+		      "Keys set, merged or removed");
+  plb.add_u64_counter(l_rocksdb_prefix_write_bytes, "write_bytes",
+		      "Bytes of keys and values written", NULL, 0,
+		      unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_rocksdb_prefix_submits, "submit",
+		      "Transactions writing to the prefix");
+  plb.add_time_avg(l_rocksdb_prefix_submit_latency, "submit_latency",
+		   "Latency of transactions writing to the prefix");
+  plb.add_u64_counter_histogram(
+    l_rocksdb_prefix_submit_lat_bytes_hist, "submit_latency_bytes_histogram",
+    prefix_lat_axis_config, prefix_bytes_axis_config,
+    "Histogram of submit latency + bytes written to the prefix");
+  stats = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(stats);
+  return stats;
+}
+
+PerfCounters* RocksDBStore::get_prefix_stats(const string& prefix,
+					     rocksdb::ColumnFamilyHandle* cf)
+{
+  if (!track_prefix_stats) {
+    return nullptr;
+  }
+  if (cf) {
+    auto p = cf_stats.find(cf->GetID());
+    if (p != cf_stats.end()) {
+      return p->second;
+    }
+  }
+  const string& name = cf ? cf->GetName() : prefix;
+  auto& slot = prefix_stats_by_char[name.empty() ? 0 : (unsigned char)name[0]];
+  for (auto e = slot.load(std::memory_order_acquire); e; e = e->next) {
+    if (e->name == name) {
+      return e->stats;
+    }
+  }
+  std::lock_guard l(prefix_stats_lock);
+  // someone may have added it meanwhile
+  for (auto e = slot.load(std::memory_order_relaxed); e; e = e->next) {
+    if (e->name == name) {
+      return e->stats;
+    }
+  }
+  PerfCounters* stats = _create_prefix_stats(name);
+  slot.store(new prefix_stats_entry_t{
+      name, stats, slot.load(std::memory_order_relaxed)},
+    std::memory_order_release);
+  return stats;
+}
+
+PerfCounters* RocksDBStore::find_prefix_stats(const string& name)
+{
+  std::lock_guard l(prefix_stats_lock);
+  auto p = prefix_stats.find(name);
+  return p == prefix_stats.end() ? nullptr : p->second;
+}
+
+void RocksDBStore::close_prefix_stats()
+{
+  std::lock_guard l(prefix_stats_lock);
+  for (auto& slot : prefix_stats_by_char) {
+    auto e = slot.exchange(nullptr);
+    while (e) {
+      delete std::exchange(e, e->next);
+    }
+  }
+  cf_stats.clear();
+  for (auto& [name, stats] : prefix_stats) {
+    cct->get_perfcounters_collection()->remove(stats);
+    delete stats;
+  }
+  prefix_stats.clear();
+}
+
+void RocksDBStore::dump_prefix_stats(Formatter* f)
+{
+  std::lock_guard l(prefix_stats_lock);
+  f->open_object_section("rocksdb_prefix_stats");
+  for (auto& [name, stats] : prefix_stats) {
+    stats->dump_formatted(f, false);
+  }
+  f->close_section();
+}
+
+/// when a seek accounted to stats starts; no clock read without them
+static utime_t prefix_seek_start(PerfCounters* stats)
+{
+  return stats ? ceph_clock_now() : utime_t();
+}
+
+/// a seek that started at start left it where it is now
+static void note_prefix_seek(PerfCounters* stats, const utime_t& start,
+			     rocksdb::Iterator* it)
+{
+  if (!stats) {
+    return;
+  }
+  utime_t lat = ceph_clock_now() - start;
+  uint64_t bytes = it->Valid() ? it->key().size() + it->value().size() : 0;
+  stats->inc(l_rocksdb_prefix_seeks);
+  stats->tinc(l_rocksdb_prefix_seek_latency, lat);
+  stats->hinc(l_rocksdb_prefix_seek_lat_bytes_hist, lat.to_nsec(), bytes);
+}
+
 bool RocksDBStore::check_omap_dir(string &omap_dir)
 {
   rocksdb::Options options;
@@ -2044,29 +2445,54 @@ RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
   delete dbiter;
 }
+PerfCounters* RocksDBStore::RocksDBWholeSpaceIteratorImpl::get_stats(
+  const string &prefix)
+{
+  if (!store) {
+    return nullptr;
+  }
+  // iterators mostly keep seeking within the same prefix
+  if (!stats || prefix != stats_prefix) {
+    stats = store->get_prefix_stats(prefix);
+    stats_prefix = prefix;
+  }
+  return stats;
+}
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first()
 {
+  watch.begin({});
   dbiter->SeekToFirst();
+  watch.end(dbiter);
   ceph_assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first(const string &prefix)
 {
+  PerfCounters* seek_stats = get_stats(prefix);
+  utime_t start = prefix_seek_start(seek_stats);
   rocksdb::Slice slice_prefix(prefix);
+  watch.begin(slice_prefix);
   dbiter->Seek(slice_prefix);
+  watch.end(dbiter);
+  note_prefix_seek(seek_stats, start, dbiter);
   ceph_assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last()
 {
+  watch.begin({});
   dbiter->SeekToLast();
+  watch.end(dbiter, false);
   ceph_assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last(const string &prefix)
 {
+  PerfCounters* seek_stats = get_stats(prefix);
+  utime_t start = prefix_seek_start(seek_stats);
   string limit = past_prefix(prefix);
   rocksdb::Slice slice_limit(limit);
+  watch.begin(slice_limit);
   dbiter->Seek(slice_limit);
 
   if (!dbiter->Valid()) {
@@ -2074,6 +2500,8 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last(const string &pref
   } else {
     dbiter->Prev();
   }
+  watch.end(dbiter, false);
+  note_prefix_seek(seek_stats, start, dbiter);
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefix, const string &after)
@@ -2088,9 +2516,14 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefi
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::lower_bound(const string &prefix, const string &to)
 {
+  PerfCounters* seek_stats = get_stats(prefix);
+  utime_t start = prefix_seek_start(seek_stats);
   string bound = combine_strings(prefix, to);
   rocksdb::Slice slice_bound(bound);
+  watch.begin(slice_bound);
   dbiter->Seek(slice_bound);
+  watch.end(dbiter);
+  note_prefix_seek(seek_stats, start, dbiter);
   return dbiter->status().ok() ? 0 : -1;
 }
 bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::valid()
@@ -2100,7 +2533,9 @@ bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::valid()
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::next()
 {
   if (valid()) {
+    watch.begin(dbiter->key(), false);
     dbiter->Next();
+    watch.end(dbiter);
   }
   ceph_assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
@@ -2108,7 +2543,9 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::next()
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::prev()
 {
   if (valid()) {
+    watch.begin(dbiter->key(), false);
     dbiter->Prev();
+    watch.end(dbiter, false);
   }
   ceph_assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
@@ -2173,20 +2610,31 @@ class CFIteratorImpl : public KeyValueDB::IteratorImpl {
 protected:
   string prefix;
   rocksdb::Iterator *dbiter;
+  RocksDBStore::TombstoneWatch watch;
+  PerfCounters *stats;
 public:
-  explicit CFIteratorImpl(const std::string& p,
-				 rocksdb::Iterator *iter)
-    : prefix(p), dbiter(iter) { }
+  explicit CFIteratorImpl(RocksDBStore* db,
+			  const std::string& p,
+			  rocksdb::Iterator *iter)
+    : prefix(p), dbiter(iter), watch(db, p), stats(db->get_prefix_stats(p)) { }
   ~CFIteratorImpl() {
     delete dbiter;
   }
 
   int seek_to_first() override {
+    utime_t start = prefix_seek_start(stats);
+    watch.begin({});
     dbiter->SeekToFirst();
+    watch.end(dbiter);
+    note_prefix_seek(stats, start, dbiter);
     return dbiter->status().ok() ? 0 : -1;
   }
   int seek_to_last() override {
+    utime_t start = prefix_seek_start(stats);
+    watch.begin({});
     dbiter->SeekToLast();
+    watch.end(dbiter, false);
+    note_prefix_seek(stats, start, dbiter);
     return dbiter->status().ok() ? 0 : -1;
   }
   int upper_bound(const string &after) override {
@@ -2197,19 +2645,27 @@ public:
     return dbiter->status().ok() ? 0 : -1;
   }
   int lower_bound(const string &to) override {
+    utime_t start = prefix_seek_start(stats);
     rocksdb::Slice slice_bound(to);
+    watch.begin(slice_bound);
     dbiter->Seek(slice_bound);
+    watch.end(dbiter);
+    note_prefix_seek(stats, start, dbiter);
     return dbiter->status().ok() ? 0 : -1;
   }
   int next() override {
     if (valid()) {
+      watch.begin(dbiter->key(), false);
       dbiter->Next();
+      watch.end(dbiter);
     }
     return dbiter->status().ok() ? 0 : -1;
   }
   int prev() override {
     if (valid()) {
+      watch.begin(dbiter->key(), false);
       dbiter->Prev();
+      watch.end(dbiter, false);
     }
     return dbiter->status().ok() ? 0 : -1;
   }
@@ -2709,11 +3165,14 @@ private:
   KeyLess keyless;
   string prefix;
   std::vector<rocksdb::Iterator*> iters;
+  RocksDBStore::TombstoneWatch watch;
+  PerfCounters *stats;  ///< of the column family, not of a shard
 public:
-  explicit ShardMergeIteratorImpl(const RocksDBStore* db,
+  explicit ShardMergeIteratorImpl(RocksDBStore* db,
 				  const std::string& prefix,
 				  const std::vector<rocksdb::ColumnFamilyHandle*>& shards)
-    : db(db), keyless(db->comparator), prefix(prefix)
+    : db(db), keyless(db->comparator), prefix(prefix), watch(db, prefix),
+      stats(db->get_prefix_stats(prefix))
   {
     iters.reserve(shards.size());
     for (auto& s : shards) {
@@ -2726,6 +3185,10 @@ public:
     }
   }
   int seek_to_first() override {
+    utime_t start = prefix_seek_start(stats);
+    watch.begin({});
+    // restores the perf level if a shard fails before end()
+    auto unwatch = make_scope_guard([this] { watch.cancel(); });
     for (auto& it : iters) {
       it->SeekToFirst();
       if (!it->status().ok()) {
@@ -2734,9 +3197,13 @@ public:
     }
     //all iterators seeked, sort
     std::sort(iters.begin(), iters.end(), keyless);
+    // the shards skipped up to wherever the last of them stopped
+    watch.end(iters.back());
+    note_prefix_seek(stats, start, iters[0]);
     return 0;
   }
   int seek_to_last() override {
+    utime_t start = prefix_seek_start(stats);
     for (auto& it : iters) {
       it->SeekToLast();
       if (!it->status().ok()) {
@@ -2763,10 +3230,14 @@ public:
       }
     }
     //no need to sort, as at most 1 iterator is valid now
+    note_prefix_seek(stats, start, iters[0]);
     return 0;
   }
   int upper_bound(const string &after) override {
+    utime_t start = prefix_seek_start(stats);
     rocksdb::Slice slice_bound(after);
+    watch.begin(slice_bound);
+    auto unwatch = make_scope_guard([this] { watch.cancel(); });
     for (auto& it : iters) {
       it->Seek(slice_bound);
       if (it->Valid() && it->key() == after) {
@@ -2777,10 +3248,15 @@ public:
       }
     }
     std::sort(iters.begin(), iters.end(), keyless);
+    watch.end(iters.back());
+    note_prefix_seek(stats, start, iters[0]);
     return 0;
   }
   int lower_bound(const string &to) override {
+    utime_t start = prefix_seek_start(stats);
     rocksdb::Slice slice_bound(to);
+    watch.begin(slice_bound);
+    auto unwatch = make_scope_guard([this] { watch.cancel(); });
     for (auto& it : iters) {
       it->Seek(slice_bound);
       if (!it->status().ok()) {
@@ -2788,12 +3264,16 @@ public:
       }
     }
     std::sort(iters.begin(), iters.end(), keyless);
+    watch.end(iters.back());
+    note_prefix_seek(stats, start, iters[0]);
     return 0;
   }
   int next() override {
     int r = -1;
     if (iters[0]->Valid()) {
+      watch.begin(iters[0]->key(), false);
       iters[0]->Next();
+      watch.end(iters[0]);
       if (iters[0]->status().ok()) {
 	r = 0;
 	//bubble up
@@ -2894,6 +3374,7 @@ KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix, Itera
   if (cf_it != cf_handles.end()) {
     if (cf_it->second.handles.size() == 1) {
       return std::make_shared<CFIteratorImpl>(
+        this,
         prefix,
         db->NewIterator(rocksdb::ReadOptions(), cf_it->second.handles[0]));
     } else {
@@ -2919,7 +3400,7 @@ RocksDBStore::WholeSpaceIterator RocksDBStore::get_wholespace_iterator(IteratorO
     if (opts & ITERATOR_NOCACHE)
       opt.fill_cache=false;
     return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
-      db->NewIterator(opt, default_cf));
+      db->NewIterator(opt, default_cf), this);
   } else {
     return std::make_shared<WholeMergeIteratorImpl>(this);
   }
@@ -2928,7 +3409,7 @@ RocksDBStore::WholeSpaceIterator RocksDBStore::get_wholespace_iterator(IteratorO
 RocksDBStore::WholeSpaceIterator RocksDBStore::get_default_cf_iterator()
 {
   return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
-    db->NewIterator(rocksdb::ReadOptions(), default_cf));
+    db->NewIterator(rocksdb::ReadOptions(), default_cf), this);
 }
 
 int RocksDBStore::prepare_for_reshard(const std::string& new_sharding,
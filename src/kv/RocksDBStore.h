@@ -10,6 +10,7 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <atomic>
 #include <boost/scoped_ptr.hpp>
 #include "rocksdb/write_batch.h"
 #include "rocksdb/perf_context.h"
@@ -43,9 +44,30 @@ enum {
   l_rocksdb_write_memtable_time,
   l_rocksdb_write_delay_time,
   l_rocksdb_write_pre_and_post_process_time,
+  l_rocksdb_iter_tombstones_per_seek,
+  l_rocksdb_iter_tombstones_skipped,
+  l_rocksdb_tombstone_compact,
   l_rocksdb_last,
 };
 
+// per prefix (or column family shard) statistics
+enum {
+  l_rocksdb_prefix_first = 34350,
+  l_rocksdb_prefix_gets,
+  l_rocksdb_prefix_get_bytes,
+  l_rocksdb_prefix_get_latency,
+  l_rocksdb_prefix_get_lat_bytes_hist,
+  l_rocksdb_prefix_seeks,
+  l_rocksdb_prefix_seek_latency,
+  l_rocksdb_prefix_seek_lat_bytes_hist,
+  l_rocksdb_prefix_writes,
+  l_rocksdb_prefix_write_bytes,
+  l_rocksdb_prefix_submits,
+  l_rocksdb_prefix_submit_latency,
+  l_rocksdb_prefix_submit_lat_bytes_hist,
+  l_rocksdb_prefix_last,
+};
+
 namespace rocksdb{
   class DB;
   class Env;
@@ -175,6 +197,93 @@ private:
 
   void compact_range(const std::string& start, const std::string& end);
   void compact_range_async(const std::string& start, const std::string& end);
+
+  // tombstones our iterators had to skip, per prefix
+  struct tombstone_stats_t {
+    uint64_t ops = 0;          ///< iterator moves that skipped any
+    uint64_t skipped = 0;
+    uint64_t compactions = 0;  ///< ranges queued for compaction
+    std::string last_start, last_end;  ///< the last of those
+  };
+  ceph::mutex tombstone_lock =
+    ceph::make_mutex("RocksDBStore::tombstone_lock");
+  std::map<std::string, tombstone_stats_t> tombstone_stats;
+  ceph::mono_clock::time_point last_tombstone_compact;
+  /// an iterator move skipped this many tombstones in start~end
+  void note_tombstones(const std::string& prefix, uint64_t skipped,
+		       const std::string& start, const std::string& end);
+
+  // access statistics, per prefix or, for keys in sharded column
+  // families, per shard; seeks over all shards of a column family are
+  // accounted to the column family itself
+  ceph::mutex prefix_stats_lock =
+    ceph::make_mutex("RocksDBStore::prefix_stats_lock");
+  std::map<std::string, PerfCounters*> prefix_stats;  ///< by name
+  /// the stats of the prefixes starting with each character, so that
+  /// looking them up doesn't lock; entries are only ever prepended, and
+  /// only freed on close
+  struct prefix_stats_entry_t {
+    std::string name;
+    PerfCounters* stats;
+    prefix_stats_entry_t* next;
+  };
+  std::atomic<prefix_stats_entry_t*> prefix_stats_by_char[256] = {};
+  /// column family shards by id, set up on open
+  std::unordered_map<uint32_t, PerfCounters*> cf_stats;
+  PerfCounters* _create_prefix_stats(const std::string& name);
+  void close_prefix_stats();
+  void dump_prefix_stats(ceph::Formatter* f);
+public:
+  /// the stats for a key in prefix, or in column family shard cf if
+  /// it's not null; null if they are disabled
+  PerfCounters* get_prefix_stats(const std::string& prefix,
+				 rocksdb::ColumnFamilyHandle* cf = nullptr);
+  /// the stats named name (a prefix or a shard), null if there are none
+  PerfCounters* find_prefix_stats(const std::string& name);
+
+  /**
+   * Counts the tombstones rocksdb skips while an iterator moves.
+   *
+   * Iterators call begin() before and end() after every move.  A move
+   * that skips tombstone_compact_threshold of them queues the range it
+   * crossed for compaction, so deleted omap ranges don't slow every
+   * later listing down until rocksdb happens to compact them.
+   *
+   * Every seek is watched, but only one next()/prev() in step_sample:
+   * steps are the hot path, and a step that crosses a big deleted range
+   * is usually preceded by a seek into it.  A move that fails between
+   * begin() and end() must call cancel().
+   */
+  class TombstoneWatch {
+    static constexpr unsigned step_sample = 64;
+
+    RocksDBStore* store;
+    std::string cf_prefix;  ///< for column family iterators, whose keys
+			    ///< don't carry the prefix
+    std::string from;       ///< where the move started
+    uint64_t skipped_before = 0;
+    unsigned steps = 0;     ///< next()/prev() calls seen, for sampling
+    bool watching = false;  ///< between a counted begin() and its end()
+    bool seeking = false;
+    bool raised_perf_level = false;
+    rocksdb::PerfLevel prev_perf_level = rocksdb::PerfLevel::kDisable;
+
+    void restore_perf_level();
+  public:
+    TombstoneWatch(RocksDBStore* store, const std::string& cf_prefix = {})
+      : store(store), cf_prefix(cf_prefix) {}
+    bool enabled() const {
+      return store && store->tombstone_compact_threshold;
+    }
+    /// about to move away from key (empty if the move starts at either
+    /// end); seek is false for next/prev
+    void begin(const rocksdb::Slice& key, bool seek = true);
+    /// done moving it; forward false if it moved towards smaller keys
+    void end(rocksdb::Iterator* it, bool forward = true);
+    /// the move begun failed; drop it
+    void cancel();
+  };
+private:
   int tryInterpret(const std::string& key, const std::string& val,
 		   rocksdb::Options& opt);
 
@@ -183,6 +292,9 @@ public:
   bool compact_on_mount;
   bool disableWAL;
   const uint64_t delete_range_threshold;
+  const uint64_t tombstone_compact_threshold;
+  const double tombstone_compact_interval;
+  const bool track_prefix_stats;
   void compact() override;
 
   void compact_async() override {
@@ -228,7 +340,10 @@ public:
     compact_thread(this),
     compact_on_mount(false),
     disableWAL(false),
-    delete_range_threshold(cct->_conf.get_val<uint64_t>("rocksdb_delete_range_threshold"))
+    delete_range_threshold(cct->_conf.get_val<uint64_t>("rocksdb_delete_range_threshold")),
+    tombstone_compact_threshold(cct->_conf.get_val<uint64_t>("rocksdb_tombstone_compact_threshold")),
+    tombstone_compact_interval(cct->_conf.get_val<double>("rocksdb_tombstone_compact_interval")),
+    track_prefix_stats(cct->_conf.get_val<bool>("rocksdb_prefix_stats"))
   {}
 
   ~RocksDBStore() override;
@@ -261,6 +376,10 @@ public:
     const std::string &property,
     uint64_t *out) final;
 
+  uint64_t get_last_sequence() override {
+    return db->GetLatestSequenceNumber();
+  }
+
   int64_t estimate_prefix_size(const std::string& prefix,
 			       const std::string& key_prefix) override;
   struct RocksWBHandler;
@@ -270,7 +389,22 @@ public:
     RocksDBStore *db;
 
     explicit RocksDBTransactionImpl(RocksDBStore *_db);
+    /// account the writes to their prefixes, the transaction was
+    /// submitted in lat
+    void note_submitted(const utime_t& lat);
   private:
+    /// what the transaction writes to one prefix (or shard)
+    struct prefix_writes_t {
+      std::string prefix;
+      rocksdb::ColumnFamilyHandle* cf;
+      PerfCounters* stats;
+      uint64_t ops;
+      uint64_t bytes;
+    };
+    std::vector<prefix_writes_t> prefix_writes;
+    void note_write(const std::string& prefix,
+		    rocksdb::ColumnFamilyHandle* cf,
+		    uint64_t bytes);
     void put_bat(
       rocksdb::WriteBatch& bat,
       rocksdb::ColumnFamilyHandle *cf,
@@ -336,9 +470,15 @@ public:
     public KeyValueDB::WholeSpaceIteratorImpl {
   protected:
     rocksdb::Iterator *dbiter;
+    RocksDBStore *store;
+    TombstoneWatch watch;
+    std::string stats_prefix;  ///< the prefix stats is for
+    PerfCounters *stats = nullptr;
+    PerfCounters *get_stats(const std::string &prefix);
   public:
-    explicit RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter) :
-      dbiter(iter) { }
+    explicit RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter,
+					   RocksDBStore *store = nullptr) :
+      dbiter(iter), store(store), watch(store) { }
     //virtual ~RocksDBWholeSpaceIteratorImpl() { }
     ~RocksDBWholeSpaceIteratorImpl() override;
 
@@ -114,6 +114,15 @@ Allocator::Allocator(const std::string& name,
   asok_hook = new SocketHook(this, name);
 }
 
+Allocator::Allocator(Allocator* wrapped)
+  : capacity(wrapped->get_capacity()), block_size(wrapped->get_block_size())
+{
+  asok_hook = wrapped->asok_hook;
+  wrapped->asok_hook = nullptr;
+  if (asok_hook->alloc) {
+    asok_hook->alloc = this;
+  }
+}
 
 Allocator::~Allocator()
 {
@@ -86,6 +86,12 @@ public:
     return block_size;
   }
 
+protected:
+  /// for allocators in front of another one: take over its admin socket
+  /// commands, which keep their name but report on the new allocator.
+  /// get_name() must not be called on wrapped afterwards.
+  explicit Allocator(Allocator* wrapped);
+
 private:
   class SocketHook;
   SocketHook* asok_hook = nullptr;
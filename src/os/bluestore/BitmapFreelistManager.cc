@@ -470,6 +470,83 @@ bool BitmapFreelistManager::enumerate_next(KeyValueDB *kvdb, uint64_t *offset, u
   return false;
 }
 
+int BitmapFreelistManager::enumerate_range(
+  KeyValueDB *kvdb, uint64_t begin, uint64_t end,
+  std::function<void(uint64_t offset, uint64_t length)> cb) const
+{
+  ceph_assert((begin & ~block_mask) == 0);
+  end = std::min(end, get_alloc_units() * bytes_per_block);
+  dout(10) << __func__ << std::hex << " 0x" << begin << "~" << (end - begin)
+	   << std::dec << dendl;
+
+  // a run of clear bits, possibly spanning several keys
+  bool in_run = false;
+  uint64_t run_start = 0;
+  auto set_bit = [&](uint64_t off) {
+    if (in_run) {
+      cb(run_start, off - run_start);
+      in_run = false;
+    }
+  };
+  auto clear_bit = [&](uint64_t off) {
+    if (!in_run) {
+      run_start = off;
+      in_run = true;
+    }
+  };
+
+  auto it = kvdb->get_iterator(bitmap_prefix);
+  string k;
+  uint64_t pos = begin & key_mask;
+  make_offset_key(pos, &k);
+  it->lower_bound(k);
+  while (pos < end) {
+    uint64_t key_off = end;
+    if (it->valid()) {
+      string key = it->key();
+      const char *p = key.c_str();
+      _key_decode_u64(p, &key_off);
+    }
+    if (key_off > pos) {
+      // no key: all of it is free
+      clear_bit(std::max(pos, begin));
+      pos = std::min(key_off, end);
+      continue;
+    }
+    ceph_assert(key_off == pos);
+    bufferlist bl = it->value();
+    const unsigned char *p = (const unsigned char*)bl.c_str();
+    uint64_t bits = std::min<uint64_t>(bl.length() * 8,
+				       (end - pos) / bytes_per_block);
+    // a range that starts inside this key skips the bits before it
+    uint64_t b = begin > pos ? (begin - pos) / bytes_per_block : 0;
+    while (b < bits) {
+      unsigned char c = p[b >> 3];
+      if ((b & 7) == 0 && b + 8 <= bits &&
+	  (c == 0xff || c == 0)) {
+	// whole byte at once
+	if (c) {
+	  set_bit(_get_offset(pos, b));
+	} else {
+	  clear_bit(_get_offset(pos, b));
+	}
+	b += 8;
+	continue;
+      }
+      if (c & (1 << (b & 7))) {
+	set_bit(_get_offset(pos, b));
+      } else {
+	clear_bit(_get_offset(pos, b));
+      }
+      ++b;
+    }
+    pos += bytes_per_key;
+    it->next();
+  }
+  set_bit(end);
+  return 0;
+}
+
 void BitmapFreelistManager::dump(KeyValueDB *kvdb)
 {
   enumerate_reset();
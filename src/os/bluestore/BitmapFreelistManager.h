@@ -34,7 +34,7 @@ class BitmapFreelistManager : public FreelistManager {
   ceph::buffer::list enumerate_bl;   ///< current key at enumerate_offset
   int enumerate_bl_pos;      ///< bit position in enumerate_bl
 
-  uint64_t _get_offset(uint64_t key_off, int bit) {
+  uint64_t _get_offset(uint64_t key_off, int bit) const {
     return key_off + bit * bytes_per_block;
   }
 
@@ -75,6 +75,12 @@ public:
 
   void enumerate_reset() override;
   bool enumerate_next(KeyValueDB *kvdb, uint64_t *offset, uint64_t *length) override;
+  int enumerate_range(
+    KeyValueDB *kvdb, uint64_t begin, uint64_t end,
+    std::function<void(uint64_t offset, uint64_t length)> cb) const override;
+  uint64_t get_enumerate_granularity() const override {
+    return bytes_per_key;
+  }
 
   void allocate(
     uint64_t offset, uint64_t length,
@@ -8,6 +8,7 @@
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "common/Thread.h"
 #include "Allocator.h"
 #include "include/ceph_assert.h"
 #include "common/admin_socket.h"
@@ -299,6 +300,30 @@ void BlueFS::_init_logger()
 	    "How many times bluefs read found page with all 0s");
   b.add_u64(l_bluefs_read_zeros_errors, "read_zeros_errors",
 	    "How many times bluefs read found transient page with all 0s");
+  b.add_time_avg(l_bluefs_log_compaction_lock_lat, "log_compaction_lock_lat",
+		 "Time async log compaction held the lock, per compaction");
+
+  PerfHistogramCommon::axis_config_d stall_x_axis_config{
+    "Stall (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10,    ///< 10 usec quantization
+    20,    ///< up to ~5 sec
+  };
+  PerfHistogramCommon::axis_config_d stall_y_axis_config{
+    "Compacted log size (bytes)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    64 * 1024,
+    14,    ///< up to ~512 MiB
+  };
+  b.add_u64_counter_histogram(
+    l_bluefs_log_compaction_stall_histogram,
+    "log_compaction_stall_histogram",
+    stall_x_axis_config, stall_y_axis_config,
+    "Histogram of log writer stalls caused by async compaction vs. compacted log size");
+  b.add_u64_counter(l_bluefs_wal_ring_extends, "wal_ring_extends",
+		    "WAL ring preallocations (each one is logged)");
 
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
@@ -815,6 +840,7 @@ int BlueFS::mount()
            << std::hex << log_writer->pos << std::dec
            << dendl;
 
+  _start_compact_log_thread();
   return 0;
 
  out:
@@ -843,6 +869,7 @@ void BlueFS::umount(bool avoid_compact)
 {
   dout(1) << __func__ << dendl;
 
+  _stop_compact_log_thread();
   sync_metadata(avoid_compact);
 
   _close_writer(log_writer);
@@ -861,6 +888,13 @@ int BlueFS::prepare_new_device(int id, const bluefs_layout_t& layout)
 {
   dout(1) << __func__ << dendl;
 
+  std::unique_lock l(lock);
+  // the log is about to be rewritten under an async compaction's feet
+  while (new_log) {
+    dout(10) << __func__ << " waiting for async compaction" << dendl;
+    log_cond.wait(l);
+  }
+
   if(id == BDEV_NEWDB) {
     int new_log_dev_cur = BDEV_WAL;
     int new_log_dev_next = BDEV_WAL;
@@ -1671,6 +1705,11 @@ int BlueFS::device_migrate_to_existing(
         new_log_dev_next;
   }
 
+  std::unique_lock l(lock);
+  while (new_log) {
+    dout(10) << __func__ << " waiting for async compaction" << dendl;
+    log_cond.wait(l);
+  }
   _rewrite_log_and_layout_sync(
     false,
     (flags & REMOVE_DB) ? BDEV_SLOW : BDEV_DB,
@@ -1806,6 +1845,11 @@ int BlueFS::device_migrate_to_new(
         BDEV_DB :
 	BDEV_SLOW;
 
+  std::unique_lock l(lock);
+  while (new_log) {
+    dout(10) << __func__ << " waiting for async compaction" << dendl;
+    log_cond.wait(l);
+  }
   _rewrite_log_and_layout_sync(
     false,
     super_dev,
@@ -2107,6 +2151,10 @@ uint64_t BlueFS::_estimate_log_size()
 void BlueFS::compact_log()
 {
   std::unique_lock<ceph::mutex> l(lock);
+  while (new_log) {
+    dout(10) << __func__ << " waiting for async compaction" << dendl;
+    log_cond.wait(l);
+  }
   if (!cct->_conf->bluefs_replay_recovery_disable_compact) {
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync();
@@ -2292,28 +2340,31 @@ void BlueFS::_rewrite_log_and_layout_sync(bool allocate_with_fallback,
  * old extent(s) won't be written to, and reflect everything to compact.
  * New events will be written to the new region that we'll keep.
  *
- * 2. While still holding the lock, encode a bufferlist that dumps all of the
- * in-memory fnodes and names.  This will become the new beginning of the
- * log.  The last event will jump to the log continuation extent from #1.
- *
- * 3. Queue a write to a new extent for the new beginnging of the log.
+ * 2. While still holding the lock, dump all of the in-memory fnodes and
+ * names into a transaction.  This is a consistent snapshot and will become
+ * the new beginning of the log.  The last event will jump to the log
+ * continuation extent from #1.
  *
- * 4. Drop lock and wait
+ * 3. Drop the lock, encode the snapshot and write it to a new extent.
+ * Nothing refers to that extent yet, so writers keep appending to the log
+ * continuation meanwhile.
  *
- * 5. Retake the lock.
+ * 4. Wait for the write and retake the lock.
  *
- * 6. Update the log_fnode to splice in the new beginning.
+ * 5. Update the log_fnode to splice in the new beginning.
  *
- * 7. Write the new superblock.
+ * 6. Write the new superblock.
  *
- * 8. Release the old log space.  Clean up.
+ * 7. Release the old log space.  Clean up.
  */
 void BlueFS::_compact_log_async(std::unique_lock<ceph::mutex>& l)
 {
   dout(10) << __func__ << dendl;
   File *log_file = log_writer->file.get();
   ceph_assert(!new_log);
-  ceph_assert(!new_log_writer);
+  ceph_assert(!new_log_writing);
+  auto locked_since = ceph::mono_clock::now();
+  ceph::timespan locked;
 
   // create a new log [writer] so that we know compaction is in progress
   // (see _should_compact_log)
@@ -2375,22 +2426,25 @@ void BlueFS::_compact_log_async(std::unique_lock<ceph::mutex>& l)
   // we might have some more ops in log_t due to _allocate call
   t.claim_ops(log_t);
 
-  bufferlist bl;
-  encode(t, bl);
-  _pad_bl(bl);
-
   dout(10) << __func__ << " new_log_jump_to 0x" << std::hex << new_log_jump_to
 	   << std::dec << dendl;
 
-  new_log_writer = _create_writer(new_log);
-  new_log_writer->append(bl);
+  // 3. write the new log head, without the lock: new_log's extents are
+  // ours alone until the superblock points at them
+  new_log_writing = true;
+  new_log_head_bytes = t.op_bl.length();
+  locked += ceph::mono_clock::now() - locked_since;
+  l.unlock();
 
-  // 3. flush
-  r = _flush(new_log_writer, true);
-  ceph_assert(r == 0);
+  bufferlist bl;
+  encode(t, bl);
+  _pad_bl(bl);
+  ceph_assert(bl.length() <= new_log_jump_to);
+  _write_log_head(new_log->fnode, bl);
 
-  // 4. wait
-  _flush_bdev_safely(new_log_writer);
+  // 4. retake the lock
+  l.lock();
+  locked_since = ceph::mono_clock::now();
 
   // 5. update our log fnode
   // discard first old_log_jump_to extents
@@ -2453,17 +2507,12 @@ void BlueFS::_compact_log_async(std::unique_lock<ceph::mutex>& l)
     pending_release[r.bdev].insert(r.offset, r.length);
   }
 
-  // delete the new log, remove from the dirty files list
-  _close_writer(new_log_writer);
-  if (new_log->dirty_seq) {
-    ceph_assert(dirty_files.count(new_log->dirty_seq));
-    auto it = dirty_files[new_log->dirty_seq].iterator_to(*new_log);
-    dirty_files[new_log->dirty_seq].erase(it);
-  }
-  new_log_writer = nullptr;
+  new_log_writing = false;
   new_log = nullptr;
   log_cond.notify_all();
 
+  locked += ceph::mono_clock::now() - locked_since;
+  logger->tinc(l_bluefs_log_compaction_lock_lat, locked);
   dout(10) << __func__ << " log extents " << log_file->fnode.extents << dendl;
   logger->inc(l_bluefs_log_compactions);
 }
@@ -2478,16 +2527,55 @@ void BlueFS::_pad_bl(bufferlist& bl)
   }
 }
 
+void BlueFS::_write_log_head(const bluefs_fnode_t& fnode, bufferlist& bl)
+{
+  dout(10) << __func__ << " 0x" << std::hex << bl.length() << std::dec
+	   << " to " << fnode.extents << dendl;
+  bool touched[MAX_BDEV] = {false};
+  uint64_t pos = 0;
+  for (auto& e : fnode.extents) {
+    if (pos >= bl.length()) {
+      break;
+    }
+    uint64_t len = std::min<uint64_t>(e.length, bl.length() - pos);
+    bufferlist piece;
+    piece.substr_of(bl, pos, len);
+    bdev[e.bdev]->write(e.offset, piece, false, WRITE_LIFE_SHORT);
+    touched[e.bdev] = true;
+    pos += len;
+  }
+  ceph_assert(pos == bl.length());
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (touched[i]) {
+      bdev[i]->flush();
+    }
+  }
+}
+
+void BlueFS::_note_compaction_stall(const ceph::timespan& stall)
+{
+  logger->hinc(l_bluefs_log_compaction_stall_histogram,
+	       std::chrono::duration_cast<std::chrono::microseconds>(stall).count(),
+	       new_log_head_bytes);
+}
+
 
 int BlueFS::_flush_and_sync_log(std::unique_lock<ceph::mutex>& l,
 				uint64_t want_seq,
 				uint64_t jump_to)
 {
+  auto wait_start = ceph::mono_clock::now();
+  bool compacting = new_log && !jump_to;
+  bool waited = false;
   while (log_flushing) {
     dout(10) << __func__ << " want_seq " << want_seq
 	     << " log is currently flushing, waiting" << dendl;
     ceph_assert(!jump_to);
     log_cond.wait(l);
+    waited = true;
+  }
+  if (compacting && waited) {
+    _note_compaction_stall(ceph::mono_clock::now() - wait_start);
   }
   if (want_seq && want_seq <= log_seq_stable) {
     dout(10) << __func__ << " want_seq " << want_seq << " <= log_seq_stable "
@@ -2530,9 +2618,13 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<ceph::mutex>& l,
   if (runway < (int64_t)cct->_conf->bluefs_min_log_runway) {
     dout(10) << __func__ << " allocating more log runway (0x"
 	     << std::hex << runway << std::dec  << " remaining)" << dendl;
-    while (new_log_writer) {
-      dout(10) << __func__ << " waiting for async compaction" << dendl;
-      log_cond.wait(l);
+    if (new_log_writing) {
+      auto stall_start = ceph::mono_clock::now();
+      while (new_log_writing) {
+	dout(10) << __func__ << " waiting for async compaction" << dendl;
+	log_cond.wait(l);
+      }
+      _note_compaction_stall(ceph::mono_clock::now() - stall_start);
     }
     vselector->sub_usage(log_writer->file->vselector_hint, log_writer->file->fnode);
     int r = _allocate(
@@ -2714,9 +2806,11 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
     // we should never run out of log space here; see the min runway check
     // in _flush_and_sync_log.
     ceph_assert(h->file->fnode.ino != 1);
-    int r = _allocate(vselector->select_prefer_bdev(h->file->vselector_hint),
-		      offset + length - allocated,
-		      &h->file->fnode);
+    int r = h->file->wal_ring ?
+      _extend_wal_ring(h->file, offset + length) :
+      _allocate(vselector->select_prefer_bdev(h->file->vselector_hint),
+		offset + length - allocated,
+		&h->file->fnode);
     if (r < 0) {
       derr << __func__ << " allocated: 0x" << std::hex << allocated
            << " offset: 0x" << offset << " length: 0x" << length << std::dec
@@ -3132,9 +3226,11 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
     uint64_t want = off + len - allocated;
     vselector->sub_usage(f->vselector_hint, f->fnode);
 
-    int r = _allocate(vselector->select_prefer_bdev(f->vselector_hint),
-      want,
-      &f->fnode);
+    int r = f->wal_ring ?
+      _extend_wal_ring(f, off + len) :
+      _allocate(vselector->select_prefer_bdev(f->vselector_hint),
+		want,
+		&f->fnode);
     vselector->add_usage(f->vselector_hint, f->fnode);
     if (r < 0)
       return r;
@@ -3143,6 +3239,74 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
   return 0;
 }
 
+// Allocate whole ring chunks until f has at least want bytes and expose
+// everything allocated as file data, zeroed first.  Callers take care of
+// the volume selector and of logging the fnode.
+int BlueFS::_extend_wal_ring(FileRef f, uint64_t want)
+{
+  ceph_assert(wal_ring_size);
+  uint64_t allocated = f->fnode.get_allocated();
+  uint64_t target = round_up_to(want, wal_ring_size);
+  if (allocated < target) {
+    int r = _allocate(vselector->select_prefer_bdev(f->vselector_hint),
+		      target - allocated,
+		      &f->fnode);
+    if (r < 0) {
+      return r;
+    }
+    allocated = f->fnode.get_allocated();
+    logger->inc(l_bluefs_wal_ring_extends);
+  }
+  if (f->fnode.size < allocated) {
+    // never expose what the space held before: past the end of the log,
+    // stale records would pass for live ones on replay, while zeros read
+    // as the end of it.  Our own writes pad the last block with zeros.
+    int r = _zero_range(f, p2roundup(f->fnode.size,
+				     (uint64_t)super.block_size));
+    if (r < 0) {
+      return r;
+    }
+    dout(20) << __func__ << " size 0x" << std::hex << f->fnode.size
+	     << " -> 0x" << allocated << std::dec << dendl;
+    f->fnode.size = allocated;
+  }
+  return 0;
+}
+
+// Write zeros over f's allocation from offset on, and flush them.
+int BlueFS::_zero_range(FileRef f, uint64_t offset)
+{
+  uint64_t x_off = 0;
+  auto p = f->fnode.seek(offset, &x_off);
+  if (p == f->fnode.extents.end()) {
+    return 0;
+  }
+  dout(20) << __func__ << " " << f->fnode.ino << " from 0x" << std::hex
+	   << offset << std::dec << dendl;
+  bufferptr zeros = buffer::create_page_aligned(
+    std::min<uint64_t>(wal_ring_size, 1048576));
+  zeros.zero();
+  std::array<bool, MAX_BDEV> dirty_bdevs = {false};
+  for (; p != f->fnode.extents.end(); ++p, x_off = 0) {
+    for (uint64_t off = x_off; off < p->length; ) {
+      uint64_t len = std::min<uint64_t>(p->length - off, zeros.length());
+      bufferlist bl;
+      bl.append(zeros, 0, len);
+      int r = bdev[p->bdev]->write(p->offset + off, bl, false);
+      if (r < 0) {
+	derr << __func__ << " failed to zero 0x" << std::hex
+	     << (p->offset + off) << "~" << len << std::dec << ": "
+	     << cpp_strerror(r) << dendl;
+	return r;
+      }
+      off += len;
+    }
+    dirty_bdevs[p->bdev] = true;
+  }
+  flush_bdev(dirty_bdevs);
+  return 0;
+}
+
 void BlueFS::sync_metadata(bool avoid_compact)
 {
   std::unique_lock l(lock);
@@ -3169,12 +3333,55 @@ void BlueFS::_maybe_compact_log(std::unique_lock<ceph::mutex>& l)
       _should_compact_log()) {
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync();
+    } else if (compact_log_thread.joinable()) {
+      compact_log_pending = true;
+      compact_log_cond.notify_one();
     } else {
       _compact_log_async(l);
     }
   }
 }
 
+void BlueFS::_start_compact_log_thread()
+{
+  std::lock_guard l(lock);
+  ceph_assert(!compact_log_thread.joinable());
+  compact_log_stop = false;
+  compact_log_pending = false;
+  compact_log_thread = make_named_thread("bluefs_compact",
+    &BlueFS::_compact_log_thread_entry, this);
+}
+
+void BlueFS::_stop_compact_log_thread()
+{
+  if (!compact_log_thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard l(lock);
+    compact_log_stop = true;
+    compact_log_cond.notify_one();
+  }
+  compact_log_thread.join();
+}
+
+void BlueFS::_compact_log_thread_entry()
+{
+  std::unique_lock l(lock);
+  while (!compact_log_stop) {
+    if (compact_log_pending) {
+      compact_log_pending = false;
+      // the log may have been compacted (or settings changed) meanwhile
+      if (!cct->_conf->bluefs_replay_recovery_disable_compact &&
+	  _should_compact_log()) {
+	_compact_log_async(l);
+      }
+      continue;
+    }
+    compact_log_cond.wait(l);
+  }
+}
+
 int BlueFS::open_for_write(
   const string& dirname,
   const string& filename,
@@ -3197,6 +3404,7 @@ int BlueFS::open_for_write(
   FileRef file;
   bool create = false;
   bool truncate = false;
+  bool is_wal = boost::algorithm::ends_with(filename, ".log");
   map<string,FileRef>::iterator q = dir->file_map.find(filename);
   if (q == dir->file_map.end()) {
     if (overwrite) {
@@ -3239,6 +3447,18 @@ int BlueFS::open_for_write(
   if (create || truncate) {
     vselector->add_usage(file->vselector_hint, file->fnode); // update file count
   }
+  if (is_wal && wal_ring_size) {
+    // preallocate the log and publish its final size now, so that fsync
+    // only writes data; rocksdb finds the end of the records by itself
+    vselector->sub_usage(file->vselector_hint, file->fnode);
+    int r = _extend_wal_ring(file, std::max(wal_ring_size, file->fnode.size));
+    vselector->add_usage(file->vselector_hint, file->fnode);
+    if (r < 0) {
+      dout(1) << __func__ << " unable to preallocate WAL ring for "
+	      << filename << ": " << cpp_strerror(r) << dendl;
+    }
+    file->wal_ring = (r == 0);
+  }
 
   dout(20) << __func__ << " mapping " << dirname << "/" << filename
 	   << " vsel_hint " << file->vselector_hint
@@ -3250,7 +3470,7 @@ int BlueFS::open_for_write(
 
   *h = _create_writer(file);
 
-  if (boost::algorithm::ends_with(filename, ".log")) {
+  if (is_wal) {
     (*h)->writer_type = BlueFS::WRITER_WAL;
     if (logger && !overwrite) {
       logger->inc(l_bluefs_files_written_wal);
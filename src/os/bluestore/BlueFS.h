@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <thread>
 
 #include "bluefs_types.h"
 #include "blk/BlockDevice.h"
@@ -51,6 +52,9 @@ enum {
   l_bluefs_read_prefetch_bytes,
   l_bluefs_read_zeros_candidate,
   l_bluefs_read_zeros_errors,
+  l_bluefs_log_compaction_lock_lat,
+  l_bluefs_log_compaction_stall_histogram,
+  l_bluefs_wal_ring_extends,
 
   l_bluefs_last,
 };
@@ -113,6 +117,7 @@ public:
     uint64_t dirty_seq;
     bool locked;
     bool deleted;
+    bool wal_ring;   ///< WAL file kept at its allocated size, see wal_ring_size
     boost::intrusive::list_member_hook<> dirty_item;
 
     std::atomic_int num_readers, num_writers;
@@ -128,6 +133,7 @@ public:
 	dirty_seq(0),
 	locked(false),
 	deleted(false),
+	wal_ring(false),
 	num_readers(0),
 	num_writers(0),
 	num_reading(0),
@@ -320,7 +326,22 @@ private:
   uint64_t new_log_jump_to = 0;
   uint64_t old_log_jump_to = 0;
   FileRef new_log = nullptr;
-  FileWriter *new_log_writer = nullptr;
+  bool new_log_writing = false; ///< compacted log head is being written
+  uint64_t new_log_head_bytes = 0;
+
+  /// RocksDB WAL files are preallocated in chunks of this size and
+  /// exposed at their full allocated size, so that appending to them
+  /// does not update the BlueFS log on every fsync.  New chunks are
+  /// zeroed, which rocksdb reads as the end of the records; recycled
+  /// logs keep their old records, which the recyclable format tells
+  /// apart.  0 disables.
+  uint64_t wal_ring_size = 0;
+
+  // async log compaction runs here rather than in the fsync caller
+  std::thread compact_log_thread;
+  ceph::condition_variable compact_log_cond;
+  bool compact_log_stop = false;
+  bool compact_log_pending = false;
 
   /*
    * There are up to 3 block devices:
@@ -403,6 +424,11 @@ private:
 				  int flags);
   void _compact_log_sync();
   void _compact_log_async(std::unique_lock<ceph::mutex>& l);
+  void _write_log_head(const bluefs_fnode_t& fnode, ceph::buffer::list& bl);
+  void _note_compaction_stall(const ceph::timespan& stall);
+  void _start_compact_log_thread();
+  void _stop_compact_log_thread();
+  void _compact_log_thread_entry();
 
   void _rewrite_log_and_layout_sync(bool allocate_with_fallback,
 				    int super_dev,
@@ -418,6 +444,8 @@ private:
   void flush_bdev(std::array<bool, MAX_BDEV>& dirty_bdevs);  // this is safe to call without a lock
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
+  int _extend_wal_ring(FileRef f, uint64_t want);
+  int _zero_range(FileRef f, uint64_t offset);
   int _truncate(FileWriter *h, uint64_t off);
 
   int64_t _read(
@@ -542,6 +570,10 @@ public:
   void set_volume_selector(BlueFSVolumeSelector* s) {
     vselector.reset(s);
   }
+  void set_wal_ring_size(uint64_t size) {
+    std::lock_guard l(lock);
+    wal_ring_size = size;
+  }
   void dump_volume_selector(std::ostream& sout) {
     vselector->dump(sout);
   }
@@ -555,6 +587,10 @@ public:
 		       bluefs_shared_alloc_context_t* _shared_alloc = nullptr);
   bool bdev_support_label(unsigned id);
   uint64_t get_block_device_size(unsigned bdev) const;
+  /// for raw I/O to extents of files we own (see BlueStore's fast tier)
+  BlockDevice* get_block_device(unsigned id) const {
+    return id < bdev.size() ? bdev[id] : nullptr;
+  }
 
   // handler for discard event
   void handle_discard(unsigned dev, interval_set<uint64_t>& to_release);
@@ -246,6 +246,10 @@ class BlueRocksWritableFile : public rocksdb::WritableFile {
    * Get the size of valid data in the file.
    */
   uint64_t GetFileSize() override {
+    if (h->file->wal_ring) {
+      // the fnode size covers the whole preallocated ring
+      return h->get_effective_write_pos();
+    }
     return h->file->fnode.size + h->get_buffer_length();;
   }
 
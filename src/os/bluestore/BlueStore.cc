@@ -31,11 +31,15 @@
 #include "include/stringify.h"
 #include "include/str_map.h"
 #include "include/util.h"
+#include "common/admin_socket.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/Thread.h"
 #include "common/PriorityCache.h"
 #include "common/RWLock.h"
 #include "Allocator.h"
+#include "MagazineAllocator.h"
+#include "FastTier.h"
 #include "FreelistManager.h"
 #include "BlueFS.h"
 #include "BlueRocksEnv.h"
@@ -66,6 +70,10 @@ using bid_t = decltype(BlueStore::Blob::id);
 MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Onode, bluestore_onode,
 			      bluestore_cache_onode);
 
+// bluestore_cache_encoded
+MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::EncodedOnode, bluestore_encoded_onode,
+			      bluestore_cache_encoded);
+
 // bluestore_cache_other
 MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Buffer, bluestore_buffer,
 			      bluestore_Buffer);
@@ -123,6 +131,10 @@ const string PREFIX_ZONED_FM_META = "Z";  // (see ZonedFreelistManager)
 const string PREFIX_ZONED_FM_INFO = "z";  // (see ZonedFreelistManager)
 const string PREFIX_ZONED_CL_INFO = "G";  // (per-zone cleaner metadata)
 
+// allocator state saved on clean umount (see _save_alloc_snapshot)
+const string BLUEFS_ALLOC_SNAPSHOT_DIR = "bluestore";
+const string BLUEFS_ALLOC_SNAPSHOT_FILE = "alloc_snapshot";
+
 const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
 
 // write a label in the first block.  always use this size.  note that
@@ -1086,6 +1098,7 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
   void _trim_to(uint64_t new_size) override
   {
     if (new_size >= lru.size()) {
+      _trim_encoded();
       return; // don't even try
     } 
     uint64_t n = lru.size() - new_size;
@@ -1106,8 +1119,12 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
       }
       auto pinned = !o->pop_cache();
       ceph_assert(!pinned);
+      if (encoded_enabled() && o->exists) {
+        o->c->onode_map._add_encoded(o);
+      }
       o->c->onode_map._remove(o->oid);
     }
+    _trim_encoded();
   }
   void move_pinned(OnodeCacheShard *to, BlueStore::Onode *o) override
   {
@@ -1143,6 +1160,31 @@ BlueStore::OnodeCacheShard *BlueStore::OnodeCacheShard::create(
   return c;
 }
 
+void BlueStore::OnodeCacheShard::_add_encoded(EncodedOnode *e)
+{
+  encoded_lru.push_front(*e);
+  encoded_bytes += e->bl.length();
+}
+
+void BlueStore::OnodeCacheShard::_rm_encoded(EncodedOnode *e)
+{
+  encoded_lru.erase(encoded_lru.iterator_to(*e));
+  ceph_assert(encoded_bytes >= e->bl.length());
+  encoded_bytes -= e->bl.length();
+}
+
+void BlueStore::OnodeCacheShard::_trim_encoded()
+{
+  while (encoded_bytes > encoded_max && !encoded_lru.empty()) {
+    EncodedOnode *e = &encoded_lru.back();
+    dout(20) << __func__ << " rm encoded " << e->oid << " "
+             << e->bl.length() << dendl;
+    e->space->encoded_map.erase(e->oid);
+    _rm_encoded(e);
+    delete e;
+  }
+}
+
 // LruBufferCacheShard
 struct LruBufferCacheShard : public BlueStore::BufferCacheShard {
   typedef boost::intrusive::list<
@@ -1828,6 +1870,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add(const ghobject_t& oid,
   OnodeRef& o)
 {
   std::lock_guard l(cache->lock);
+  std::unique_lock ml(map_lock);
   auto p = onode_map.find(oid);
   if (p != onode_map.end()) {
     ldout(cache->cct, 30) << __func__ << " " << oid << " " << o
@@ -1837,6 +1880,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add(const ghobject_t& oid,
   }
   ldout(cache->cct, 20) << __func__ << " " << oid << " " << o << dendl;
   onode_map[oid] = o;
+  ml.unlock();
   cache->_add(o.get(), 1);
   cache->_trim();
   return o;
@@ -1845,7 +1889,59 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add(const ghobject_t& oid,
 void BlueStore::OnodeSpace::_remove(const ghobject_t& oid)
 {
   ldout(cache->cct, 20) << __func__ << " " << oid << " " << dendl;
-  onode_map.erase(oid);
+  OnodeRef o;
+  {
+    std::unique_lock ml(map_lock);
+    auto p = onode_map.find(oid);
+    if (p != onode_map.end()) {
+      o = std::move(p->second);
+      onode_map.erase(p);
+    }
+  }
+  // drop the map's reference (possibly the last one) outside of map_lock
+}
+
+void BlueStore::OnodeSpace::_add_encoded(Onode *o)
+{
+  bufferlist bl;
+  unsigned onode_part, blob_part, extent_part;
+  o->encode(bl, &onode_part, &blob_part, &extent_part);
+  ldout(cache->cct, 20) << __func__ << " " << o->oid << " " << bl.length()
+			<< dendl;
+  auto e = new EncodedOnode(this, o->oid, std::move(bl));
+  auto& slot = encoded_map[o->oid];
+  if (slot) {
+    cache->_rm_encoded(slot);
+    delete slot;
+  }
+  slot = e;
+  cache->_add_encoded(e);
+}
+
+bool BlueStore::OnodeSpace::take_encoded(const ghobject_t& oid, bufferlist *bl)
+{
+  std::lock_guard l(cache->lock);
+  auto p = encoded_map.find(oid);
+  if (p == encoded_map.end()) {
+    return false;
+  }
+  EncodedOnode *e = p->second;
+  encoded_map.erase(p);
+  cache->_rm_encoded(e);
+  if (bl) {
+    bl->claim_append(e->bl);
+  }
+  delete e;
+  return true;
+}
+
+void BlueStore::OnodeSpace::_clear_encoded()
+{
+  for (auto& p : encoded_map) {
+    cache->_rm_encoded(p.second);
+    delete p.second;
+  }
+  encoded_map.clear();
 }
 
 BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
@@ -1855,7 +1951,20 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
   bool hit = false;
 
   {
+    // fast path: a hot onode is normally pinned by concurrent users, in
+    // which case we can take another reference without the shard lock.
+    // LRU bookkeeping is deferred until the onode gets unpinned anyway.
+    std::shared_lock ml(map_lock);
+    auto p = onode_map.find(oid);
+    if (p != onode_map.end() && p->second->get_if_pinned()) {
+      o.reset(p->second.get(), false);
+      hit = true;
+    }
+  }
+
+  if (!hit) {
     std::lock_guard l(cache->lock);
+    std::shared_lock ml(map_lock);
     ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(oid);
     if (p == onode_map.end()) {
       ldout(cache->cct, 30) << __func__ << " " << oid << " miss" << dendl;
@@ -1885,16 +1994,21 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
 void BlueStore::OnodeSpace::clear()
 {
   std::lock_guard l(cache->lock);
-  ldout(cache->cct, 10) << __func__ << " " << onode_map.size()<< dendl;
-  for (auto &p : onode_map) {
-    cache->_rm(p.second.get());
+  decltype(onode_map) to_release;
+  {
+    std::unique_lock ml(map_lock);
+    ldout(cache->cct, 10) << __func__ << " " << onode_map.size()<< dendl;
+    for (auto &p : onode_map) {
+      cache->_rm(p.second.get());
+    }
+    onode_map.swap(to_release);
   }
-  onode_map.clear();
+  _clear_encoded();
 }
 
 bool BlueStore::OnodeSpace::empty()
 {
-  std::lock_guard l(cache->lock);
+  std::shared_lock ml(map_lock);
   return onode_map.empty();
 }
 
@@ -1905,6 +2019,7 @@ void BlueStore::OnodeSpace::rename(
   const mempool::bluestore_cache_meta::string& new_okey)
 {
   std::lock_guard l(cache->lock);
+  std::unique_lock ml(map_lock);
   ldout(cache->cct, 30) << __func__ << " " << old_oid << " -> " << new_oid
 			<< dendl;
   ceph::unordered_map<ghobject_t,OnodeRef>::iterator po, pn;
@@ -1939,6 +2054,7 @@ void BlueStore::OnodeSpace::rename(
 bool BlueStore::OnodeSpace::map_any(std::function<bool(Onode*)> f)
 {
   std::lock_guard l(cache->lock);
+  std::shared_lock ml(map_lock);
   ldout(cache->cct, 20) << __func__ << dendl;
   for (auto& i : onode_map) {
     if (f(i.second.get())) {
@@ -3550,6 +3666,44 @@ void BlueStore::Onode::put() {
   }
 }
 
+// Take a reference only if the onode is already pinned and referenced by
+// someone besides the OnodeSpace, i.e. nref >= 3. In that state put()
+// cannot unpin it concurrently, so no shard lock is needed.
+bool BlueStore::Onode::get_if_pinned() {
+  int n = nref.load();
+  while (n >= 3 && pinned) {
+    if (nref.compare_exchange_weak(n, n + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlueStore::Onode::encode(bufferlist& bl,
+			      unsigned *onode_part,
+			      unsigned *blob_part,
+			      unsigned *extent_part)
+{
+  // bound encode
+  size_t bound = 0;
+  denc(onode, bound);
+  extent_map.bound_encode_spanning_blobs(bound);
+  if (onode.extent_map_shards.empty()) {
+    denc(extent_map.inline_bl, bound);
+  }
+
+  // encode
+  auto p = bl.get_contiguous_appender(bound, true);
+  denc(onode, p);
+  *onode_part = p.get_logical_offset();
+  extent_map.encode_spanning_blobs(p);
+  *blob_part = p.get_logical_offset() - *onode_part;
+  if (onode.extent_map_shards.empty()) {
+    denc(extent_map.inline_bl, p);
+  }
+  *extent_part = p.get_logical_offset() - *onode_part - *blob_part;
+}
+
 BlueStore::Onode* BlueStore::Onode::decode(
   CollectionRef c,
   const ghobject_t& oid,
@@ -3967,8 +4121,18 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
   int r = -ENOENT;
   Onode *on;
   if (!is_createop) {
-    r = store->db->get(PREFIX_OBJ, key.c_str(), key.size(), &v);
-    ldout(store->cct, 20) << " r " << r << " v.len " << v.length() << dendl;
+    if (onode_map.take_encoded(oid, &v)) {
+      r = 0;
+      store->logger->inc(l_bluestore_onode_encoded_hits);
+      ldout(store->cct, 20) << " encoded hit v.len " << v.length() << dendl;
+    } else {
+      r = store->db->get(PREFIX_OBJ, key.c_str(), key.size(), &v);
+      ldout(store->cct, 20) << " r " << r << " v.len " << v.length() << dendl;
+    }
+  } else {
+    // never resurrect a stale encoding over a freshly created onode; the
+    // tier may have been switched off since it was filled, so always look
+    onode_map.take_encoded(oid, nullptr);
   }
   if (v.length() == 0) {
     ceph_assert(r == -ENOENT);
@@ -3991,7 +4155,25 @@ void BlueStore::Collection::split_cache(
 {
   ldout(store->cct, 10) << __func__ << " to " << dest << dendl;
 
-  // lock (one or both) cache shards
+  // References taken here are dropped only once all the locks below are
+  // released: put() may unpin and _remove() the onode, which takes the
+  // onode shard lock and then map_lock.
+  vector<OnodeRef> moving;
+  vector<OnodeRef> displaced;
+
+  // lock (one or both) onode cache shards first, as everything touching
+  // onode_map does, then the buffer cache shards
+  std::lock(get_onode_cache()->lock, dest->get_onode_cache()->lock);
+  std::lock_guard ol(get_onode_cache()->lock, std::adopt_lock);
+  std::lock_guard ol2(dest->get_onode_cache()->lock, std::adopt_lock);
+
+  // The encoded onode tier is kept per collection; simply drop it on
+  // both sides rather than sorting it out between parent and child.
+  // Anything evicted from here on for an object that moves belongs to a
+  // pg this collection no longer serves, and gets dropped again on merge.
+  onode_map._clear_encoded();
+  dest->onode_map._clear_encoded();
+
   std::lock(cache->lock, dest->cache->lock);
   std::lock_guard l(cache->lock, std::adopt_lock);
   std::lock_guard l2(dest->cache->lock, std::adopt_lock);
@@ -4001,61 +4183,73 @@ void BlueStore::Collection::split_cache(
   bool is_pg = dest->cid.is_pg(&destpg);
   ceph_assert(is_pg);
 
-  auto p = onode_map.onode_map.begin();
-  while (p != onode_map.onode_map.end()) {
-    OnodeRef o = p->second;
-    if (!p->second->oid.match(destbits, destpg.pgid.ps())) {
+  // onode_map only changes under the onode shard lock, which we hold, so
+  // it can be walked without map_lock.  Pinning the onodes that move
+  // keeps them physically out of the cache during the transition.
+  for (auto& p : onode_map.onode_map) {
+    if (!p.second->oid.match(destbits, destpg.pgid.ps())) {
       // onode does not belong to this child
-      ldout(store->cct, 20) << __func__ << " not moving " << o << " " << o->oid
-			    << dendl;
-      ++p;
-    } else {
+      ldout(store->cct, 20) << __func__ << " not moving " << p.second << " "
+			    << p.second->oid << dendl;
+      continue;
+    }
+    moving.push_back(p.second);
+    ceph_assert(p.second->pinned);
+  }
+
+  {
+    // only raw pointers and moved refs in here, see above
+    std::unique_lock ml(onode_map.map_lock);
+    std::unique_lock ml2(dest->onode_map.map_lock);
+    displaced.reserve(moving.size());
+    for (auto& o : moving) {
       ldout(store->cct, 20) << __func__ << " moving " << o << " " << o->oid
 			    << dendl;
-
-      // ensuring that nref is always >= 2 and hence onode is pinned and 
-      // physically out of cache during the transition
-      OnodeRef o_pin = o;
-      ceph_assert(o->pinned);
-
-      p = onode_map.onode_map.erase(p);
-      dest->onode_map.onode_map[o->oid] = o;
+      auto p = onode_map.onode_map.find(o->oid);
+      ceph_assert(p != onode_map.onode_map.end());
+      std::swap(dest->onode_map.onode_map[o->oid], p->second);
+      if (p->second) {
+	displaced.push_back(std::move(p->second));
+      }
+      onode_map.onode_map.erase(p);
       if (o->cached) {
-        get_onode_cache()->move_pinned(dest->get_onode_cache(), o.get());
+	get_onode_cache()->move_pinned(dest->get_onode_cache(), o.get());
       }
       o->c = dest;
+    }
+  }
 
-      // move over shared blobs and buffers.  cover shared blobs from
-      // both extent map and spanning blob map (the full extent map
-      // may not be faulted in)
-      vector<SharedBlob*> sbvec;
-      for (auto& e : o->extent_map.extent_map) {
-	sbvec.push_back(e.blob->shared_blob.get());
+  for (auto& o : moving) {
+    // move over shared blobs and buffers.  cover shared blobs from
+    // both extent map and spanning blob map (the full extent map
+    // may not be faulted in)
+    vector<SharedBlob*> sbvec;
+    for (auto& e : o->extent_map.extent_map) {
+      sbvec.push_back(e.blob->shared_blob.get());
+    }
+    for (auto& b : o->extent_map.spanning_blob_map) {
+      sbvec.push_back(b.second->shared_blob.get());
+    }
+    for (auto sb : sbvec) {
+      if (sb->coll == dest) {
+	ldout(store->cct, 20) << __func__ << "  already moved " << *sb
+			      << dendl;
+	continue;
       }
-      for (auto& b : o->extent_map.spanning_blob_map) {
-	sbvec.push_back(b.second->shared_blob.get());
+      ldout(store->cct, 20) << __func__ << "  moving " << *sb << dendl;
+      if (sb->get_sbid()) {
+	ldout(store->cct, 20) << __func__
+			      << "   moving registration " << *sb << dendl;
+	shared_blob_set.remove(sb);
+	dest->shared_blob_set.add(dest, sb);
       }
-      for (auto sb : sbvec) {
-	if (sb->coll == dest) {
-	  ldout(store->cct, 20) << __func__ << "  already moved " << *sb
-				<< dendl;
-	  continue;
-	}
-	ldout(store->cct, 20) << __func__ << "  moving " << *sb << dendl;
-	if (sb->get_sbid()) {
-	  ldout(store->cct, 20) << __func__
-				<< "   moving registration " << *sb << dendl;
-	  shared_blob_set.remove(sb);
-	  dest->shared_blob_set.add(dest, sb);
-	}
-	sb->coll = dest;
-	if (dest->cache != cache) {
-	  for (auto& i : sb->bc.buffer_map) {
-	    if (!i.second->is_writing()) {
-	      ldout(store->cct, 20) << __func__ << "   moving " << *i.second
-				    << dendl;
-	      dest->cache->_move(cache, i.second.get());
-	    }
+      sb->coll = dest;
+      if (dest->cache != cache) {
+	for (auto& i : sb->bc.buffer_map) {
+	  if (!i.second->is_writing()) {
+	    ldout(store->cct, 20) << __func__ << "   moving " << *i.second
+				  << dendl;
+	    dest->cache->_move(cache, i.second.get());
 	  }
 	}
       }
@@ -4103,6 +4297,9 @@ void *BlueStore::MempoolThread::entry()
     if (binned_kv_onode_cache != nullptr) {
       pcm->insert("kv_onode", binned_kv_onode_cache, true);
     }
+    if (store->cache_meta_encoded_ratio > 0) {
+      pcm->insert("meta_encoded", encoded_meta_cache, true);
+    }
   }
 
   utime_t next_balance = ceph_clock_now();
@@ -4189,6 +4386,7 @@ void BlueStore::MempoolThread::_adjust_cache_settings()
   }
   meta_cache->set_cache_ratio(store->cache_meta_ratio);
   data_cache->set_cache_ratio(store->cache_data_ratio);
+  encoded_meta_cache->set_cache_ratio(store->cache_meta_encoded_ratio);
 }
 
 void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
@@ -4199,6 +4397,7 @@ void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
   int64_t kv_onode_used = store->db->get_cache_usage(PREFIX_OBJ);
   int64_t meta_used = meta_cache->_get_used_bytes();
   int64_t data_used = data_cache->_get_used_bytes();
+  int64_t encoded_used = encoded_meta_cache->_get_used_bytes();
 
   uint64_t cache_size = store->cache_size;
   int64_t kv_alloc =
@@ -4209,12 +4408,17 @@ void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
      static_cast<int64_t>(store->cache_meta_ratio * cache_size);
   int64_t data_alloc =
      static_cast<int64_t>(store->cache_data_ratio * cache_size);
+  int64_t encoded_alloc =
+     static_cast<int64_t>(store->cache_meta_encoded_ratio * cache_size);
 
   if (pcm != nullptr && binned_kv_cache != nullptr) {
     cache_size = pcm->get_tuned_mem();
     kv_alloc = binned_kv_cache->get_committed_size();
     meta_alloc = meta_cache->get_committed_size();
     data_alloc = data_cache->get_committed_size();
+    if (store->cache_meta_encoded_ratio > 0) {
+      encoded_alloc = encoded_meta_cache->get_committed_size();
+    }
     if (binned_kv_onode_cache != nullptr) {
       kv_onode_alloc = binned_kv_onode_cache->get_committed_size();
     }
@@ -4229,7 +4433,9 @@ void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
                   << " meta_alloc: " << meta_alloc
                   << " meta_used: " << meta_used
                   << " data_alloc: " << data_alloc
-                  << " data_used: " << data_used << dendl;
+                  << " data_used: " << data_used
+                  << " encoded_alloc: " << encoded_alloc
+                  << " encoded_used: " << encoded_used << dendl;
   } else {
     dout(20) << __func__  << " cache_size: " << cache_size
                    << " kv_alloc: " << kv_alloc
@@ -4239,7 +4445,9 @@ void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
                    << " meta_alloc: " << meta_alloc
                    << " meta_used: " << meta_used
                    << " data_alloc: " << data_alloc
-                   << " data_used: " << data_used << dendl;
+                   << " data_used: " << data_used
+                   << " encoded_alloc: " << encoded_alloc
+                   << " encoded_used: " << encoded_used << dendl;
   }
 
   uint64_t max_shard_onodes = static_cast<uint64_t>(
@@ -4249,8 +4457,11 @@ void BlueStore::MempoolThread::_resize_shards(bool interval_stats)
   dout(30) << __func__ << " max_shard_onodes: " << max_shard_onodes
                  << " max_shard_buffer: " << max_shard_buffer << dendl;
 
+  uint64_t max_shard_encoded = static_cast<uint64_t>(
+      encoded_alloc / onode_shards);
   for (auto i : store->onode_cache_shards) {
     i->set_max(max_shard_onodes);
+    i->set_encoded_max(max_shard_encoded);
   }
   for (auto i : store->buffer_cache_shards) {
     i->set_max(max_shard_buffer);
@@ -4462,6 +4673,60 @@ void BlueStore::handle_discard(interval_set<uint64_t>& to_release)
   shared_alloc.a->release(to_release);
 }
 
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore* store;
+public:
+  static BlueStore::SocketHook* create(BlueStore* store)
+  {
+    BlueStore::SocketHook* hook = nullptr;
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    if (admin_socket) {
+      hook = new BlueStore::SocketHook(store);
+      int r = admin_socket->register_command("bluestore numa placement",
+					     hook,
+					     "Show numa placement of bluestore "
+					     "devices, kv threads and cache shards");
+      if (r == 0) {
+	r = admin_socket->register_command("bluestore deferred policy",
+					   hook,
+					   "Show the current deferred write "
+					   "thresholds and what they are "
+					   "based on");
+      }
+      if (r != 0) {
+	ldout(store->cct, 1) << __func__ << " cannot register SocketHook"
+			     << dendl;
+	delete hook;
+	hook = nullptr;
+      }
+    }
+    return hook;
+  }
+
+  ~SocketHook() {
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    admin_socket->unregister_commands(this);
+  }
+private:
+  SocketHook(BlueStore* store) :
+    store(store) {}
+  int call(std::string_view command, const cmdmap_t& cmdmap,
+	   Formatter *f,
+	   std::ostream& errss,
+	   bufferlist& out) override {
+    if (command == "bluestore numa placement") {
+      store->dump_numa_placement(f);
+      return 0;
+    }
+    if (command == "bluestore deferred policy") {
+      store->dump_deferred_policy(f);
+      return 0;
+    }
+    errss << "Invalid command" << std::endl;
+    return -ENOSYS;
+  }
+};
+
 BlueStore::BlueStore(CephContext *cct, const string& path)
   : BlueStore(cct, path, 0) {}
 
@@ -4522,6 +4787,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_adaptive",
+    "bluestore_deferred_adaptive_interval",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -4540,6 +4807,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_warn_on_legacy_statfs",
     "bluestore_warn_on_no_per_pool_omap",
     "bluestore_max_defer_interval",
+    "bluestore_prefetch_sequential_reads",
+    "bluestore_prefetch_max_bytes",
     NULL
   };
   return KEYS;
@@ -4586,6 +4855,12 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       _set_alloc_sizes();
     }
   }
+  if (changed.count("bluestore_deferred_adaptive") ||
+      changed.count("bluestore_deferred_adaptive_interval")) {
+    if (bdev) {
+      _set_deferred_adaptive();
+    }
+  }
   if (changed.count("bluestore_throttle_cost_per_io") ||
       changed.count("bluestore_throttle_cost_per_io_hdd") ||
       changed.count("bluestore_throttle_cost_per_io_ssd")) {
@@ -4603,6 +4878,10 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       _set_max_defer_interval();
     }
   }
+  if (changed.count("bluestore_prefetch_sequential_reads") ||
+      changed.count("bluestore_prefetch_max_bytes")) {
+    _set_prefetch();
+  }
   if (changed.count("osd_memory_target") ||
       changed.count("osd_memory_base") ||
       changed.count("osd_memory_cache_min") ||
@@ -4774,18 +5053,29 @@ int BlueStore::_set_cache_sizes()
     return -EINVAL;
   }
 
-  if (cache_meta_ratio + cache_kv_ratio > 1.0) {
+  cache_meta_encoded_ratio =
+    cct->_conf.get_val<double>("bluestore_cache_meta_encoded_ratio");
+  if (cache_meta_encoded_ratio < 0 || cache_meta_encoded_ratio > 1.0) {
+    derr << __func__ << " bluestore_cache_meta_encoded_ratio ("
+         << cache_meta_encoded_ratio << ") must be in range [0,1.0]" << dendl;
+    return -EINVAL;
+  }
+
+  if (cache_meta_ratio + cache_kv_ratio + cache_meta_encoded_ratio > 1.0) {
     derr << __func__ << " bluestore_cache_meta_ratio (" << cache_meta_ratio
          << ") + bluestore_cache_kv_ratio (" << cache_kv_ratio
-         << ") = " << cache_meta_ratio + cache_kv_ratio << "; must be <= 1.0"
-         << dendl;
+         << ") + bluestore_cache_meta_encoded_ratio ("
+         << cache_meta_encoded_ratio << ") = "
+         << cache_meta_ratio + cache_kv_ratio + cache_meta_encoded_ratio
+         << "; must be <= 1.0" << dendl;
     return -EINVAL;
   }
 
   cache_data_ratio = (double)1.0 - 
                      (double)cache_meta_ratio - 
                      (double)cache_kv_ratio - 
-                     (double)cache_kv_onode_ratio;
+                     (double)cache_kv_onode_ratio -
+                     (double)cache_meta_encoded_ratio;
   if (cache_data_ratio < 0) {
     // deal with floating point imprecision
     cache_data_ratio = 0;
@@ -4793,6 +5083,7 @@ int BlueStore::_set_cache_sizes()
     
   dout(1) << __func__ << " cache_size " << cache_size
           << " meta " << cache_meta_ratio
+          << " meta_encoded " << cache_meta_encoded_ratio
 	  << " kv " << cache_kv_ratio
 	  << " data " << cache_data_ratio
 	  << dendl;
@@ -4841,6 +5132,10 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_kv_sync_lat, "kv_sync_lat",
 		 "Average kv_sync thread latency",
 		 "ks_l", PerfCountersBuilder::PRIO_INTERESTING);
+  b.add_u64_avg(l_bluestore_kv_sync_batch, "kv_sync_batch",
+		"Average number of transactions committed per kv sync");
+  b.add_time_avg(l_bluestore_kv_group_wait_lat, "kv_group_wait_lat",
+		 "Average time kv_sync thread waited for a batch to grow");
   b.add_time_avg(l_bluestore_kv_final_lat, "kv_final_lat",
 		 "Average kv_finalize thread latency",
 		 "kf_l", PerfCountersBuilder::PRIO_INTERESTING);
@@ -4883,6 +5178,17 @@ void BlueStore::_init_logger()
     "Average read onode metadata latency");
   b.add_time_avg(l_bluestore_read_wait_aio_lat, "read_wait_aio_lat",
     "Average read latency");
+  b.add_u64_counter(l_bluestore_read_prefetch_bytes, "read_prefetch_bytes",
+    "Bytes read ahead for sequential readers",
+    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_read_prefetch_hit_bytes,
+    "read_prefetch_hit_bytes",
+    "Bytes requested by readers that had been prefetched",
+    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_read_prefetch_waste_bytes,
+    "read_prefetch_waste_bytes",
+    "Prefetched bytes abandoned when a sequential stream broke off",
+    NULL, 0, unit_t(UNIT_BYTES));
   b.add_time_avg(l_bluestore_compress_lat, "compress_lat",
     "Average compress latency");
   b.add_time_avg(l_bluestore_decompress_lat, "decompress_lat",
@@ -4893,12 +5199,32 @@ void BlueStore::_init_logger()
     "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
     "Sum for compress ops rejected due to low net gain of space");
+  b.add_time_avg(l_bluestore_compress_queue_lat, "compress_queue_lat",
+    "Average time blobs waited for a compression thread");
+  b.add_u64_counter(l_bluestore_compress_saturated_count,
+    "compress_saturated_count",
+    "Blobs written uncompressed because the compression queue was full");
+  b.add_u64_counter(l_bluestore_compress_in_bytes, "compress_in_bytes",
+    "Bytes given to the compressor", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_compress_out_bytes, "compress_out_bytes",
+    "Bytes the compressor returned for compress_in_bytes",
+    NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_write_pad_bytes, "write_pad_bytes",
 		    "Sum for write-op padded bytes", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_deferred_write_ops, "deferred_write_ops",
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def", 0, unit_t(UNIT_BYTES));
+  b.add_time_avg(l_bluestore_deferred_aio_lat, "deferred_aio_lat",
+		 "Average deferred write aio latency, per aio of a batch");
+  b.add_u64(l_bluestore_deferred_policy_size, "deferred_policy_size",
+	    "Current size threshold for deferred writes", NULL, 0,
+	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_deferred_policy_batch_ops, "deferred_policy_batch_ops",
+	    "Current number of deferred writes batched before submitting");
+  b.add_u64_counter(l_bluestore_deferred_policy_adjustments,
+		    "deferred_policy_adjustments",
+		    "Changes to the deferred thresholds by the adaptive policy");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4922,6 +5248,13 @@ void BlueStore::_init_logger()
 		    "Sum for onode-lookups hit in the cache");
   b.add_u64_counter(l_bluestore_onode_misses, "bluestore_onode_misses",
 		    "Sum for onode-lookups missed in the cache");
+  b.add_u64_counter(l_bluestore_onode_encoded_hits,
+		    "bluestore_onode_encoded_hits",
+		    "Sum for onode-lookups served from the encoded onode cache");
+  b.add_u64(l_bluestore_encoded_onodes, "bluestore_encoded_onodes",
+	    "Number of onodes in the encoded onode cache");
+  b.add_u64(l_bluestore_encoded_onode_bytes, "bluestore_encoded_onode_bytes",
+	    "Size of the encoded onode cache", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_onode_shard_hits, "bluestore_onode_shard_hits",
 		    "Sum for onode-shard lookups hit in the cache");
   b.add_u64_counter(l_bluestore_onode_shard_misses,
@@ -4982,6 +5315,9 @@ void BlueStore::_init_logger()
                     "Read operations that required at least one retry due to failed checksum validation");
   b.add_u64(l_bluestore_fragmentation, "bluestore_fragmentation_micros",
             "How fragmented bluestore free space is (free extents / max possible number of free extents) * 1000");
+  b.add_u64_counter(l_bluestore_alloc_snapshot_loads,
+		    "bluestore_alloc_snapshot_loads",
+		    "Allocator initializations from the snapshot saved on umount");
   b.add_time_avg(l_bluestore_omap_seek_to_first_lat, "omap_seek_to_first_lat",
     "Average omap iterator seek_to_first call latency");
   b.add_time_avg(l_bluestore_omap_upper_bound_lat, "omap_upper_bound_lat",
@@ -5176,6 +5512,7 @@ void BlueStore::_set_alloc_sizes(void)
       prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_ssd;
     }
   }
+  prefer_deferred_size_base = prefer_deferred_size.load();
 
   if (cct->_conf->bluestore_deferred_batch_ops) {
     deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
@@ -5187,6 +5524,9 @@ void BlueStore::_set_alloc_sizes(void)
       deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
+  deferred_batch_ops_base = deferred_batch_ops.load();
+  logger->set(l_bluestore_deferred_policy_size, prefer_deferred_size);
+  logger->set(l_bluestore_deferred_policy_batch_ops, deferred_batch_ops);
 
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
@@ -5222,6 +5562,7 @@ int BlueStore::_open_bdev(bool create)
   block_size_order = ctz(block_size);
   ceph_assert(block_size == 1u << block_size_order);
   _set_max_defer_interval();
+  _set_prefetch();
   // and set cache_size based on device type
   r = _set_cache_sizes();
   if (r < 0) {
@@ -5396,16 +5737,23 @@ int BlueStore::_create_alloc()
     alloc_size = _zoned_piggyback_device_parameters_onto(alloc_size);
   }
 
-  shared_alloc.set(Allocator::create(cct, cct->_conf->bluestore_allocator,
+  Allocator* a = Allocator::create(cct, cct->_conf->bluestore_allocator,
     bdev->get_size(),
-    alloc_size, "block"));
+    alloc_size, "block");
 
-  if (!shared_alloc.a) {
+  if (!a) {
     lderr(cct) << __func__ << "Failed to create allocator:: "
       << cct->_conf->bluestore_allocator
       << dendl;
     return -EINVAL;
   }
+  auto magazines = cct->_conf.get_val<uint64_t>("bluestore_alloc_magazines");
+  if (magazines && !bdev->is_smr()) {
+    a = new MagazineAllocator(cct, a, magazines,
+      cct->_conf.get_val<Option::size_t>("bluestore_alloc_magazine_max_extent"),
+      cct->_conf.get_val<uint64_t>("bluestore_alloc_magazine_extents"));
+  }
+  shared_alloc.set(a);
   return 0;
 }
 
@@ -5425,14 +5773,34 @@ int BlueStore::_init_alloc()
 
   dout(1) << __func__ << " opening allocation metadata" << dendl;
   // initialize from freelist
-  fm->enumerate_reset();
-  uint64_t offset, length;
-  while (fm->enumerate_next(db, &offset, &length)) {
-    shared_alloc.a->init_add_free(offset, length);
-    ++num;
-    bytes += length;
+  size_t threads = cct->_conf.get_val<uint64_t>("bluestore_alloc_init_threads");
+  r = -EOPNOTSUPP;
+  if (cct->_conf.get_val<bool>("bluestore_alloc_snapshot")) {
+    r = _load_alloc_snapshot(&num, &bytes);
+    if (r < 0) {
+      // the freelist it is
+      num = bytes = 0;
+      r = -EOPNOTSUPP;
+    } else {
+      logger->inc(l_bluestore_alloc_snapshot_loads);
+    }
+  }
+  if (r == -EOPNOTSUPP && threads > 1) {
+    r = _init_alloc_parallel(threads, &num, &bytes);
+    if (r < 0 && r != -EOPNOTSUPP) {
+      return r;
+    }
+  }
+  if (r == -EOPNOTSUPP) {
+    fm->enumerate_reset();
+    uint64_t offset, length;
+    while (fm->enumerate_next(db, &offset, &length)) {
+      shared_alloc.a->init_add_free(offset, length);
+      ++num;
+      bytes += length;
+    }
+    fm->enumerate_reset();
   }
-  fm->enumerate_reset();
 
   dout(1) << __func__
           << " loaded " << byte_u_t(bytes) << " in " << num << " extents"
@@ -5447,6 +5815,215 @@ int BlueStore::_init_alloc()
   return 0;
 }
 
+int BlueStore::_init_alloc_parallel(size_t threads,
+                                    uint64_t *num, uint64_t *bytes)
+{
+  // Decode the freelist in parallel, a few ranges per thread, then feed the
+  // allocator in offset order from this thread, merging extents that were
+  // split at range bounds.
+  uint64_t size = fm->get_size();
+  uint64_t gran = fm->get_enumerate_granularity();
+  uint64_t step = std::max(gran, p2roundup(size / (threads * 8), gran));
+  size_t parts = div_round_up(size, step);
+  std::vector<std::vector<std::pair<uint64_t, uint64_t>>> found(parts);
+  std::atomic<size_t> next_part = {0};
+  std::atomic<int> error = {0};
+
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next_part++) < parts && error == 0) {
+      auto& v = found[i];
+      int r = fm->enumerate_range(
+        db, i * step, std::min(size, (i + 1) * step),
+        [&](uint64_t offset, uint64_t length) {
+          v.emplace_back(offset, length);
+        });
+      if (r < 0) {
+        error = r;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::min(threads, parts); ++t) {
+    workers.emplace_back(make_named_thread("bstore_alloc_ld", worker));
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  if (error) {
+    return error;
+  }
+
+  uint64_t offset = 0, length = 0;
+  for (auto& v : found) {
+    for (auto& [o, l] : v) {
+      if (length && offset + length == o) {
+        length += l;
+        continue;
+      }
+      if (length) {
+        shared_alloc.a->init_add_free(offset, length);
+        ++*num;
+        *bytes += length;
+      }
+      offset = o;
+      length = l;
+    }
+    v.clear();
+    v.shrink_to_fit();
+  }
+  if (length) {
+    shared_alloc.a->init_add_free(offset, length);
+    ++*num;
+    *bytes += length;
+  }
+  dout(10) << __func__ << " " << parts << " ranges of 0x" << std::hex << step
+           << std::dec << " with " << workers.size() << " threads" << dendl;
+  return 0;
+}
+
+/*
+ * The snapshot stands in for the freelist: the free extents according to
+ * the allocator plus whatever BlueFS holds on the shared device (which the
+ * freelist does not track; BlueFS takes it out of the allocator again when
+ * it is mounted).  It is tagged with the kv store's last sequence number
+ * as of closing it, so any later write to the db, by whoever, makes it
+ * stale.
+ */
+void BlueStore::_save_alloc_snapshot(uint64_t seq)
+{
+  ceph_assert(bluefs);
+  ceph_assert(fm);
+  ceph_assert(shared_alloc.a);
+  if (bdev->is_smr()) {
+    return;
+  }
+  // let in-flight discards and BlueFS releases land in the allocator
+  bdev->discard_drain();
+  bluefs->sync_metadata(false);
+
+  interval_set<uint64_t> free;
+  shared_alloc.a->dump([&](uint64_t offset, uint64_t length) {
+    free.insert(offset, length);
+  });
+  interval_set<uint64_t> bluefs_extents;
+  int r = bluefs->get_block_extents(bluefs_layout.shared_bdev, &bluefs_extents);
+  ceph_assert(r == 0);
+  free.union_of(bluefs_extents);
+
+  bufferlist payload;
+  for (auto [offset, length] : free) {
+    encode(offset, payload);
+    encode(length, payload);
+  }
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  encode(fsid, bl);
+  encode(seq, bl);
+  encode(fm->get_size(), bl);
+  encode(fm->get_alloc_size(), bl);
+  encode((uint64_t)free.num_intervals(), bl);
+  encode(payload.crc32c(-1), bl);
+  ENCODE_FINISH(bl);
+  bl.claim_append(payload);
+
+  if (!bluefs->dir_exists(BLUEFS_ALLOC_SNAPSHOT_DIR)) {
+    bluefs->mkdir(BLUEFS_ALLOC_SNAPSHOT_DIR);
+  }
+  BlueFS::FileWriter *h;
+  r = bluefs->open_for_write(BLUEFS_ALLOC_SNAPSHOT_DIR,
+			     BLUEFS_ALLOC_SNAPSHOT_FILE, &h, false);
+  if (r < 0) {
+    derr << __func__ << " failed to create: " << cpp_strerror(r) << dendl;
+    return;
+  }
+  h->append(bl);
+  r = bluefs->fsync(h);
+  bluefs->close_writer(h);
+  if (r < 0) {
+    derr << __func__ << " failed to write: " << cpp_strerror(r) << dendl;
+    bluefs->unlink(BLUEFS_ALLOC_SNAPSHOT_DIR, BLUEFS_ALLOC_SNAPSHOT_FILE);
+    bluefs->sync_metadata(false);
+    return;
+  }
+  dout(1) << __func__ << " saved " << free.num_intervals() << " extents, "
+	  << byte_u_t(free.size()) << " free at seq " << seq << dendl;
+}
+
+int BlueStore::_load_alloc_snapshot(uint64_t *num, uint64_t *bytes)
+{
+  if (!bluefs || bdev->is_smr()) {
+    return -ENOENT;
+  }
+  uint64_t size;
+  utime_t mtime;
+  int r = bluefs->stat(BLUEFS_ALLOC_SNAPSHOT_DIR, BLUEFS_ALLOC_SNAPSHOT_FILE,
+		       &size, &mtime);
+  if (r < 0) {
+    return r;
+  }
+  BlueFS::FileReader *h;
+  r = bluefs->open_for_read(BLUEFS_ALLOC_SNAPSHOT_DIR,
+			    BLUEFS_ALLOC_SNAPSHOT_FILE, &h);
+  if (r < 0) {
+    return r;
+  }
+  bufferlist bl;
+  int64_t got = bluefs->read(h, 0, size, &bl, nullptr);
+  delete h;
+  if (got != (int64_t)size) {
+    derr << __func__ << " short read " << got << " of " << size << dendl;
+    return -EIO;
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> extents;
+  try {
+    auto p = bl.cbegin();
+    uuid_d snap_fsid;
+    uint64_t seq, fm_size, fm_alloc_size, n;
+    uint32_t crc;
+    DECODE_START(1, p);
+    decode(snap_fsid, p);
+    decode(seq, p);
+    decode(fm_size, p);
+    decode(fm_alloc_size, p);
+    decode(n, p);
+    decode(crc, p);
+    DECODE_FINISH(p);
+    uint64_t db_seq = db->get_last_sequence();
+    if (snap_fsid != fsid || seq != db_seq ||
+	fm_size != fm->get_size() || fm_alloc_size != fm->get_alloc_size()) {
+      dout(1) << __func__ << " stale snapshot from seq " << seq
+	      << ", db is at " << db_seq << dendl;
+      return -ESTALE;
+    }
+    bufferlist payload;
+    p.copy(p.get_remaining(), payload);
+    if (payload.length() != n * 2 * sizeof(uint64_t) ||
+	payload.crc32c(-1) != crc) {
+      derr << __func__ << " corrupt snapshot" << dendl;
+      return -EIO;
+    }
+    extents.resize(n);
+    auto q = payload.cbegin();
+    for (auto& [offset, length] : extents) {
+      decode(offset, q);
+      decode(length, q);
+    }
+  } catch (ceph::buffer::error& e) {
+    derr << __func__ << " failed to decode: " << e.what() << dendl;
+    return -EIO;
+  }
+
+  for (auto& [offset, length] : extents) {
+    shared_alloc.a->init_add_free(offset, length);
+    ++*num;
+    *bytes += length;
+  }
+  dout(1) << __func__ << " loaded " << *num << " extents" << dendl;
+  return 0;
+}
+
 void BlueStore::_close_alloc()
 {
   ceph_assert(bdev);
@@ -5818,6 +6395,8 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
 {
   dout(0) << __func__ << " read-only:" << read_only
           << " repair:" << to_repair << dendl;
+  open_phases.clear();
+  auto phase_start = mono_clock::now();
   {
     string type;
     int r = read_meta("type", &type);
@@ -5851,12 +6430,14 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   r = _open_bdev(false);
   if (r < 0)
     goto out_fsid;
+  _note_open_phase("open_bdev", phase_start);
 
   // open in read-only first to read FM list and init allocator
   // as they might be needed for some BlueFS procedures
   r = _open_db(false, false, true);
   if (r < 0)
     goto out_bdev;
+  _note_open_phase("open_db", phase_start);
 
   r = _open_super_meta();
   if (r < 0) {
@@ -5866,10 +6447,12 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   r = _open_fm(nullptr, true);
   if (r < 0)
     goto out_db;
+  _note_open_phase("open_fm", phase_start);
 
   r = _init_alloc();
   if (r < 0)
     goto out_fm;
+  _note_open_phase("init_alloc", phase_start);
 
   // Re-open in the proper mode(s).
 
@@ -5883,6 +6466,7 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   if (r < 0) {
     goto out_alloc;
   }
+  _note_open_phase("reopen_db", phase_start);
   return 0;
 
 out_alloc:
@@ -6108,6 +6692,15 @@ int BlueStore::_open_db(bool create, bool to_repair_db, bool read_only)
     if (cct->_conf.get_val<bool>("bluestore_rocksdb_cf")) {
       sharding_def = cct->_conf.get_val<std::string>("bluestore_rocksdb_cfs");
     }
+
+  }
+
+  uint64_t wal_ring_size = cct->_conf.get_val<Option::size_t>(
+    "bluefs_wal_ring_size");
+  if (bluefs && wal_ring_size && !read_only) {
+    dout(1) << __func__ << " bluefs WAL ring size 0x" << std::hex
+	    << wal_ring_size << std::dec << dendl;
+    bluefs->set_wal_ring_size(wal_ring_size);
   }
 
   db->init(options);
@@ -6127,6 +6720,7 @@ int BlueStore::_open_db(bool create, bool to_repair_db, bool read_only)
     _close_db(read_only);
     return -EIO;
   }
+
   dout(1) << __func__ << " opened " << kv_backend
 	  << " path " << kv_dir_fn << " options " << options << dendl;
   return 0;
@@ -6135,9 +6729,17 @@ int BlueStore::_open_db(bool create, bool to_repair_db, bool read_only)
 void BlueStore::_close_db(bool cold_close)
 {
   ceph_assert(db);
+  uint64_t seq = 0;
+  if (save_alloc_snapshot && bluefs && !cold_close) {
+    seq = db->get_last_sequence();
+  }
   delete db;
   db = NULL;
   if (bluefs) {
+    if (seq) {
+      _save_alloc_snapshot(seq);
+    }
+    save_alloc_snapshot = false;
     _close_bluefs(cold_close);
   }
 }
@@ -7002,6 +7604,12 @@ int BlueStore::_mount()
 
   mempool_thread.init();
 
+  _fast_tier_start();
+
+  compress_pipeline.start(
+    cct->_conf.get_val<uint64_t>("bluestore_compression_threads"),
+    cct->_conf.get_val<uint64_t>("bluestore_compression_queue_max"));
+
   if ((!per_pool_stat_collection || per_pool_omap != OMAP_PER_PG) &&
     cct->_conf->bluestore_fsck_quick_fix_on_mount == true) {
 
@@ -7021,6 +7629,8 @@ int BlueStore::_mount()
     }
   }
 
+  asok_hook = SocketHook::create(this);
+
   mounted = true;
   return 0;
 
@@ -7044,8 +7654,12 @@ int BlueStore::umount()
   _osr_drain_all();
 
   mounted = false;
+  delete asok_hook;
+  asok_hook = nullptr;
   if (!_kv_only) {
     mempool_thread.shutdown();
+    _fast_tier_stop();
+    compress_pipeline.stop();
     if (bdev->is_smr()) {
       dout(20) << __func__ << " stopping zone cleaner thread" << dendl;
       _zoned_cleaner_stop();
@@ -7054,6 +7668,7 @@ int BlueStore::umount()
     _kv_stop();
     _shutdown_cache();
     dout(20) << __func__ << " closing" << dendl;
+    save_alloc_snapshot = cct->_conf.get_val<bool>("bluestore_alloc_snapshot");
 
   }
   _close_db_and_around(false);
@@ -7081,6 +7696,18 @@ int BlueStore::cold_close()
   return 0;
 }
 
+void BlueStore::dump_open_phases(Formatter *f) const
+{
+  f->open_array_section("phases");
+  for (auto& [name, lat] : open_phases) {
+    f->open_object_section("phase");
+    f->dump_string("name", name);
+    f->dump_float("seconds", std::chrono::duration<double>(lat).count());
+    f->close_section();
+  }
+  f->close_section();
+}
+
 // derr wrapper to limit enormous output and avoid log flooding.
 // Of limited use where such output is expected for now
 #define fsck_derr(err_cnt, threshold) \
@@ -7488,250 +8115,6 @@ BlueStore::OnodeRef BlueStore::fsck_check_objects_shallow(
   return o;
 }
 
-#include "common/WorkQueue.h"
-
-class ShallowFSCKThreadPool : public ThreadPool
-{
-public:
-  ShallowFSCKThreadPool(CephContext* cct_, std::string nm, std::string tn, int n) :
-    ThreadPool(cct_, nm, tn, n) {
-  }
-  void worker(ThreadPool::WorkThread* wt) override {
-    int next_wq = 0;
-    while (!_stop) {
-      next_wq %= work_queues.size();
-      WorkQueue_ *wq = work_queues[next_wq++];
-
-      void* item = wq->_void_dequeue();
-      if (item) {
-        processing++;
-        TPHandle tp_handle(cct, nullptr, wq->timeout_interval, wq->suicide_interval);
-        wq->_void_process(item, tp_handle);
-        processing--;
-      }
-    }
-  }
-  template <size_t BatchLen>
-  struct FSCKWorkQueue : public ThreadPool::WorkQueue_
-  {
-    struct Entry {
-      int64_t pool_id;
-      BlueStore::CollectionRef c;
-      ghobject_t oid;
-      string key;
-      bufferlist value;
-    };
-    struct Batch {
-      std::atomic<size_t> running = { 0 };
-      size_t entry_count = 0;
-      std::array<Entry, BatchLen> entries;
-
-      int64_t errors = 0;
-      int64_t warnings = 0;
-      uint64_t num_objects = 0;
-      uint64_t num_extents = 0;
-      uint64_t num_blobs = 0;
-      uint64_t num_sharded_objects = 0;
-      uint64_t num_spanning_blobs = 0;
-      store_statfs_t expected_store_statfs;
-      BlueStore::per_pool_statfs expected_pool_statfs;
-    };
-
-    size_t batchCount;
-    BlueStore* store = nullptr;
-
-    ceph::mutex* sb_info_lock = nullptr;
-    BlueStore::sb_info_map_t* sb_info = nullptr;
-    BlueStoreRepairer* repairer = nullptr;
-
-    Batch* batches = nullptr;
-    size_t last_batch_pos = 0;
-    bool batch_acquired = false;
-
-    FSCKWorkQueue(std::string n,
-                  size_t _batchCount,
-                  BlueStore* _store,
-                  ceph::mutex* _sb_info_lock,
-                  BlueStore::sb_info_map_t& _sb_info,
-                  BlueStoreRepairer* _repairer) :
-      WorkQueue_(n, ceph::timespan::zero(), ceph::timespan::zero()),
-      batchCount(_batchCount),
-      store(_store),
-      sb_info_lock(_sb_info_lock),
-      sb_info(&_sb_info),
-      repairer(_repairer)
-    {
-      batches = new Batch[batchCount];
-    }
-    ~FSCKWorkQueue() {
-      delete[] batches;
-    }
-
-    /// Remove all work items from the queue.
-    void _clear() override {
-      //do nothing
-    }
-    /// Check whether there is anything to do.
-    bool _empty() override {
-      ceph_assert(false);
-    }
-
-    /// Get the next work item to process.
-    void* _void_dequeue() override {
-      size_t pos = rand() % batchCount;
-      size_t pos0 = pos;
-      do {
-        auto& batch = batches[pos];
-        if (batch.running.fetch_add(1) == 0) {
-          if (batch.entry_count) {
-            return &batch;
-          }
-        }
-        batch.running--;
-        pos++;
-        pos %= batchCount;
-      } while (pos != pos0);
-      return nullptr;
-    }
-    /** @brief Process the work item.
-     * This function will be called several times in parallel
-     * and must therefore be thread-safe. */
-    void _void_process(void* item, TPHandle& handle) override {
-      Batch* batch = (Batch*)item;
-
-      BlueStore::FSCK_ObjectCtx ctx(
-        batch->errors,
-        batch->warnings,
-        batch->num_objects,
-        batch->num_extents,
-        batch->num_blobs,
-        batch->num_sharded_objects,
-        batch->num_spanning_blobs,
-        nullptr, // used_blocks
-        nullptr, //used_omap_head
-        sb_info_lock,
-        *sb_info,
-        batch->expected_store_statfs,
-        batch->expected_pool_statfs,
-        repairer);
-
-      for (size_t i = 0; i < batch->entry_count; i++) {
-        auto& entry = batch->entries[i];
-
-        store->fsck_check_objects_shallow(
-          BlueStore::FSCK_SHALLOW,
-          entry.pool_id,
-          entry.c,
-          entry.oid,
-          entry.key,
-          entry.value,
-          nullptr, // expecting_shards - this will need a protection if passed
-          nullptr, // referenced
-          ctx);
-      }
-      //std::cout << "processed " << batch << std::endl;
-      batch->entry_count = 0;
-      batch->running--;
-    }
-    /** @brief Synchronously finish processing a work item.
-     * This function is called after _void_process with the global thread pool lock held,
-     * so at most one copy will execute simultaneously for a given thread pool.
-     * It can be used for non-thread-safe finalization. */
-    void _void_process_finish(void*) override {
-      ceph_assert(false);
-    }
-
-    bool queue(
-      int64_t pool_id,
-      BlueStore::CollectionRef c,
-      const ghobject_t& oid,
-      const string& key,
-      const bufferlist& value) {
-      bool res = false;
-      size_t pos0 = last_batch_pos;
-      if (!batch_acquired) {
-        do {
-          auto& batch = batches[last_batch_pos];
-          if (batch.running.fetch_add(1) == 0) {
-            if (batch.entry_count < BatchLen) {
-              batch_acquired = true;
-              break;
-            }
-          }
-          batch.running.fetch_sub(1);
-          last_batch_pos++;
-          last_batch_pos %= batchCount;
-        } while (last_batch_pos != pos0);
-      }
-      if (batch_acquired) {
-        auto& batch = batches[last_batch_pos];
-        ceph_assert(batch.running);
-        ceph_assert(batch.entry_count < BatchLen);
-
-        auto& entry = batch.entries[batch.entry_count];
-        entry.pool_id = pool_id;
-        entry.c = c;
-        entry.oid = oid;
-        entry.key = key;
-        entry.value = value;
-
-        ++batch.entry_count;
-        if (batch.entry_count == BatchLen) {
-          batch_acquired = false;
-          batch.running.fetch_sub(1);
-          last_batch_pos++;
-          last_batch_pos %= batchCount;
-        }
-        res = true;
-      }
-      return res;
-    }
-
-    void finalize(ThreadPool& tp,
-                  BlueStore::FSCK_ObjectCtx& ctx) {
-      if (batch_acquired) {
-        auto& batch = batches[last_batch_pos];
-        ceph_assert(batch.running);
-        batch.running.fetch_sub(1);
-      }
-      tp.stop();
-
-      for (size_t i = 0; i < batchCount; i++) {
-        auto& batch = batches[i];
-
-        //process leftovers if any
-        if (batch.entry_count) {
-          TPHandle tp_handle(store->cct,
-            nullptr,
-            timeout_interval,
-            suicide_interval);
-          ceph_assert(batch.running == 0);
-
-          batch.running++; // just to be on-par with the regular call
-          _void_process(&batch, tp_handle);
-        }
-        ceph_assert(batch.entry_count == 0);
-
-        ctx.errors += batch.errors;
-        ctx.warnings += batch.warnings;
-        ctx.num_objects += batch.num_objects;
-        ctx.num_extents += batch.num_extents;
-        ctx.num_blobs += batch.num_blobs;
-        ctx.num_sharded_objects += batch.num_sharded_objects;
-        ctx.num_spanning_blobs += batch.num_spanning_blobs;
-
-        ctx.expected_store_statfs.add(batch.expected_store_statfs);
-
-        for (auto it = batch.expected_pool_statfs.begin();
-          it != batch.expected_pool_statfs.end();
-          it++) {
-          ctx.expected_pool_statfs[it->first].add(it->second);
-        }
-      }
-    }
-  };
-};
-
 void BlueStore::_fsck_check_object_omap(FSCKDepth depth,
   OnodeRef& o,
   const BlueStore::FSCK_ObjectCtx& ctx)
@@ -7814,41 +8197,161 @@ void BlueStore::_fsck_check_object_omap(FSCKDepth depth,
   }
 }
 
-void BlueStore::_fsck_check_objects(FSCKDepth depth,
+void BlueStore::_fsck_check_objects_partitioned(size_t thread_count,
   BlueStore::FSCK_ObjectCtx& ctx)
 {
-  auto& errors = ctx.errors;
-  auto sb_info_lock = ctx.sb_info_lock;
-  auto& sb_info = ctx.sb_info;
-  auto repairer = ctx.repairer;
-
-  uint64_t_btree_t used_nids;
-
-  size_t processed_myself = 0;
-
-  auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
-  mempool::bluestore_fsck::list<string> expecting_shards;
-  if (it) {
-    const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
-    typedef ShallowFSCKThreadPool::FSCKWorkQueue<256> WQ;
-    std::unique_ptr<WQ> wq(
-      new WQ(
-        "FSCKWorkQueue",
-        (thread_count ? : 1) * 32,
-        this,
-        sb_info_lock,
-        sb_info,
-        repairer));
-
-    ShallowFSCKThreadPool thread_pool(cct, "ShallowFSCKThreadPool", "ShallowFSCK", thread_count);
-
-    thread_pool.add_work_queue(wq.get());
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
-      //not the best place but let's check anyway
-      ceph_assert(sb_info_lock);
-      thread_pool.start();
+  ceph_assert(ctx.sb_info_lock);
+
+  // Split the object keyspace into a few partitions per thread and let
+  // every thread walk its partitions with an iterator of its own.  Any
+  // split is correct as the owning collection is resolved per key; using
+  // collection start keys as split points just keeps them evenly sized.
+  std::vector<string> bounds;
+  for (auto& [cid, c] : coll_map) {
+    ghobject_t temp_start, temp_end, start, end;
+    get_coll_range(cid, c->cnode.bits, &temp_start, &temp_end, &start, &end);
+    bounds.emplace_back();
+    get_object_key(cct, start, &bounds.back());
+    bounds.emplace_back();
+    get_object_key(cct, temp_start, &bounds.back());
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  size_t stride = std::max<size_t>(1, bounds.size() / (thread_count * 8));
+  std::vector<string> splits(1); // the first one starts at the very beginning
+  for (size_t i = stride; i < bounds.size(); i += stride) {
+    splits.push_back(bounds[i]);
+  }
+
+  struct part_result_t {
+    int64_t errors = 0;
+    int64_t warnings = 0;
+    uint64_t num_objects = 0;
+    uint64_t num_extents = 0;
+    uint64_t num_blobs = 0;
+    uint64_t num_sharded_objects = 0;
+    uint64_t num_spanning_blobs = 0;
+    store_statfs_t expected_store_statfs;
+    per_pool_statfs expected_pool_statfs;
+  };
+  std::vector<part_result_t> results(thread_count);
+  std::atomic<size_t> next_part = {0};
+
+  auto worker = [&](size_t t) {
+    auto& res = results[t];
+    FSCK_ObjectCtx wctx(
+      res.errors,
+      res.warnings,
+      res.num_objects,
+      res.num_extents,
+      res.num_blobs,
+      res.num_sharded_objects,
+      res.num_spanning_blobs,
+      nullptr, // used_blocks
+      nullptr, // used_omap_head
+      ctx.sb_info_lock,
+      ctx.sb_info,
+      res.expected_store_statfs,
+      res.expected_pool_statfs,
+      ctx.repairer);
+
+    auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
+    CollectionRef c;
+    int64_t pool_id = -1;
+    spg_t pgid;
+    size_t i;
+    while ((i = next_part++) < splits.size()) {
+      const string* upper = i + 1 < splits.size() ? &splits[i + 1] : nullptr;
+      for (it->lower_bound(splits[i]);
+           it->valid() && (!upper || it->key() < *upper);
+           it->next()) {
+        string key = it->key();
+        if (is_extent_shard_key(key)) {
+          continue;
+        }
+        ghobject_t oid;
+        int r = get_key_object(key, &oid);
+        if (r < 0) {
+          derr << "fsck error: bad object key "
+            << pretty_binary_string(key) << dendl;
+          ++res.errors;
+          continue;
+        }
+        if (!c ||
+          oid.shard_id != pgid.shard ||
+          oid.hobj.get_logical_pool() != (int64_t)pgid.pool() ||
+          !c->contains(oid)) {
+          c = nullptr;
+          for (auto& p : coll_map) {
+            if (p.second->contains(oid)) {
+              c = p.second;
+              break;
+            }
+          }
+          if (!c) {
+            derr << "fsck error: stray object " << oid
+              << " not owned by any collection" << dendl;
+            ++res.errors;
+            continue;
+          }
+          pool_id = c->cid.is_pg(&pgid) ? pgid.pool() : META_POOL_ID;
+        }
+        fsck_check_objects_shallow(
+          FSCK_SHALLOW,
+          pool_id,
+          c,
+          oid,
+          key,
+          it->value(),
+          nullptr, // expecting_shards
+          nullptr, // referenced
+          wctx);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back(make_named_thread("bstore_fsck", worker, t));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (auto& res : results) {
+    ctx.errors += res.errors;
+    ctx.warnings += res.warnings;
+    ctx.num_objects += res.num_objects;
+    ctx.num_extents += res.num_extents;
+    ctx.num_blobs += res.num_blobs;
+    ctx.num_sharded_objects += res.num_sharded_objects;
+    ctx.num_spanning_blobs += res.num_spanning_blobs;
+    ctx.expected_store_statfs.add(res.expected_store_statfs);
+    for (auto& [pool, st] : res.expected_pool_statfs) {
+      ctx.expected_pool_statfs[pool].add(st);
     }
+  }
+  dout(1) << __func__ << " checked " << ctx.num_objects << " objects in "
+          << splits.size() << " partitions with " << thread_count
+          << " threads" << dendl;
+}
 
+void BlueStore::_fsck_check_objects(FSCKDepth depth,
+  BlueStore::FSCK_ObjectCtx& ctx)
+{
+  auto& errors = ctx.errors;
+
+  uint64_t_btree_t used_nids;
+
+  const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
+  if (depth == FSCK_SHALLOW && thread_count > 0) {
+    _fsck_check_objects_partitioned(thread_count, ctx);
+    return;
+  }
+
+  auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
+  mempool::bluestore_fsck::list<string> expecting_shards;
+  if (it) {
     //fill global if not overriden below
     CollectionRef c;
     int64_t pool_id = -1;
@@ -7940,32 +8443,17 @@ void BlueStore::_fsck_check_objects(FSCKDepth depth,
         expecting_shards.clear();
       }
 
-      bool queued = false;
-      if (depth == FSCK_SHALLOW && thread_count > 0) {
-        queued = wq->queue(
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value());
-      }
-      OnodeRef o;
       map<BlobRef, bluestore_blob_t::unused_t> referenced;
-
-      if (!queued) {
-        ++processed_myself;
-
-         o = fsck_check_objects_shallow(
-          depth,
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value(),
-          &expecting_shards,
-          &referenced,
-          ctx);
-      }
+      OnodeRef o = fsck_check_objects_shallow(
+        depth,
+        pool_id,
+        c,
+        oid,
+        it->key(),
+        it->value(),
+        &expecting_shards,
+        &referenced,
+        ctx);
 
       if (depth != FSCK_SHALLOW) {
         ceph_assert(o != nullptr);
@@ -8056,17 +8544,6 @@ void BlueStore::_fsck_check_objects(FSCKDepth depth,
         } // deep
       } //if (depth != FSCK_SHALLOW)
     } // for (it->lower_bound(string()); it->valid(); it->next())
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
-      wq->finalize(thread_pool, ctx);
-      if (processed_myself) {
-        // may be needs more threads?
-        dout(0) << __func__ << " partial offload"
-                << ", done myself " << processed_myself
-                << " of " << ctx.num_objects
-                << "objects, threads " << thread_count
-                << dendl;
-      }
-    }
   } // if (it)
 }
 /**
@@ -8119,6 +8596,7 @@ int BlueStore::_fsck(BlueStore::FSCKDepth depth, bool repair)
   int r = _open_db_and_around(read_only);
   if (r < 0)
     return r;
+  auto phase_start = mono_clock::now();
 
   if (!read_only) {
     r = _upgrade_super();
@@ -8130,6 +8608,7 @@ int BlueStore::_fsck(BlueStore::FSCKDepth depth, bool repair)
   r = _open_collections();
   if (r < 0)
     goto out_db;
+  _note_open_phase("open_collections", phase_start);
 
   mempool_thread.init();
 
@@ -8144,6 +8623,7 @@ int BlueStore::_fsck(BlueStore::FSCKDepth depth, bool repair)
     goto out_scan;
 
   r = _fsck_on_open(depth, repair);
+  _note_open_phase("fsck", phase_start);
 
 out_scan:
   mempool_thread.shutdown();
@@ -8291,7 +8771,9 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
       expected_pool_statfs,
       repair ? &repairer : nullptr);
 
+    auto objects_start = mono_clock::now();
     _fsck_check_objects(depth, ctx);
+    _note_open_phase("fsck_objects", objects_start);
   }
 
   dout(1) << __func__ << " checking shared_blobs" << dendl;
@@ -8905,6 +9387,35 @@ void BlueStore::inject_false_free(coll_t cid, ghobject_t oid)
   db->submit_transaction_sync(txn);
 }
 
+void BlueStore::inject_bad_csum(coll_t cid, ghobject_t oid, uint64_t offset)
+{
+  OnodeRef o;
+  CollectionRef c = _get_collection(cid);
+  ceph_assert(c);
+  std::unique_lock l{c->lock}; // just to avoid internal asserts
+  o = c->get_onode(oid, false);
+  ceph_assert(o);
+  o->extent_map.fault_range(db, offset, 1);
+
+  auto ep = o->extent_map.seek_lextent(offset);
+  ceph_assert(ep != o->extent_map.extent_map.end());
+  ceph_assert(ep->logical_offset <= offset);
+  const bluestore_blob_t& blob = ep->blob->get_blob();
+  ceph_assert(blob.has_csum());
+  uint64_t chunk = blob.get_csum_chunk_size();
+  uint64_t b_off = p2align(ep->blob_offset + offset - ep->logical_offset,
+			   chunk);
+  blob.map(b_off, chunk, [&](uint64_t p_off, uint64_t p_len) {
+    dout(20) << __func__ << " overwrite 0x" << std::hex << p_off
+	     << "~" << p_len << std::dec << dendl;
+    bufferlist bl;
+    bl.append_zero(p_len);
+    int r = bdev->write(p_off, bl, false);
+    ceph_assert(r == 0);
+    return 0;
+  });
+}
+
 void BlueStore::inject_legacy_omap()
 {
   dout(1) << __func__ << dendl;
@@ -9077,8 +9588,8 @@ int BlueStore::get_numa_node(
   set<string> failed;
   for (auto& devname : devices) {
     int n;
-    BlkDev bdev(devname);
-    int r = bdev.get_numa_node(&n);
+    BlkDev blkdev(devname);
+    int r = blkdev.get_numa_node(&n);
     if (r < 0) {
       dout(10) << __func__ << " bdev " << devname << " can't detect numa_node"
 	       << dendl;
@@ -9104,6 +9615,76 @@ int BlueStore::get_numa_node(
   return 0;
 }
 
+void BlueStore::dump_deferred_policy(Formatter *f)
+{
+  std::lock_guard l(deferred_policy_lock);
+  f->open_object_section("deferred_policy");
+  f->dump_bool("adaptive", deferred_adaptive);
+  f->dump_unsigned("prefer_deferred_size", prefer_deferred_size);
+  f->dump_unsigned("prefer_deferred_size_configured",
+		   prefer_deferred_size_base);
+  f->dump_int("deferred_batch_ops", deferred_batch_ops);
+  f->dump_int("deferred_batch_ops_configured", deferred_batch_ops_base);
+  f->dump_unsigned("deferred_aio_latency_ns", deferred_policy.aio_lat_ns);
+  f->dump_unsigned("kv_sync_latency_ns", deferred_policy.kv_lat_ns);
+  f->dump_unsigned("compaction_debt_bytes", deferred_policy.compaction_debt);
+  f->dump_bool("device_busy", deferred_policy.device_busy);
+  f->dump_bool("kv_busy", deferred_policy.kv_busy);
+  f->close_section();
+}
+
+void BlueStore::dump_numa_placement(Formatter *f)
+{
+  f->open_object_section("numa_placement");
+  f->open_array_section("devices");
+  set<string> devices;
+  get_devices(&devices);
+  for (auto& devname : devices) {
+    f->open_object_section("device");
+    f->dump_string("name", devname);
+    int n = -1;
+    BlkDev blkdev(devname);
+    blkdev.get_numa_node(&n);
+    f->dump_int("numa_node", n);
+    f->close_section();
+  }
+  f->close_section();
+
+  f->open_object_section("kv_threads");
+  f->dump_int("numa_node", kv_numa_node);
+  if (kv_numa_node >= 0) {
+    size_t cpu_set_size;
+    cpu_set_t cpu_set;
+    if (get_numa_node_cpu_set(kv_numa_node, &cpu_set_size, &cpu_set) == 0) {
+      f->dump_string("cpus", cpu_set_to_str_list(cpu_set_size, &cpu_set));
+    }
+  }
+  f->close_section();
+
+  // cache shards are sized by set_cache_shards() to the number of osd op
+  // shards; collection cid.hash_to_shard() picks the same index the osd
+  // uses for its pg, so cache shard N is only touched by op shard N
+  f->open_array_section("cache_shards");
+  for (size_t i = 0; i < onode_cache_shards.size(); ++i) {
+    uint64_t onodes = 0, pinned_onodes = 0;
+    uint64_t extents = 0, blobs = 0, buffers = 0, buffer_bytes = 0;
+    onode_cache_shards[i]->add_stats(&onodes, &pinned_onodes);
+    if (i < buffer_cache_shards.size()) {
+      buffer_cache_shards[i]->add_stats(&extents, &blobs, &buffers,
+					&buffer_bytes);
+    }
+    f->open_object_section("shard");
+    f->dump_unsigned("shard", i);
+    f->dump_unsigned("onodes", onodes);
+    f->dump_unsigned("pinned_onodes", pinned_onodes);
+    f->dump_unsigned("buffers", buffers);
+    f->dump_unsigned("buffer_bytes", buffer_bytes);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
 int BlueStore::get_devices(set<string> *ls)
 {
   if (bdev) {
@@ -9333,8 +9914,11 @@ void BlueStore::_update_cache_logger()
   uint64_t num_blobs = 0;
   uint64_t num_buffers = 0;
   uint64_t num_buffer_bytes = 0;
+  uint64_t num_encoded_onodes = 0;
+  uint64_t num_encoded_bytes = 0;
   for (auto c : onode_cache_shards) {
     c->add_stats(&num_onodes, &num_pinned_onodes);
+    c->add_encoded_stats(&num_encoded_onodes, &num_encoded_bytes);
   }
   for (auto c : buffer_cache_shards) {
     c->add_stats(&num_extents, &num_blobs,
@@ -9342,6 +9926,8 @@ void BlueStore::_update_cache_logger()
   }
   logger->set(l_bluestore_onodes, num_onodes);
   logger->set(l_bluestore_pinned_onodes, num_pinned_onodes);
+  logger->set(l_bluestore_encoded_onodes, num_encoded_onodes);
+  logger->set(l_bluestore_encoded_onode_bytes, num_encoded_bytes);
   logger->set(l_bluestore_extents, num_extents);
   logger->set(l_bluestore_blobs, num_blobs);
   logger->set(l_bluestore_buffers, num_buffers);
@@ -9608,8 +10194,69 @@ void BlueStore::_read_cache(
 int BlueStore::_prepare_read_ioc(
   blobs2read_t& blobs2read,
   vector<bufferlist>* compressed_blob_bls,
-  IOContext* ioc)
-{
+  IOContext* ioc,
+  std::vector<FastTier::read_t>* tier_reads,
+  bool coalesce)
+{
+  // When coalescing, physically adjacent extents (possibly belonging to
+  // different blobs) are issued as a single aio and the result is then
+  // split up between their owners; the pieces share the same raw buffer,
+  // so this can be done before the io completes.
+  uint64_t c_off = 0, c_len = 0;
+  std::vector<std::pair<bufferlist*, uint64_t>> c_dst;
+  auto flush = [&]() {
+    if (c_len == 0) {
+      return 0;
+    }
+    bufferlist whole;
+    int r = bdev->aio_read(c_off, c_len, &whole, ioc);
+    if (r < 0) {
+      return r;
+    }
+    dout(30) << __func__ << " coalesced 0x" << std::hex << c_off << "~"
+             << c_len << std::dec << " for " << c_dst.size() << " extents"
+             << dendl;
+    uint64_t pos = 0;
+    for (auto& [dst, len] : c_dst) {
+      bufferlist t;
+      t.substr_of(whole, pos, len);
+      dst->claim_append(t);
+      pos += len;
+    }
+    c_len = 0;
+    c_dst.clear();
+    return 0;
+  };
+  auto read = [&](uint64_t offset, uint64_t length, bufferlist* dst) {
+    FastTier::read_t tr;
+    if (fast_tier && fast_tier->lookup(offset, length, &tr)) {
+      // anything queued for dst has to land in front of this, and go
+      // to the main device before the tier read goes to the fast one
+      int r = flush();
+      if (r < 0) {
+        return r;
+      }
+      bdev->aio_submit(ioc);
+      if (fast_tier->submit_read(&tr, dst, ioc) == 0) {
+        tier_reads->push_back(std::move(tr));
+        return 0;
+      }
+    }
+    if (!coalesce) {
+      return bdev->aio_read(offset, length, dst, ioc);
+    }
+    if (c_len == 0 || c_off + c_len != offset) {
+      int r = flush();
+      if (r < 0) {
+        return r;
+      }
+      c_off = offset;
+    }
+    c_len += length;
+    c_dst.emplace_back(dst, length);
+    return 0;
+  };
+
   for (auto& p : blobs2read) {
     const BlobRef& bptr = p.first;
     regions2read_t& r2r = p.second;
@@ -9626,7 +10273,7 @@ int BlueStore::_prepare_read_ioc(
       auto r = bptr->get_blob().map(
         0, bptr->get_blob().get_ondisk_length(),
         [&](uint64_t offset, uint64_t length) {
-          int r = bdev->aio_read(offset, length, &bl, ioc);
+          int r = read(offset, length, &bl);
           if (r < 0)
             return r;
           return 0;
@@ -9653,7 +10300,7 @@ int BlueStore::_prepare_read_ioc(
         auto r = bptr->get_blob().map(
           req.r_off, req.r_len,
           [&](uint64_t offset, uint64_t length) {
-            int r = bdev->aio_read(offset, length, &req.bl, ioc);
+            int r = read(offset, length, &req.bl);
             if (r < 0)
               return r;
             return 0;
@@ -9667,13 +10314,76 @@ int BlueStore::_prepare_read_ioc(
           }
           ceph_assert(r == 0);
         }
-        ceph_assert(req.bl.length() == req.r_len);
+        ceph_assert(coalesce || req.bl.length() == req.r_len);
       }
     }
   }
+  if (coalesce) {
+    int r = flush();
+    if (r < 0) {
+      derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+      if (r == -EIO) {
+        return r;
+      }
+      ceph_assert(r == 0);
+    }
+  }
   return 0;
 }
 
+int BlueStore::_finish_tier_reads(std::vector<FastTier::read_t>& tier_reads)
+{
+  for (auto& tr : tier_reads) {
+    int r = fast_tier->finish_read(tr);
+    if (r < 0) {
+      derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  return 0;
+}
+
+uint64_t BlueStore::_note_sequential_read(
+  Onode *o,
+  uint64_t offset,
+  uint64_t length)
+{
+  uint64_t end = offset + length;
+  uint64_t pf_end = o->prefetch_end;
+  uint64_t expected = o->seq_read_next.exchange(end);
+  uint32_t count;
+  if (offset == expected) {
+    count = ++o->seq_read_count;
+    if (pf_end > offset) {
+      logger->inc(l_bluestore_read_prefetch_hit_bytes,
+                  std::min(end, pf_end) - offset);
+    }
+  } else {
+    if (pf_end > expected) {
+      logger->inc(l_bluestore_read_prefetch_waste_bytes, pf_end - expected);
+    }
+    o->seq_read_count = count = 0;
+    o->prefetch_end = pf_end = 0;
+  }
+  if (count < prefetch_trigger || end >= o->onode.size) {
+    return 0;
+  }
+  // keep up to prefetch_max_bytes ahead of the reader; top the window up
+  // only once half of it has been consumed so that we issue few, large ios
+  uint64_t want = std::min<uint64_t>(end + prefetch_max_bytes, o->onode.size);
+  if (pf_end > end && pf_end - end >= prefetch_max_bytes / 2) {
+    return 0;
+  }
+  if (want <= pf_end) {
+    return 0;
+  }
+  logger->inc(l_bluestore_read_prefetch_bytes, want - std::max(end, pf_end));
+  o->prefetch_end = want;
+  dout(20) << __func__ << " " << o->oid << " sequential read #" << count
+           << ", prefetch to 0x" << std::hex << want << std::dec << dendl;
+  return want - end;
+}
+
 int BlueStore::_generate_read_result_bl(
   OnodeRef o,
   uint64_t offset,
@@ -9682,9 +10392,24 @@ int BlueStore::_generate_read_result_bl(
   vector<bufferlist>& compressed_blob_bls,
   blobs2read_t& blobs2read,
   bool buffered,
+  uint64_t prefetch_offset,
   bool* csum_error,
   bufferlist& bl)
 {
+  // a blob read only for the prefetch (all of it at or past
+  // prefetch_offset) that fails its checksum is left out rather than
+  // failing the read: nobody asked for it yet
+  auto prefetched_only = [&](const regions2read_t& r2r) {
+    for (auto& req : r2r) {
+      for (auto& r : req.regs) {
+        if (r.logical_offset < prefetch_offset) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+
  // enumerate and decompress desired blobs
   auto p = compressed_blob_bls.begin();
   blobs2read_t::iterator b2r_it = blobs2read.begin();
@@ -9698,6 +10423,12 @@ int BlueStore::_generate_read_result_bl(
       bufferlist& compressed_bl = *p++;
       if (_verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
                        r2r.front().regs.front().logical_offset) < 0) {
+        if (prefetched_only(r2r)) {
+          dout(10) << __func__ << " dropping prefetched blob " << *bptr
+                   << dendl;
+          ++b2r_it;
+          continue;
+        }
         *csum_error = true;
         return -EIO;
       }
@@ -9716,12 +10447,17 @@ int BlueStore::_generate_read_result_bl(
         }
       }
     } else {
-      for (auto& req : r2r) {
-        if (_verify_csum(o, &bptr->get_blob(), req.r_off, req.bl,
-                         req.regs.front().logical_offset) < 0) {
-          *csum_error = true;
-          return -EIO;
+      if (_verify_csum(o, &bptr->get_blob(), r2r) < 0) {
+        if (prefetched_only(r2r)) {
+          dout(10) << __func__ << " dropping prefetched blob " << *bptr
+                   << dendl;
+          ++b2r_it;
+          continue;
         }
+        *csum_error = true;
+        return -EIO;
+      }
+      for (auto& req : r2r) {
         if (buffered) {
           bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(),
                                          req.r_off, req.bl);
@@ -9806,14 +10542,6 @@ int BlueStore::_do_read(
     length = o->onode.size - offset;
   }
 
-  auto start = mono_clock::now();
-  o->extent_map.fault_range(db, offset, length);
-  log_latency(__func__,
-    l_bluestore_read_onode_meta_lat,
-    mono_clock::now() - start,
-    cct->_conf->bluestore_log_op_age);
-  _dump_onode<30>(cct, *o);
-
   // for deep-scrub, we only read dirty cache and bypass clean cache in
   // order to read underlying block device in case there are silent disk errors.
   if (op_flags & CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE) {
@@ -9821,10 +10549,36 @@ int BlueStore::_do_read(
     read_cache_policy = BufferSpace::BYPASS_CLEAN_CACHE;
   }
 
+  // for sequential readers pull in the extents that follow as part of the
+  // same ios and leave them in the buffer cache for the next call.
+  // A prefetched-only blob with a bad checksum is just dropped; one that
+  // holds requested data too fails the read, and the retry goes without
+  // prefetch so that only the requested range is checked again.
+  uint64_t prefetch = 0;
+  if (prefetch_trigger && prefetch_max_bytes && retry_count == 0 &&
+      read_cache_policy == 0 &&
+      (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+                   CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
+    prefetch = _note_sequential_read(o.get(), offset, length);
+    if (prefetch) {
+      buffered = true;
+    }
+  }
+  uint64_t read_length = length + prefetch;
+
+  auto start = mono_clock::now();
+  o->extent_map.fault_range(db, offset, read_length);
+  log_latency(__func__,
+    l_bluestore_read_onode_meta_lat,
+    mono_clock::now() - start,
+    cct->_conf->bluestore_log_op_age);
+  _dump_onode<30>(cct, *o);
+
   // build blob-wise list to of stuff read (that isn't cached)
   ready_regions_t ready_regions;
   blobs2read_t blobs2read;
-  _read_cache(o, offset, length, read_cache_policy, ready_regions, blobs2read);
+  _read_cache(o, offset, read_length, read_cache_policy, ready_regions,
+              blobs2read);
 
 
   // read raw blob data.
@@ -9832,15 +10586,20 @@ int BlueStore::_do_read(
                              // measure the whole block below.
                              // The error isn't that much...
   vector<bufferlist> compressed_blob_bls;
+  std::vector<FastTier::read_t> tier_reads;
   IOContext ioc(cct, NULL, true); // allow EIO
-  r = _prepare_read_ioc(blobs2read, &compressed_blob_bls, &ioc);
+  r = _prepare_read_ioc(blobs2read, &compressed_blob_bls, &ioc, &tier_reads,
+                        prefetch > 0);
   // we always issue aio for reading, so errors other than EIO are not allowed
-  if (r < 0)
+  if (r < 0) {
+    // some ios may be out already, ahead of reads from the fast tier
+    ioc.aio_wait();
     return r;
+  }
 
   int64_t num_ios = blobs2read.size();
-  if (ioc.has_pending_aios()) {
-    num_ios = ioc.get_num_ios();
+  if (ioc.has_pending_aios() || !tier_reads.empty()) {
+    num_ios = ioc.get_num_ios() + tier_reads.size();
     bdev->aio_submit(&ioc);
     dout(20) << __func__ << " waiting for aio" << dendl;
     ioc.aio_wait();
@@ -9849,6 +10608,10 @@ int BlueStore::_do_read(
       ceph_assert(r == -EIO); // no other errors allowed
       return -EIO;
     }
+    r = _finish_tier_reads(tier_reads);
+    if (r < 0) {
+      return -EIO;
+    }
   }
   log_latency_fn(__func__,
     l_bluestore_read_wait_aio_lat,
@@ -9858,9 +10621,14 @@ int BlueStore::_do_read(
   );
 
   bool csum_error = false;
-  r = _generate_read_result_bl(o, offset, length, ready_regions,
+  r = _generate_read_result_bl(o, offset, read_length, ready_regions,
                               compressed_blob_bls, blobs2read,
-                              buffered, &csum_error, bl);
+                              buffered, offset + length, &csum_error, bl);
+  if (prefetch && !csum_error) {
+    bufferlist head;
+    head.substr_of(bl, 0, length);
+    bl.swap(head);
+  }
   if (csum_error) {
     // Handles spurious read errors caused by a kernel bug.
     // We sometimes get all-zero pages as a result of the read under
@@ -9888,10 +10656,50 @@ int BlueStore::_verify_csum(OnodeRef& o,
 			    const bluestore_blob_t* blob, uint64_t blob_xoffset,
 			    const bufferlist& bl,
 			    uint64_t logical_offset) const
+{
+  auto start = mono_clock::now();
+  int r = _verify_csum_extent(o, blob, blob_xoffset, bl, logical_offset);
+  log_latency(__func__,
+    l_bluestore_csum_lat,
+    mono_clock::now() - start,
+    cct->_conf->bluestore_log_op_age);
+  if (cct->_conf->bluestore_ignore_data_csum) {
+    return 0;
+  }
+  return r;
+}
+
+int BlueStore::_verify_csum(OnodeRef& o,
+			    const bluestore_blob_t* blob,
+			    const regions2read_t& r2r) const
+{
+  auto start = mono_clock::now();
+  int r = 0;
+  for (auto& req : r2r) {
+    r = _verify_csum_extent(o, blob, req.r_off, req.bl,
+			    req.regs.front().logical_offset);
+    if (r < 0) {
+      break;
+    }
+  }
+  log_latency(__func__,
+    l_bluestore_csum_lat,
+    mono_clock::now() - start,
+    cct->_conf->bluestore_log_op_age);
+  if (cct->_conf->bluestore_ignore_data_csum) {
+    return 0;
+  }
+  return r;
+}
+
+int BlueStore::_verify_csum_extent(OnodeRef& o,
+				   const bluestore_blob_t* blob,
+				   uint64_t blob_xoffset,
+				   const bufferlist& bl,
+				   uint64_t logical_offset) const
 {
   int bad;
   uint64_t bad_csum;
-  auto start = mono_clock::now();
   int r = blob->verify_csum(blob_xoffset, bl, &bad, &bad_csum);
   if (cct->_conf->bluestore_debug_inject_csum_err_probability > 0 &&
       (rand() % 10000) < cct->_conf->bluestore_debug_inject_csum_err_probability * 10000.0) {
@@ -9926,13 +10734,6 @@ int BlueStore::_verify_csum(OnodeRef& o,
       derr << __func__ << " failed with exit code: " << cpp_strerror(r) << dendl;
     }
   }
-  log_latency(__func__,
-    l_bluestore_csum_lat,
-    mono_clock::now() - start,
-    cct->_conf->bluestore_log_op_age);
-  if (cct->_conf->bluestore_ignore_data_csum) {
-    return 0;
-  }
   return r;
 }
 
@@ -10179,6 +10980,7 @@ int BlueStore::_do_readv(
   _dump_onode<30>(cct, *o);
 
   IOContext ioc(cct, NULL, true); // allow EIO
+  std::vector<FastTier::read_t> tier_reads;
   vector<std::tuple<ready_regions_t, vector<bufferlist>, blobs2read_t>> raw_results;
   raw_results.reserve(m.num_intervals());
   int i = 0;
@@ -10186,15 +10988,19 @@ int BlueStore::_do_readv(
     raw_results.push_back({});
     _read_cache(o, p.get_start(), p.get_len(), read_cache_policy,
                 std::get<0>(raw_results[i]), std::get<2>(raw_results[i]));
-    r = _prepare_read_ioc(std::get<2>(raw_results[i]), &std::get<1>(raw_results[i]), &ioc);
+    r = _prepare_read_ioc(std::get<2>(raw_results[i]), &std::get<1>(raw_results[i]), &ioc,
+                          &tier_reads);
     // we always issue aio for reading, so errors other than EIO are not allowed
-    if (r < 0)
+    if (r < 0) {
+      // some ios may be out already, ahead of reads from the fast tier
+      ioc.aio_wait();
       return r;
+    }
   }
 
   auto num_ios = m.size();
-  if (ioc.has_pending_aios()) {
-    num_ios = ioc.get_num_ios();
+  if (ioc.has_pending_aios() || !tier_reads.empty()) {
+    num_ios = ioc.get_num_ios() + tier_reads.size();
     bdev->aio_submit(&ioc);
     dout(20) << __func__ << " waiting for aio" << dendl;
     ioc.aio_wait();
@@ -10203,6 +11009,10 @@ int BlueStore::_do_readv(
       ceph_assert(r == -EIO); // no other errors allowed
       return -EIO;
     }
+    r = _finish_tier_reads(tier_reads);
+    if (r < 0) {
+      return -EIO;
+    }
   }
   log_latency_fn(__func__,
     l_bluestore_read_wait_aio_lat,
@@ -10220,7 +11030,7 @@ int BlueStore::_do_readv(
                                  std::get<0>(raw_results[i]),
                                  std::get<1>(raw_results[i]),
                                  std::get<2>(raw_results[i]),
-                                 buffered, &csum_error, t);
+                                 buffered, p.get_end(), &csum_error, t);
     if (csum_error) {
       // Handles spurious read errors caused by a kernel bug.
       // We sometimes get all-zero pages as a result of the read under
@@ -10761,15 +11571,18 @@ int BlueStore::omap_get_values(
     const string& prefix = o->get_omap_prefix();
     o->get_omap_key(string(), &final_key);
     size_t base_key_len = final_key.size();
+    set<string> final_keys;
     for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
       final_key.resize(base_key_len); // keep prefix
       final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-	out->insert(make_pair(*p, val));
-      }
+      final_keys.emplace_hint(final_keys.end(), final_key);
+    }
+    map<string, bufferlist> vals;
+    db->get(prefix, final_keys, &vals);
+    for (auto& [k, val] : vals) {
+      dout(30) << __func__ << "  got " << pretty_binary_string(k)
+	       << " -> " << k.substr(base_key_len) << dendl;
+      out->emplace(k.substr(base_key_len), std::move(val));
     }
   }
  out:
@@ -10853,17 +11666,22 @@ int BlueStore::omap_check_keys(
     const string& prefix = o->get_omap_prefix();
     o->get_omap_key(string(), &final_key);
     size_t base_key_len = final_key.size();
+    set<string> final_keys;
     for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
       final_key.resize(base_key_len); // keep prefix
       final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  have " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-	out->insert(*p);
+      final_keys.emplace_hint(final_keys.end(), final_key);
+    }
+    map<string, bufferlist> vals;
+    db->get(prefix, final_keys, &vals);
+    for (auto& k : final_keys) {
+      if (vals.count(k)) {
+	dout(30) << __func__ << "  have " << pretty_binary_string(k)
+		 << " -> " << k.substr(base_key_len) << dendl;
+	out->insert(k.substr(base_key_len));
       } else {
-	dout(30) << __func__ << "  miss " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
+	dout(30) << __func__ << "  miss " << pretty_binary_string(k)
+		 << " -> " << k.substr(base_key_len) << dendl;
       }
     }
   }
@@ -11038,6 +11856,7 @@ int BlueStore::_open_super_meta()
 
   _open_statfs();
   _set_alloc_sizes();
+  _set_deferred_adaptive();
   _set_throttle_params();
 
   _set_csum();
@@ -11232,6 +12051,10 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 		  << dendl;
 	}
       }
+      if (fast_tier && !txc->tier_written.empty()) {
+	// the mover may have copied these while the writes were in flight
+	fast_tier->invalidate(txc->tier_written);
+      }
 
       _txc_finish_io(txc);  // may trigger blocked txc's too
       return;
@@ -11271,9 +12094,12 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       {
 	std::lock_guard l(kv_lock);
 	kv_queue.push_back(txc);
+	--kv_txc_preparing;
 	if (!kv_sync_in_progress) {
 	  kv_sync_in_progress = true;
 	  kv_cond.notify_one();
+	} else if (kv_sync_batching) {
+	  kv_cond.notify_one();
 	}
 	if (txc->get_state() != TransContext::STATE_KV_SUBMITTED) {
 	  kv_queue_unsubmitted.push_back(txc);
@@ -11693,6 +12519,9 @@ void BlueStore::_txc_finish(TransContext *txc)
 void BlueStore::_txc_release_alloc(TransContext *txc)
 {
   // it's expected we're called with lazy_release_lock already taken!
+  if (fast_tier) {
+    fast_tier->invalidate(txc->released);
+  }
   if (likely(!cct->_conf->bluestore_debug_no_reuse_blocks)) {
     int r = 0;
     if (cct->_conf->bdev_enable_discard && cct->_conf->bdev_async_discard) {
@@ -11875,6 +12704,44 @@ void BlueStore::_kv_start()
   finisher.start();
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
+  _kv_set_numa_affinity();
+}
+
+void BlueStore::_kv_set_numa_affinity()
+{
+  kv_numa_node = -1;
+  int node = cct->_conf.get_val<int64_t>("bluestore_kv_numa_node");
+  if (node < 0) {
+    if (!cct->_conf.get_val<bool>("bluestore_kv_numa_auto_affinity")) {
+      return;
+    }
+    get_numa_node(&node, nullptr, nullptr);
+    if (node < 0) {
+      dout(1) << __func__ << " devices are not on a single numa node,"
+	      << " not binding kv threads" << dendl;
+      return;
+    }
+  }
+  size_t cpu_set_size;
+  cpu_set_t cpu_set;
+  int r = get_numa_node_cpu_set(node, &cpu_set_size, &cpu_set);
+  if (r < 0) {
+    derr << __func__ << " unable to determine numa node " << node
+	 << " cpus: " << cpp_strerror(r) << dendl;
+    return;
+  }
+  for (Thread *t : {static_cast<Thread*>(&kv_sync_thread),
+		    static_cast<Thread*>(&kv_finalize_thread)}) {
+    r = set_cpu_affinity_thread(t->get_thread_id(), cpu_set_size, &cpu_set);
+    if (r < 0) {
+      derr << __func__ << " failed to bind kv thread to numa node " << node
+	   << ": " << cpp_strerror(r) << dendl;
+      return;
+    }
+  }
+  kv_numa_node = node;
+  dout(1) << __func__ << " kv threads bound to numa node " << node
+	  << " cpus " << cpu_set_to_str_list(cpu_set_size, &cpu_set) << dendl;
 }
 
 void BlueStore::_kv_stop()
@@ -11958,6 +12825,8 @@ void BlueStore::_kv_sync_thread()
       deque<DeferredBatch*> deferred_done, deferred_stable;
       uint64_t aios = 0, costs = 0;
 
+      _kv_sync_group_wait(l);
+
       dout(20) << __func__ << " committing " << kv_queue.size()
 	       << " submitting " << kv_queue_unsubmitted.size()
 	       << " deferred done " << deferred_done_queue.size()
@@ -12168,6 +13037,7 @@ void BlueStore::_kv_sync_thread()
 	  l_bluestore_kv_sync_lat,
 	  dur,
 	  cct->_conf->bluestore_log_op_age);
+	logger->inc(l_bluestore_kv_sync_batch, committing_size);
       }
 
       l.lock();
@@ -12180,6 +13050,69 @@ void BlueStore::_kv_sync_thread()
   kv_sync_started = false;
 }
 
+// Group commit: give the current kv batch a chance to grow before we
+// flush and sync it.  We only wait while the batch is below
+// bluestore_kv_sync_min_batch, more txcs are still being prepared by the
+// OpSequencers, and the time spent so far plus the recent kv sync
+// latency stays below bluestore_kv_sync_target_latency.
+ceph::timespan BlueStore::kv_sync_group_wait_time(double target,
+						  uint64_t min_batch,
+						  size_t queued,
+						  int preparing,
+						  ceph::timespan expected)
+{
+  if (target <= 0 || min_batch <= 1 || queued >= min_batch ||
+      preparing <= 0) {
+    return ceph::timespan::zero();
+  }
+  auto budget = ceph::make_timespan(target);
+  if (expected >= budget) {
+    return ceph::timespan::zero();
+  }
+  return budget - expected;
+}
+
+void BlueStore::_kv_sync_group_wait(std::unique_lock<ceph::mutex>& l)
+{
+  double target = cct->_conf.get_val<double>(
+    "bluestore_kv_sync_target_latency");
+  uint64_t min_batch = cct->_conf.get_val<uint64_t>(
+    "bluestore_kv_sync_min_batch");
+  if (target <= 0 || min_batch <= 1 ||
+      kv_queue.size() >= min_batch ||
+      kv_stop || deferred_aggressive) {
+    return;
+  }
+  perf_tracker.kv_sync_latency_ns.consume_next(
+    logger->get_tavg_ns(l_bluestore_kv_sync_lat));
+  auto expected = std::chrono::nanoseconds(
+    perf_tracker.kv_sync_latency_ns.current_avg());
+  auto wait = kv_sync_group_wait_time(target, min_batch, kv_queue.size(),
+				      kv_txc_preparing, expected);
+  if (wait == ceph::timespan::zero()) {
+    dout(20) << __func__ << " batch " << kv_queue.size()
+	     << " preparing " << kv_txc_preparing.load()
+	     << " recent kv sync latency " << expected
+	     << ", not waiting" << dendl;
+    return;
+  }
+  auto start = mono_clock::now();
+  auto deadline = start + wait;
+  kv_sync_batching = true;
+  while (kv_queue.size() < min_batch &&
+	 kv_txc_preparing > 0 &&
+	 !kv_stop &&
+	 !deferred_aggressive &&
+	 mono_clock::now() < deadline) {
+    kv_cond.wait_until(l, deadline);
+  }
+  kv_sync_batching = false;
+  auto waited = mono_clock::now() - start;
+  logger->tinc(l_bluestore_kv_group_wait_lat, waited);
+  dout(20) << __func__ << " waited " << waited << " for batch of "
+	   << kv_queue.size() << dendl;
+}
+
 void BlueStore::_kv_finalize_thread()
 {
   deque<TransContext*> kv_committed;
@@ -12227,6 +13160,7 @@ void BlueStore::_kv_finalize_thread()
       }
       deferred_stable.clear();
 
+      _deferred_policy_update();
       if (!deferred_aggressive) {
 	if (deferred_queue_size >= deferred_batch_ops.load() ||
 	    throttle.should_submit_deferred()) {
@@ -12252,6 +13186,215 @@ void BlueStore::_kv_finalize_thread()
   kv_finalize_started = false;
 }
 
+// Adaptive deferred policy.  The configured prefer_deferred_size and
+// deferred_batch_ops are the upper and lower bounds the policy works
+// from:
+//  - while the kv store is slow to commit or behind on compaction, every
+//    deferred byte written to its WAL makes that worse, so the size
+//    threshold is halved (down to min_alloc_size) and otherwise grows
+//    back by a quarter of the configured value per interval;
+//  - while each deferred write aio takes long to complete on the main
+//    device (the batch latency divided by its aios, so that a larger
+//    batch does not look like a slower device), flushing them competes
+//    with client writes, so the batch is doubled (up to
+//    DEFERRED_MAX_BATCH_FACTOR times the configured value) and flushes
+//    come less often and sort better, and it is halved back once the
+//    device recovers.  The deferred throttle still forces a flush when
+//    too much is pending, however large the batch.
+static constexpr int DEFERRED_MAX_BATCH_FACTOR = 8;
+
+void BlueStore::deferred_policy_step(const deferred_policy_sample_t& s,
+				     uint64_t *size, int *batch,
+				     bool *device_busy, bool *kv_busy)
+{
+  *device_busy = s.deferred_aio_lat_ns >= s.device_latency_limit_ns;
+  *kv_busy = s.kv_lat_ns >= s.kv_latency_limit_ns ||
+    s.compaction_debt >= s.compaction_debt_limit;
+
+  uint64_t min_size = std::min(s.base_size, s.min_alloc_size);
+  if (*kv_busy) {
+    *size = std::max(min_size, *size / 2);
+  } else {
+    *size = std::min(s.base_size,
+		     *size + std::max<uint64_t>(s.base_size / 4, 1));
+  }
+  if (*device_busy) {
+    *batch = std::min(s.base_batch * DEFERRED_MAX_BATCH_FACTOR,
+		      std::max(*batch * 2, 1));
+  } else {
+    *batch = std::max(s.base_batch, *batch / 2);
+  }
+}
+
+void BlueStore::_set_deferred_adaptive()
+{
+  std::lock_guard l(deferred_policy_lock);
+  deferred_adaptive = cct->_conf.get_val<bool>("bluestore_deferred_adaptive");
+  deferred_adaptive_interval = cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_interval");
+  if (!deferred_adaptive) {
+    // back to the configured thresholds
+    deferred_policy.device_busy = deferred_policy.kv_busy = false;
+    prefer_deferred_size = prefer_deferred_size_base.load();
+    deferred_batch_ops = deferred_batch_ops_base.load();
+    logger->set(l_bluestore_deferred_policy_size, prefer_deferred_size);
+    logger->set(l_bluestore_deferred_policy_batch_ops, deferred_batch_ops);
+  }
+}
+
+void BlueStore::_deferred_policy_update()
+{
+  // called on every kv_finalize pass, keep it cheap while disabled
+  if (!deferred_adaptive) {
+    return;
+  }
+  auto now = mono_clock::now();
+  std::lock_guard l(deferred_policy_lock);
+  if (!deferred_adaptive ||
+      now - deferred_policy.last_update <
+	make_timespan(deferred_adaptive_interval)) {
+    return;
+  }
+  deferred_policy.last_update = now;
+
+  uint64_t base_size = prefer_deferred_size_base;
+  int base_batch = deferred_batch_ops_base;
+  uint64_t size = prefer_deferred_size;
+  int batch = deferred_batch_ops;
+  auto& p = deferred_policy;
+  p.deferred_aio_latency_ns.consume_next(
+    logger->get_tavg_ns(l_bluestore_deferred_aio_lat));
+  p.kv_sync_latency_ns.consume_next(
+    logger->get_tavg_ns(l_bluestore_kv_sync_lat));
+  p.aio_lat_ns = p.deferred_aio_latency_ns.current_avg();
+  p.kv_lat_ns = p.kv_sync_latency_ns.current_avg();
+  p.compaction_debt = 0;
+  db->get_property("rocksdb.estimate-pending-compaction-bytes",
+		   &p.compaction_debt);
+
+  deferred_policy_sample_t sample;
+  sample.base_size = base_size;
+  sample.min_alloc_size = min_alloc_size;
+  sample.base_batch = base_batch;
+  sample.device_latency_limit_ns = 1e9 * cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_device_latency");
+  sample.kv_latency_limit_ns = 1e9 * cct->_conf.get_val<double>(
+    "bluestore_deferred_adaptive_kv_latency");
+  sample.compaction_debt_limit = cct->_conf.get_val<Option::size_t>(
+    "bluestore_deferred_adaptive_compaction_debt");
+  sample.deferred_aio_lat_ns = p.aio_lat_ns;
+  sample.kv_lat_ns = p.kv_lat_ns;
+  sample.compaction_debt = p.compaction_debt;
+  deferred_policy_step(sample, &size, &batch, &p.device_busy, &p.kv_busy);
+
+  if (size != prefer_deferred_size || batch != deferred_batch_ops) {
+    dout(10) << __func__ << " deferred aio " << deferred_policy.aio_lat_ns
+	     << "ns kv_sync " << deferred_policy.kv_lat_ns
+	     << "ns compaction debt " << byte_u_t(deferred_policy.compaction_debt)
+	     << ": prefer_deferred_size 0x" << std::hex
+	     << prefer_deferred_size << " -> 0x" << size << std::dec
+	     << " deferred_batch_ops " << deferred_batch_ops << " -> " << batch
+	     << dendl;
+    prefer_deferred_size = size;
+    deferred_batch_ops = batch;
+    logger->inc(l_bluestore_deferred_policy_adjustments);
+    logger->set(l_bluestore_deferred_policy_size, size);
+    logger->set(l_bluestore_deferred_policy_batch_ops, batch);
+  }
+}
+
+void BlueStore::_fast_tier_start()
+{
+  static const char* dir = "bluestore.tier";
+  static const char* file = "chunks";
+  if (!bluefs) {
+    return;
+  }
+  uint64_t want = cct->_conf.get_val<Option::size_t>("bluestore_fast_tier_size");
+  if (!want || !bluefs_layout.dedicated_db) {
+    if (want) {
+      dout(1) << __func__ << " no dedicated block.db device, not using"
+	      << " a fast tier" << dendl;
+    }
+    if (bluefs->dir_exists(dir)) {
+      dout(1) << __func__ << " releasing fast tier space" << dendl;
+      bluefs->unlink(dir, file);
+      bluefs->rmdir(dir);
+      bluefs->sync_metadata(false);
+    }
+    return;
+  }
+  uint64_t chunk_size =
+    cct->_conf.get_val<Option::size_t>("bluestore_fast_tier_chunk_size");
+  BlockDevice* fast_bdev = bluefs->get_block_device(BlueFS::BDEV_DB);
+  ceph_assert(fast_bdev);
+  if (!isp2(chunk_size) ||
+      chunk_size < bdev->get_block_size() ||
+      chunk_size < fast_bdev->get_block_size()) {
+    derr << __func__ << " invalid bluestore_fast_tier_chunk_size 0x"
+	 << std::hex << chunk_size << std::dec << ", not using a fast tier"
+	 << dendl;
+    return;
+  }
+
+  // whatever the last mount left is released (the tier starts out empty
+  // anyway) so that it counts as free space below
+  int r = 0;
+  if (!bluefs->dir_exists(dir)) {
+    r = bluefs->mkdir(dir);
+  }
+  if (r == 0) {
+    r = bluefs->open_for_write(dir, file, &fast_tier_file, false);
+  }
+  if (r < 0) {
+    derr << __func__ << " unable to create the fast tier file: "
+	 << cpp_strerror(r) << dendl;
+    return;
+  }
+  bluefs->sync_metadata(false);
+
+  double ratio = cct->_conf.get_val<double>("bluestore_fast_tier_max_db_ratio");
+  uint64_t size = p2align<uint64_t>(
+    std::min<uint64_t>(want,
+		       uint64_t(bluefs->get_free(BlueFS::BDEV_DB) * ratio)),
+    chunk_size);
+  r = size ? bluefs->preallocate(fast_tier_file->file, 0, size) : -ENOSPC;
+  bluefs->sync_metadata(false);
+  std::vector<std::pair<uint64_t,uint64_t>> extents;
+  if (r == 0) {
+    for (auto& e : fast_tier_file->file->fnode.extents) {
+      if (e.bdev == BlueFS::BDEV_DB) {
+	extents.emplace_back(e.offset, e.length);
+      }
+    }
+  }
+  if (extents.empty()) {
+    derr << __func__ << " unable to reserve 0x" << std::hex << size
+	 << std::dec << " of block.db for the fast tier: " << cpp_strerror(r)
+	 << dendl;
+    bluefs->close_writer(fast_tier_file);
+    fast_tier_file = nullptr;
+    return;
+  }
+  fast_tier = new FastTier(
+    cct, bdev, fast_bdev, extents, chunk_size,
+    cct->_conf.get_val<uint64_t>("bluestore_fast_tier_promote_threshold"));
+  fast_tier->start();
+}
+
+void BlueStore::_fast_tier_stop()
+{
+  if (fast_tier) {
+    fast_tier->stop();
+    delete fast_tier;
+    fast_tier = nullptr;
+  }
+  if (fast_tier_file) {
+    bluefs->close_writer(fast_tier_file);
+    fast_tier_file = nullptr;
+  }
+}
+
 void BlueStore::_zoned_cleaner_start() {
   dout(10) << __func__ << dendl;
 
@@ -12432,8 +13575,12 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
 	if (!g_conf()->bluestore_debug_omit_block_device_write) {
 	  logger->inc(l_bluestore_deferred_write_ops);
 	  logger->inc(l_bluestore_deferred_write_bytes, bl.length());
+	  if (fast_tier) {
+	    fast_tier->invalidate(start, bl.length());
+	  }
 	  int r = bdev->aio_write(start, bl, &b->ioc, false);
 	  ceph_assert(r == 0);
+	  ++b->ios;
 	}
       }
       if (i == b->iomap.end()) {
@@ -12497,13 +13644,26 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
 
   {
     uint64_t costs = 0;
+    if (fast_tier) {
+      for (auto& [offset, io] : b->iomap) {
+	fast_tier->invalidate(offset, io.bl.length());
+      }
+    }
     {
+      // every txc waited for the whole batch; what the device took per
+      // aio does not grow with the batch size
+      mono_clock::duration lat = mono_clock::duration::zero();
       for (auto& i : b->txcs) {
 	TransContext *txc = &i;
-	throttle.log_state_latency(*txc, logger, l_bluestore_state_deferred_aio_wait_lat);
+	lat = std::max(lat, throttle.log_state_latency(
+	  *txc, logger, l_bluestore_state_deferred_aio_wait_lat));
 	txc->set_state(TransContext::STATE_DEFERRED_CLEANUP);
 	costs += txc->cost;
       }
+      if (b->ios) {
+	logger->tinc(l_bluestore_deferred_aio_lat,
+		     deferred_io_latency(lat, b->ios));
+      }
     }
     throttle.release_deferred_throttle(costs);
   }
@@ -12590,6 +13750,7 @@ int BlueStore::queue_transactions(
   // prepare
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit, op);
+  ++kv_txc_preparing;
 
   // With HM-SMR drives (and ZNS SSDs) we want the I/O allocation and I/O
   // submission to happen atomically because if I/O submission happens in a
@@ -13299,6 +14460,10 @@ void BlueStore::_do_write_small(
 	      b->get_blob().map_bl(
 		b_off, bl,
 		[&](uint64_t offset, bufferlist& t) {
+		  if (fast_tier) {
+		    fast_tier->invalidate(offset, t.length());
+		    txc->tier_written.union_insert(offset, t.length());
+		  }
 		  bdev->aio_write(offset, t,
 				  &txc->ioc, wctx->buffered);
 		});
@@ -13893,20 +15058,42 @@ int BlueStore::_do_alloc_write(
   );
 
   // compress (as needed) and calc needed space
+  std::vector<CompressPipeline::Job> cjobs;
+  if (c) {
+    // all blobs go to the compression threads at once, we need all of
+    // them back before we know how much to allocate
+    CompressPipeline::Batch batch;
+    cjobs.resize(wctx->writes.size());
+    for (size_t i = 0; i < wctx->writes.size(); ++i) {
+      auto& wi = wctx->writes[i];
+      if (wi.blob_length > min_alloc_size) {
+	ceph_assert(wi.b_off == 0);
+	ceph_assert(wi.blob_length == wi.bl.length());
+	cjobs[i].compressor = c;
+	cjobs[i].in = &wi.bl;
+	if (!compress_pipeline.queue(batch, &cjobs[i])) {
+	  logger->inc(l_bluestore_compress_saturated_count);
+	}
+      }
+    }
+    compress_pipeline.wait(batch);
+  }
   uint64_t need = 0;
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
-  for (auto& wi : wctx->writes) {
-    if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
-
-      // compress
-      ceph_assert(wi.b_off == 0);
-      ceph_assert(wi.blob_length == wi.bl.length());
+  for (size_t i = 0; i < wctx->writes.size(); ++i) {
+    auto& wi = wctx->writes[i];
+    if (c && cjobs[i].done) {
+      auto& job = cjobs[i];
+      logger->tinc(l_bluestore_compress_queue_lat, job.queue_lat);
 
       // FIXME: memory alignment here is bad
-      bufferlist t;
-      boost::optional<int32_t> compressor_message;
-      int r = c->compress(wi.bl, t, compressor_message);
+      bufferlist& t = job.out;
+      boost::optional<int32_t>& compressor_message = job.compressor_message;
+      int r = job.r;
+      if (r == 0) {
+	logger->inc(l_bluestore_compress_in_bytes, wi.blob_length);
+	logger->inc(l_bluestore_compress_out_bytes, t.length());
+      }
       uint64_t want_len_raw = wi.blob_length * crr;
       uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
       bool rejected = false;
@@ -13969,7 +15156,7 @@ int BlueStore::_do_alloc_write(
       }
       log_latency("compress@_do_alloc_write",
 	l_bluestore_compress_lat,
-        mono_clock::now() - start,
+	job.compress_lat,
 	cct->_conf->bluestore_log_op_age );
     } else {
       need += wi.blob_length;
@@ -14137,6 +15324,10 @@ int BlueStore::_do_alloc_write(
 	b->get_blob().map_bl(
 	  b_off, *l,
 	  [&](uint64_t offset, bufferlist& t) {
+	    if (fast_tier) {
+	      fast_tier->invalidate(offset, t.length());
+	      txc->tier_written.union_insert(offset, t.length());
+	    }
 	    bdev->aio_write(offset, t, &txc->ioc, false);
 	  });
 	logger->inc(l_bluestore_write_new);
@@ -15889,28 +17080,9 @@ void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
     logger->inc(l_bluestore_onode_reshard);
   }
 
-  // bound encode
-  size_t bound = 0;
-  denc(o->onode, bound);
-  o->extent_map.bound_encode_spanning_blobs(bound);
-  if (o->onode.extent_map_shards.empty()) {
-    denc(o->extent_map.inline_bl, bound);
-  }
-
-  // encode
   bufferlist bl;
   unsigned onode_part, blob_part, extent_part;
-  {
-    auto p = bl.get_contiguous_appender(bound, true);
-    denc(o->onode, p);
-    onode_part = p.get_logical_offset();
-    o->extent_map.encode_spanning_blobs(p);
-    blob_part = p.get_logical_offset() - onode_part;
-    if (o->onode.extent_map_shards.empty()) {
-      denc(o->extent_map.inline_bl, p);
-    }
-    extent_part = p.get_logical_offset() - onode_part - blob_part;
-  }
+  o->encode(bl, &onode_part, &blob_part, &extent_part);
 
   dout(20) << __func__  << " onode " << o->oid << " is " << bl.length()
 	    << " (" << onode_part << " bytes onode + "
@@ -50,6 +50,8 @@
 
 #include "bluestore_types.h"
 #include "BlueFS.h"
+#include "CompressPipeline.h"
+#include "FastTier.h"
 #include "common/EventTrace.h"
 
 #ifdef WITH_BLKIN
@@ -75,6 +77,8 @@ enum {
   l_bluestore_kv_commit_lat,
   l_bluestore_kv_sync_lat,
   l_bluestore_kv_final_lat,
+  l_bluestore_kv_sync_batch,
+  l_bluestore_kv_group_wait_lat,
   l_bluestore_state_prepare_lat,
   l_bluestore_state_aio_wait_lat,
   l_bluestore_state_io_done_lat,
@@ -92,14 +96,25 @@ enum {
   l_bluestore_read_lat,
   l_bluestore_read_onode_meta_lat,
   l_bluestore_read_wait_aio_lat,
+  l_bluestore_read_prefetch_bytes,
+  l_bluestore_read_prefetch_hit_bytes,
+  l_bluestore_read_prefetch_waste_bytes,
   l_bluestore_compress_lat,
   l_bluestore_decompress_lat,
   l_bluestore_csum_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_queue_lat,
+  l_bluestore_compress_saturated_count,
+  l_bluestore_compress_in_bytes,
+  l_bluestore_compress_out_bytes,
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_aio_lat,
+  l_bluestore_deferred_policy_size,
+  l_bluestore_deferred_policy_batch_ops,
+  l_bluestore_deferred_policy_adjustments,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -110,6 +125,9 @@ enum {
   l_bluestore_pinned_onodes,
   l_bluestore_onode_hits,
   l_bluestore_onode_misses,
+  l_bluestore_onode_encoded_hits,
+  l_bluestore_encoded_onodes,
+  l_bluestore_encoded_onode_bytes,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
   l_bluestore_extents,
@@ -136,6 +154,7 @@ enum {
   l_bluestore_read_eio,
   l_bluestore_reads_with_retries,
   l_bluestore_fragmentation,
+  l_bluestore_alloc_snapshot_loads,
   l_bluestore_omap_seek_to_first_lat,
   l_bluestore_omap_upper_bound_lat,
   l_bluestore_omap_lower_bound_lat,
@@ -170,6 +189,12 @@ public:
     max_defer_interval =
 	cct->_conf.get_val<double>("bluestore_max_defer_interval");
   }
+  void _set_prefetch() {
+    prefetch_trigger =
+      cct->_conf.get_val<uint64_t>("bluestore_prefetch_sequential_reads");
+    prefetch_max_bytes =
+      cct->_conf.get_val<Option::size_t>("bluestore_prefetch_max_bytes");
+  }
 
   struct TransContext;
 
@@ -1085,6 +1110,13 @@ public:
     // effects cannot be read via the kvdb read methods)
     std::atomic<int> flushing_count = {0};
     std::atomic<int> waiting_count = {0};
+
+    // sequential read stream detection; only hints, so racing readers
+    // under the shared collection lock may clobber each other harmlessly
+    std::atomic<uint64_t> seq_read_next = {0};  ///< expected next read offset
+    std::atomic<uint64_t> prefetch_end = {0};   ///< end of prefetched range
+    std::atomic<uint32_t> seq_read_count = {0}; ///< back-to-back sequential reads
+
     /// protect flush_txns
     ceph::mutex flush_lock = ceph::make_mutex("BlueStore::Onode::flush_lock");
     ceph::condition_variable flush_cond;   ///< wait here for uncommitted txns
@@ -1134,6 +1166,14 @@ public:
     void flush();
     void get();
     void put();
+    bool get_if_pinned();
+
+    /// encode as stored under PREFIX_OBJ (onode, spanning blobs and
+    /// inline extents); returns the size of each part
+    void encode(ceph::buffer::list& bl,
+                unsigned *onode_part,
+                unsigned *blob_part,
+                unsigned *extent_part);
 
     inline bool put_cache() {
       ceph_assert(!cached);
@@ -1165,6 +1205,22 @@ public:
   };
   typedef boost::intrusive_ptr<Onode> OnodeRef;
 
+  /// an onode evicted from the decoded cache, kept in its compact
+  /// on-disk encoding until it is either looked up again or trimmed
+  struct EncodedOnode {
+    MEMPOOL_CLASS_HELPERS();
+
+    OnodeSpace *space;
+    ghobject_t oid;
+    ceph::buffer::list bl;
+    boost::intrusive::list_member_hook<> lru_item;
+
+    EncodedOnode(OnodeSpace *s, const ghobject_t& o, ceph::buffer::list&& b)
+      : space(s), oid(o), bl(std::move(b)) {
+      bl.reassign_to_mempool(mempool::mempool_bluestore_cache_encoded);
+    }
+  };
+
   /// A generic Cache Shard
   struct CacheShard {
     CephContext *cct;
@@ -1221,6 +1277,16 @@ public:
 
     std::array<std::pair<ghobject_t, ceph::mono_clock::time_point>, 64> dumped_onodes;
 
+    typedef boost::intrusive::list<
+      EncodedOnode,
+      boost::intrusive::member_hook<
+        EncodedOnode,
+        boost::intrusive::list_member_hook<>,
+        &EncodedOnode::lru_item> > encoded_list_t;
+    encoded_list_t encoded_lru;          ///< encoded tier, protected by lock
+    uint64_t encoded_bytes = 0;
+    std::atomic<uint64_t> encoded_max = {0};  ///< bytes; 0 disables the tier
+
     virtual void _pin(Onode* o) = 0;
     virtual void _unpin(Onode* o) = 0;
 
@@ -1237,6 +1303,21 @@ public:
     bool empty() {
       return _get_num() == 0;
     }
+
+    void set_encoded_max(uint64_t max_) {
+      encoded_max = max_;
+    }
+    bool encoded_enabled() const {
+      return encoded_max > 0;
+    }
+    void _add_encoded(EncodedOnode *e);
+    void _rm_encoded(EncodedOnode *e);
+    void _trim_encoded();
+    void add_encoded_stats(uint64_t *onodes, uint64_t *bytes) {
+      std::lock_guard l(lock);
+      *onodes += encoded_lru.size();
+      *bytes += encoded_bytes;
+    }
   };
 
   /// A Generic buffer Cache Shard
@@ -1288,13 +1369,23 @@ public:
     OnodeCacheShard *cache;
 
   private:
+    /// protect onode_map; taken after cache->lock when both are needed,
+    /// and on its own (shared) by lookup() for already pinned onodes
+    ceph::shared_mutex map_lock =
+      ceph::make_shared_mutex("BlueStore::OnodeSpace::map_lock");
     /// forward lookups
     mempool::bluestore_cache_meta::unordered_map<ghobject_t,OnodeRef> onode_map;
+    /// onodes in the encoded tier, protected by cache->lock
+    mempool::bluestore_cache_encoded::unordered_map<ghobject_t,EncodedOnode*>
+      encoded_map;
 
     friend struct Collection; // for split_cache()
     friend struct Onode; // for put()
     friend struct LruOnodeCacheShard;
+    friend struct OnodeCacheShard; // for encoded tier trimming
     void _remove(const ghobject_t& oid);
+    void _add_encoded(Onode *o);
+    void _clear_encoded();
   public:
     OnodeSpace(OnodeCacheShard *c) : cache(c) {}
     ~OnodeSpace() {
@@ -1303,6 +1394,8 @@ public:
 
     OnodeRef add(const ghobject_t& oid, OnodeRef& o);
     OnodeRef lookup(const ghobject_t& o);
+    /// remove oid from the encoded tier, returning its encoding if present
+    bool take_encoded(const ghobject_t& oid, ceph::buffer::list *bl);
     void rename(OnodeRef& o, const ghobject_t& old_oid,
 		const ghobject_t& new_oid,
 		const mempool::bluestore_cache_meta::string& new_okey);
@@ -1601,6 +1694,7 @@ public:
     bluestore_deferred_transaction_t *deferred_txn = nullptr; ///< if any
 
     interval_set<uint64_t> allocated, released;
+    interval_set<uint64_t> tier_written; ///< to drop from the fast tier once written
     volatile_statfs statfs_delta;	   ///< overall store statistics delta
     uint64_t osd_pool_id = META_POOL_ID;    ///< osd pool id we're operating on
 
@@ -1819,6 +1913,7 @@ public:
     IOContext ioc;                   ///< our aios
     /// bytes of pending io for each deferred seq (may be 0)
     std::map<uint64_t,int> seq_bytes;
+    unsigned ios = 0;                ///< aios submitted for this batch
 
     void _discard(CephContext *cct, uint64_t offset, uint64_t length);
     void _audit(CephContext *cct);
@@ -2028,6 +2123,9 @@ private:
 
   KeyValueDB *db = nullptr;
   BlockDevice *bdev = nullptr;
+  FastTier *fast_tier = nullptr;  ///< hot data copies on the block.db device
+  BlueFS::FileWriter *fast_tier_file = nullptr;
+  CompressPipeline compress_pipeline{cct};
   std::string freelist_type;
   FreelistManager *fm = nullptr;
 
@@ -2037,6 +2135,14 @@ private:
   int path_fd = -1;  ///< open handle to $path
   int fsid_fd = -1;  ///< open handle (locked) to $path/fsid
   bool mounted = false;
+  /// how long each step of the last _open_db_and_around() took
+  std::vector<std::pair<std::string, ceph::timespan>> open_phases;
+
+  void _note_open_phase(const char *name, mono_clock::time_point& start) {
+    auto now = mono_clock::now();
+    open_phases.emplace_back(name, now - start);
+    start = now;
+  }
 
   ceph::shared_mutex coll_lock = ceph::make_shared_mutex("BlueStore::coll_lock");  ///< rwlock to protect coll_map
   mempool::bluestore_cache_other::unordered_map<coll_t, CollectionRef> coll_map;
@@ -2067,6 +2173,10 @@ private:
   utime_t  deferred_last_submitted = utime_t();
 
   KVSyncThread kv_sync_thread;
+  int kv_numa_node = -1;  ///< numa node kv threads are bound to, if any
+
+  class SocketHook;
+  SocketHook* asok_hook = nullptr;
   ceph::mutex kv_lock = ceph::make_mutex("BlueStore::kv_lock");
   ceph::condition_variable kv_cond;
   bool _kv_only = false;
@@ -2079,6 +2189,8 @@ private:
   std::deque<TransContext*> kv_committing;        ///< currently syncing
   std::deque<DeferredBatch*> deferred_done_queue;   ///< deferred ios done
   bool kv_sync_in_progress = false;
+  bool kv_sync_batching = false;  ///< kv sync thread waits to grow a batch
+  std::atomic_int kv_txc_preparing = {0}; ///< txcs not yet kv queued
 
   KVFinalizeThread kv_finalize_thread;
   ceph::mutex kv_finalize_lock = ceph::make_mutex("BlueStore::kv_finalize_lock");
@@ -2132,6 +2244,31 @@ private:
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
+  ///< configured values of the above, which the adaptive deferred
+  ///< policy moves away from and back to
+  std::atomic<int> deferred_batch_ops_base = {0};
+  std::atomic<uint64_t> prefer_deferred_size_base = {0};
+
+  /// state of the adaptive deferred policy, updated by the kv finalize
+  /// thread
+  struct deferred_policy_t {
+    PerfCounters::avg_tracker<uint64_t> deferred_aio_latency_ns;
+    PerfCounters::avg_tracker<uint64_t> kv_sync_latency_ns;
+    ceph::mono_clock::time_point last_update;
+    // what the last update saw and did
+    uint64_t aio_lat_ns = 0;
+    uint64_t kv_lat_ns = 0;
+    uint64_t compaction_debt = 0;
+    bool device_busy = false;
+    bool kv_busy = false;
+  };
+  ceph::mutex deferred_policy_lock =
+    ceph::make_mutex("BlueStore::deferred_policy_lock");
+  deferred_policy_t deferred_policy;
+  ///< bluestore_deferred_adaptive, also readable without the lock
+  std::atomic<bool> deferred_adaptive = {false};
+  double deferred_adaptive_interval = 0; ///< under deferred_policy_lock
+
   ///< approx cost per io, in bytes
   std::atomic<uint64_t> throttle_cost_per_io = {0};
 
@@ -2151,6 +2288,7 @@ private:
   double cache_meta_ratio = 0;   ///< cache ratio dedicated to metadata
   double cache_kv_ratio = 0;     ///< cache ratio dedicated to kv (e.g., rocksdb)
   double cache_kv_onode_ratio = 0; ///< cache ratio dedicated to kv onodes (e.g., rocksdb onode CF)
+  double cache_meta_encoded_ratio = 0; ///< cache ratio dedicated to encoded onodes
   double cache_data_ratio = 0;   ///< cache ratio dedicated to object data
   bool cache_autotune = false;   ///< cache autotune setting
   double cache_autotune_interval = 0; ///< time to wait between cache rebalancing
@@ -2160,6 +2298,9 @@ private:
   uint64_t osd_memory_cache_min = 0; ///< Min memory to assign when autotuning cache
   double osd_memory_cache_resize_interval = 0; ///< Time to wait between cache resizing 
   double max_defer_interval = 0; ///< Time to wait between last deferred submit
+  uint64_t prefetch_trigger = 0; ///< sequential reads before we prefetch
+  uint64_t prefetch_max_bytes = 0; ///< how far ahead to prefetch
+  bool save_alloc_snapshot = false; ///< write one as the db is closed
   std::atomic<uint32_t> config_changed = {0}; ///< Counter to determine if there is a configuration change.
 
   typedef std::map<uint64_t, volatile_statfs> osd_pools_map;
@@ -2289,11 +2430,24 @@ private:
     };
     std::shared_ptr<DataCache> data_cache;
 
+    struct EncodedMetaCache : public MempoolCache {
+      EncodedMetaCache(BlueStore *s) : MempoolCache(s) {};
+
+      virtual uint64_t _get_used_bytes() const {
+        return mempool::bluestore_cache_encoded::allocated_bytes();
+      }
+      virtual std::string get_cache_name() const {
+        return "BlueStore Encoded Meta Cache";
+      }
+    };
+    std::shared_ptr<EncodedMetaCache> encoded_meta_cache;
+
   public:
     explicit MempoolThread(BlueStore *s)
       : store(s),
         meta_cache(new MetaCache(s)),
-        data_cache(new DataCache(s)) {}
+        data_cache(new DataCache(s)),
+        encoded_meta_cache(new EncodedMetaCache(s)) {}
 
     void *entry() override;
     void init() {
@@ -2333,6 +2487,7 @@ private:
   int _write_fsid();
   void _close_fsid();
   void _set_alloc_sizes();
+  void _set_deferred_adaptive();
   void _set_blob_size();
   void _set_finisher_num();
   void _set_per_pool_omap();
@@ -2375,6 +2530,9 @@ private:
   int _write_out_fm_meta(uint64_t target_size);
   int _create_alloc();
   int _init_alloc();
+  int _load_alloc_snapshot(uint64_t *num, uint64_t *bytes);
+  void _save_alloc_snapshot(uint64_t seq);
+  int _init_alloc_parallel(size_t threads, uint64_t *num, uint64_t *bytes);
   void _close_alloc();
   int _open_collections();
   void _fsck_collections(int64_t* errors);
@@ -2456,7 +2614,13 @@ private:
   void _kv_start();
   void _kv_stop();
   void _kv_sync_thread();
+  void _kv_sync_group_wait(std::unique_lock<ceph::mutex>& l);
+  void _kv_set_numa_affinity();
   void _kv_finalize_thread();
+  void _deferred_policy_update();
+
+  void _fast_tier_start();
+  void _fast_tier_stop();
 
   void _zoned_cleaner_start();
   void _zoned_cleaner_stop();
@@ -2591,6 +2755,39 @@ public:
     int *numa_node,
     std::set<int> *nodes,
     std::set<std::string> *failed) override;
+  void dump_numa_placement(ceph::Formatter *f);
+  void dump_deferred_policy(ceph::Formatter *f);
+
+  /// inputs of one adaptive deferred policy step
+  struct deferred_policy_sample_t {
+    uint64_t base_size = 0;       ///< configured prefer_deferred_size
+    uint64_t min_alloc_size = 0;
+    int base_batch = 0;           ///< configured deferred_batch_ops
+    uint64_t device_latency_limit_ns = 0;
+    uint64_t kv_latency_limit_ns = 0;
+    uint64_t compaction_debt_limit = 0;
+    uint64_t deferred_aio_lat_ns = 0;
+    uint64_t kv_lat_ns = 0;
+    uint64_t compaction_debt = 0;
+  };
+  /// move *size and *batch one step with the load seen in s, within the
+  /// bounds given by the configured values; see _deferred_policy_update()
+  static void deferred_policy_step(const deferred_policy_sample_t& s,
+				   uint64_t *size, int *batch,
+				   bool *device_busy, bool *kv_busy);
+  /// how long the kv sync thread may hold a batch of queued txcs open
+  /// for more to join it, zero to commit right away; see
+  /// _kv_sync_group_wait()
+  static ceph::timespan kv_sync_group_wait_time(double target,
+						uint64_t min_batch,
+						size_t queued,
+						int preparing,
+						ceph::timespan expected);
+  /// latency of one aio of a deferred batch of ios that took lat
+  static ceph::timespan deferred_io_latency(ceph::timespan lat,
+					    unsigned ios) {
+    return ios ? lat / ios : lat;
+  }
 
   static int get_block_device_fsid(CephContext* cct, const std::string& path,
 				   uuid_d *fsid);
@@ -2615,6 +2812,9 @@ public:
   int cold_open();
   int cold_close();
 
+  /// time spent in the steps of the last open (and fsck, if any)
+  void dump_open_phases(ceph::Formatter *f) const;
+
   int fsck(bool deep) override {
     return _fsck(deep ? FSCK_DEEP : FSCK_REGULAR, false);
   }
@@ -2624,6 +2824,9 @@ public:
   int quick_fix() override {
     return _fsck(FSCK_SHALLOW, true);
   }
+  int fsck_shallow() {
+    return _fsck(FSCK_SHALLOW, false);
+  }
 
   void set_cache_shards(unsigned num) override;
   void dump_cache_stats(ceph::Formatter *f) override {
@@ -2768,7 +2971,15 @@ private:
   int _prepare_read_ioc(
     blobs2read_t& blobs2read,
     std::vector<ceph::buffer::list>* compressed_blob_bls,
-    IOContext* ioc);
+    IOContext* ioc,
+    std::vector<FastTier::read_t>* tier_reads,
+    bool coalesce = false);
+  int _finish_tier_reads(std::vector<FastTier::read_t>& tier_reads);
+
+  uint64_t _note_sequential_read(
+    Onode *o,
+    uint64_t offset,
+    uint64_t length);
 
   int _generate_read_result_bl(
     OnodeRef o,
@@ -2778,6 +2989,7 @@ private:
     std::vector<ceph::buffer::list>& compressed_blob_bls,
     blobs2read_t& blobs2read,
     bool buffered,
+    uint64_t prefetch_offset,
     bool* csum_error,
     ceph::buffer::list& bl);
 
@@ -2924,6 +3136,9 @@ public:
   struct BSPerfTracker {
     PerfCounters::avg_tracker<uint64_t> os_commit_latency_ns;
     PerfCounters::avg_tracker<uint64_t> os_apply_latency_ns;
+    /// recent kv sync (flush + commit) latency, used by kv group commit;
+    /// only touched by the kv sync thread
+    PerfCounters::avg_tracker<uint64_t> kv_sync_latency_ns;
 
     objectstore_perf_stat_t get_cur_stats() const {
       objectstore_perf_stat_t ret;
@@ -2976,6 +3191,8 @@ public:
 			   coll_t cid2, ghobject_t oid2,
 			   uint64_t offset);
   void inject_zombie_spanning_blob(coll_t cid, ghobject_t oid, int16_t blob_id);
+  /// overwrite the checksum chunk holding offset on disk
+  void inject_bad_csum(coll_t cid, ghobject_t oid, uint64_t offset);
   // resets global per_pool_omap in DB
   void inject_legacy_omap();
   // resets per_pool_omap | pgmeta_omap for onode
@@ -3079,6 +3296,17 @@ private:
     uint64_t blob_xoffset,
     const ceph::buffer::list& bl,
     uint64_t logical_offset) const;
+  /// verify all the regions read from one blob in one go
+  int _verify_csum(
+    OnodeRef& o,
+    const bluestore_blob_t* blob,
+    const regions2read_t& r2r) const;
+  int _verify_csum_extent(
+    OnodeRef& o,
+    const bluestore_blob_t* blob,
+    uint64_t blob_xoffset,
+    const ceph::buffer::list& bl,
+    uint64_t logical_offset) const;
   int _decompress(ceph::buffer::list& source, ceph::buffer::list* result);
 
 
@@ -3436,6 +3664,8 @@ private:
 
   void _fsck_check_objects(FSCKDepth depth,
     FSCK_ObjectCtx& ctx);
+  void _fsck_check_objects_partitioned(size_t thread_count,
+    FSCK_ObjectCtx& ctx);
 };
 
 inline std::ostream& operator<<(std::ostream& out, const BlueStore::volatile_statfs& s) {
@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "CompressPipeline.h"
+
+#include <algorithm>
+
+#include "common/debug.h"
+#include "common/Thread.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "compress_pipeline "
+
+CompressPipeline::~CompressPipeline()
+{
+  ceph_assert(workers.empty());
+  ceph_assert(jobs.empty());
+}
+
+void CompressPipeline::start(unsigned threads, unsigned _max_queued)
+{
+  ceph_assert(workers.empty());
+  stopping = false;
+  max_queued = std::max(_max_queued, 1u);
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.push_back(
+      make_named_thread("bstore_compress", &CompressPipeline::_worker_entry,
+			this));
+  }
+  ldout(cct, 10) << __func__ << " " << threads << " threads, up to "
+		 << max_queued << " queued" << dendl;
+}
+
+void CompressPipeline::stop()
+{
+  {
+    std::lock_guard l(lock);
+    // writers drain their own batches, nothing may be left behind
+    ceph_assert(jobs.empty());
+    stopping = true;
+    cond.notify_all();
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  workers.clear();
+}
+
+bool CompressPipeline::queue(Batch& b, Job* j)
+{
+  ceph_assert(j->compressor);
+  ceph_assert(j->in);
+  std::lock_guard l(lock);
+  // without workers the writer compresses everything itself, as it
+  // always did, and nothing can pile up
+  if (!workers.empty() && jobs.size() >= max_queued) {
+    ldout(cct, 20) << __func__ << " saturated, " << jobs.size()
+		   << " queued" << dendl;
+    return false;
+  }
+  j->batch = &b;
+  j->queued_at = ceph::mono_clock::now();
+  ++b.pending;
+  jobs.push_back(j);
+  cond.notify_one();
+  return true;
+}
+
+void CompressPipeline::_run(Job* j, std::unique_lock<ceph::mutex>& l)
+{
+  auto start = ceph::mono_clock::now();
+  j->queue_lat = start - j->queued_at;
+  l.unlock();
+  j->r = j->compressor->compress(*j->in, j->out, j->compressor_message);
+  j->compress_lat = ceph::mono_clock::now() - start;
+  l.lock();
+  j->done = true;
+  if (--j->batch->pending == 0) {
+    done_cond.notify_all();
+  }
+}
+
+void CompressPipeline::wait(Batch& b)
+{
+  std::unique_lock l(lock);
+  while (b.pending > 0) {
+    // help with our own jobs rather than idle behind other writers'
+    auto p = std::find_if(jobs.begin(), jobs.end(),
+			  [&](Job* j) { return j->batch == &b; });
+    if (p != jobs.end()) {
+      Job* j = *p;
+      jobs.erase(p);
+      _run(j, l);
+    } else {
+      done_cond.wait(l);
+    }
+  }
+}
+
+void CompressPipeline::_worker_entry()
+{
+  std::unique_lock l(lock);
+  while (true) {
+    if (jobs.empty()) {
+      if (stopping) {
+	break;
+      }
+      cond.wait(l);
+      continue;
+    }
+    Job* j = jobs.front();
+    jobs.pop_front();
+    _run(j, l);
+  }
+}
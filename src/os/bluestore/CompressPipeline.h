@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "include/ceph_assert.h"
+#include "include/buffer.h"
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "compressor/Compressor.h"
+
+/*
+ * Worker threads compressing the blobs of a write.
+ *
+ * The writer queues one job per blob in a batch and then waits for the
+ * whole batch before it allocates space, so large writes get compressed
+ * by several threads at once and the op thread is free to take part.
+ * Whatever the workers haven't started by the time the writer waits is
+ * run on the writer's thread.  The queue is bounded; a job that doesn't
+ * fit is not run at all and its blob is written uncompressed, so that a
+ * compression backlog costs space rather than write latency.  The jobs
+ * run through the regular Compressor plugins, which use QAT themselves
+ * when it is enabled.
+ */
+class CompressPipeline {
+public:
+  struct Batch;
+
+  struct Job {
+    CompressorRef compressor;
+    const ceph::buffer::list *in = nullptr;
+    ceph::buffer::list out;
+    boost::optional<int32_t> compressor_message;
+    int r = 0;
+    bool done = false;        ///< false if the pipeline refused it
+    ceph::timespan queue_lat; ///< time spent waiting for a thread
+    ceph::timespan compress_lat;
+
+  private:
+    friend class CompressPipeline;
+    Batch *batch = nullptr;
+    ceph::mono_clock::time_point queued_at;
+  };
+
+  /// the jobs of one write, waited for together
+  struct Batch {
+  private:
+    friend class CompressPipeline;
+    unsigned pending = 0;
+  };
+
+  CompressPipeline(CephContext* cct) : cct(cct) {}
+  ~CompressPipeline();
+
+  /// start threads workers, no more than max_queued jobs may wait for
+  /// them; without workers jobs all run in wait()
+  void start(unsigned threads, unsigned max_queued);
+  void stop();
+
+  /// queue j as part of b; false (and j not done) if the queue is full
+  bool queue(Batch& b, Job* j);
+
+  /// return once all jobs queued for b are done
+  void wait(Batch& b);
+
+private:
+  CephContext* cct;
+  unsigned max_queued = 0;
+
+  ceph::mutex lock = ceph::make_mutex("CompressPipeline::lock");
+  ceph::condition_variable cond;       ///< work for the workers
+  ceph::condition_variable done_cond;  ///< jobs finished
+  bool stopping = false;
+  std::deque<Job*> jobs;
+  std::vector<std::thread> workers;
+
+  void _run(Job* j, std::unique_lock<ceph::mutex>& l);
+  void _worker_entry();
+};
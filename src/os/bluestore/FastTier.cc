@@ -0,0 +1,460 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "FastTier.h"
+
+#include "blk/BlockDevice.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "common/Thread.h"
+#include "include/intarith.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "fast_tier "
+
+// how often the mover halves the heat of chunks that were not promoted
+static constexpr auto HEAT_DECAY_INTERVAL = std::chrono::seconds(10);
+// chunks we keep heat for, and promotions we queue, per slot
+static constexpr size_t HEAT_PER_SLOT = 4;
+static constexpr size_t QUEUE_PER_SLOT = 1;
+
+FastTier::FastTier(
+  CephContext* _cct,
+  BlockDevice* _main_bdev,
+  BlockDevice* _fast_bdev,
+  const std::vector<std::pair<uint64_t,uint64_t>>& fast_extents,
+  uint64_t _chunk_size,
+  unsigned _promote_threshold)
+  : cct(_cct),
+    main_bdev(_main_bdev),
+    fast_bdev(_fast_bdev),
+    chunk_size(_chunk_size),
+    promote_threshold(std::max(_promote_threshold, 1u))
+{
+  ceph_assert(isp2(chunk_size));
+  std::vector<uint64_t> offsets;
+  for (auto& [offset, length] : fast_extents) {
+    uint64_t pos = p2roundup(offset, chunk_size);
+    for (; pos + chunk_size <= offset + length; pos += chunk_size) {
+      offsets.push_back(pos);
+    }
+  }
+  slots = std::vector<slot_t>(offsets.size());
+  free_slots.reserve(slots.size());
+  for (unsigned s = slots.size(); s > 0; --s) {
+    slots[s - 1].fast_offset = offsets[s - 1];
+    free_slots.push_back(s - 1);
+  }
+  max_heat = std::max<size_t>(slots.size() * HEAT_PER_SLOT / NUM_SHARDS, 1);
+
+  PerfCountersBuilder b(cct, "bluestore_fast_tier",
+			l_fast_tier_first, l_fast_tier_last);
+  b.add_u64_counter(l_fast_tier_hits, "hits",
+		    "Reads served from the fast tier");
+  b.add_u64_counter(l_fast_tier_hit_bytes, "hit_bytes",
+		    "Bytes read from the fast tier", NULL,
+		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_fast_tier_read_races, "read_races",
+		    "Fast tier reads redone on the main device because the "
+		    "chunk changed meanwhile");
+  b.add_u64_counter(l_fast_tier_promotions, "promotions",
+		    "Chunks copied to the fast tier");
+  b.add_u64_counter(l_fast_tier_demotions, "demotions",
+		    "Cold chunks dropped from the fast tier to make room");
+  b.add_u64_counter(l_fast_tier_invalidations, "invalidations",
+		    "Chunks dropped from the fast tier because they were "
+		    "rewritten or released");
+  b.add_u64(l_fast_tier_used_bytes, "used_bytes",
+	    "Fast tier space holding chunks", NULL,
+	    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64(l_fast_tier_capacity_bytes, "capacity_bytes",
+	    "Fast tier size", NULL, 0, unit_t(UNIT_BYTES));
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+  logger->set(l_fast_tier_capacity_bytes, get_capacity());
+
+  ldout(cct, 1) << __func__ << " 0x" << std::hex << get_capacity()
+		<< " in 0x" << chunk_size << std::dec << " chunks" << dendl;
+}
+
+FastTier::~FastTier()
+{
+  ceph_assert(!mover.joinable());
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+void FastTier::start()
+{
+  ceph_assert(!mover.joinable());
+  stopping = false;
+  mover = make_named_thread("bstore_tier", &FastTier::_mover_entry, this);
+}
+
+void FastTier::stop()
+{
+  if (!mover.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard l(lock);
+    stopping = true;
+    cond.notify_all();
+  }
+  mover.join();
+}
+
+bool FastTier::lookup(uint64_t offset, uint64_t length, read_t* r)
+{
+  if (length == 0 || slots.empty()) {
+    return false;
+  }
+  uint64_t end = offset + length;
+  bool missed = false;
+  std::vector<uint64_t> hot;
+  r->hits.clear();
+  for (uint64_t c = p2align(offset, chunk_size); c < end; c += chunk_size) {
+    auto& sh = _shard(c);
+    std::lock_guard l(sh.lock);
+    auto p = sh.chunk_map.find(c);
+    if (p == sh.chunk_map.end()) {
+      if (_note_miss(sh, c)) {
+	hot.push_back(c);
+      }
+      missed = true;
+    } else if (!missed) {
+      r->hits.emplace_back(p->second, slots[p->second].gen.load());
+    }
+  }
+  if (!hot.empty()) {
+    _queue_promote(hot);
+  }
+  if (missed) {
+    r->hits.clear();
+    return false;
+  }
+  for (auto& h : r->hits) {
+    slots[h.first].ref = true;
+  }
+  r->offset = offset;
+  r->length = length;
+  return true;
+}
+
+int FastTier::submit_read(read_t* r, ceph::buffer::list* bl, IOContext* ioc)
+{
+  r->dst = bl;
+  r->dst_offset = bl->length();
+  uint64_t end = r->offset + r->length;
+  uint64_t pos = r->offset;
+  for (auto& h : r->hits) {
+    uint64_t c = p2align(pos, chunk_size);
+    uint64_t len = std::min(end, c + chunk_size) - pos;
+    // slot offsets never change, the generations tell whether what we
+    // read is still the chunk we looked up
+    int ret = fast_bdev->aio_read(slots[h.first].fast_offset + pos - c, len,
+				  bl, ioc);
+    if (ret < 0) {
+      // only a device without aio fails here, having queued nothing
+      lderr(cct) << __func__ << " fast device read failed: "
+		 << cpp_strerror(ret) << dendl;
+      bl->splice(r->dst_offset, bl->length() - r->dst_offset);
+      return ret;
+    }
+    pos += len;
+  }
+  fast_bdev->aio_submit(ioc);
+  return 0;
+}
+
+int FastTier::finish_read(const read_t& r)
+{
+  bool raced = false;
+  for (auto& h : r.hits) {
+    if (slots[h.first].gen.load() != h.second) {
+      raced = true;
+      break;
+    }
+  }
+  if (!raced) {
+    logger->inc(l_fast_tier_hits);
+    logger->inc(l_fast_tier_hit_bytes, r.length);
+    return 0;
+  }
+  logger->inc(l_fast_tier_read_races);
+  ceph::buffer::list fresh;
+  IOContext ioc(cct, NULL);
+  int ret = main_bdev->read(r.offset, r.length, &fresh, &ioc, false);
+  if (ret < 0) {
+    return ret;
+  }
+  ceph::buffer::list t;
+  t.substr_of(*r.dst, 0, r.dst_offset);
+  t.claim_append(fresh);
+  uint64_t tail = r.dst->length() - r.dst_offset - r.length;
+  if (tail) {
+    ceph::buffer::list rest;
+    rest.substr_of(*r.dst, r.dst_offset + r.length, tail);
+    t.claim_append(rest);
+  }
+  r.dst->swap(t);
+  return 0;
+}
+
+bool FastTier::read(uint64_t offset, uint64_t length, ceph::buffer::list* bl)
+{
+  read_t r;
+  if (!lookup(offset, length, &r)) {
+    return false;
+  }
+  IOContext ioc(cct, NULL);
+  if (submit_read(&r, bl, &ioc) < 0) {
+    return false;
+  }
+  ioc.aio_wait();
+  return ioc.get_return_value() == 0 && finish_read(r) == 0;
+}
+
+bool FastTier::_note_miss(shard_t& sh, uint64_t chunk)
+{
+  if (chunk + chunk_size > main_bdev->get_size()) {
+    return false;
+  }
+  auto p = sh.heat.find(chunk);
+  if (p == sh.heat.end()) {
+    if (sh.heat.size() >= max_heat) {
+      return false;
+    }
+    p = sh.heat.emplace(chunk, 0).first;
+  }
+  if (++p->second < promote_threshold) {
+    return false;
+  }
+  sh.heat.erase(p);
+  return true;
+}
+
+void FastTier::_queue_promote(const std::vector<uint64_t>& chunks)
+{
+  std::lock_guard l(lock);
+  for (auto c : chunks) {
+    if (filling.count(c) ||
+	promote_queue.size() >= slots.size() * QUEUE_PER_SLOT) {
+      continue;
+    }
+    promote_queue.push_back(c);
+  }
+  cond.notify_one();
+}
+
+void FastTier::_drop(shard_t& sh, unsigned s)
+{
+  auto& slot = slots[s];
+  ceph_assert(slot.chunk != EMPTY);
+  sh.chunk_map.erase(slot.chunk);
+  slot.chunk = EMPTY;
+  slot.ref = false;
+  ++slot.gen;
+  --num_resident;
+  logger->dec(l_fast_tier_used_bytes, chunk_size);
+}
+
+void FastTier::invalidate(uint64_t offset, uint64_t length)
+{
+  if (num_resident == 0 && num_filling == 0) {
+    return;
+  }
+  uint64_t end = offset + length;
+  auto drop = [&](uint64_t c) {
+    auto& sh = _shard(c);
+    std::lock_guard sl(sh.lock);
+    auto p = sh.chunk_map.find(c);
+    if (p == sh.chunk_map.end() && num_filling == 0) {
+      return;
+    }
+    std::lock_guard l(lock);
+    if (p != sh.chunk_map.end()) {
+      unsigned s = p->second;
+      _drop(sh, s);
+      free_slots.push_back(s);
+      logger->inc(l_fast_tier_invalidations);
+    }
+    // the mover checks for this before publishing the chunk
+    if (filling.erase(c)) {
+      --num_filling;
+    }
+  };
+  uint64_t first = p2align(offset, chunk_size);
+  if ((end - first) / chunk_size <= num_resident + num_filling) {
+    for (uint64_t c = first; c < end; c += chunk_size) {
+      drop(c);
+    }
+  } else {
+    // a large release, cheaper to walk what we have
+    std::vector<uint64_t> victims;
+    auto in_range = [&](uint64_t c) {
+      return c + chunk_size > offset && c < end;
+    };
+    for (auto& sh : shards) {
+      std::lock_guard sl(sh.lock);
+      for (auto& p : sh.chunk_map) {
+	if (in_range(p.first)) {
+	  victims.push_back(p.first);
+	}
+      }
+    }
+    {
+      std::lock_guard l(lock);
+      for (auto& p : filling) {
+	if (in_range(p.first)) {
+	  victims.push_back(p.first);
+	}
+      }
+    }
+    for (auto c : victims) {
+      drop(c);
+    }
+  }
+}
+
+void FastTier::invalidate(const interval_set<uint64_t>& extents)
+{
+  for (auto p = extents.begin(); p != extents.end(); ++p) {
+    invalidate(p.get_start(), p.get_len());
+  }
+}
+
+int FastTier::_get_slot(std::unique_lock<ceph::mutex>& l)
+{
+  // second chance: skip (and clear) slots read since the last pass
+  for (size_t i = 0; i < slots.size() * 2; ++i) {
+    if (!free_slots.empty()) {
+      unsigned s = free_slots.back();
+      free_slots.pop_back();
+      return s;
+    }
+    unsigned s = clock_hand;
+    clock_hand = (clock_hand + 1) % slots.size();
+    auto& slot = slots[s];
+    if (slot.filling || slot.chunk == EMPTY) {
+      continue;
+    }
+    if (slot.ref) {
+      slot.ref = false;
+      continue;
+    }
+    // the victim's shard lock goes first; it may be invalidated meanwhile
+    uint64_t victim = slot.chunk;
+    l.unlock();
+    auto& sh = _shard(victim);
+    std::lock_guard sl(sh.lock);
+    l.lock();
+    if (slot.chunk != victim || slot.filling) {
+      continue;
+    }
+    ldout(cct, 20) << __func__ << " demote 0x" << std::hex << victim
+		   << std::dec << " from slot " << s << dendl;
+    _drop(sh, s);
+    logger->inc(l_fast_tier_demotions);
+    return s;
+  }
+  return -1;
+}
+
+void FastTier::_decay()
+{
+  for (auto& sh : shards) {
+    std::lock_guard l(sh.lock);
+    for (auto p = sh.heat.begin(); p != sh.heat.end(); ) {
+      p->second /= 2;
+      if (p->second == 0) {
+	p = sh.heat.erase(p);
+      } else {
+	++p;
+      }
+    }
+  }
+}
+
+void FastTier::_mover_entry()
+{
+  std::unique_lock l(lock);
+  auto next_decay = ceph::mono_clock::now() + HEAT_DECAY_INTERVAL;
+  while (!stopping) {
+    if (ceph::mono_clock::now() >= next_decay) {
+      l.unlock();
+      _decay();
+      l.lock();
+      next_decay = ceph::mono_clock::now() + HEAT_DECAY_INTERVAL;
+      continue;
+    }
+    if (promote_queue.empty()) {
+      cond.wait_for(l, HEAT_DECAY_INTERVAL);
+      continue;
+    }
+    uint64_t c = promote_queue.front();
+    promote_queue.pop_front();
+    if (filling.count(c)) {
+      continue;
+    }
+    auto& sh = _shard(c);
+    l.unlock();
+    bool resident;
+    {
+      std::lock_guard sl(sh.lock);
+      resident = sh.chunk_map.count(c);
+    }
+    l.lock();
+    if (resident) {
+      continue;
+    }
+    int s = _get_slot(l);
+    if (s < 0) {
+      continue;
+    }
+    auto& slot = slots[s];
+    slot.filling = true;
+    ++slot.gen;
+    filling[c] = s;
+    ++num_filling;
+    l.unlock();
+
+    ceph::buffer::list bl;
+    IOContext ioc(cct, NULL);
+    int r = main_bdev->read(c, chunk_size, &bl, &ioc, false);
+    if (r == 0) {
+      r = fast_bdev->write(slot.fast_offset, bl, false);
+    }
+
+    std::unique_lock sl(sh.lock);
+    l.lock();
+    slot.filling = false;
+    auto p = filling.find(c);
+    bool ours = p != filling.end() && p->second == (unsigned)s;
+    if (ours) {
+      filling.erase(p);
+      --num_filling;
+    }
+    if (r == 0 && ours) {
+      slot.chunk = c;
+      slot.ref = true;
+      sh.chunk_map[c] = s;
+      ++num_resident;
+      logger->inc(l_fast_tier_promotions);
+      logger->inc(l_fast_tier_used_bytes, chunk_size);
+      ldout(cct, 20) << __func__ << " promoted 0x" << std::hex << c
+		     << std::dec << " to slot " << s << dendl;
+    } else {
+      if (r < 0) {
+	lderr(cct) << __func__ << " copying 0x" << std::hex << c << std::dec
+		   << " failed: " << cpp_strerror(r) << dendl;
+      }
+      ++slot.gen;
+      free_slots.push_back(s);
+    }
+    sl.unlock();
+  }
+}
@@ -0,0 +1,153 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "include/ceph_assert.h"
+#include "include/buffer.h"
+#include "include/common_fwd.h"
+#include "include/interval_set.h"
+#include "common/ceph_mutex.h"
+
+class BlockDevice;
+struct IOContext;
+
+enum {
+  l_fast_tier_first = 732700,
+  l_fast_tier_hits,
+  l_fast_tier_hit_bytes,
+  l_fast_tier_read_races,
+  l_fast_tier_promotions,
+  l_fast_tier_demotions,
+  l_fast_tier_invalidations,
+  l_fast_tier_used_bytes,
+  l_fast_tier_capacity_bytes,
+  l_fast_tier_last
+};
+
+/*
+ * Copies of hot main device data in spare space of the block.db device.
+ *
+ * The main device stays authoritative.  The tier is an in-memory map
+ * from fixed size chunks of the main device to slots of a preallocated
+ * BlueFS file, and starts out empty on every mount.  Reads that miss
+ * heat up the chunks they touch; once a chunk is hot enough the mover
+ * thread copies it into a slot, taking the coldest one (CLOCK) when the
+ * tier is full.  Anything that rewrites or releases main device space
+ * must invalidate() it first.
+ *
+ * Which chunks are in the tier, and how hot the others are, is split
+ * over shards by chunk, so reads only take the lock of the shards they
+ * touch.  The slots themselves, and the chunks being copied, are under
+ * the tier lock, which is always taken after a shard lock.
+ */
+class FastTier {
+  static constexpr uint64_t EMPTY = ~0ull;
+  static constexpr unsigned NUM_SHARDS = 16;
+
+  struct slot_t {
+    uint64_t fast_offset = 0;   ///< where the slot lives on the fast device
+    uint64_t chunk = EMPTY;     ///< main device chunk it holds
+    std::atomic<uint64_t> gen = {0};  ///< bumped whenever the contents change
+    std::atomic<bool> ref = {false};  ///< read since the clock hand last passed
+    bool filling = false;       ///< being written by the mover
+  };
+
+  struct shard_t {
+    ceph::mutex lock = ceph::make_mutex("FastTier::shard_t::lock");
+    std::unordered_map<uint64_t, unsigned> chunk_map;  ///< chunk -> slot
+    std::unordered_map<uint64_t, uint32_t> heat;       ///< chunk -> misses
+  };
+
+  CephContext* cct;
+  PerfCounters* logger = nullptr;
+  BlockDevice* main_bdev;
+  BlockDevice* fast_bdev;
+  const uint64_t chunk_size;
+  const unsigned promote_threshold;
+
+  std::array<shard_t, NUM_SHARDS> shards;
+  size_t max_heat = 0;        ///< chunks we keep heat for, per shard
+
+  ceph::mutex lock = ceph::make_mutex("FastTier::lock");
+  ceph::condition_variable cond;
+  bool stopping = false;
+  std::thread mover;
+
+  std::vector<slot_t> slots;
+  std::vector<unsigned> free_slots;
+  unsigned clock_hand = 0;
+  std::unordered_map<uint64_t, unsigned> filling;    ///< chunk -> slot
+  std::deque<uint64_t> promote_queue;
+  /// chunks in the tier or being copied, to let invalidate() skip locking
+  std::atomic<size_t> num_resident = {0};
+  std::atomic<size_t> num_filling = {0};
+
+  shard_t& _shard(uint64_t chunk) {
+    return shards[(chunk / chunk_size) % NUM_SHARDS];
+  }
+  bool _note_miss(shard_t& sh, uint64_t chunk);
+  void _queue_promote(const std::vector<uint64_t>& chunks);
+  void _drop(shard_t& sh, unsigned s);
+  int _get_slot(std::unique_lock<ceph::mutex>& l);
+  void _decay();
+  void _mover_entry();
+
+public:
+  /// a read served by the tier, between lookup() and finish_read()
+  struct read_t {
+    uint64_t offset = 0;        ///< main device range it stands for
+    uint64_t length = 0;
+    ceph::buffer::list* dst = nullptr;
+    uint64_t dst_offset = 0;    ///< where in dst the data goes
+    std::vector<std::pair<unsigned, uint64_t>> hits;  ///< slot, gen
+  };
+
+  /// fast_extents are (offset, length) pairs on fast_bdev, owned by the
+  /// caller for the lifetime of the tier
+  FastTier(CephContext* cct,
+	   BlockDevice* main_bdev,
+	   BlockDevice* fast_bdev,
+	   const std::vector<std::pair<uint64_t,uint64_t>>& fast_extents,
+	   uint64_t chunk_size,
+	   unsigned promote_threshold);
+  ~FastTier();
+
+  void start();
+  void stop();
+
+  /// true if all of main device range offset~length is in the tier;
+  /// otherwise note the access and return false
+  bool lookup(uint64_t offset, uint64_t length, read_t* r);
+
+  /// queue the reads of a lookup() hit on ioc, appending to bl, and
+  /// submit them to the fast device.  Anything else pending on ioc must
+  /// have been submitted to its own device already.
+  int submit_read(read_t* r, ceph::buffer::list* bl, IOContext* ioc);
+
+  /// once ioc is done: redo from the main device a read whose chunks
+  /// changed while it was in flight
+  int finish_read(const read_t& r);
+
+  /// serve main device range offset~length from the tier if all of it
+  /// is there, synchronously; otherwise note the access and return false
+  bool read(uint64_t offset, uint64_t length, ceph::buffer::list* bl);
+
+  /// main device range offset~length is about to change or be reused
+  void invalidate(uint64_t offset, uint64_t length);
+  void invalidate(const interval_set<uint64_t>& extents);
+
+  uint64_t get_capacity() const {
+    return slots.size() * chunk_size;
+  }
+  PerfCounters* get_perf_counters() const {
+    return logger;
+  }
+};
@@ -38,6 +38,20 @@ public:
   virtual void enumerate_reset() = 0;
   virtual bool enumerate_next(KeyValueDB *kvdb, uint64_t *offset, uint64_t *length) = 0;
 
+  /// stateless enumeration of the free extents within [begin, end), safe to
+  /// run concurrently for disjoint ranges; begin must be a multiple of
+  /// get_alloc_size() and extents are clipped at the range bounds.
+  /// Returns -EOPNOTSUPP if only enumerate_next() is available.
+  virtual int enumerate_range(
+    KeyValueDB *kvdb, uint64_t begin, uint64_t end,
+    std::function<void(uint64_t offset, uint64_t length)> cb) const {
+    return -EOPNOTSUPP;
+  }
+  /// granularity at which enumerate_range() bounds read no shared keys
+  virtual uint64_t get_enumerate_granularity() const {
+    return get_alloc_size();
+  }
+
   virtual void allocate(
     uint64_t offset, uint64_t length,
     KeyValueDB::Transaction txn) = 0;
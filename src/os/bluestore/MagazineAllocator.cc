@@ -0,0 +1,263 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "MagazineAllocator.h"
+
+#include "common/debug.h"
+#include "common/perf_counters.h"
+#include "include/intarith.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "MagazineAllocator "
+
+// threads pick their magazine once, in the order they first allocate
+static std::atomic<unsigned> next_thread_slot = {0};
+
+MagazineAllocator::MagazineAllocator(CephContext* _cct,
+				     Allocator* _backing,
+				     unsigned _num_magazines,
+				     uint64_t max_extent_size,
+				     unsigned _class_capacity)
+  : Allocator(_backing),
+    cct(_cct),
+    backing(_backing),
+    num_magazines(std::max(_num_magazines, 1u)),
+    num_classes(max_extent_size >= uint64_t(get_block_size()) ?
+		cbits(max_extent_size / get_block_size()) : 0),
+    class_capacity(std::max(_class_capacity, 2u)),
+    magazines(new magazine_t[num_magazines])
+{
+  ceph_assert(isp2(get_block_size()));
+  uint64_t per_magazine = 0;
+  for (unsigned c = 0; c < num_classes; ++c) {
+    per_magazine += _get_class_size(c) * class_capacity;
+  }
+  refill_reserve = 2 * per_magazine * num_magazines;
+  for (unsigned i = 0; i < num_magazines; ++i) {
+    magazines[i].classes.resize(num_classes);
+  }
+
+  PerfCountersBuilder b(cct, "bluestore_alloc_magazines",
+			l_alloc_magazines_first, l_alloc_magazines_last);
+  b.add_u64_counter(l_alloc_magazines_hits, "hits",
+		    "Allocations served from a magazine");
+  b.add_u64_counter(l_alloc_magazines_misses, "misses",
+		    "Allocations passed on to the backing allocator");
+  b.add_u64_counter(l_alloc_magazines_drains, "drains",
+		    "Times all magazines were handed back to the backing "
+		    "allocator");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  ldout(cct, 1) << __func__ << " " << num_magazines << " magazines, "
+		<< num_classes << " size classes up to 0x" << std::hex
+		<< (num_classes ? _get_class_size(num_classes - 1) : 0)
+		<< ", refill reserve 0x" << refill_reserve << std::dec
+		<< dendl;
+}
+
+MagazineAllocator::~MagazineAllocator()
+{
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+int MagazineAllocator::_get_class(uint64_t length) const
+{
+  uint64_t bs = get_block_size();
+  if (length < bs || !isp2(length)) {
+    return -1;
+  }
+  int c = cbits(length / bs) - 1;
+  return c < (int)num_classes ? c : -1;
+}
+
+MagazineAllocator::magazine_t& MagazineAllocator::_get_magazine()
+{
+  static thread_local unsigned slot = next_thread_slot++;
+  return magazines[slot % num_magazines];
+}
+
+void MagazineAllocator::_refill(std::vector<uint64_t>& stack, int c)
+{
+  if (backing->get_free() < refill_reserve) {
+    // getting full, keep what's left where everybody can reach it
+    return;
+  }
+  uint64_t size = _get_class_size(c);
+  uint64_t want = size * (class_capacity / 2);
+  PExtentVector exts;
+  int64_t got = backing->allocate(want, get_block_size(), want, 0, &exts);
+  if (got <= 0) {
+    return;
+  }
+  interval_set<uint64_t> leftover;
+  for (auto& e : exts) {
+    uint64_t off = e.offset;
+    uint64_t end = e.offset + e.length;
+    for (; off + size <= end; off += size) {
+      stack.push_back(off);
+    }
+    if (off < end) {
+      leftover.insert(off, end - off);
+    }
+  }
+  cached_bytes += got - leftover.size();
+  if (!leftover.empty()) {
+    backing->release(leftover);
+  }
+}
+
+void MagazineAllocator::_drain_all()
+{
+  interval_set<uint64_t> to_release;
+  for (unsigned i = 0; i < num_magazines; ++i) {
+    auto& m = magazines[i];
+    std::lock_guard l(m.lock);
+    for (unsigned c = 0; c < num_classes; ++c) {
+      uint64_t size = _get_class_size(c);
+      for (auto off : m.classes[c]) {
+	to_release.insert(off, size);
+      }
+      m.classes[c].clear();
+    }
+  }
+  if (!to_release.empty()) {
+    logger->inc(l_alloc_magazines_drains);
+    ldout(cct, 10) << __func__ << " returning 0x" << std::hex
+		   << to_release.size() << std::dec << " bytes" << dendl;
+    cached_bytes -= to_release.size();
+    backing->release(to_release);
+  }
+}
+
+int64_t MagazineAllocator::allocate(
+  uint64_t want,
+  uint64_t unit,
+  uint64_t max_alloc_size,
+  int64_t  hint,
+  PExtentVector *extents)
+{
+  // cached extents are only guaranteed to be aligned to our block size
+  int c = unit == uint64_t(get_block_size()) ? _get_class(want) : -1;
+  if (c >= 0 && (max_alloc_size == 0 || max_alloc_size >= want)) {
+    auto& m = _get_magazine();
+    std::lock_guard l(m.lock);
+    auto& stack = m.classes[c];
+    if (stack.empty()) {
+      _refill(stack, c);
+    }
+    if (!stack.empty()) {
+      logger->inc(l_alloc_magazines_hits);
+      extents->emplace_back(stack.back(), want);
+      stack.pop_back();
+      cached_bytes -= want;
+      return want;
+    }
+  }
+  logger->inc(l_alloc_magazines_misses);
+  int64_t r = backing->allocate(want, unit, max_alloc_size, hint, extents);
+  if (r < (int64_t)want && cached_bytes > 0) {
+    // out of space in the backing allocator, give it everything we hold
+    // and try again for the rest
+    _drain_all();
+    int64_t done = std::max<int64_t>(r, 0);
+    int64_t more = backing->allocate(want - done, unit, max_alloc_size, hint,
+				     extents);
+    if (more > 0) {
+      r = done + more;
+    }
+  }
+  return r;
+}
+
+void MagazineAllocator::release(const interval_set<uint64_t>& release_set)
+{
+  interval_set<uint64_t> to_release;
+  // releases mostly come from a few finisher threads, spread them out so
+  // that every magazine gets its share back
+  auto& m = magazines[release_cursor++ % num_magazines];
+  {
+    std::lock_guard l(m.lock);
+    for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+      int c = _get_class(p.get_len());
+      if (c >= 0 && p2phase<uint64_t>(p.get_start(), get_block_size()) == 0 &&
+	  m.classes[c].size() < class_capacity) {
+	m.classes[c].push_back(p.get_start());
+	cached_bytes += p.get_len();
+      } else {
+	to_release.insert(p.get_start(), p.get_len());
+      }
+    }
+  }
+  if (!to_release.empty()) {
+    backing->release(to_release);
+  }
+}
+
+void MagazineAllocator::dump()
+{
+  ldout(cct, 0) << __func__ << " cached 0x" << std::hex << cached_bytes
+		<< std::dec
+		<< " hits " << logger->get(l_alloc_magazines_hits)
+		<< " misses " << logger->get(l_alloc_magazines_misses)
+		<< " drains " << logger->get(l_alloc_magazines_drains) << dendl;
+  for (unsigned i = 0; i < num_magazines; ++i) {
+    auto& m = magazines[i];
+    std::lock_guard l(m.lock);
+    for (unsigned c = 0; c < num_classes; ++c) {
+      if (!m.classes[c].empty()) {
+	ldout(cct, 0) << __func__ << " magazine " << i << " 0x" << std::hex
+		      << _get_class_size(c) << std::dec << " x "
+		      << m.classes[c].size() << dendl;
+      }
+    }
+  }
+  backing->dump();
+}
+
+void MagazineAllocator::dump(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  backing->dump(notify);
+  for (unsigned i = 0; i < num_magazines; ++i) {
+    auto& m = magazines[i];
+    std::lock_guard l(m.lock);
+    for (unsigned c = 0; c < num_classes; ++c) {
+      uint64_t size = _get_class_size(c);
+      for (auto off : m.classes[c]) {
+	notify(off, size);
+      }
+    }
+  }
+}
+
+void MagazineAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  backing->init_add_free(offset, length);
+}
+
+void MagazineAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  // the range may be sitting in a magazine
+  _drain_all();
+  backing->init_rm_free(offset, length);
+}
+
+uint64_t MagazineAllocator::get_free()
+{
+  return backing->get_free() + cached_bytes;
+}
+
+double MagazineAllocator::get_fragmentation()
+{
+  return backing->get_fragmentation();
+}
+
+void MagazineAllocator::shutdown()
+{
+  _drain_all();
+  backing->shutdown();
+}
@@ -0,0 +1,109 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Allocator.h"
+#include "include/common_fwd.h"
+#include "common/ceph_mutex.h"
+
+enum {
+  l_alloc_magazines_first = 732800,
+  l_alloc_magazines_hits,
+  l_alloc_magazines_misses,
+  l_alloc_magazines_drains,
+  l_alloc_magazines_last
+};
+
+/*
+ * Per-thread caches of free extents ("magazines") in front of another
+ * allocator.
+ *
+ * Allocations of a single block-aligned power of two size up to
+ * max_extent_size are served from the calling thread's magazine, so
+ * they don't contend on the backing allocator's lock. Magazines are
+ * refilled from the backing allocator in batches and released extents
+ * are put back into them; whatever doesn't fit is returned in one
+ * bulk release. Cached extents are still free space: get_free() and
+ * dump() account for them, and they are all handed back once the
+ * backing allocator runs short. The admin socket commands of the
+ * backing allocator are taken over, so they see the cached extents too.
+ */
+class MagazineAllocator : public Allocator {
+  struct magazine_t {
+    ceph::mutex lock = ceph::make_mutex("MagazineAllocator::magazine_t::lock");
+    // stacks of extent offsets, one per size class
+    std::vector<std::vector<uint64_t>> classes;
+  };
+
+  CephContext* cct;
+  std::unique_ptr<Allocator> backing;
+  const unsigned num_magazines;
+  const unsigned num_classes;
+  const unsigned class_capacity;  // extents per size class and magazine
+  std::unique_ptr<magazine_t[]> magazines;
+  // don't refill magazines when the backing allocator has less than that
+  uint64_t refill_reserve = 0;
+
+  std::atomic<uint64_t> cached_bytes = {0};
+  std::atomic<unsigned> release_cursor = {0};
+  PerfCounters* logger = nullptr;
+
+  int _get_class(uint64_t length) const;
+  uint64_t _get_class_size(int c) const {
+    return uint64_t(get_block_size()) << c;
+  }
+  magazine_t& _get_magazine();
+  void _refill(std::vector<uint64_t>& stack, int c);
+  void _drain_all();
+
+public:
+  /// takes ownership of backing
+  MagazineAllocator(CephContext* cct,
+		    Allocator* backing,
+		    unsigned num_magazines,
+		    uint64_t max_extent_size,
+		    unsigned class_capacity);
+  ~MagazineAllocator() override;
+
+  const char* get_type() const override
+  {
+    return backing->get_type();
+  }
+
+  int64_t allocate(
+    uint64_t want,
+    uint64_t unit,
+    uint64_t max_alloc_size,
+    int64_t  hint,
+    PExtentVector *extents) override;
+  void release(const interval_set<uint64_t>& release_set) override;
+
+  void dump() override;
+  void dump(std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void zoned_set_zone_states(std::vector<zone_state_t> &&_zone_states) override {
+    backing->zoned_set_zone_states(std::move(_zone_states));
+  }
+  bool zoned_get_zones_to_clean(std::deque<uint64_t> *zones_to_clean) override {
+    return backing->zoned_get_zones_to_clean(zones_to_clean);
+  }
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+  void shutdown() override;
+
+  uint64_t get_cached_bytes() const {
+    return cached_bytes;
+  }
+  PerfCounters* get_perf_counters() const {
+    return logger;
+  }
+};
@@ -276,7 +276,8 @@ int main(int argc, char **argv)
         "free-score, "
         "bluefs-stats, "
         "reshard, "
-        "show-sharding")
+        "show-sharding, "
+        "bench-open")
     ;
   po::options_description po_all("All options");
   po_all.add(po_options).add(po_positional);
@@ -309,7 +310,8 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  if (action == "fsck" || action == "repair" || action == "quick-fix") {
+  if (action == "fsck" || action == "repair" || action == "quick-fix" ||
+      action == "bench-open") {
     if (path.empty()) {
       cerr << "must specify bluestore path" << std::endl;
       exit(EXIT_FAILURE);
@@ -972,6 +974,34 @@ int main(int argc, char **argv)
       exit(EXIT_FAILURE);
     }
     cout << sharding << std::endl;
+  } else if (action == "bench-open") {
+    // time a read-only open (allocator rebuild included) followed by a
+    // shallow or, with --deep, a deep fsck
+    validate_path(cct.get(), path, false);
+    BlueStore bluestore(cct.get(), path);
+    JSONFormatter jf(true);
+    jf.open_object_section("bench_open");
+    int r = bluestore.cold_open();
+    if (r < 0) {
+      cerr << "error from cold_open: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    jf.open_object_section("open");
+    bluestore.dump_open_phases(&jf);
+    jf.close_section();
+    bluestore.cold_close();
+
+    r = fsck_deep ? bluestore.fsck(true) : bluestore.fsck_shallow();
+    if (r < 0) {
+      cerr << "fsck failed: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    jf.open_object_section("fsck");
+    jf.dump_int("errors", r);
+    bluestore.dump_open_phases(&jf);
+    jf.close_section();
+    jf.close_section();
+    jf.flush(cout);
   } else {
     cerr << "unrecognized action " << action << std::endl;
     return 1;
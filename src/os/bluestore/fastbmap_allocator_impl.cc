@@ -8,6 +8,13 @@
 
 #include "fastbmap_allocator_impl.h"
 
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(NON_CEPH_BUILD)
+#define HAVE_FASTBMAP_X86_KERNELS
+#include <immintrin.h>
+#include "arch/probe.h"
+#include "arch/intel.h"
+#endif
+
 uint64_t AllocatorLevel::l0_dives = 0;
 uint64_t AllocatorLevel::l0_iterations = 0;
 uint64_t AllocatorLevel::l0_inner_iterations = 0;
@@ -15,6 +22,132 @@ uint64_t AllocatorLevel::alloc_fragments = 0;
 uint64_t AllocatorLevel::alloc_fragments_fast = 0;
 uint64_t AllocatorLevel::l2_allocs = 0;
 
+static slotset_state_t slotset_state_scalar(const slot_t* slotset)
+{
+  slot_t any = all_slot_clear;
+  slot_t all = all_slot_set;
+  for (size_t i = 0; i < slots_per_slotset; ++i) {
+    any |= slotset[i];
+    all &= slotset[i];
+  }
+  if (any == all_slot_clear) {
+    return SLOTSET_ALL_CLEAR;
+  }
+  return all == all_slot_set ? SLOTSET_ALL_SET : SLOTSET_MIXED;
+}
+
+static uint64_t count_set_scalar(const slot_t* slots, size_t count)
+{
+  uint64_t res = 0;
+  for (size_t i = 0; i < count; ++i) {
+    auto v = slots[i];
+    if (v == all_slot_set) {
+      res += bits_per_slot;
+    } else if (v != all_slot_clear) {
+#ifdef __GNUC__
+      res += __builtin_popcountll(v);
+#else
+      // Kernighan's Alg to count set bits
+      while (v) {
+        v &= (v - 1);
+        res++;
+      }
+#endif
+    }
+  }
+  return res;
+}
+
+static const fastbmap_kernels_t fastbmap_scalar = {
+  "scalar", slotset_state_scalar, count_set_scalar
+};
+
+#ifdef HAVE_FASTBMAP_X86_KERNELS
+
+__attribute__((target("avx2")))
+static slotset_state_t slotset_state_avx2(const slot_t* slotset)
+{
+  static_assert(slotset_bytes == 2 * sizeof(__m256i));
+  auto p = reinterpret_cast<const __m256i*>(slotset);
+  __m256i a = _mm256_loadu_si256(p);
+  __m256i b = _mm256_loadu_si256(p + 1);
+  __m256i any = _mm256_or_si256(a, b);
+  if (_mm256_testz_si256(any, any)) {
+    return SLOTSET_ALL_CLEAR;
+  }
+  // testc is set when all the bits of the second operand are set in the first
+  return _mm256_testc_si256(_mm256_and_si256(a, b), _mm256_set1_epi64x(-1)) ?
+    SLOTSET_ALL_SET : SLOTSET_MIXED;
+}
+
+// nibble lookup popcount (W. Mula), 4 slots per iteration
+__attribute__((target("avx2")))
+static uint64_t count_set_avx2(const slot_t* slots, size_t count)
+{
+  const __m256i lookup = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(slots + i));
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+				  _mm256_shuffle_epi8(lookup, hi));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+  }
+  uint64_t res = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+    _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  return res + count_set_scalar(slots + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static slotset_state_t slotset_state_avx512(const slot_t* slotset)
+{
+  static_assert(slotset_bytes == sizeof(__m512i));
+  __m512i v = _mm512_loadu_si512(slotset);
+  if (_mm512_test_epi64_mask(v, v) == 0) {
+    return SLOTSET_ALL_CLEAR;
+  }
+  return _mm512_cmpeq_epi64_mask(v, _mm512_set1_epi64(-1)) == 0xff ?
+    SLOTSET_ALL_SET : SLOTSET_MIXED;
+}
+
+static const fastbmap_kernels_t fastbmap_avx2 = {
+  "avx2", slotset_state_avx2, count_set_avx2
+};
+// without avx512bw there is no byte shuffle on zmm, so counting stays on ymm
+static const fastbmap_kernels_t fastbmap_avx512 = {
+  "avx512f", slotset_state_avx512, count_set_avx2
+};
+
+#endif // HAVE_FASTBMAP_X86_KERNELS
+
+std::vector<const fastbmap_kernels_t*> fastbmap_available_kernels()
+{
+  std::vector<const fastbmap_kernels_t*> res = { &fastbmap_scalar };
+#ifdef HAVE_FASTBMAP_X86_KERNELS
+  ceph_arch_probe();
+  if (ceph_arch_intel_avx2) {
+    res.push_back(&fastbmap_avx2);
+    if (ceph_arch_intel_avx512f) {
+      res.push_back(&fastbmap_avx512);
+    }
+  }
+#endif
+  return res;
+}
+
+const fastbmap_kernels_t& fastbmap_kernels()
+{
+  // the last one available is the widest
+  static const fastbmap_kernels_t* chosen = fastbmap_available_kernels().back();
+  return *chosen;
+}
+
 inline interval_t _align2units(uint64_t offset, uint64_t len, uint64_t min_length)
 {
   interval_t res;
@@ -93,30 +226,40 @@ interval_t AllocatorLevel01Loose::_get_longest_from_l0(uint64_t pos0,
       }
     } //if ((pos % d) == 0)
 
-    end_loop = ++pos >= pos1;
-    if (bits & 1) {
-      // item is free
-      if (!res_candidate.length) {
-	res_candidate.offset = pos - 1;
-      }
-      ++res_candidate.length;
-      if (end_loop) {
-	*tail = res_candidate;
+    // mixed or partially covered slot, walk it run by run
+    uint64_t slot_end = std::min(pos1, p2roundup<uint64_t>(pos + 1, d));
+    while (pos < slot_end) {
+      uint64_t run;
+      if (bits & 1) {
+	// items are free
+	run = find_next_clear_bit(bits, 0);
+	run = std::min(run, slot_end - pos);
+	if (!res_candidate.length) {
+	  res_candidate.offset = pos;
+	}
+	res_candidate.length += run;
+      } else {
+	run = find_next_set_bit(bits, 0);
+	run = std::min(run, slot_end - pos);
 	res_candidate = _align2units(res_candidate.offset,
 	  res_candidate.length, min_granules);
 	if (res.length < res_candidate.length) {
 	  res = res_candidate;
 	}
+	res_candidate = interval_t();
       }
-    } else {
+      pos += run;
+      bits = run < d ? bits >> run : 0;
+    }
+    end_loop = pos >= pos1;
+    if (end_loop && res_candidate.length) {
+      *tail = res_candidate;
       res_candidate = _align2units(res_candidate.offset,
 	res_candidate.length, min_granules);
       if (res.length < res_candidate.length) {
 	res = res_candidate;
       }
-      res_candidate = interval_t();
     }
-    bits >>= 1;
   } while (!end_loop);
   res.offset *= l0_granularity;
   res.length *= l0_granularity;
@@ -217,64 +360,45 @@ void AllocatorLevel01Loose::_mark_l1_on_l0(int64_t l0_pos, int64_t l0_pos_end)
 
   int64_t idx = l0_pos / bits_per_slot;
   int64_t idx_end = l0_pos_end / bits_per_slot;
-  slot_t mask_to_apply = L1_ENTRY_NOT_USED;
+  auto& kernels = fastbmap_kernels();
 
   auto l1_pos = l0_pos / d0;
 
-  while (idx < idx_end) {
-    if (l0[idx] == all_slot_clear) {
-      // if not all prev slots are allocated then no need to check the
-      // current slot set, it's partial
-      ++idx;
-      if (mask_to_apply == L1_ENTRY_NOT_USED) {
-	mask_to_apply = L1_ENTRY_FULL;
-      } else if (mask_to_apply != L1_ENTRY_FULL) {
-	idx = p2roundup(idx, int64_t(slots_per_slotset));
-        mask_to_apply = L1_ENTRY_PARTIAL;
-      }
-    } else if (l0[idx] == all_slot_set) {
-      // if not all prev slots are free then no need to check the
-      // current slot set, it's partial
-      ++idx;
-      if (mask_to_apply == L1_ENTRY_NOT_USED) {
-	mask_to_apply = L1_ENTRY_FREE;
-      } else if (mask_to_apply != L1_ENTRY_FREE) {
-	idx = p2roundup(idx, int64_t(slots_per_slotset));
-        mask_to_apply = L1_ENTRY_PARTIAL;
-      }
-    } else {
-      // no need to check the current slot set, it's partial
+  for (; idx < idx_end; idx += slots_per_slotset, ++l1_pos) {
+    slot_t mask_to_apply;
+    switch (kernels.slotset_state(l0.data() + idx)) {
+    case SLOTSET_ALL_CLEAR:
+      mask_to_apply = L1_ENTRY_FULL;
+      break;
+    case SLOTSET_ALL_SET:
+      mask_to_apply = L1_ENTRY_FREE;
+      break;
+    default:
       mask_to_apply = L1_ENTRY_PARTIAL;
-      ++idx;
-      idx = p2roundup(idx, int64_t(slots_per_slotset));
+      break;
     }
-    if ((idx % slots_per_slotset) == 0) {
-      ceph_assert(mask_to_apply != L1_ENTRY_NOT_USED);
-      uint64_t shift = (l1_pos % l1_w) * L1_ENTRY_WIDTH;
-      slot_t& slot_val = l1[l1_pos / l1_w];
-      auto mask = slot_t(L1_ENTRY_MASK) << shift;
-
-      slot_t old_mask = (slot_val & mask) >> shift;
-      switch(old_mask) {
-      case L1_ENTRY_FREE:
-	unalloc_l1_count--;
-	break;
-      case L1_ENTRY_PARTIAL:
-	partial_l1_count--;
-	break;
-      }
-      slot_val &= ~mask;
-      slot_val |= slot_t(mask_to_apply) << shift;
-      switch(mask_to_apply) {
-      case L1_ENTRY_FREE:
-	unalloc_l1_count++;
-	break;
-      case L1_ENTRY_PARTIAL:
-	partial_l1_count++;
-	break;
-      }
-      mask_to_apply = L1_ENTRY_NOT_USED;
-      ++l1_pos;
+    uint64_t shift = (l1_pos % l1_w) * L1_ENTRY_WIDTH;
+    slot_t& slot_val = l1[l1_pos / l1_w];
+    auto mask = slot_t(L1_ENTRY_MASK) << shift;
+
+    slot_t old_mask = (slot_val & mask) >> shift;
+    switch(old_mask) {
+    case L1_ENTRY_FREE:
+      unalloc_l1_count--;
+      break;
+    case L1_ENTRY_PARTIAL:
+      partial_l1_count--;
+      break;
+    }
+    slot_val &= ~mask;
+    slot_val |= slot_t(mask_to_apply) << shift;
+    switch(mask_to_apply) {
+    case L1_ENTRY_FREE:
+      unalloc_l1_count++;
+      break;
+    case L1_ENTRY_PARTIAL:
+      partial_l1_count++;
+      break;
     }
   }
 }
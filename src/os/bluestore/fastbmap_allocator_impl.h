@@ -55,19 +55,50 @@ static const slot_t all_slot_clear = 0;
 inline size_t find_next_set_bit(slot_t slot_val, size_t start_pos)
 {
 #ifdef __GNUC__
-  if (start_pos == 0) {
-    start_pos = __builtin_ffsll(slot_val);
-    return start_pos ? start_pos - 1 : bits_per_slot;
+  if (start_pos >= bits_per_slot) {
+    return bits_per_slot;
   }
-#endif
+  // drop the bits below start_pos and let ffs find the next one
+  slot_val &= all_slot_set << start_pos;
+  start_pos = __builtin_ffsll(slot_val);
+  return start_pos ? start_pos - 1 : bits_per_slot;
+#else
   slot_t mask = slot_t(1) << start_pos;
   while (start_pos < bits_per_slot && !(slot_val & mask)) {
     mask <<= 1;
     ++start_pos;
   }
   return start_pos;
+#endif
+}
+
+inline size_t find_next_clear_bit(slot_t slot_val, size_t start_pos)
+{
+  return find_next_set_bit(~slot_val, start_pos);
 }
 
+// Kernels working on whole slotsets (a cache line of l0 bits).
+// Vectorized variants are picked at runtime from the CPU features,
+// the way crc32c picks its implementation.
+enum slotset_state_t {
+  SLOTSET_ALL_CLEAR = 0, // all the entries are allocated
+  SLOTSET_ALL_SET,       // all the entries are free
+  SLOTSET_MIXED,
+};
+
+struct fastbmap_kernels_t {
+  const char* name;
+  // classify slots_per_slotset slots starting at slotset
+  slotset_state_t (*slotset_state)(const slot_t* slotset);
+  // number of set (free) bits in count slots
+  uint64_t (*count_set)(const slot_t* slots, size_t count);
+};
+
+// the implementation chosen for this CPU
+const fastbmap_kernels_t& fastbmap_kernels();
+// all implementations this CPU can run, scalar one first
+std::vector<const fastbmap_kernels_t*> fastbmap_available_kernels();
+
 
 class AllocatorLevel
 {
@@ -229,34 +260,20 @@ class AllocatorLevel01Loose : public AllocatorLevel01
 
       auto free_pos = find_next_set_bit(slot_val, 0);
       ceph_assert(free_pos < bits_per_slot);
-      auto next_pos = free_pos + 1;
-      while (next_pos < bits_per_slot &&
-        (next_pos - free_pos) < need_entries) {
+      do {
 	++l0_inner_iterations;
-
-        if (0 == (slot_val & (slot_t(1) << next_pos))) {
-          auto to_alloc = (next_pos - free_pos);
-          *allocated += to_alloc * l0_granularity;
-	  ++alloc_fragments;
-          need_entries -= to_alloc;
-	  _fragment_and_emplace(max_length, (base + free_pos) * l0_granularity,
-	    to_alloc * l0_granularity, res);
-          _mark_alloc_l0(base + free_pos, base + next_pos);
-          free_pos = find_next_set_bit(slot_val, next_pos + 1);
-          next_pos = free_pos + 1;
-        } else {
-          ++next_pos;
-        }
-      }
-      if (need_entries && free_pos < bits_per_slot) {
-        auto to_alloc = std::min(need_entries, d0 - free_pos);
-        *allocated += to_alloc * l0_granularity;
+	// take the whole free run starting at free_pos, up to what's needed
+	uint64_t run_end = std::min<uint64_t>(
+	  find_next_clear_bit(slot_val, free_pos), free_pos + need_entries);
+	auto to_alloc = run_end - free_pos;
+	*allocated += to_alloc * l0_granularity;
 	++alloc_fragments;
 	need_entries -= to_alloc;
 	_fragment_and_emplace(max_length, (base + free_pos) * l0_granularity,
 	  to_alloc * l0_granularity, res);
-        _mark_alloc_l0(base + free_pos, base + free_pos + to_alloc);
-      }
+	_mark_alloc_l0(base + free_pos, base + run_end);
+	free_pos = find_next_set_bit(slot_val, run_end);
+      } while (need_entries && free_pos < bits_per_slot);
     }
     return _is_empty_l0(l0_pos0, l0_pos1);
   }
@@ -478,23 +495,8 @@ public:
     }
 
     uint64_t res = 0;
-    for (uint64_t i = idx0; i < idx1; ++i) {
-      auto v = l0[i];
-      if (v == all_slot_set) {
-        res += L0_ENTRIES_PER_SLOT;
-      } else if (v != all_slot_clear) {
-        size_t cnt = 0;
-#ifdef __GNUC__
-        cnt = __builtin_popcountll(v);
-#else
-        // Kernighan's Alg to count set bits
-        while (v) {
-          v &= (v - 1);
-          cnt++;
-        }
-#endif
-        res += cnt;
-      }
+    if (idx1 > idx0) {
+      res = fastbmap_kernels().count_set(l0.data() + idx0, idx1 - idx0);
     }
     return res * l0_granularity;
   }
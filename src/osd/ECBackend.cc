@@ -174,6 +174,8 @@ ostream &operator<<(ostream &lhs, const ECBackend::Op &rhs)
       << " pending_commit=" << rhs.pending_commit
       << " plan.to_read=" << rhs.plan.to_read
       << " plan.will_write=" << rhs.plan.will_write
+      << " plan.delta_writes=" << rhs.plan.delta_writes.size()
+      << " delta_reads_pending=" << rhs.delta_reads_pending
       << ")";
   return lhs;
 }
@@ -1673,7 +1675,8 @@ int ECBackend::get_remaining_shards(
   const set<int> &want,
   const read_result_t &result,
   map<pg_shard_t, vector<pair<int, int>>> *to_read,
-  bool for_recovery)
+  bool for_recovery,
+  bool keep_subchunks)
 {
   ceph_assert(to_read);
 
@@ -1708,7 +1711,8 @@ int ECBackend::get_remaining_shards(
        ++i) {
     ceph_assert(shards.count(shard_id_t(*i)));
     ceph_assert(avail.find(*i) == avail.end());
-    to_read->insert(make_pair(shards[shard_id_t(*i)], subchunks));
+    to_read->insert(make_pair(shards[shard_id_t(*i)],
+			      keep_subchunks ? need[*i] : subchunks));
   }
   return 0;
 }
@@ -1877,6 +1881,9 @@ void ECBackend::start_rmw(Op *op, PGTransactionUPtr &&t)
 {
   ceph_assert(op);
 
+  bool deltas = get_parent()->get_pool().allows_ecoverwrites() &&
+    ec_impl->supports_parity_delta() &&
+    cct->_conf.get_val<bool>("osd_ec_parity_delta_writes");
   op->plan = ECTransaction::get_write_plan(
     sinfo,
     std::move(t),
@@ -1891,7 +1898,8 @@ void ECBackend::start_rmw(Op *op, PGTransactionUPtr &&t)
       }
       return ref;
     },
-    get_parent()->get_dpp());
+    get_parent()->get_dpp(),
+    deltas ? ec_impl : ErasureCodeInterfaceRef());
 
   dout(10) << __func__ << ": " << *op << dendl;
 
@@ -1927,6 +1935,7 @@ bool ECBackend::try_state_to_reads()
 
   if (op->using_cache) {
     cache.open_write_pin(op->pin);
+    choose_delta_writes(op);
 
     extent_set empty;
     for (auto &&hpair: op->plan.will_write) {
@@ -1953,6 +1962,8 @@ bool ECBackend::try_state_to_reads()
       }
     }
   } else {
+    // deltas rely on the cache to know the parity they read is current
+    op->plan.delta_writes.clear();
     op->remote_read = op->plan.to_read;
   }
 
@@ -1969,10 +1980,192 @@ bool ECBackend::try_state_to_reads()
 	check_ops();
       });
   }
+  if (!op->plan.delta_writes.empty()) {
+    start_delta_reads(op);
+  }
 
   return true;
 }
 
+void ECBackend::choose_delta_writes(Op *op)
+{
+  auto &plan = op->plan;
+  for (auto i = plan.delta_writes.begin(); i != plan.delta_writes.end(); ) {
+    const hobject_t &hoid = i->first;
+    auto &dw = i->second;
+    // The parity we would read is only current once earlier writes to
+    // these stripes are done, and the cache only holds their data.
+    if (cache.is_pinned(hoid, dw.stripes)) {
+      dout(20) << __func__ << ": " << hoid << " has writes in progress on "
+	       << dw.stripes << ", rewriting whole stripes" << dendl;
+      i = plan.delta_writes.erase(i);
+      continue;
+    }
+    // Nor can we update shards we would have to rebuild first.
+    set<int> have;
+    map<shard_id_t, pg_shard_t> shards;
+    get_all_avail_shards(hoid, set<pg_shard_t>(), have, shards, false);
+    if (have.size() < ec_impl->get_chunk_count()) {
+      dout(20) << __func__ << ": " << hoid << " is degraded"
+	       << ", rewriting whole stripes" << dendl;
+      i = plan.delta_writes.erase(i);
+      continue;
+    }
+    dout(20) << __func__ << ": " << hoid << " writing "
+	     << dw.will_write << " with parity deltas" << dendl;
+    plan.will_write[hoid] = dw.will_write;
+    plan.to_read.erase(hoid);
+    ++i;
+  }
+}
+
+struct FinishDeltaRead :
+  public GenContext<pair<RecoveryMessages*, ECBackend::read_result_t& > &> {
+  ECBackend *ec;
+  ECBackend::Op *op;
+  hobject_t hoid;
+  FinishDeltaRead(ECBackend *ec, ECBackend::Op *op, const hobject_t &hoid)
+    : ec(ec), op(op), hoid(hoid) {}
+  void finish(pair<RecoveryMessages *, ECBackend::read_result_t &> &in) override {
+    ec->handle_delta_read(op, hoid, in.second);
+  }
+};
+
+void ECBackend::start_delta_reads(Op *op)
+{
+  vector<pair<int, int>> subchunks;
+  subchunks.push_back(make_pair(0, ec_impl->get_sub_chunk_count()));
+
+  map<hobject_t, set<int>> want_to_read;
+  map<hobject_t, read_request_t> for_read_op;
+  for (auto &&i : op->plan.delta_writes) {
+    const hobject_t &hoid = i.first;
+    const auto &dw = i.second;
+
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
+    for (auto &&extent : dw.stripes) {
+      to_read.push_back(boost::make_tuple(extent.first, extent.second, 0));
+    }
+    set<int> have;
+    map<shard_id_t, pg_shard_t> shards;
+    get_all_avail_shards(hoid, set<pg_shard_t>(), have, shards, false);
+    map<pg_shard_t, vector<pair<int, int>>> need;
+    for (auto shard : dw.shards) {
+      ceph_assert(shards.count(shard_id_t(shard)));
+      need[shards[shard_id_t(shard)]] = subchunks;
+    }
+    for_read_op.insert(
+      make_pair(
+	hoid,
+	read_request_t(
+	  to_read,
+	  need,
+	  false,
+	  new FinishDeltaRead(this, op, hoid))));
+    want_to_read.insert(make_pair(hoid, dw.shards));
+  }
+  op->delta_reads_pending = for_read_op.size();
+  start_read_op(
+    CEPH_MSG_PRIO_DEFAULT,
+    want_to_read,
+    for_read_op,
+    OpRequestRef(),
+    false, false);
+}
+
+void ECBackend::handle_delta_read(
+  Op *op,
+  const hobject_t &hoid,
+  read_result_t &res)
+{
+  auto &dw = op->plan.delta_writes.at(hoid);
+  if (res.r != 0) {
+    // even reading around the shards that failed did; read the whole
+    // stripes, as a full stripe rmw would, and work out the old chunks
+    // from them
+    dout(0) << __func__ << ": error " << res.r << " reading " << hoid
+	    << " for " << *op << ", reading whole stripes " << dw.stripes
+	    << dendl;
+    objects_read_async_no_cache(
+      map<hobject_t, extent_set>{{hoid, dw.stripes}},
+      [this, op, hoid](map<hobject_t, pair<int, extent_map> > &&results) {
+	auto &result = results[hoid];
+	handle_delta_stripes_read(op, hoid, result.first, result.second);
+      });
+    return;
+  }
+  ceph_assert(res.returned.size() == dw.stripes.num_intervals());
+  for (auto &&returned : res.returned) {
+    pair<uint64_t, uint64_t> chunk_off_len =
+      sinfo.aligned_offset_len_to_chunk(
+	make_pair(returned.get<0>(), returned.get<1>()));
+    map<int, bufferlist> chunks;
+    for (auto &&j : returned.get<2>()) {
+      chunks[j.first.shard] = std::move(j.second);
+    }
+    // shards which failed were read around, rebuild them from the rest
+    map<int, bufferlist> rebuilt;
+    map<int, bufferlist*> to_rebuild;
+    for (auto shard : dw.shards) {
+      if (!chunks.count(shard)) {
+	to_rebuild[shard] = &rebuilt[shard];
+      }
+    }
+    if (!to_rebuild.empty()) {
+      dout(10) << __func__ << ": " << hoid << " rebuilding shards "
+	       << rebuilt.size() << dendl;
+      int r = ECUtil::decode(sinfo, ec_impl, chunks, to_rebuild);
+      ceph_assert(r == 0);
+      for (auto &&j : rebuilt) {
+	chunks[j.first] = std::move(j.second);
+      }
+    }
+    for (auto shard : dw.shards) {
+      ceph_assert(chunks[shard].length() == chunk_off_len.second);
+      dw.old_chunks[shard].insert(
+	chunk_off_len.first, chunk_off_len.second, chunks[shard]);
+    }
+  }
+  ceph_assert(op->delta_reads_pending > 0);
+  --op->delta_reads_pending;
+  check_ops();
+}
+
+void ECBackend::handle_delta_stripes_read(
+  Op *op,
+  const hobject_t &hoid,
+  int r,
+  extent_map &stripes)
+{
+  auto &dw = op->plan.delta_writes.at(hoid);
+  if (r < 0) {
+    // fewer than k shards are readable; a full stripe rmw would have
+    // nothing to encode from either
+    derr << __func__ << ": error " << r << " reading " << hoid
+	 << " stripes " << dw.stripes << " for " << *op << dendl;
+    ceph_abort_msg("unable to read the stripes of an overwrite");
+  }
+  set<int> want;
+  for (unsigned i = 0; i < ec_impl->get_chunk_count(); ++i) {
+    want.insert(i);
+  }
+  for (auto &&extent : stripes) {
+    bufferlist bl = extent.get_val();
+    map<int, bufferlist> chunks;
+    int r = ECUtil::encode(sinfo, ec_impl, bl, want, &chunks);
+    ceph_assert(r == 0);
+    uint64_t chunk_off =
+      sinfo.aligned_logical_offset_to_chunk_offset(extent.get_off());
+    for (auto shard : dw.shards) {
+      dw.old_chunks[shard].insert(
+	chunk_off, chunks[shard].length(), chunks[shard]);
+    }
+  }
+  ceph_assert(op->delta_reads_pending > 0);
+  --op->delta_reads_pending;
+  check_ops();
+}
+
 bool ECBackend::try_reads_to_commit()
 {
   if (waiting_reads.empty())
@@ -2225,11 +2418,9 @@ void ECBackend::objects_read_async(
 	 to_read.begin();
        i != to_read.end();
        ++i) {
-    pair<uint64_t, uint64_t> tmp =
-      sinfo.offset_len_to_stripe_bounds(
-	make_pair(i->first.get<0>(), i->first.get<1>()));
-
-    es.union_insert(tmp.first, tmp.second);
+    // objects_read_and_reconstruct rounds out to stripes itself, pass the
+    // exact extents so it knows which shards hold them
+    es.union_insert(i->first.get<0>(), i->first.get<1>());
     flags |= i->first.get<2>();
   }
 
@@ -2333,58 +2524,74 @@ struct CallClientContexts :
   ECBackend *ec;
   ECBackend::ClientAsyncReadStatus *status;
   list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
+  set<int> want_to_read;
   CallClientContexts(
     hobject_t hoid,
     ECBackend *ec,
     ECBackend::ClientAsyncReadStatus *status,
-    const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read)
-    : hoid(hoid), ec(ec), status(status), to_read(to_read) {}
+    const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
+    const set<int> &want_to_read)
+    : hoid(hoid), ec(ec), status(status), to_read(to_read),
+      want_to_read(want_to_read) {}
   void finish(pair<RecoveryMessages *, ECBackend::read_result_t &> &in) override {
     ECBackend::read_result_t &res = in.second;
     extent_map result;
+    // to_read is sorted and each extent lies in one of the stripe
+    // aligned extents returned
+    auto read = to_read.begin();
     if (res.r != 0)
       goto out;
-    ceph_assert(res.returned.size() == to_read.size());
     ceph_assert(res.errors.empty());
-    for (auto &&read: to_read) {
-      pair<uint64_t, uint64_t> adjusted =
-	ec->sinfo.offset_len_to_stripe_bounds(
-	  make_pair(read.get<0>(), read.get<1>()));
-      ceph_assert(res.returned.front().get<0>() == adjusted.first &&
-	     res.returned.front().get<1>() == adjusted.second);
+    for (auto &&returned: res.returned) {
+      uint64_t end = returned.get<0>() + returned.get<1>();
       map<int, bufferlist> to_decode;
-      bufferlist bl;
-      for (map<pg_shard_t, bufferlist>::iterator j =
-	     res.returned.front().get<2>().begin();
-	   j != res.returned.front().get<2>().end();
-	   ++j) {
-	to_decode[j->first.shard] = std::move(j->second);
+      for (auto &&j: returned.get<2>()) {
+	to_decode[j.first.shard] = std::move(j.second);
+      }
+      map<int, bufferlist> decoded;
+      map<int, bufferlist*> out;
+      for (int i: want_to_read) {
+	out[i] = &decoded[i];
       }
       int r = ECUtil::decode(
 	ec->sinfo,
 	ec->ec_impl,
 	to_decode,
-	&bl);
+	out);
       if (r < 0) {
         res.r = r;
         goto out;
       }
-      bufferlist trimmed;
-      trimmed.substr_of(
-	bl,
-	read.get<0>() - adjusted.first,
-	std::min(read.get<1>(),
-	    bl.length() - (read.get<0>() - adjusted.first)));
-      result.insert(
-	read.get<0>(), trimmed.length(), std::move(trimmed));
-      res.returned.pop_front();
+      for (; read != to_read.end() && read->get<0>() < end; ++read) {
+	ceph_assert(read->get<0>() >= returned.get<0>());
+	bufferlist bl;
+	ec->gather_read_from_shards(
+	  returned.get<0>(),
+	  read->get<0>(),
+	  read->get<1>(),
+	  decoded,
+	  &bl);
+	result.insert(read->get<0>(), bl.length(), std::move(bl));
+      }
     }
+    ceph_assert(read == to_read.end());
 out:
     status->complete_object(hoid, res.r, std::move(result));
     ec->kick_reads();
   }
 };
 
+void ECBackend::gather_read_from_shards(
+  uint64_t shard_start,
+  uint64_t off,
+  uint64_t len,
+  map<int, bufferlist> &shards,
+  bufferlist *out) const
+{
+  ECUtil::gather_read_from_shards(
+    sinfo, ec_impl->get_chunk_mapping(), shard_start, off, len, shards, out);
+}
+
 void ECBackend::objects_read_and_reconstruct(
   const map<hobject_t,
     std::list<boost::tuple<uint64_t, uint64_t, uint32_t> >
@@ -2399,12 +2606,34 @@ void ECBackend::objects_read_and_reconstruct(
     return;
   }
 
+  // redundant reads go to every shard anyway
+  bool partial =
+    cct->_conf.get_val<bool>("osd_ec_partial_reads") && !fast_read;
+
   map<hobject_t, set<int>> obj_want_to_read;
-  set<int> want_to_read;
-  get_want_to_read_shards(&want_to_read);
-    
   map<hobject_t, read_request_t> for_read_op;
   for (auto &&to_read: reads) {
+    set<int> want_to_read;
+    extent_set stripes;
+    uint32_t flags = 0;
+    for (auto &&read: to_read.second) {
+      pair<uint64_t, uint64_t> bounds =
+	sinfo.offset_len_to_stripe_bounds(
+	  make_pair(read.get<0>(), read.get<1>()));
+      stripes.union_insert(bounds.first, bounds.second);
+      flags |= read.get<2>();
+      if (partial) {
+	get_want_to_read_shards(read.get<0>(), read.get<1>(), &want_to_read);
+      }
+    }
+    if (want_to_read.empty()) {
+      get_want_to_read_shards(&want_to_read);
+    }
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > stripe_reads;
+    for (auto &&i: stripes) {
+      stripe_reads.push_back(boost::make_tuple(i.first, i.second, flags));
+    }
+
     map<pg_shard_t, vector<pair<int, int>>> shards;
     int r = get_min_avail_to_read_shards(
       to_read.first,
@@ -2413,17 +2642,20 @@ void ECBackend::objects_read_and_reconstruct(
       fast_read,
       &shards);
     ceph_assert(r == 0);
+    dout(20) << __func__ << " " << to_read.first << " want " << want_to_read
+	     << " from " << shards << dendl;
 
     CallClientContexts *c = new CallClientContexts(
       to_read.first,
       this,
       &(in_progress_client_reads.back()),
-      to_read.second);
+      to_read.second,
+      want_to_read);
     for_read_op.insert(
       make_pair(
 	to_read.first,
 	read_request_t(
-	  to_read.second,
+	  stripe_reads,
 	  shards,
 	  false,
 	  c)));
@@ -2449,9 +2681,32 @@ int ECBackend::send_all_remaining_reads(
   for (set<pg_shard_t>::iterator i = ots.begin(); i != ots.end(); ++i)
     already_read.insert(i->shard);
   dout(10) << __func__ << " have/error shards=" << already_read << dendl;
+
+  // A partial client read may have fetched only the sub-chunks its first
+  // choice of shards needed to rebuild one shard, which cannot be mixed
+  // with other shards.  Start it over from the shards still good.
+  bool restart = false;
+  if (!rop.for_recovery) {
+    for (auto &&i: rop.to_read.find(hoid)->second.need) {
+      if (i.second.size() != 1 ||
+	  i.second.front().second != ec_impl->get_sub_chunk_count()) {
+	restart = true;
+	break;
+      }
+    }
+  }
+  if (restart) {
+    dout(10) << __func__ << " sub-chunk read, restarting " << hoid << dendl;
+    for (auto &&returned: rop.complete[hoid].returned) {
+      returned.get<2>().clear();
+    }
+    already_read.clear();
+  }
+
   map<pg_shard_t, vector<pair<int, int>>> shards;
   int r = get_remaining_shards(hoid, already_read, rop.want_to_read[hoid],
-			       rop.complete[hoid], &shards, rop.for_recovery);
+			       rop.complete[hoid], &shards, rop.for_recovery,
+			       restart);
   if (r)
     return r;
 
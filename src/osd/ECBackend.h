@@ -125,6 +125,12 @@ public:
    * CallClientContexts is responsible for reconstructing the response
    * buffer as well as for calling the callbacks.
    *
+   * With osd_ec_partial_reads, only the data shards covering the
+   * requested extents are wanted, so a small read in a healthy pg goes
+   * to a single shard, and a degraded one fetches whatever
+   * minimum_to_decode asks for (sub-chunks included) to rebuild just
+   * those shards.
+   *
    * One tricky bit is that two reads may possibly not read from the same
    * std::set of replicas.  This could result in two reads completing in the
    * wrong (from the interface user's point of view) order.  Thus, we
@@ -143,6 +149,15 @@ public:
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func);
 
   friend struct CallClientContexts;
+  friend struct FinishDeltaRead;
+  /// copy logical [off, off + len) out of the decoded data shards, which
+  /// start at the stripe aligned logical offset shard_start
+  void gather_read_from_shards(
+    uint64_t shard_start,
+    uint64_t off,
+    uint64_t len,
+    std::map<int, ceph::buffer::list> &shards,
+    ceph::buffer::list *out) const;
   struct ClientAsyncReadStatus {
     unsigned objects_to_read;
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> func;
@@ -216,6 +231,15 @@ private:
     }
   }
 
+  /// the data shards holding logical range [offset, offset + length)
+  void get_want_to_read_shards(
+    uint64_t offset,
+    uint64_t length,
+    std::set<int> *want_to_read) const {
+    ECUtil::get_want_to_read_shards(
+      sinfo, ec_impl->get_chunk_mapping(), offset, length, want_to_read);
+  }
+
   /**
    * Recovery
    *
@@ -481,8 +505,10 @@ public:
     std::map<hobject_t,extent_set> pending_read; // subset already being read
     std::map<hobject_t,extent_set> remote_read;  // subset we must read
     std::map<hobject_t,extent_map> remote_read_result;
+    unsigned delta_reads_pending = 0; // plan.delta_writes still reading
     bool read_in_progress() const {
-      return !remote_read.empty() && remote_read_result.empty();
+      return (!remote_read.empty() && remote_read_result.empty()) ||
+	delta_reads_pending > 0;
     }
 
     /// In progress write state.
@@ -562,6 +588,11 @@ public:
   eversion_t committed_to;
   void start_rmw(Op *op, PGTransactionUPtr &&t);
   bool try_state_to_reads();
+  void choose_delta_writes(Op *op);
+  void start_delta_reads(Op *op);
+  void handle_delta_read(Op *op, const hobject_t &hoid, read_result_t &res);
+  void handle_delta_stripes_read(Op *op, const hobject_t &hoid, int r,
+				 extent_map &stripes);
   bool try_reads_to_commit();
   bool try_finish_rmw();
   void check_ops();
@@ -657,7 +688,8 @@ public:
     const std::set<int> &want,
     const read_result_t &result,
     std::map<pg_shard_t, std::vector<std::pair<int, int>>> *to_read,
-    bool for_recovery);
+    bool for_recovery,
+    bool keep_subchunks = false);
 
   int objects_get_attrs(
     const hobject_t &hoid,
@@ -92,6 +92,165 @@ void encode_and_write(
   }
 }
 
+static int chunk_to_shard(const ErasureCodeInterfaceRef &ecimpl,
+			  unsigned chunk)
+{
+  const vector<int> &chunk_mapping = ecimpl->get_chunk_mapping();
+  return (int)chunk_mapping.size() > (int)chunk ?
+    chunk_mapping[chunk] : (int)chunk;
+}
+
+static bufferlist get_old_chunk(
+  const ECTransaction::DeltaWrite &dw,
+  int shard,
+  uint64_t offset,
+  uint64_t length)
+{
+  auto iter = dw.old_chunks.find(shard);
+  ceph_assert(iter != dw.old_chunks.end());
+  auto old = iter->second.intersect(offset, length);
+  ceph_assert(old.ext_count() == 1);
+  ceph_assert(old.begin().get_off() == offset);
+  ceph_assert(old.begin().get_len() == length);
+  return old.begin().get_val();
+}
+
+void encode_delta_and_write(
+  pg_t pgid,
+  const hobject_t &oid,
+  const ECUtil::stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ecimpl,
+  ECTransaction::DeltaWrite &dw,
+  const extent_map &to_write,
+  uint32_t flags,
+  extent_map &written,
+  map<shard_id_t, ObjectStore::Transaction> *transactions,
+  DoutPrefixProvider *dpp) {
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const unsigned k = ecimpl->get_data_chunk_count();
+  const unsigned n = ecimpl->get_chunk_count();
+
+  auto write_chunk = [&](int shard, uint64_t offset, bufferlist &bl) {
+    auto t = transactions->find(shard_id_t(shard));
+    if (t == transactions->end())
+      return;
+    t->second.write(
+      coll_t(spg_t(pgid, t->first)),
+      ghobject_t(oid, ghobject_t::NO_GEN, t->first),
+      offset,
+      bl.length(),
+      bl,
+      flags);
+  };
+
+  for (auto &&stripes : dw.stripes) {
+    for (uint64_t off = stripes.first;
+	 off < stripes.first + stripes.second;
+	 off += stripe_width) {
+      const uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+	off);
+      map<int, bufferlist> old_data, new_data, parity;
+      for (unsigned i = 0; i < k; ++i) {
+	const uint64_t chunk_start = off + i * chunk_size;
+	auto updates = to_write.intersect(chunk_start, chunk_size);
+	if (updates.empty())
+	  continue;
+	int shard = chunk_to_shard(ecimpl, i);
+	bufferlist old = get_old_chunk(dw, shard, chunk_off, chunk_size);
+	extent_map chunk;
+	chunk.insert(chunk_start, chunk_size, old);
+	for (auto &&u : updates) {
+	  chunk.insert(u.get_off(), u.get_len(), u.get_val());
+	}
+	ceph_assert(chunk.ext_count() == 1);
+	bufferlist bl = chunk.begin().get_val();
+	ceph_assert(bl.length() == chunk_size);
+	written.insert(chunk_start, chunk_size, bl);
+	old_data[shard] = std::move(old);
+	new_data[shard] = std::move(bl);
+      }
+      ceph_assert(!new_data.empty());
+      for (unsigned i = k; i < n; ++i) {
+	int shard = chunk_to_shard(ecimpl, i);
+	parity[shard] = get_old_chunk(dw, shard, chunk_off, chunk_size);
+      }
+
+      ldpp_dout(dpp, 20) << __func__ << ": " << oid
+			 << " updating stripe " << off
+			 << " from " << new_data.size() << " changed chunks"
+			 << dendl;
+      int r = ECUtil::encode_delta(sinfo, ecimpl, old_data, new_data, &parity);
+      ceph_assert(r == 0);
+
+      for (auto &&i : new_data) {
+	write_chunk(i.first, chunk_off, i.second);
+      }
+      for (auto &&i : parity) {
+	write_chunk(i.first, chunk_off, i.second);
+      }
+    }
+  }
+  dw.old_chunks.clear();
+}
+
+void ECTransaction::plan_delta_write(
+  const ECUtil::stripe_info_t &sinfo,
+  const ErasureCodeInterfaceRef &ec_impl,
+  const hobject_t &oid,
+  const extent_set &raw_write_set,
+  WritePlan &plan,
+  DoutPrefixProvider *dpp)
+{
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const unsigned k = ec_impl->get_data_chunk_count();
+  const unsigned m = ec_impl->get_coding_chunk_count();
+
+  DeltaWrite dw;
+  dw.stripes = plan.will_write.at(oid);
+  set<unsigned> data_chunks;
+  for (auto &&extent : raw_write_set) {
+    uint64_t start = extent.first - extent.first % chunk_size;
+    uint64_t end = round_up_to(extent.first + extent.second, chunk_size);
+    dw.will_write.union_insert(start, end - start);
+  }
+  for (auto &&extent : dw.will_write) {
+    for (uint64_t off = extent.first;
+	 off < extent.first + extent.second;
+	 off += chunk_size) {
+      data_chunks.insert((off % stripe_width) / chunk_size);
+    }
+  }
+
+  // Cost in chunks read and written.  The full rmw reads k chunks of
+  // each partially written stripe and writes all of every stripe.  A
+  // delta reads the data chunks changed in any of the stripes from all
+  // of them, and their parity, then writes the data chunks changed and
+  // the parity.
+  const uint64_t stripes = dw.stripes.size() / stripe_width;
+  const uint64_t full_cost =
+    plan.to_read.at(oid).size() / stripe_width * k +
+    stripes * (k + m);
+  const uint64_t delta_cost =
+    stripes * (data_chunks.size() + m) +
+    dw.will_write.size() / chunk_size + stripes * m;
+  ldpp_dout(dpp, 20) << __func__ << ": " << oid
+		     << " full stripe cost " << full_cost
+		     << ", delta cost " << delta_cost
+		     << dendl;
+  if (delta_cost >= full_cost)
+    return;
+
+  for (auto i : data_chunks) {
+    dw.shards.insert(chunk_to_shard(ec_impl, i));
+  }
+  for (unsigned i = k; i < k + m; ++i) {
+    dw.shards.insert(chunk_to_shard(ec_impl, i));
+  }
+  plan.delta_writes.emplace(oid, std::move(dw));
+}
+
 bool ECTransaction::requires_overwrite(
   uint64_t prev_size,
   const PGTransaction::ObjectOperation &op) {
@@ -553,10 +712,57 @@ void ECTransaction::generate_transactions(
       for (unsigned i = 0; i < ecimpl->get_chunk_count(); ++i) {
 	want.insert(i);
       }
+      auto dwiter = plan.delta_writes.find(oid);
       auto to_overwrite = to_write.intersect(0, append_after);
       ldpp_dout(dpp, 20) << __func__ << ": to_overwrite: "
 			 << to_overwrite
+			 << (dwiter != plan.delta_writes.end() ? " (delta)" : "")
 			 << dendl;
+      if (dwiter != plan.delta_writes.end()) {
+	ceph_assert(to_overwrite.ext_count() == to_write.ext_count());
+	// every shard saves the whole stripes, changed or not, since the
+	// rollback extents are the same for all of them
+	for (auto &&extent: dwiter->second.stripes) {
+	  if (!entry)
+	    break;
+	  uint64_t restore_from = sinfo.aligned_logical_offset_to_chunk_offset(
+	    extent.first);
+	  uint64_t restore_len = sinfo.aligned_logical_offset_to_chunk_offset(
+	    extent.second);
+	  ldpp_dout(dpp, 20) << __func__ << ": overwriting "
+			     << restore_from << "~" << restore_len
+			     << dendl;
+	  if (rollback_extents.empty()) {
+	    for (auto &&st : *transactions) {
+	      st.second.touch(
+		coll_t(spg_t(pgid, st.first)),
+		ghobject_t(oid, entry->version.version, st.first));
+	    }
+	  }
+	  rollback_extents.emplace_back(make_pair(restore_from, restore_len));
+	  for (auto &&st : *transactions) {
+	    st.second.clone_range(
+	      coll_t(spg_t(pgid, st.first)),
+	      ghobject_t(oid, ghobject_t::NO_GEN, st.first),
+	      ghobject_t(oid, entry->version.version, st.first),
+	      restore_from,
+	      restore_len,
+	      restore_from);
+	  }
+	}
+	encode_delta_and_write(
+	  pgid,
+	  oid,
+	  sinfo,
+	  ecimpl,
+	  dwiter->second,
+	  to_overwrite,
+	  fadvise_flags,
+	  written,
+	  transactions,
+	  dpp);
+	to_overwrite.clear();
+      }
       for (auto &&extent: to_overwrite) {
 	ceph_assert(extent.get_off() + extent.get_len() <= append_after);
 	ceph_assert(sinfo.logical_offset_is_stripe_aligned(extent.get_off()));
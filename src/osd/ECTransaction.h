@@ -23,12 +23,36 @@
 #include "ExtentCache.h"
 
 namespace ECTransaction {
+  /**
+   * An overwrite applied by updating the parity chunks with the
+   * difference between the old and new content of the data chunks it
+   * changes, rather than by reading and encoding whole stripes again.
+   * It reads and writes only those data chunks and the parity chunks
+   * of their stripes.
+   */
+  struct DeltaWrite {
+    extent_set stripes;    ///< logical, the stripes overwritten
+    extent_set will_write; ///< logical, the data chunks overwritten
+    std::set<int> shards;  ///< shards to read, changed data and parity
+
+    /// shard -> chunk offset -> old content, for all shards over stripes
+    std::map<int, extent_map> old_chunks;
+  };
+
   struct WritePlan {
     PGTransactionUPtr t;
     bool invalidates_cache = false; // Yes, both are possible
     std::map<hobject_t,extent_set> to_read;
     std::map<hobject_t,extent_set> will_write; // superset of to_read
 
+    /**
+     * Objects which may be written as DeltaWrites.  to_read and
+     * will_write still describe the full stripe rmw; whoever uses a
+     * delta instead replaces its will_write and drops its to_read,
+     * otherwise the entry must be erased.
+     */
+    std::map<hobject_t,DeltaWrite> delta_writes;
+
     std::map<hobject_t,ECUtil::HashInfoRef> hash_infos;
   };
 
@@ -36,12 +60,24 @@ namespace ECTransaction {
     uint64_t prev_size,
     const PGTransaction::ObjectOperation &op);
 
+  /// Plan writes to oid as a DeltaWrite if that costs less IO than the
+  /// full stripe rmw planned in plan
+  void plan_delta_write(
+    const ECUtil::stripe_info_t &sinfo,
+    const ceph::ErasureCodeInterfaceRef &ec_impl,
+    const hobject_t &oid,
+    const extent_set &raw_write_set,
+    WritePlan &plan,
+    DoutPrefixProvider *dpp);
+
   template <typename F>
   WritePlan get_write_plan(
     const ECUtil::stripe_info_t &sinfo,
     PGTransactionUPtr &&t,
     F &&get_hinfo,
-    DoutPrefixProvider *dpp) {
+    DoutPrefixProvider *dpp,
+    const ceph::ErasureCodeInterfaceRef &delta_ec_impl = nullptr) {
+    // with delta_ec_impl, overwrites may be planned as DeltaWrites
     WritePlan plan;
     t->safe_create_traverse(
       [&](std::pair<const hobject_t, PGTransaction::ObjectOperation> &i) {
@@ -162,6 +198,16 @@ namespace ECTransaction {
 	  projected_size = truncating_to;
 	}
 
+	if (delta_ec_impl &&
+	    delta_ec_impl->supports_parity_delta() &&
+	    plan.to_read.count(i.first) &&
+	    i.second.is_none() &&
+	    !i.second.truncate &&
+	    raw_write_set.range_end() <= orig_size) {
+	  plan_delta_write(
+	    sinfo, delta_ec_impl, i.first, raw_write_set, plan, dpp);
+	}
+
 	ldpp_dout(dpp, 20) << __func__ << ": " << i.first
 			   << " projected size "
 			   << projected_size
@@ -6,9 +6,13 @@
 
 using namespace std;
 using ceph::bufferlist;
+using ceph::bufferptr;
 using ceph::ErasureCodeInterfaceRef;
 using ceph::Formatter;
 
+// as ErasureCode::SIMD_ALIGN, which the OSD does not link
+static const unsigned SIMD_ALIGN = 32;
+
 int ECUtil::decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
@@ -136,19 +140,9 @@ int ECUtil::encode(
   if (logical_size == 0)
     return 0;
 
-  for (uint64_t i = 0; i < logical_size; i += sinfo.get_stripe_width()) {
-    map<int, bufferlist> encoded;
-    bufferlist buf;
-    buf.substr_of(in, i, sinfo.get_stripe_width());
-    int r = ec_impl->encode(want, buf, &encoded);
-    ceph_assert(r == 0);
-    for (map<int, bufferlist>::iterator i = encoded.begin();
-	 i != encoded.end();
-	 ++i) {
-      ceph_assert(i->second.length() == sinfo.get_chunk_size());
-      (*out)[i->first].claim_append(i->second);
-    }
-  }
+  int r = ec_impl->encode_batch(
+    want, in, logical_size / sinfo.get_stripe_width(), out);
+  ceph_assert(r == 0);
 
   for (map<int, bufferlist>::iterator i = out->begin();
        i != out->end();
@@ -161,6 +155,100 @@ int ECUtil::encode(
   return 0;
 }
 
+int ECUtil::encode_delta(
+  const stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ec_impl,
+  map<int, bufferlist> &old_data,
+  map<int, bufferlist> &new_data,
+  map<int, bufferlist> *parity) {
+
+  ceph_assert(parity);
+  ceph_assert(ec_impl->supports_parity_delta());
+
+  map<int, bufferptr> deltas;
+  for (auto &&i : new_data) {
+    ceph_assert(i.second.length() == sinfo.get_chunk_size());
+    auto old = old_data.find(i.first);
+    ceph_assert(old != old_data.end());
+    ceph_assert(old->second.length() == sinfo.get_chunk_size());
+    // c_str() leaves a single contiguous ptr
+    i.second.c_str();
+    old->second.c_str();
+    bufferptr delta;
+    ec_impl->encode_delta(old->second.front(), i.second.front(), &delta);
+    deltas.emplace(i.first, std::move(delta));
+  }
+
+  // the old parity came back from a read and may share its buffers with
+  // other readers; apply the delta to a copy and hand that back
+  map<int, bufferptr> out;
+  for (auto &&i : *parity) {
+    ceph_assert(i.second.length() == sinfo.get_chunk_size());
+    bufferptr p = ceph::buffer::create_aligned(sinfo.get_chunk_size(),
+					       SIMD_ALIGN);
+    i.second.begin().copy(p.length(), p.c_str());
+    i.second.clear();
+    i.second.append(p);
+    out.emplace(i.first, std::move(p));
+  }
+  return ec_impl->apply_delta(deltas, &out);
+}
+
+void ECUtil::get_want_to_read_shards(
+  const stripe_info_t &sinfo,
+  const vector<int> &chunk_mapping,
+  uint64_t offset,
+  uint64_t length,
+  set<int> *want_to_read)
+{
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t stripe_width = sinfo.get_stripe_width();
+  if (length >= stripe_width) {
+    length = stripe_width;
+  }
+  for (uint64_t pos = offset - offset % chunk_size;
+       pos < offset + length;
+       pos += chunk_size) {
+    int i = (pos % stripe_width) / chunk_size;
+    int chunk = (int)chunk_mapping.size() > i ? chunk_mapping[i] : i;
+    want_to_read->insert(chunk);
+  }
+}
+
+void ECUtil::gather_read_from_shards(
+  const stripe_info_t &sinfo,
+  const vector<int> &chunk_mapping,
+  uint64_t shard_start,
+  uint64_t off,
+  uint64_t len,
+  const map<int, bufferlist> &shards,
+  bufferlist *out)
+{
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t stripe_width = sinfo.get_stripe_width();
+  for (uint64_t pos = off; pos < off + len; ) {
+    int i = (pos % stripe_width) / chunk_size;
+    int chunk = (int)chunk_mapping.size() > i ? chunk_mapping[i] : i;
+    auto shard = shards.find(chunk);
+    ceph_assert(shard != shards.end());
+    const bufferlist &bl = shard->second;
+    uint64_t in_chunk = pos % chunk_size;
+    uint64_t shard_off =
+      sinfo.aligned_logical_offset_to_chunk_offset(
+	sinfo.logical_to_prev_stripe_offset(pos) - shard_start) + in_chunk;
+    if (shard_off >= bl.length()) {
+      // short read, past the end of the object
+      break;
+    }
+    uint64_t n = std::min(
+      {off + len - pos, chunk_size - in_chunk, bl.length() - shard_off});
+    bufferlist piece;
+    piece.substr_of(bl, shard_off, n);
+    out->claim_append(piece);
+    pos += n;
+  }
+}
+
 void ECUtil::HashInfo::append(uint64_t old_size,
 			      map<int, bufferlist> &to_append) {
   ceph_assert(old_size == total_chunk_size);
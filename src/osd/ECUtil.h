@@ -98,6 +98,38 @@ int encode(
   const std::set<int> &want,
   std::map<int, ceph::buffer::list> *out);
 
+/// Update the parity chunks of one stripe for the data chunks changed
+/// from old_data to new_data.  parity holds the old chunks on input
+/// and the new ones, in newly allocated buffers, on output; the input
+/// buffers are left as they are.  All maps are keyed by shard.
+int encode_delta(
+  const stripe_info_t &sinfo,
+  ceph::ErasureCodeInterfaceRef &ec_impl,
+  std::map<int, ceph::buffer::list> &old_data,
+  std::map<int, ceph::buffer::list> &new_data,
+  std::map<int, ceph::buffer::list> *parity);
+
+/// Add the shards holding data of logical range [offset, offset + length)
+/// to want_to_read, chunk_mapping being the plugin's data chunk order.
+void get_want_to_read_shards(
+  const stripe_info_t &sinfo,
+  const std::vector<int> &chunk_mapping,
+  uint64_t offset,
+  uint64_t length,
+  std::set<int> *want_to_read);
+
+/// Append logical [off, off + len) out of the decoded data shards, which
+/// start at the stripe aligned logical offset shard_start, to out.  Stops
+/// early where the shards are short, past the end of the object.
+void gather_read_from_shards(
+  const stripe_info_t &sinfo,
+  const std::vector<int> &chunk_mapping,
+  uint64_t shard_start,
+  uint64_t off,
+  uint64_t len,
+  const std::map<int, ceph::buffer::list> &shards,
+  ceph::buffer::list *out);
+
 class HashInfo {
   uint64_t total_chunk_size = 0;
   std::vector<uint32_t> cumulative_shard_hashes;
@@ -129,6 +129,23 @@ std::pair<
   return std::make_pair(fst, lst);
 }
 
+bool ExtentCache::is_pinned(
+  const hobject_t &oid,
+  const extent_set &extents)
+{
+  auto eset = get_if_exists(oid);
+  if (!eset) {
+    return false;
+  }
+  for (auto &&res: extents) {
+    auto range = eset->get_containing_range(res.first, res.second);
+    if (range.first != range.second) {
+      return true;
+    }
+  }
+  return false;
+}
+
 extent_set ExtentCache::reserve_extents_for_rmw(
   const hobject_t &oid,
   write_pin &pin,
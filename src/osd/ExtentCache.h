@@ -406,6 +406,17 @@ public:
     pin.open(next_write_tid++);
   }
 
+  /**
+   * Checks for writes in progress on extents
+   *
+   * @param oid [in] object
+   * @param extents [in] extents to check
+   * @return true if any of extents is pinned by a write
+   */
+  bool is_pinned(
+    const hobject_t &oid,
+    const extent_set &extents);
+
   /**
    * Reserves extents required for rmw, and learn
    * which need to be read
@@ -10365,6 +10365,7 @@ void OSDShard::_wake_pg_slot(
 	   << " to_process " << slot->to_process
 	   << " waiting " << slot->waiting
 	   << " waiting_peering " << slot->waiting_peering << dendl;
+  int requeued = slot->to_process.size() + slot->waiting.size();
   for (auto i = slot->to_process.rbegin();
        i != slot->to_process.rend();
        ++i) {
@@ -10385,9 +10386,11 @@ void OSDShard::_wake_pg_slot(
     // someday, if we decide this inefficiency matters
     for (auto j = i->second.rbegin(); j != i->second.rend(); ++j) {
       scheduler->enqueue_front(std::move(*j));
+      ++requeued;
     }
   }
   slot->waiting_peering.clear();
+  _note_queue_depth(requeued);
   ++slot->requeue_seq;
 }
 
@@ -10594,6 +10597,14 @@ OSDShard::OSDShard(
     context_queue(sdata_wait_lock, sdata_cond)
 {
   dout(0) << "using op scheduler " << *scheduler << dendl;
+  logger = build_osd_shard_logger(cct, shard_id);
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+OSDShard::~OSDShard()
+{
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
 }
 
 
@@ -10641,6 +10652,16 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 
   // peek at spg_t
   sdata->shard_lock.lock();
+  if (steal_min_queue &&
+      sdata->scheduler->empty() &&
+      (!is_smallest_thread_index || sdata->context_queue.empty())) {
+    // nothing to do here, help an overloaded shard instead
+    sdata->shard_lock.unlock();
+    if (_steal(sdata, hb)) {
+      return;
+    }
+    sdata->shard_lock.lock();
+  }
   if (sdata->scheduler->empty() &&
       (!is_smallest_thread_index || sdata->context_queue.empty())) {
     std::unique_lock wait_lock{sdata->sdata_wait_lock};
@@ -10651,7 +10672,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       dout(20) << __func__ << " empty q, waiting" << dendl;
       osd->cct->get_heartbeat_map()->clear_timeout(hb);
       sdata->shard_lock.unlock();
+      ++sdata->idle_threads;
       sdata->sdata_cond.wait(wait_lock);
+      --sdata->idle_threads;
       wait_lock.unlock();
       sdata->shard_lock.lock();
       if (sdata->scheduler->empty() &&
@@ -10670,8 +10693,65 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     }
   }
 
+  _process_shard(sdata, is_smallest_thread_index, !is_smallest_thread_index,
+		 hb);
+}
+
+bool OSD::ShardedOpWQ::_steal(OSDShard *home, heartbeat_handle_d *hb)
+{
+  uint32_t shard_index = home->shard_id;
+  // the shard with the most items waiting, if that's enough to bother
+  OSDShard *victim = nullptr;
+  unsigned depth = steal_min_queue - 1;
+  for (auto s : osd->shards) {
+    unsigned d = s->queue_depth.load(std::memory_order_relaxed);
+    if (s != home && d > depth) {
+      victim = s;
+      depth = d;
+    }
+  }
+  if (!victim) {
+    return false;
+  }
+  victim->shard_lock.lock();
+  if (victim->scheduler->empty()) {
+    victim->shard_lock.unlock();
+    return false;
+  }
+  dout(20) << __func__ << " from shard " << victim->shard_id
+	   << ", " << depth << " queued" << dendl;
+  osd->cct->get_heartbeat_map()->reset_timeout(hb,
+    timeout_interval, suicide_interval);
+  victim->logger->inc(l_osd_shard_stolen);
+  home->logger->inc(l_osd_shard_steals);
+  // we work the victim's queue like one of its own threads: items still
+  // go through their pg's slot there, which keeps them in order.  the
+  // shard's own threads complete its oncommits and wait for its future
+  // items.
+  _process_shard(victim, false, false, hb);
+  return true;
+}
+
+void OSD::ShardedOpWQ::_wake_thief(OSDShard *busy)
+{
+  for (auto s : osd->shards) {
+    if (s != busy && s->idle_threads.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard l{s->sdata_wait_lock};
+      s->sdata_cond.notify_one();
+      return;
+    }
+  }
+}
+
+void OSD::ShardedOpWQ::_process_shard(
+  OSDShard *sdata,
+  bool run_oncommits,
+  bool wait_future,
+  heartbeat_handle_d *hb)
+{
+  uint32_t shard_index = sdata->shard_id;
   list<Context *> oncommits;
-  if (is_smallest_thread_index) {
+  if (run_oncommits) {
     sdata->context_queue.move_to(oncommits);
   }
 
@@ -10692,6 +10772,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     }
 
     work_item = sdata->scheduler->dequeue();
+    if (std::get_if<OpSchedulerItem>(&work_item)) {
+      sdata->_note_queue_depth(-1);
+    }
     if (osd->is_stopping()) {
       sdata->shard_lock.unlock();
       for (auto c : oncommits) {
@@ -10704,7 +10787,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     // If the work item is scheduled in the future, wait until
     // the time returned in the dequeue response before retrying.
     if (auto when_ready = std::get_if<double>(&work_item)) {
-      if (is_smallest_thread_index) {
+      if (!wait_future) {
         sdata->shard_lock.unlock();
         handle_oncommits(oncommits);
         return;
@@ -10965,10 +11048,12 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
   assert (NULL != sdata);
 
   bool empty = true;
+  unsigned depth;
   {
     std::lock_guard l{sdata->shard_lock};
     empty = sdata->scheduler->empty();
     sdata->scheduler->enqueue(std::move(item));
+    depth = sdata->_note_queue_depth(1);
   }
 
   {
@@ -10979,6 +11064,9 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
       sdata->sdata_cond.notify_one();
     }
   }
+  if (steal_min_queue && depth >= steal_min_queue) {
+    _wake_thief(sdata);
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
@@ -11004,6 +11092,7 @@ void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
     dout(20) << __func__ << " " << item << dendl;
   }
   sdata->scheduler->enqueue_front(std::move(item));
+  sdata->_note_queue_depth(1);
   sdata->shard_lock.unlock();
   std::lock_guard l{sdata->sdata_wait_lock};
   sdata->sdata_cond.notify_one();
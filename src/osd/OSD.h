@@ -1013,6 +1013,10 @@ struct OSDShard {
   ceph::mutex sdata_wait_lock;
   ceph::condition_variable sdata_cond;
   int waiting_threads = 0;
+  /// threads with nothing to do, which may help other shards
+  std::atomic<int> idle_threads = {0};
+
+  PerfCounters *logger = nullptr;
 
   ceph::mutex osdmap_lock;  ///< protect shard_osdmap updates vs users w/o shard_lock
   OSDMapRef shard_osdmap;
@@ -1049,6 +1053,14 @@ struct OSDShard {
 
   /// priority queue
   ceph::osd::scheduler::OpSchedulerRef scheduler;
+  /// items in scheduler; read without shard_lock by other shards'
+  /// threads looking for work
+  std::atomic<unsigned> queue_depth = {0};
+  unsigned _note_queue_depth(int delta) {
+    unsigned depth = queue_depth += delta;
+    logger->set(l_osd_shard_queue_depth, depth);
+    return depth;
+  }
 
   bool stop_waiting = false;
 
@@ -1087,6 +1099,7 @@ struct OSDShard {
     int id,
     CephContext *cct,
     OSD *osd);
+  ~OSDShard();
 };
 
 class OSD : public Dispatcher,
@@ -1601,6 +1614,19 @@ protected:
     : public ShardedThreadPool::ShardedWQ<OpSchedulerItem>
   {
     OSD *osd;
+    /// idle threads work the queue of a shard with this many items
+    /// waiting; 0 if they don't
+    const unsigned steal_min_queue;
+
+    /// dequeue and run an item of sdata, whose shard_lock we hold;
+    /// drops it
+    void _process_shard(OSDShard *sdata, bool run_oncommits,
+			bool wait_future, ceph::heartbeat_handle_d *hb);
+    /// run an item of the busiest shard other than home, if any is
+    /// busy enough; false if there was nothing to do
+    bool _steal(OSDShard *home, ceph::heartbeat_handle_d *hb);
+    /// wake an idle thread of another shard to help busy
+    void _wake_thief(OSDShard *busy);
 
   public:
     ShardedOpWQ(OSD *o,
@@ -1608,7 +1634,9 @@ protected:
 		ceph::timespan si,
 		ShardedThreadPool* tp)
       : ShardedThreadPool::ShardedWQ<OpSchedulerItem>(ti, si, tp),
-        osd(o) {
+        osd(o),
+	steal_min_queue(
+	  o->cct->_conf.get_val<uint64_t>("osd_op_steal_min_queue")) {
     }
 
     void _add_slot_waiter(
@@ -1654,6 +1682,9 @@ protected:
 
 	std::scoped_lock l{sdata->shard_lock};
 	f->open_object_section(queue_name);
+	f->dump_unsigned("queue_depth", sdata->queue_depth);
+	f->dump_unsigned("stolen", sdata->logger->get(l_osd_shard_stolen));
+	f->dump_unsigned("steals", sdata->logger->get(l_osd_shard_steals));
 	sdata->scheduler->dump(*f);
 	f->close_section();
       }
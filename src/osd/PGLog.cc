@@ -46,13 +46,60 @@ void PGLog::IndexedLog::split_out_child(
   unsigned split_bits,
   PGLog::IndexedLog *target)
 {
+  auto to_index = indexed_data;
   unindex();
   *target = IndexedLog(pg_log_t::split_out_child(child_pgid, split_bits));
-  index();
-  target->index();
+  index(to_index);
   reset_rollback_info_trimmed_to_riter();
 }
 
+uint64_t PGLog::IndexedLog::approx_bytes() const
+{
+  // list nodes carry two pointers, hash nodes a next pointer (and the
+  // cached hash), plus one bucket pointer per bucket
+  constexpr size_t list_node = 2 * sizeof(void*);
+  constexpr size_t hash_node = 2 * sizeof(void*);
+  uint64_t bytes = 0;
+  for (auto& e : log) {
+    bytes += sizeof(e) + list_node;
+    bytes += e.soid.oid.name.capacity() + e.soid.get_key().capacity() +
+      e.soid.nspace.capacity();
+    bytes += e.extra_reqids.size() *
+      sizeof(decltype(e.extra_reqids)::value_type);
+    bytes += e.op_returns.size() * sizeof(pg_log_op_return_item_t);
+    bytes += e.mod_desc.get_heap_bytes();
+  }
+  for (auto& d : dups) {
+    bytes += sizeof(d) + list_node;
+    bytes += d.op_returns.size() * sizeof(pg_log_op_return_item_t);
+  }
+  bytes += objects.size() *
+    (sizeof(decltype(objects)::value_type) + hash_node) +
+    objects.bucket_count() * sizeof(void*);
+  bytes += caller_ops.size() *
+    (sizeof(decltype(caller_ops)::value_type) + hash_node) +
+    caller_ops.bucket_count() * sizeof(void*);
+  bytes += extra_caller_ops.size() *
+    (sizeof(decltype(extra_caller_ops)::value_type) + hash_node) +
+    extra_caller_ops.bucket_count() * sizeof(void*);
+  bytes += dup_index.size() *
+    (sizeof(decltype(dup_index)::value_type) + hash_node) +
+    dup_index.bucket_count() * sizeof(void*);
+  return bytes;
+}
+
+void PGLog::IndexedLog::dump_mem_usage(Formatter *f) const
+{
+  f->dump_unsigned("entries", log.size());
+  f->dump_unsigned("dups", dups.size());
+  f->dump_unsigned("indexed", indexed_data);
+  f->dump_unsigned("objects_index", objects.size());
+  f->dump_unsigned("caller_ops_index", caller_ops.size());
+  f->dump_unsigned("extra_caller_ops_index", extra_caller_ops.size());
+  f->dump_unsigned("dup_index", dup_index.size());
+  f->dump_unsigned("approx_bytes", approx_bytes());
+}
+
 void PGLog::IndexedLog::trim(
   CephContext* cct,
   eversion_t s,
@@ -144,19 +144,23 @@ public:
   /**
    * IndexLog - adds in-memory index of the log, by oid.
    * plus some methods to manipulate it all.
+   *
+   * The indexes are built on first use and only kept up to date from
+   * then on, so a log that is never queried (e.g. on a replica) does not
+   * pay for them.  They live in the osd_pglog mempool with the entries.
    */
   struct IndexedLog : public pg_log_t {
-    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
-    mutable ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
-
     // recovery pointers
     std::list<pg_log_entry_t>::iterator complete_to; // not inclusive of referenced item
     version_t last_requested = 0;               // last object requested by primary
 
     //
   private:
+    mutable mempool::osd_pglog::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    mutable mempool::osd_pglog::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
+    mutable mempool::osd_pglog::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
+    mutable mempool::osd_pglog::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
+
     mutable __u16 indexed_data = 0;
     /**
      * rollback_info_trimmed_to_riter points to the first log entry <=
@@ -219,7 +223,6 @@ public:
       rollback_info_trimmed_to_riter(log.rbegin())
     {
       reset_rollback_info_trimmed_to_riter();
-      index();
     }
 
     IndexedLog(const IndexedLog &rhs) :
@@ -260,7 +263,7 @@ public:
 
     mempool::osd_pglog::list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
       auto divergent = pg_log_t::rewind_from_head(newhead);
-      index();
+      index(indexed_data);
       reset_rollback_info_trimmed_to_riter();
       return divergent;
     }
@@ -286,10 +289,11 @@ public:
       ceph_assert(rollback_info_trimmed_to == head);
       ceph_assert(rollback_info_trimmed_to_riter == log.rbegin());
 
+      auto to_index = indexed_data;
       *this = IndexedLog(o);
 
       skip_can_rollback_to_to_head();
-      index();
+      index(to_index);
     }
 
     void split_out_child(
@@ -323,6 +327,15 @@ public:
       return objects.count(oid);
     }
 
+    /// latest indexed entry for oid, or nullptr
+    const pg_log_entry_t *get_latest_entry(const hobject_t& oid) const {
+      if (!(indexed_data & PGLOG_INDEXED_OBJECTS)) {
+         index_objects();
+      }
+      auto p = objects.find(oid);
+      return p == objects.end() ? nullptr : p->second;
+    }
+
     bool logged_req(const osd_reqid_t &r) const {
       if (!(indexed_data & PGLOG_INDEXED_CALLER_OPS)) {
         index_caller_ops();
@@ -534,13 +547,36 @@ public:
     }
 
     void unindex() {
-      objects.clear();
-      caller_ops.clear();
-      extra_caller_ops.clear();
-      dup_index.clear();
+      objects = decltype(objects)();
+      caller_ops = decltype(caller_ops)();
+      extra_caller_ops = decltype(extra_caller_ops)();
+      dup_index = decltype(dup_index)();
       indexed_data = 0;
     }
 
+    __u16 get_indexed_data() const {
+      return indexed_data;
+    }
+
+    // the indexes as they stand, these do not build them, see
+    // get_indexed_data()
+    const auto& get_objects() const {
+      return objects;
+    }
+    const auto& get_caller_ops() const {
+      return caller_ops;
+    }
+    const auto& get_extra_caller_ops() const {
+      return extra_caller_ops;
+    }
+    const auto& get_dup_index() const {
+      return dup_index;
+    }
+
+    /// approximate memory held by the entries, dups and indexes
+    uint64_t approx_bytes() const;
+    void dump_mem_usage(ceph::Formatter *f) const;
+
     void unindex(const pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
       if (indexed_data & PGLOG_INDEXED_OBJECTS) {
@@ -865,6 +901,7 @@ public:
   void merge_from(
     const std::vector<PGLog*>& sources,
     eversion_t last_update) {
+    auto to_index = log.get_indexed_data();
     unindex();
     missing.clear();
 
@@ -874,7 +911,7 @@ public:
     }
     log.merge_from(slogs, last_update);
 
-    index();
+    log.index(to_index);
 
     mark_log_for_rewrite();
   }
@@ -1051,20 +1088,20 @@ protected:
 		       << " last_divergent_update: " << last_divergent_update
 		       << dendl;
 
-    auto objiter = log.objects.find(hoid);
-    if (objiter != log.objects.end() &&
-	objiter->second->version >= first_divergent_update) {
+    auto latest = log.get_latest_entry(hoid);
+    if (latest &&
+	latest->version >= first_divergent_update) {
       /// Case 1)
       ldpp_dout(dpp, 10) << __func__ << ": more recent entry found: "
-			 << *objiter->second << ", already merged" << dendl;
+			 << *latest << ", already merged" << dendl;
 
-      ceph_assert(objiter->second->version > last_divergent_update);
+      ceph_assert(latest->version > last_divergent_update);
 
       // ensure missing has been updated appropriately
-      if (objiter->second->is_update() ||
-	  (missing.may_include_deletes && objiter->second->is_delete())) {
+      if (latest->is_update() ||
+	  (missing.may_include_deletes && latest->is_delete())) {
 	ceph_assert(missing.is_missing(hoid) &&
-	       missing.get_items().at(hoid).need == objiter->second->version);
+	       missing.get_items().at(hoid).need == latest->version);
       } else {
 	ceph_assert(!missing.is_missing(hoid));
       }
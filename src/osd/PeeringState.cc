@@ -731,6 +731,11 @@ void PeeringState::start_peering_interval(
     if (was_old_primary != is_primary()) {
       state_clear(PG_STATE_CLEAN);
     }
+    if (was_old_primary && !is_primary()) {
+      // only the primary looks requests up in the log; the indexes are
+      // rebuilt on demand if we become primary again
+      pg_log.unindex();
+    }
 
     pl->on_role_change();
   } else {
@@ -2531,10 +2536,12 @@ void PeeringState::log_weirdness()
 			     << pg_log.get_log().log.rbegin()->version << "]";
   }
 
-  if (pg_log.get_log().caller_ops.size() > pg_log.get_log().log.size()) {
+  // the index is built on demand, there is nothing to check until then
+  if ((pg_log.get_log().get_indexed_data() & PGLOG_INDEXED_CALLER_OPS) &&
+      pg_log.get_log().get_caller_ops().size() > pg_log.get_log().log.size()) {
     pl->get_clog_error() << info.pgid
 			   << " caller_ops.size "
-			   << pg_log.get_log().caller_ops.size()
+			   << pg_log.get_log().get_caller_ops().size()
 			   << " > log size " << pg_log.get_log().log.size();
   }
 }
@@ -4029,6 +4036,10 @@ void PeeringState::dump_peering_state(Formatter *f)
     f->close_section();
   }
   f->close_section();
+
+  f->open_object_section("pg_log_mem");
+  pg_log.get_log().dump_mem_usage(f);
+  f->close_section();
 }
 
 void PeeringState::update_stats(
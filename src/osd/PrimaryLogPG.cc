@@ -411,7 +411,7 @@ void PrimaryLogPG::on_local_recover(
   if (!is_delete && recovery_state.get_pg_log().get_missing().is_missing(recovery_info.soid) &&
       recovery_state.get_pg_log().get_missing().get_items().find(recovery_info.soid)->second.need > recovery_info.version) {
     ceph_assert(is_primary());
-    const pg_log_entry_t *latest = recovery_state.get_pg_log().get_log().objects.find(recovery_info.soid)->second;
+    const pg_log_entry_t *latest = recovery_state.get_pg_log().get_log().get_latest_entry(recovery_info.soid);
     if (latest->op == pg_log_entry_t::LOST_REVERT &&
 	latest->reverting_to == recovery_info.version) {
       dout(10) << " got old revert version " << recovery_info.version
@@ -11290,13 +11290,14 @@ void PrimaryLogPG::check_blocklisted_obc_watchers(ObjectContextRef obc)
 void PrimaryLogPG::populate_obc_watchers(ObjectContextRef obc)
 {
   ceph_assert(is_primary() && is_active());
-  auto it_objects = recovery_state.get_pg_log().get_log().objects.find(obc->obs.oi.soid);
+  auto latest =
+    recovery_state.get_pg_log().get_log().get_latest_entry(obc->obs.oi.soid);
   ceph_assert((recovering.count(obc->obs.oi.soid) ||
 	  !is_missing_object(obc->obs.oi.soid)) ||
-	 (it_objects != recovery_state.get_pg_log().get_log().objects.end() && // or this is a revert... see recover_primary()
-	  it_objects->second->op ==
+	 (latest && // or this is a revert... see recover_primary()
+	  latest->op ==
 	    pg_log_entry_t::LOST_REVERT &&
-	  it_objects->second->reverting_to ==
+	  latest->reverting_to ==
 	    obc->obs.oi.version));
 
   dout(10) << "populate_obc_watchers " << obc->obs.oi.soid << dendl;
@@ -11414,12 +11415,12 @@ ObjectContextRef PrimaryLogPG::get_object_context(
   bool can_create,
   const map<string, bufferlist> *attrs)
 {
-  auto it_objects = recovery_state.get_pg_log().get_log().objects.find(soid);
+  auto latest = recovery_state.get_pg_log().get_log().get_latest_entry(soid);
   ceph_assert(
     attrs || !recovery_state.get_pg_log().get_missing().is_missing(soid) ||
     // or this is a revert... see recover_primary()
-    (it_objects != recovery_state.get_pg_log().get_log().objects.end() &&
-      it_objects->second->op ==
+    (latest &&
+      latest->op ==
       pg_log_entry_t::LOST_REVERT));
   ObjectContextRef obc = object_contexts.lookup(soid);
   osd->logger->inc(l_osd_object_ctx_cache_total);
@@ -12951,7 +12952,7 @@ uint64_t PrimaryLogPG::recover_primary(uint64_t max, ThreadPool::TPHandle &handl
   dout(25) << __func__ << " " << missing.get_items() << dendl;
 
   // look at log!
-  pg_log_entry_t *latest = 0;
+  const pg_log_entry_t *latest = 0;
   unsigned started = 0;
   int skipped = 0;
 
@@ -12963,13 +12964,11 @@ uint64_t PrimaryLogPG::recover_primary(uint64_t max, ThreadPool::TPHandle &handl
     hobject_t soid;
     version_t v = p->first;
 
-    auto it_objects = recovery_state.get_pg_log().get_log().objects.find(p->second);
-    if (it_objects != recovery_state.get_pg_log().get_log().objects.end()) {
-      latest = it_objects->second;
+    latest = recovery_state.get_pg_log().get_log().get_latest_entry(p->second);
+    if (latest) {
       ceph_assert(latest->is_update() || latest->is_delete());
       soid = latest->soid;
     } else {
-      latest = 0;
       soid = p->second;
     }
     const pg_missing_item& item = missing.get_items().find(p->second)->second;
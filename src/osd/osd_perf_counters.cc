@@ -282,6 +282,23 @@ PerfCounters *build_osd_logger(CephContext *cct) {
 }
  
 
+PerfCounters *build_osd_shard_logger(CephContext *cct, unsigned shard_id) {
+  PerfCountersBuilder plb(cct, "osd_shard." + std::to_string(shard_id),
+			  l_osd_shard_first, l_osd_shard_last);
+
+  plb.add_u64(
+    l_osd_shard_queue_depth, "queue_depth",
+    "Operations queued");
+  plb.add_u64_counter(
+    l_osd_shard_stolen, "stolen",
+    "Times threads of other shards worked this shard's queue");
+  plb.add_u64_counter(
+    l_osd_shard_steals, "steals",
+    "Times this shard's threads worked another shard's queue");
+
+  return plb.create_perf_counters();
+}
+
 PerfCounters *build_recoverystate_perf(CephContext *cct) {
   PerfCountersBuilder rs_perf(cct, "recoverystate_perf", rs_first, rs_last);
 
@@ -123,6 +123,17 @@ enum {
 
 PerfCounters *build_osd_logger(CephContext *cct);
 
+// OSDShard perf counters
+enum {
+  l_osd_shard_first = 10500,
+  l_osd_shard_queue_depth,
+  l_osd_shard_stolen,
+  l_osd_shard_steals,
+  l_osd_shard_last,
+};
+
+PerfCounters *build_osd_shard_logger(CephContext *cct, unsigned shard_id);
+
 // PeeringState perf counters
 enum {
   rs_first = 20000,
@@ -4399,6 +4399,8 @@ void pg_lease_ack_t::generate_test_instances(std::list<pg_lease_ack_t*>& o)
 // -- ObjectModDesc --
 void ObjectModDesc::visit(Visitor *visitor) const
 {
+  ceph::buffer::list bl;
+  bl.append(ops.data(), ops.size());
   auto bp = bl.cbegin();
   try {
     while (!bp.end()) {
@@ -4551,7 +4553,10 @@ void ObjectModDesc::encode(ceph::buffer::list &_bl) const
   ENCODE_START(max_required_version, max_required_version, _bl);
   encode(can_local_rollback, _bl);
   encode(rollback_info_completed, _bl);
-  encode(bl, _bl);
+  // as a ceph::buffer::list
+  __u32 len = ops.size();
+  encode(len, _bl);
+  _bl.append(ops.data(), ops.size());
   ENCODE_FINISH(_bl);
 }
 void ObjectModDesc::decode(ceph::buffer::list::const_iterator &_bl)
@@ -4560,10 +4565,18 @@ void ObjectModDesc::decode(ceph::buffer::list::const_iterator &_bl)
   max_required_version = struct_v;
   decode(can_local_rollback, _bl);
   decode(rollback_info_completed, _bl);
-  decode(bl, _bl);
-  // ensure bl does not pin a larger ceph::buffer in memory
-  bl.rebuild();
-  bl.reassign_to_mempool(mempool::mempool_osd_pglog);
+  // as a ceph::buffer::list, copied out so that it does not pin the
+  // larger message buffer in memory
+  __u32 len;
+  decode(len, _bl);
+  if (_bl.get_remaining() < len) {
+    // don't let a bogus length allocate before the copy fails
+    throw ceph::buffer::end_of_buffer();
+  }
+  ops.clear();
+  ops.reserve(len);
+  ops.resize(len);
+  _bl.copy(len, ops.data());
   DECODE_FINISH(_bl);
 }
 
@@ -24,6 +24,7 @@
 #include <memory>
 #include <string_view>
 
+#include <boost/container/small_vector.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/optional/optional_io.hpp>
 #include <boost/variant.hpp>
@@ -3857,6 +3858,23 @@ class ObjectModDesc {
 
   // version required to decode, reflected in encode/decode version
   __u8 max_required_version = 1;
+
+  /*
+   * The encoded rollback ops.  Most entries only carry an append or a
+   * create, a few dozen bytes, so keep those inside the log entry rather
+   * than in a separately allocated buffer.  The encoding is that of the
+   * ceph::buffer::list this used to be.
+   */
+  static constexpr size_t inline_ops_len = 32;
+  using ops_t = boost::container::small_vector<
+    char, inline_ops_len, mempool::osd_pglog::pool_allocator<char>>;
+  mutable ops_t ops;
+
+  void append_ops(const ceph::buffer::list &bl) {
+    for (auto &p : bl.buffers()) {
+      ops.insert(ops.end(), p.c_str(), p.c_str() + p.length());
+    }
+  }
 public:
   class Visitor {
   public:
@@ -3880,7 +3898,6 @@ public:
     virtual ~Visitor() {}
   };
   void visit(Visitor *visitor) const;
-  mutable ceph::buffer::list bl;
   enum ModID {
     APPEND = 1,
     SETATTRS = 2,
@@ -3890,11 +3907,10 @@ public:
     TRY_DELETE = 6,
     ROLLBACK_EXTENTS = 7
   };
-  ObjectModDesc() : can_local_rollback(true), rollback_info_completed(false) {
-    bl.reassign_to_mempool(mempool::mempool_osd_pglog);
-  }
+  ObjectModDesc() : can_local_rollback(true), rollback_info_completed(false) {}
   void claim(ObjectModDesc &other) {
-    bl = std::move(other.bl);
+    ops = std::move(other.ops);
+    other.ops.clear();
     can_local_rollback = other.can_local_rollback;
     rollback_info_completed = other.rollback_info_completed;
   }
@@ -3905,18 +3921,19 @@ public:
       mark_unrollbackable();
       return;
     }
-    bl.claim_append(other.bl);
+    ops.insert(ops.end(), other.ops.begin(), other.ops.end());
+    other.ops.clear();
     rollback_info_completed = other.rollback_info_completed;
   }
   void swap(ObjectModDesc &other) {
-    bl.swap(other.bl);
+    ops.swap(other.ops);
 
     using std::swap;
     swap(other.can_local_rollback, can_local_rollback);
     swap(other.rollback_info_completed, rollback_info_completed);
     swap(other.max_required_version, max_required_version);
   }
-  void append_id(ModID id) {
+  void append_id(ModID id, ceph::buffer::list &bl) {
     using ceph::encode;
     uint8_t _id(id);
     encode(_id, bl);
@@ -3924,36 +3941,44 @@ public:
   void append(uint64_t old_size) {
     if (!can_local_rollback || rollback_info_completed)
       return;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(APPEND);
+    append_id(APPEND, bl);
     encode(old_size, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
   }
   void setattrs(std::map<std::string, std::optional<ceph::buffer::list>> &old_attrs) {
     if (!can_local_rollback || rollback_info_completed)
       return;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(SETATTRS);
+    append_id(SETATTRS, bl);
     encode(old_attrs, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
   }
   bool rmobject(version_t deletion_version) {
     if (!can_local_rollback || rollback_info_completed)
       return false;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(DELETE);
+    append_id(DELETE, bl);
     encode(deletion_version, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
     rollback_info_completed = true;
     return true;
   }
   bool try_rmobject(version_t deletion_version) {
     if (!can_local_rollback || rollback_info_completed)
       return false;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(TRY_DELETE);
+    append_id(TRY_DELETE, bl);
     encode(deletion_version, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
     rollback_info_completed = true;
     return true;
   }
@@ -3961,17 +3986,21 @@ public:
     if (!can_local_rollback || rollback_info_completed)
       return;
     rollback_info_completed = true;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(CREATE);
+    append_id(CREATE, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
   }
   void update_snaps(const std::set<snapid_t> &old_snaps) {
     if (!can_local_rollback || rollback_info_completed)
       return;
+    ceph::buffer::list bl;
     ENCODE_START(1, 1, bl);
-    append_id(UPDATE_SNAPS);
+    append_id(UPDATE_SNAPS, bl);
     encode(old_snaps, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
   }
   void rollback_extents(
     version_t gen, const std::vector<std::pair<uint64_t, uint64_t> > &extents) {
@@ -3979,23 +4008,30 @@ public:
     ceph_assert(!rollback_info_completed);
     if (max_required_version < 2)
       max_required_version = 2;
+    ceph::buffer::list bl;
     ENCODE_START(2, 2, bl);
-    append_id(ROLLBACK_EXTENTS);
+    append_id(ROLLBACK_EXTENTS, bl);
     encode(gen, bl);
     encode(extents, bl);
     ENCODE_FINISH(bl);
+    append_ops(bl);
   }
 
   // cannot be rolled back
   void mark_unrollbackable() {
     can_local_rollback = false;
-    bl.clear();
+    ops.clear();
+    ops.shrink_to_fit();
   }
   bool can_rollback() const {
     return can_local_rollback;
   }
   bool empty() const {
-    return can_local_rollback && (bl.length() == 0);
+    return can_local_rollback && ops.empty();
+  }
+  /// bytes allocated outside of the entry for the rollback ops
+  uint64_t get_heap_bytes() const {
+    return ops.capacity() > inline_ops_len ? ops.capacity() : 0;
   }
 
   bool requires_kraken() const {
@@ -4003,13 +4039,17 @@ public:
   }
 
   /**
-   * Create fresh copy of bl bytes to avoid keeping large buffers around
-   * in the case that bl contains ptrs which point into a much larger
-   * message buffer
+   * Drop the spare capacity left behind by appending the ops one at a
+   * time, before the entry goes into the log
    */
   void trim_bl() const {
-    if (bl.length() > 0)
-      bl.rebuild();
+    // shrink_to_fit() would also move inline ops out to the heap
+    if (ops.size() > inline_ops_len && ops.capacity() > ops.size()) {
+      ops_t trimmed;
+      trimmed.reserve(ops.size());
+      trimmed.assign(ops.begin(), ops.end());
+      ops.swap(trimmed);
+    }
   }
   void encode(ceph::buffer::list &bl) const;
   void decode(ceph::buffer::list::const_iterator &bl);
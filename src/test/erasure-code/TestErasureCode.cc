@@ -156,6 +156,57 @@ TEST(ErasureCodeTest, encode_misaligned_non_contiguous)
   }
 }
 
+TEST(ErasureCodeTest, encode_prepare_batch)
+{
+  int k = 3;
+  int m = 1;
+  unsigned chunk_size = ErasureCode::SIMD_ALIGN * 7;
+  unsigned stripe_count = 2;
+  ErasureCodeTest erasure_code(k, m, chunk_size);
+
+  bufferlist in;
+  for (unsigned i = 0; i < stripe_count * k * chunk_size; i++)
+    in.append((char)(i % 251));
+  map<int, bufferlist> encoded;
+  ASSERT_EQ(0, erasure_code.encode_prepare_batch(in, stripe_count, encoded));
+  ASSERT_EQ((unsigned)(k + m), encoded.size());
+  for (int i = 0; i < k + m; i++) {
+    ASSERT_TRUE(encoded[i].is_contiguous());
+    ASSERT_TRUE(encoded[i].is_aligned(ErasureCode::SIMD_ALIGN));
+    ASSERT_EQ(stripe_count * chunk_size, encoded[i].length());
+  }
+  // chunk i of stripe s is at s * chunk_size in encoded[i]
+  for (unsigned s = 0; s < stripe_count; s++) {
+    for (int i = 0; i < k; i++) {
+      ASSERT_EQ(0, memcmp(encoded[i].c_str() + s * chunk_size,
+			  in.c_str() + (s * k + i) * chunk_size,
+			  chunk_size));
+    }
+  }
+}
+
+TEST(ErasureCodeTest, encode_batch_invalid)
+{
+  int k = 3;
+  int m = 1;
+  unsigned chunk_size = ErasureCode::SIMD_ALIGN * 7;
+  ErasureCodeTest erasure_code(k, m, chunk_size);
+
+  set<int> want_to_encode;
+  for (unsigned int i = 0; i < erasure_code.get_chunk_count(); i++)
+    want_to_encode.insert(i);
+  bufferlist in;
+  in.append(string(2 * k * chunk_size, 'X'));
+  map<int, bufferlist> encoded;
+  EXPECT_EQ(-EINVAL, erasure_code.encode_batch(want_to_encode, in, 0,
+					       &encoded));
+  // stripes of 1.5 chunks would need padding
+  EXPECT_EQ(-EINVAL, erasure_code.encode_batch(want_to_encode, in, 4,
+					       &encoded));
+  EXPECT_EQ(-EINVAL, erasure_code.encode_batch(want_to_encode, in, 5,
+					       &encoded));
+}
+
 /*
  * Local Variables:
  * compile-command: "cd ../.. ;
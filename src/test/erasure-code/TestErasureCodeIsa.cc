@@ -874,6 +874,98 @@ TEST_F(IsaErasureCodeTest, isa_xor_codec)
   EXPECT_EQ(5, cnt_cf);
 }
 
+TEST_F(IsaErasureCodeTest, parity_delta)
+{
+  // m == 1 is a plain xor, the others go through the encode tables
+  for (const char *m : { "1", "2" }) {
+    for (int matrix : { ErasureCodeIsaDefault::kVandermonde,
+			ErasureCodeIsaDefault::kCauchy }) {
+      ErasureCodeIsaDefault Isa(tcache, matrix);
+      ErasureCodeProfile profile;
+      profile["k"] = "3";
+      profile["m"] = m;
+      Isa.init(profile, &cerr);
+      ASSERT_TRUE(Isa.supports_parity_delta());
+
+      unsigned k = Isa.get_data_chunk_count();
+      unsigned n = Isa.get_chunk_count();
+      set<int> want_to_encode;
+      for (unsigned i = 0; i < n; i++)
+	want_to_encode.insert(i);
+
+      bufferlist in;
+      for (unsigned i = 0; i < k * Isa.get_alignment() * 4; i++)
+	in.append((char)(i * 13 + 1));
+      map<int, bufferlist> encoded;
+      EXPECT_EQ(0, Isa.encode(want_to_encode, in, &encoded));
+      unsigned length = encoded[0].length();
+
+      // overwrite parts of the first and last data chunks
+      bufferlist in2;
+      in2.append(in.c_str(), in.length());
+      for (unsigned i = 10; i < 50; i++)
+	in2.c_str()[i] ^= 0xa5;
+      for (unsigned i = (k - 1) * length; i < (k - 1) * length + 70; i++)
+	in2.c_str()[i] ^= 0x3c;
+      map<int, bufferlist> reencoded;
+      EXPECT_EQ(0, Isa.encode(want_to_encode, in2, &reencoded));
+
+      map<int, bufferptr> deltas;
+      for (int i : { 0, (int)k - 1 }) {
+	encoded[i].rebuild();
+	reencoded[i].rebuild();
+	Isa.encode_delta(encoded[i].front(), reencoded[i].front(), &deltas[i]);
+      }
+      map<int, bufferptr> parity;
+      for (unsigned i = k; i < n; i++) {
+	encoded[i].rebuild();
+	parity[i] = encoded[i].front();
+      }
+      EXPECT_EQ(0, Isa.apply_delta(deltas, &parity));
+      for (unsigned i = k; i < n; i++) {
+	EXPECT_EQ(0, memcmp(parity[i].c_str(), reencoded[i].c_str(), length));
+      }
+    }
+  }
+}
+
+TEST_F(IsaErasureCodeTest, encode_batch)
+{
+  for (const char *m : { "1", "2" }) {
+    ErasureCodeIsaDefault Isa(tcache);
+    ErasureCodeProfile profile;
+    profile["k"] = "3";
+    profile["m"] = m;
+    Isa.init(profile, &cerr);
+
+    unsigned n = Isa.get_chunk_count();
+    set<int> want_to_encode;
+    for (unsigned i = 0; i < n; i++)
+      want_to_encode.insert(i);
+    unsigned stripe_width = Isa.get_chunk_size(1) * 3;
+    unsigned stripe_count = 4;
+    bufferlist in;
+    for (unsigned i = 0; i < stripe_count * stripe_width; i++)
+      in.append((char)(i * 13 + i / 253));
+    map<int, bufferlist> batch;
+    EXPECT_EQ(0, Isa.encode_batch(want_to_encode, in, stripe_count, &batch));
+    EXPECT_EQ(n, batch.size());
+
+    for (unsigned s = 0; s < stripe_count; s++) {
+      bufferlist stripe;
+      stripe.substr_of(in, s * stripe_width, stripe_width);
+      map<int, bufferlist> encoded;
+      EXPECT_EQ(0, Isa.encode(want_to_encode, stripe, &encoded));
+      unsigned length = encoded[0].length();
+      for (unsigned i = 0; i < n; i++) {
+	EXPECT_EQ(stripe_count * length, batch[i].length());
+	EXPECT_EQ(0, memcmp(batch[i].c_str() + s * length,
+			    encoded[i].c_str(), length));
+      }
+    }
+  }
+}
+
 TEST_F(IsaErasureCodeTest, create_rule)
 {
   std::unique_ptr<CrushWrapper> c = std::make_unique<CrushWrapper>();
@@ -129,6 +129,86 @@ TYPED_TEST(ErasureCodeTest, encode_decode)
   }
 }
 
+TYPED_TEST(ErasureCodeTest, parity_delta)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "3";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  jerasure.init(profile, &cerr);
+  if (!jerasure.supports_parity_delta())
+    return;
+
+  bufferlist in;
+  for (unsigned i = 0; i < 3 * 1024; i++)
+    in.append((char)(i * 7 + 3));
+  set<int> want_to_encode = { 0, 1, 2, 3, 4 };
+  map<int, bufferlist> encoded;
+  EXPECT_EQ(0, jerasure.encode(want_to_encode, in, &encoded));
+  unsigned length = encoded[0].length();
+
+  // overwrite part of the second data chunk
+  bufferlist in2;
+  in2.append(in.c_str(), in.length());
+  for (unsigned i = length + 100; i < length + 300; i++)
+    in2.c_str()[i] ^= 0x5a;
+  map<int, bufferlist> reencoded;
+  EXPECT_EQ(0, jerasure.encode(want_to_encode, in2, &reencoded));
+
+  encoded[1].rebuild();
+  reencoded[1].rebuild();
+  bufferptr delta;
+  jerasure.encode_delta(encoded[1].front(), reencoded[1].front(), &delta);
+  EXPECT_EQ(length, delta.length());
+
+  map<int, bufferptr> deltas = { { 1, delta } };
+  map<int, bufferptr> parity;
+  for (int i : { 3, 4 }) {
+    encoded[i].rebuild();
+    parity[i] = encoded[i].front();
+  }
+  EXPECT_EQ(0, jerasure.apply_delta(deltas, &parity));
+  for (int i : { 3, 4 }) {
+    EXPECT_EQ(0, memcmp(parity[i].c_str(), reencoded[i].c_str(), length));
+  }
+}
+
+TYPED_TEST(ErasureCodeTest, encode_batch)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "2";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  jerasure.init(profile, &cerr);
+
+  unsigned stripe_width = jerasure.get_chunk_size(1) * 2;
+  unsigned stripe_count = 5;
+  bufferlist in;
+  for (unsigned i = 0; i < stripe_count * stripe_width; i++)
+    in.append((char)(i * 7 + i / 251));
+  set<int> want_to_encode = { 0, 1, 2, 3 };
+  map<int, bufferlist> batch;
+  EXPECT_EQ(0, jerasure.encode_batch(want_to_encode, in, stripe_count,
+				     &batch));
+  EXPECT_EQ(4u, batch.size());
+
+  // same as encoding one stripe after the other
+  for (unsigned s = 0; s < stripe_count; s++) {
+    bufferlist stripe;
+    stripe.substr_of(in, s * stripe_width, stripe_width);
+    map<int, bufferlist> encoded;
+    EXPECT_EQ(0, jerasure.encode(want_to_encode, stripe, &encoded));
+    unsigned length = encoded[0].length();
+    for (int i : want_to_encode) {
+      EXPECT_EQ(stripe_count * length, batch[i].length());
+      EXPECT_EQ(0, memcmp(batch[i].c_str() + s * length,
+			  encoded[i].c_str(), length));
+    }
+  }
+}
+
 TYPED_TEST(ErasureCodeTest, minimum_to_decode)
 {
   TypeParam jerasure;
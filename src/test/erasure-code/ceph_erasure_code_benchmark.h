@@ -24,6 +24,7 @@ using namespace std;
 
 class ErasureCodeBench {
   int in_size;
+  int stripe_width;
   int max_iterations;
   int erasures;
   int k;
@@ -49,6 +50,7 @@ public:
 		      ErasureCodeInterfaceRef erasure_code);
   int decode();
   int encode();
+  int encode_batch();
 };
 
 #endif
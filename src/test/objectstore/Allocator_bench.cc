@@ -5,6 +5,7 @@
  * Author: Igor Fedotov, ifedotov@suse.com
  */
 #include <iostream>
+#include <thread>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -13,6 +14,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/MagazineAllocator.h"
 
 #include <boost/random/uniform_int.hpp>
 typedef boost::mt11213b gen_type;
@@ -326,6 +328,59 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+TEST_P(AllocTest, test_alloc_bench_contention)
+{
+  uint64_t capacity = uint64_t(64) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  const unsigned num_threads = 8;
+  const uint64_t ops_per_thread = 200000;
+
+  auto run = [&](unsigned magazines) {
+    init_alloc(capacity, alloc_unit);
+    if (magazines) {
+      alloc.reset(new MagazineAllocator(g_ceph_context,
+	Allocator::create(g_ceph_context, string(GetParam()), capacity,
+			  alloc_unit),
+	magazines, 0x10000, 32));
+    }
+    alloc->init_add_free(0, capacity);
+
+    utime_t start = ceph_clock_now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+	gen_type rng(t);
+	boost::uniform_int<> u1(0, 4); // 4K-64K
+	std::vector<PExtentVector> live(64);
+	for (uint64_t i = 0; i < ops_per_thread; ++i) {
+	  auto& slot = live[i % live.size()];
+	  if (!slot.empty()) {
+	    alloc->release(slot);
+	    slot.clear();
+	  }
+	  uint64_t want = alloc_unit << u1(rng);
+	  EXPECT_EQ((int64_t)want, alloc->allocate(want, alloc_unit, 0, 0, &slot));
+	}
+	for (auto& slot : live) {
+	  alloc->release(slot);
+	}
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    auto elapsed = ceph_clock_now() - start;
+    std::cout << num_threads << " threads, " << magazines << " magazines: "
+	      << num_threads * ops_per_thread / (double)elapsed
+	      << " alloc+release/s" << std::endl;
+    EXPECT_EQ(capacity, alloc->get_free());
+    alloc->shutdown();
+    init_close();
+  };
+  run(0);
+  run(num_threads);
+}
+
 TEST_P(AllocTest, mempoolAccounting)
 {
   uint64_t bytes = mempool::bluestore_alloc::allocated_bytes();
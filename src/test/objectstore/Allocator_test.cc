@@ -9,10 +9,14 @@
 #include <gtest/gtest.h>
 
 #include "common/Cond.h"
+#include "common/admin_socket.h"
+#include "common/ceph_json.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/MagazineAllocator.h"
 
 typedef boost::mt11213b gen_type;
 
@@ -500,6 +504,88 @@ TEST_P(AllocTest, test_alloc_47883)
   EXPECT_EQ(got, 0x630000);
 }
 
+TEST_P(AllocTest, test_alloc_magazines)
+{
+  uint64_t block = 0x1000;
+  uint64_t capacity = 0x10000000;
+  alloc.reset(new MagazineAllocator(g_ceph_context,
+    Allocator::create(g_ceph_context, GetParam(), capacity, block,
+		      "magazines_test"),
+    4, 0x10000, 8));
+  ASSERT_EQ("magazines_test", alloc->get_name());
+  alloc->init_add_free(0, capacity);
+  ASSERT_EQ(capacity, alloc->get_free());
+
+  // small allocations get cached, free space stays exact
+  interval_set<uint64_t> allocated;
+  for (size_t i = 0; i < 100; ++i) {
+    PExtentVector extents;
+    uint64_t want = block << (i % 5);
+    ASSERT_EQ((int64_t)want, alloc->allocate(want, block, 0, 0, &extents));
+    for (auto& e : extents) {
+      allocated.insert(e.offset, e.length);
+    }
+    ASSERT_EQ(capacity - allocated.size(), alloc->get_free());
+  }
+  auto magazines = static_cast<MagazineAllocator*>(alloc.get());
+  ASSERT_GT(magazines->get_cached_bytes(), 0u);
+  PerfCounters* logger = magazines->get_perf_counters();
+  ASSERT_GT(logger->get(l_alloc_magazines_hits), 0u);
+  alloc->release(allocated);
+  allocated.clear();
+  ASSERT_EQ(capacity, alloc->get_free());
+
+  // the whole device is still reachable, cached extents included
+  uint64_t total = 0;
+  while (true) {
+    PExtentVector extents;
+    auto r = alloc->allocate(0x10000, block, 0, 0, &extents);
+    if (r <= 0) {
+      break;
+    }
+    for (auto& e : extents) {
+      allocated.insert(e.offset, e.length);
+    }
+    total += r;
+  }
+  ASSERT_EQ(capacity, total);
+  ASSERT_EQ(0u, alloc->get_free());
+  ASSERT_EQ(0u, magazines->get_cached_bytes());
+  ASSERT_GT(logger->get(l_alloc_magazines_misses), 0u);
+  ASSERT_GT(logger->get(l_alloc_magazines_drains), 0u);
+
+  alloc->release(allocated);
+  ASSERT_GT(magazines->get_cached_bytes(), 0u);
+  uint64_t dumped = 0;
+  alloc->dump([&](uint64_t off, uint64_t len) {
+    dumped += len;
+  });
+  ASSERT_EQ(capacity, dumped);
+
+  // the admin socket dump goes through the magazines as well
+  AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+  ASSERT_TRUE(admin_socket);
+  bufferlist in, out;
+  ostringstream err;
+  ASSERT_EQ(0, admin_socket->execute_command(
+    { "{\"prefix\": \"bluestore allocator dump magazines_test\"}" },
+    in, err, &out));
+  JSONParser parser;
+  ASSERT_TRUE(parser.parse(out.c_str(), out.length()));
+  JSONObj *extents = parser.find_obj("extents");
+  ASSERT_TRUE(extents);
+  dumped = 0;
+  for (auto i = extents->find_first(); !i.end(); ++i) {
+    string length;
+    JSONDecoder::decode_json("length", length, *i, true);
+    dumped += std::stoull(length, nullptr, 16);
+  }
+  ASSERT_EQ(capacity, dumped);
+  alloc->shutdown();
+  ASSERT_EQ(capacity, alloc->get_free());
+  ASSERT_EQ(0u, magazines->get_cached_bytes());
+}
+
 INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
@@ -0,0 +1,27 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * OnodeSpace lookup benchmark: concurrent lookups of hot onodes, as op
+ * shards do them, against the number of shards.
+ */
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "global/global_context.h"
+#include "onode_lookup_fixture.h"
+
+TEST(OnodeSpace, lookup_bench)
+{
+  const unsigned num_onodes = 1024;
+  const unsigned lookups_per_thread = 1000000;
+
+  for (unsigned shards : {1, 2, 4, 8, 16}) {
+    OnodeLookupFixture f(g_ceph_context, shards, num_onodes);
+    auto dur = f.run(lookups_per_thread);
+    double iops = (double)lookups_per_thread * f.num_threads() /
+      ((double)dur.count() / 1000000000.0);
+    std::cout << "shards " << shards << ", threads " << f.num_threads()
+	      << ", " << dur << " seconds, " << iops << " lookups/sec, "
+	      << iops / f.num_threads() << " per thread" << std::endl;
+  }
+}
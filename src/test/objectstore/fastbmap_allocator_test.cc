@@ -2,6 +2,7 @@
 // vim: ts=8 sw=2 smarttab
 
 #include <iostream>
+#include <random>
 #include <gtest/gtest.h>
 
 #include "os/bluestore/fastbmap_allocator_impl.h"
@@ -1064,3 +1065,45 @@ TEST(TestAllocatorLevel01, test_claim_free_l2)
   ASSERT_EQ(0x15000,
     al2.debug_get_free());
 }
+
+TEST(TestAllocatorLevel01, test_slotset_kernels)
+{
+  auto kernels = fastbmap_available_kernels();
+  ASSERT_FALSE(kernels.empty());
+  auto scalar = kernels.front();
+  std::cout << "testing " << kernels.size() << " implementation(s), using "
+	    << fastbmap_kernels().name << std::endl;
+
+  std::mt19937_64 rng(0);
+  std::vector<slot_t> slots(slots_per_slotset * 64 + 3);
+  for (size_t i = 0; i < 1000; ++i) {
+    for (auto& s : slots) {
+      switch (rng() % 4) {
+      case 0: s = all_slot_clear; break;
+      case 1: s = all_slot_set; break;
+      default: s = rng() & rng(); break;
+      }
+    }
+    // make sure uniform slotsets show up, with a single odd bit sometimes
+    for (size_t j = 0; j < slots_per_slotset; ++j) {
+      slots[j] = all_slot_clear;
+      slots[slots_per_slotset + j] = all_slot_set;
+    }
+    if (i % 2) {
+      slots[rng() % slots_per_slotset] |= slot_t(1) << (rng() % bits_per_slot);
+      slots[slots_per_slotset + rng() % slots_per_slotset] &=
+	~(slot_t(1) << (rng() % bits_per_slot));
+    }
+    size_t off = rng() % slots_per_slotset;
+    size_t count = rng() % (slots.size() - off);
+    for (auto k : kernels) {
+      for (size_t j = 0; j + slots_per_slotset <= slots.size();
+	   j += slots_per_slotset) {
+	ASSERT_EQ(scalar->slotset_state(&slots[j]), k->slotset_state(&slots[j]))
+	  << k->name;
+      }
+      ASSERT_EQ(scalar->count_set(&slots[off], count),
+		k->count_set(&slots[off], count)) << k->name;
+    }
+  }
+}
@@ -0,0 +1,93 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "common/ceph_time.h"
+#include "include/stringify.h"
+#include "os/bluestore/BlueStore.h"
+
+// One collection and cache shard per op shard, each holding its share of
+// num_onodes onodes pinned the way in-flight ops keep them.  run() looks
+// them up from two reader threads per shard.  Used by the OnodeSpace
+// concurrent_lookup test and by unittest_onode_bench.
+class OnodeLookupFixture {
+  BlueStore store;
+  std::vector<BlueStore::OnodeCacheShard*> ocs;
+  std::vector<BlueStore::BufferCacheShard*> bcs;
+  std::vector<BlueStore::CollectionRef> colls;
+  std::vector<ghobject_t> oids;
+  std::vector<BlueStore::OnodeRef> pins;
+  const unsigned shards;
+
+public:
+  PerfCounters *logger = nullptr;
+
+  OnodeLookupFixture(CephContext *cct, unsigned shards, unsigned num_onodes)
+    : store(cct, "", 4096), shards(shards) {
+    PerfCountersBuilder plb(cct, "onode_lookup",
+			    l_bluestore_first, l_bluestore_last);
+    plb.add_u64_counter(l_bluestore_onode_hits, "onode_hits", "");
+    plb.add_u64_counter(l_bluestore_onode_misses, "onode_misses", "");
+    logger = plb.create_perf_counters();
+
+    for (unsigned s = 0; s < shards; ++s) {
+      ocs.push_back(BlueStore::OnodeCacheShard::create(cct, "lru", logger));
+      bcs.push_back(BlueStore::BufferCacheShard::create(cct, "lru", NULL));
+      ocs.back()->set_max(num_onodes);
+      colls.push_back(ceph::make_ref<BlueStore::Collection>(
+	&store, ocs.back(), bcs.back(), coll_t()));
+    }
+    for (unsigned i = 0; i < num_onodes; ++i) {
+      ghobject_t oid(hobject_t(object_t("obj" + stringify(i)), "",
+			       CEPH_NOSNAP, i, 1, ""));
+      auto& c = colls[i % shards];
+      BlueStore::OnodeRef o(new BlueStore::Onode(c.get(), oid, ""));
+      o->exists = true;
+      o = c->onode_map.add(oid, o);
+      oids.push_back(oid);
+      pins.push_back(o);
+    }
+  }
+
+  ~OnodeLookupFixture() {
+    pins.clear();
+    for (auto& c : colls) {
+      c->onode_map.clear();
+    }
+    colls.clear();
+    for (unsigned s = 0; s < shards; ++s) {
+      delete ocs[s];
+      delete bcs[s];
+    }
+    delete logger;
+  }
+
+  unsigned num_threads() const {
+    return shards * 2;
+  }
+
+  // every lookup must find the pinned onode; returns the wall time
+  ceph::timespan run(unsigned lookups_per_thread) {
+    std::vector<std::thread> threads;
+    auto start = ceph::mono_clock::now();
+    for (unsigned t = 0; t < num_threads(); ++t) {
+      threads.emplace_back([&, t] {
+	unsigned s = t % shards;
+	for (unsigned i = 0; i < lookups_per_thread; ++i) {
+	  unsigned n = (i * shards + s) % oids.size();
+	  auto o = colls[s]->onode_map.lookup(oids[n]);
+	  ASSERT_EQ(pins[n].get(), o.get());
+	}
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    return std::chrono::duration_cast<ceph::timespan>(
+      ceph::mono_clock::now() - start);
+  }
+};
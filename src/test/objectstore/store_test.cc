@@ -37,6 +37,8 @@
 #include "common/ceph_mutex.h"
 #include "common/Cond.h"
 #include "common/errno.h"
+#include "common/ceph_json.h"
+#include "common/numa.h"
 #include "include/stringify.h"
 #include "include/coredumpctl.h"
 
@@ -6597,6 +6599,70 @@ TEST_P(StoreTest, BluestoreOnOffCSumTest) {
     ASSERT_EQ(r, 0);
   }
 }
+
+TEST_P(StoreTest, BluestoreCSumReadBench) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  // keep the reads off the buffer cache so that every one is verified
+  SetVal(g_conf(), "bluestore_default_buffered_read", "false");
+  SetVal(g_conf(), "bluestore_default_buffered_write", "false");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const size_t object_size = 4 << 20;
+  const int count = 64;
+  bufferlist orig;
+  orig.append(ceph::buffer::create_page_aligned(object_size));
+  for (size_t i = 0; i < object_size; ++i) {
+    orig.c_str()[i] = (char)(i * 31 + (i >> 12));
+  }
+  const char* types[] = { "none", "crc32c", "xxhash32", "xxhash64" };
+  for (auto type : types) {
+    SetVal(g_conf(), "bluestore_csum_type", type);
+    g_conf().apply_changes(nullptr);
+    ghobject_t hoid(hobject_t(sobject_t(string("Object ") + type,
+					CEPH_NOSNAP)));
+    {
+      ObjectStore::Transaction t;
+      t.write(cid, hoid, 0, orig.length(), orig);
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    auto start = ceph::mono_clock::now();
+    for (int i = 0; i < count; ++i) {
+      bufferlist in;
+      r = store->read(ch, hoid, 0, object_size, in);
+      ASSERT_EQ((int)object_size, r);
+      if (i == 0) {
+	ASSERT_TRUE(bl_eq(orig, in));
+      }
+    }
+    auto dur = std::chrono::duration_cast<ceph::timespan>(
+      ceph::mono_clock::now() - start);
+    double mbsec = (double)count * object_size / 1000000.0 /
+      std::chrono::duration<double>(dur).count();
+    cout << "csum_type " << type << ", " << dur << " seconds, "
+	 << mbsec << " MB/sec" << std::endl;
+  }
+  {
+    ObjectStore::Transaction t;
+    for (auto type : types) {
+      t.remove(cid, ghobject_t(hobject_t(sobject_t(string("Object ") + type,
+						     CEPH_NOSNAP))));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
 #endif
 
 INSTANTIATE_TEST_SUITE_P(
@@ -8466,6 +8532,367 @@ TEST_P(StoreTest, BluestoreRepairGlobalStatsFixOnMount) {
   bstore->mount();
 }
 
+TEST_P(StoreTest, BluestoreAllocSnapshot) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  const PerfCounters* logger = bstore->get_perf_counters();
+  // free space plus what BlueFS holds on the same device, which rocksdb
+  // changes on every mount
+  auto available = [&]() {
+    store_statfs_t statfs;
+    EXPECT_EQ(0, store->statfs(&statfs));
+    return statfs.available + statfs.internal_metadata +
+      statfs.omap_allocated;
+  };
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist bl;
+    bl.append(std::string(0x100000, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+
+  // a clean umount saves the snapshot, the next mount loads it
+  SetVal(g_conf(), "bluestore_alloc_snapshot", "true");
+  g_conf().apply_changes(nullptr);
+  uint64_t avail = available();
+  uint64_t loads = logger->get(l_bluestore_alloc_snapshot_loads);
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+  ASSERT_EQ(loads + 1, logger->get(l_bluestore_alloc_snapshot_loads));
+  ASSERT_EQ(avail, available());
+
+  // free space while no snapshot is saved; the one left in BlueFS is
+  // stale and the next mount must read the freelist
+  {
+    auto ch = store->open_collection(cid);
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  uint64_t freed = available();
+  ASSERT_GT(freed, avail);
+  SetVal(g_conf(), "bluestore_alloc_snapshot", "false");
+  g_conf().apply_changes(nullptr);
+  bstore->umount();
+  SetVal(g_conf(), "bluestore_alloc_snapshot", "true");
+  g_conf().apply_changes(nullptr);
+  loads = logger->get(l_bluestore_alloc_snapshot_loads);
+  ASSERT_EQ(0, bstore->mount());
+  ASSERT_EQ(loads, logger->get(l_bluestore_alloc_snapshot_loads));
+  ASSERT_EQ(freed, available());
+
+  // and a snapshot saved again is good for the mount after
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+  ASSERT_EQ(loads + 1, logger->get(l_bluestore_alloc_snapshot_loads));
+  ASSERT_EQ(freed, available());
+
+  bstore->umount();
+  ASSERT_EQ(0, bstore->fsck(false));
+  ASSERT_EQ(0, bstore->mount());
+}
+
+TEST_P(StoreTest, BluestoreAllocSnapshotShrink) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  const PerfCounters* logger = bstore->get_perf_counters();
+  auto available = [&]() {
+    store_statfs_t statfs;
+    EXPECT_EQ(0, store->statfs(&statfs));
+    return statfs.available + statfs.internal_metadata +
+      statfs.omap_allocated;
+  };
+
+  SetVal(g_conf(), "bluestore_alloc_snapshot", "true");
+  g_conf().apply_changes(nullptr);
+
+  // punch every other object out so the free list is fragmented
+  const unsigned n = 32;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  auto oid = [](unsigned i) {
+    return ghobject_t(hobject_t(sobject_t("Object " + stringify(i),
+					  CEPH_NOSNAP)));
+  };
+  for (unsigned i = 0; i < n; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x10000, 'a'));
+    t.write(cid, oid(i), 0, bl.length(), bl);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < n; i += 2) {
+      t.remove(cid, oid(i));
+    }
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  ch.reset();
+
+  uint64_t avail = available();
+  uint64_t loads = logger->get(l_bluestore_alloc_snapshot_loads);
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+  ASSERT_EQ(loads + 1, logger->get(l_bluestore_alloc_snapshot_loads));
+  ASSERT_EQ(avail, available());
+
+  // the holes merge back, so the next snapshot has fewer extents than
+  // the one it replaces and must not keep the old file's tail
+  ch = store->open_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 1; i < n; i += 2) {
+      t.remove(cid, oid(i));
+    }
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  ch.reset();
+  avail = available();
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+  ASSERT_EQ(loads + 2, logger->get(l_bluestore_alloc_snapshot_loads));
+  ASSERT_EQ(avail, available());
+
+  bstore->umount();
+  ASSERT_EQ(0, bstore->fsck(false));
+  ASSERT_EQ(0, bstore->mount());
+}
+
+TEST_P(StoreTest, BluestoreEncodedOnodeCache) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  const PerfCounters* logger = bstore->get_perf_counters();
+
+  // fixed ratios, so the encoded tier gets its share without autotuning
+  SetVal(g_conf(), "bluestore_cache_autotune", "false");
+  SetVal(g_conf(), "bluestore_cache_meta_encoded_ratio", "0.1");
+  g_conf().apply_changes(nullptr);
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+
+  coll_t cid(spg_t(pg_t(0, 52), shard_id_t::NO_SHARD));
+  coll_t tid(spg_t(pg_t(1, 52), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  const unsigned n = 16;
+  auto oid = [](const string& name, unsigned hash) {
+    return ghobject_t(hobject_t(name, "", CEPH_NOSNAP, hash, 52, ""));
+  };
+  auto obj = [&](unsigned i) {
+    return oid("Object " + stringify(i), i);
+  };
+  auto data = [](unsigned i) {
+    bufferlist bl;
+    bl.append(std::string(0x1000 + i * 0x100, 'a' + i));
+    return bl;
+  };
+  auto check = [&](ObjectStore::CollectionHandle& c, const ghobject_t& o,
+		   unsigned i) {
+    bufferlist expected = data(i);
+    bufferlist bl;
+    ASSERT_EQ((int)expected.length(),
+	      store->read(c, o, 0, expected.length(), bl));
+    ASSERT_TRUE(bl_eq(expected, bl));
+    bufferptr bp;
+    ASSERT_EQ(0, store->getattr(c, o, "attr", bp));
+    ASSERT_EQ(stringify(i), string(bp.c_str(), bp.length()));
+  };
+  auto encoded_hits = [&]() {
+    return logger->get(l_bluestore_onode_encoded_hits);
+  };
+  for (unsigned i = 0; i < n; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl = data(i);
+    bufferlist attr;
+    attr.append(stringify(i));
+    t.write(cid, obj(i), 0, bl.length(), bl);
+    t.setattr(cid, obj(i), "attr", attr);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+
+  // the mempool thread sizes the tier shortly after mount
+  uint64_t hits = encoded_hits();
+  for (unsigned tries = 0; encoded_hits() == hits; ++tries) {
+    ASSERT_LT(tries, 100u);
+    usleep(10000);
+    bstore->flush_cache();
+    struct stat st;
+    ASSERT_EQ(0, store->stat(ch, obj(0), &st));
+  }
+
+  // demote every onode, promote it back on read, then read it decoded
+  bstore->flush_cache();
+  hits = encoded_hits();
+  for (unsigned i = 0; i < n; ++i) {
+    check(ch, obj(i), i);
+  }
+  ASSERT_EQ(hits + n, encoded_hits());
+  for (unsigned i = 0; i < n; ++i) {
+    check(ch, obj(i), i);
+  }
+  ASSERT_EQ(hits + n, encoded_hits());
+
+  // a removed object must not come back from its encoding
+  bstore->flush_cache();
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, obj(0));
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  bstore->flush_cache();
+  struct stat st;
+  ASSERT_EQ(-ENOENT, store->stat(ch, obj(0), &st));
+
+  // nor a renamed one under its old name
+  ghobject_t renamed = oid("Renamed 2", 2);
+  bstore->flush_cache();
+  {
+    ObjectStore::Transaction t;
+    t.collection_move_rename(cid, obj(2), cid, renamed);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  bstore->flush_cache();
+  ASSERT_EQ(-ENOENT, store->stat(ch, obj(2), &st));
+  check(ch, renamed, 2);
+
+  // an object created again after removal starts out empty
+  bstore->flush_cache();
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, obj(4));
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  bstore->flush_cache();
+  {
+    ObjectStore::Transaction t;
+    t.create(cid, obj(4));
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  bstore->flush_cache();
+  ASSERT_EQ(0, store->stat(ch, obj(4), &st));
+  ASSERT_EQ(0, st.st_size);
+  bufferptr bp;
+  ASSERT_EQ(-ENODATA, store->getattr(ch, obj(4), "attr", bp));
+
+  // split with everything demoted; odd hashes move to the child
+  bstore->flush_cache();
+  auto tch = store->create_new_collection(tid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(tid, 1);
+    t.split_collection(cid, 1, 1, tid);
+    ASSERT_EQ(0, queue_transaction(store, ch, std::move(t)));
+  }
+  ch->flush();
+  for (unsigned pass = 0; pass < 2; ++pass) {
+    bstore->flush_cache();
+    hits = encoded_hits();
+    unsigned checked = 0;
+    for (unsigned i = 5; i < n; ++i) {
+      check((i & 1) ? tch : ch, obj(i), i);
+      ++checked;
+    }
+    // split dropped the tier, so the first pass reads from the kv store
+    if (pass == 0) {
+      ASSERT_EQ(hits, encoded_hits());
+    } else {
+      ASSERT_EQ(hits + checked, encoded_hits());
+    }
+  }
+  ch.reset();
+  tch.reset();
+
+  bstore->umount();
+  ASSERT_EQ(0, bstore->fsck(false));
+  ASSERT_EQ(0, bstore->mount());
+}
+
+TEST_P(StoreTest, BluestoreNumaPlacement) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  // pin the kv threads to node 0 explicitly; they can only be bound if
+  // the host tells us which cpus that node has
+  size_t cpu_set_size = 0;
+  cpu_set_t cpu_set;
+  bool have_node = get_numa_node_cpu_set(0, &cpu_set_size, &cpu_set) == 0;
+  SetVal(g_conf(), "bluestore_kv_numa_node", "0");
+  g_conf().apply_changes(nullptr);
+  bstore->umount();
+  ASSERT_EQ(0, bstore->mount());
+
+  AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+  ceph_assert(admin_socket);
+  bufferlist in, out;
+  ostringstream err;
+  ASSERT_EQ(0, admin_socket->execute_command(
+    { "{\"prefix\": \"bluestore numa placement\"}" }, in, err, &out));
+
+  JSONParser parser;
+  ASSERT_TRUE(parser.parse(out.c_str(), out.length()));
+
+  JSONObj *devices = parser.find_obj("devices");
+  ASSERT_TRUE(devices);
+  ASSERT_TRUE(devices->is_array());
+  set<string> expected_devices, names;
+  bstore->get_devices(&expected_devices);
+  for (auto i = devices->find_first(); !i.end(); ++i) {
+    string name;
+    int node = -2;
+    JSONDecoder::decode_json("name", name, *i, true);
+    JSONDecoder::decode_json("numa_node", node, *i, true);
+    ASSERT_GE(node, -1);
+    names.insert(name);
+  }
+  ASSERT_EQ(expected_devices, names);
+
+  JSONObj *kv = parser.find_obj("kv_threads");
+  ASSERT_TRUE(kv);
+  int kv_node = -2;
+  JSONDecoder::decode_json("numa_node", kv_node, kv, true);
+  if (have_node) {
+    ASSERT_EQ(0, kv_node);
+    string cpus;
+    JSONDecoder::decode_json("cpus", cpus, kv, true);
+    ASSERT_EQ(cpu_set_to_str_list(cpu_set_size, &cpu_set), cpus);
+  } else {
+    ASSERT_EQ(-1, kv_node);
+  }
+
+  JSONObj *shards = parser.find_obj("cache_shards");
+  ASSERT_TRUE(shards);
+  ASSERT_TRUE(shards->is_array());
+  unsigned n = 0;
+  for (auto i = shards->find_first(); !i.end(); ++i, ++n) {
+    unsigned shard = 0;
+    uint64_t onodes = 0;
+    JSONDecoder::decode_json("shard", shard, *i, true);
+    JSONDecoder::decode_json("onodes", onodes, *i, true);
+    ASSERT_EQ(n, shard);
+  }
+  ASSERT_GT(n, 0u);
+}
+
 TEST_P(StoreTest, BluestoreStatistics) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -8665,6 +9092,110 @@ TEST_P(StoreTest, SpuriousReadErrorTest) {
   }
 }
 
+TEST_P(StoreTest, BluestorePrefetchSequentialReads) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_prefetch_sequential_reads", "2");
+  SetVal(g_conf(), "bluestore_prefetch_max_bytes", "262144");
+  SetVal(g_conf(), "bluestore_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_retry_disk_reads", "1");
+  g_ceph_context->_conf.apply_changes(nullptr);
+
+  int r;
+  auto logger = store->get_perf_counters();
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // one blob per 64K, each with its own fill
+  const uint64_t blob_size = 0x10000;
+  const uint64_t obj_size = 16 * blob_size;
+  ghobject_t hoid(hobject_t(sobject_t("seq", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("seq_bad", CEPH_NOSNAP)));
+  bufferlist data;
+  for (unsigned i = 0; i < obj_size / blob_size; ++i) {
+    bufferlist bl;
+    bl.append(string(blob_size, 'a' + i));
+    data.append(bl);
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, i * blob_size, blob_size, bl);
+    t.write(cid, hoid2, i * blob_size, blob_size, bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // a bad checksum in a blob the reader only gets to later
+  BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+  ASSERT_TRUE(bstore);
+  const uint64_t bad_off = 8 * blob_size;
+  bstore->inject_bad_csum(cid, hoid2, bad_off);
+  // force cache clear
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+
+  const uint64_t len = 0x4000;
+  uint64_t prefetched = logger->get(l_bluestore_read_prefetch_bytes);
+  uint64_t hits = logger->get(l_bluestore_read_prefetch_hit_bytes);
+  for (uint64_t off = 0; off < obj_size; off += len) {
+    bufferlist in, expected;
+    r = store->read(ch, hoid, off, len, in);
+    ASSERT_EQ((int)len, r);
+    expected.substr_of(data, off, len);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ASSERT_LT(prefetched, logger->get(l_bluestore_read_prefetch_bytes));
+  // all but the first two reads come out of the prefetched range
+  ASSERT_LE(hits + obj_size - 2 * len,
+	    logger->get(l_bluestore_read_prefetch_hit_bytes));
+
+  // prefetching the bad blob neither fails nor retries the reads ahead
+  // of it
+  uint64_t retries = logger->get(l_bluestore_reads_with_retries);
+  uint64_t eio = logger->get(l_bluestore_read_eio);
+  prefetched = logger->get(l_bluestore_read_prefetch_bytes);
+  for (uint64_t off = 0; off < bad_off; off += len) {
+    bufferlist in, expected;
+    r = store->read(ch, hoid2, off, len, in);
+    ASSERT_EQ((int)len, r);
+    expected.substr_of(data, off, len);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  // the window went past the end of the bad blob
+  ASSERT_LE(prefetched + bad_off + blob_size - 2 * len,
+	    logger->get(l_bluestore_read_prefetch_bytes));
+  ASSERT_EQ(retries, logger->get(l_bluestore_reads_with_retries));
+  ASSERT_EQ(eio, logger->get(l_bluestore_read_eio));
+
+  // it is not cached either: asking for it reads it again, and fails
+  {
+    bufferlist in;
+    r = store->read(ch, hoid2, bad_off, len, in);
+    ASSERT_EQ(-EIO, r);
+    ASSERT_EQ(eio + 1, logger->get(l_bluestore_read_eio));
+  }
+  // the blobs after it are fine
+  {
+    bufferlist in, expected;
+    r = store->read(ch, hoid2, bad_off + blob_size, len, in);
+    ASSERT_EQ((int)len, r);
+    expected.substr_of(data, bad_off + blob_size, len);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, mergeRegionTest) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <gtest/gtest.h>
 #include "global/global_init.h"
 #include "global/global_context.h"
@@ -13,6 +15,10 @@
 #include "common/errno.h"
 
 #include "blk/BlockDevice.h"
+#if defined(HAVE_LIBURING)
+#include "blk/kernel/io_uring.h"
+#include "include/buffer_raw.h"
+#endif
 
 class TempBdev {
 public:
@@ -89,6 +95,200 @@ TEST(KernelDevice, Ticket45337) {
   b->close();
 }
 
+#if defined(HAVE_LIBURING)
+// submit the aios to q and wait for all of them to complete
+static int ioring_read(ioring_queue_t& q, std::list<aio_t>& aios)
+{
+  int retries = 0;
+  int r = q.submit_batch(aios.begin(), aios.end(), aios.size(), nullptr,
+			 &retries);
+  if (r < 0) {
+    return r;
+  }
+  for (size_t done = 0; done < aios.size(); ) {
+    aio_t *paio[16];
+    r = q.get_next_completed(1000, paio, 16);
+    if (r < 0) {
+      return r;
+    }
+    done += r;
+  }
+  return 0;
+}
+
+TEST(KernelDevice, ioring_fixed_buffer_pool) {
+  if (!ioring_queue_t::supported()) {
+    GTEST_SKIP() << "io_uring not supported";
+  }
+  TempBdev bdev{ 1048576 };
+  int fd = ::open(bdev.path.c_str(), O_RDWR);
+  ASSERT_LE(0, fd);
+  string pattern;
+  for (unsigned i = 0; i < 4; ++i) {
+    pattern += string(4096, 'a' + i);
+  }
+  ASSERT_EQ((ssize_t)pattern.size(),
+	    ::pwrite(fd, pattern.c_str(), pattern.size(), 0));
+
+  std::vector<int> fds = { fd };
+  {
+    ioring_queue_t q(16, false, false);
+    ASSERT_EQ(0, q.init(fds));
+    // without registered buffers there is nothing to lend
+    ASSERT_FALSE(q.alloc_fixed_buffer(4096));
+
+    // two buffers each of 4K and 16K
+    ASSERT_EQ(0, q.register_fixed_buffers(2, 16384));
+    auto a = q.alloc_fixed_buffer(4096);
+    auto b = q.alloc_fixed_buffer(4096);
+    ASSERT_TRUE(a);
+    ASSERT_TRUE(b);
+    // small ios spill into the next class once theirs is used up
+    auto c = q.alloc_fixed_buffer(4096);
+    auto d = q.alloc_fixed_buffer(8192);
+    ASSERT_TRUE(c);
+    ASSERT_TRUE(d);
+    ASSERT_EQ(4096u, c->get_len());
+    ASSERT_FALSE(q.alloc_fixed_buffer(4096));
+    ASSERT_FALSE(q.alloc_fixed_buffer(32768));
+
+    // a freed buffer is lent out again, but only to ios that fit it
+    char *slot = a->get_data();
+    a.reset();
+    ASSERT_FALSE(q.alloc_fixed_buffer(8192));
+    a = q.alloc_fixed_buffer(4096);
+    ASSERT_TRUE(a);
+    ASSERT_EQ(slot, a->get_data());
+    a.reset();
+    b.reset();
+    c.reset();
+    d.reset();
+
+    // a read through a registered buffer: once it completes the data is
+    // copied out and the buffer goes back to the pool
+    std::list<aio_t> aios;
+    for (unsigned i = 0; i < 2; ++i) {
+      aios.push_back(aio_t(nullptr, fd));
+      auto& aio = aios.back();
+      auto raw = q.alloc_fixed_buffer(i ? 8192 : 4096);
+      ASSERT_TRUE(raw);
+      aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
+      aio.bl.prepare_iov(&aio.iov);
+      aio.preadv(i * 4096, aio.bl.length());
+    }
+    char *slots[2] = {
+      static_cast<char*>(aios.front().iov[0].iov_base),
+      static_cast<char*>(aios.back().iov[0].iov_base) };
+    ASSERT_EQ(0, ioring_read(q, aios));
+    for (auto& aio : aios) {
+      ASSERT_EQ((long)aio.length, aio.get_return_value());
+      ASSERT_EQ(pattern.substr(aio.offset, aio.length), aio.bl.to_str());
+    }
+    ASSERT_NE(slots[0], aios.front().bl.front().c_str());
+    ASSERT_NE(slots[1], aios.back().bl.front().c_str());
+    a = q.alloc_fixed_buffer(4096);
+    ASSERT_TRUE(a);
+    ASSERT_EQ(slots[0], a->get_data());
+    b = q.alloc_fixed_buffer(8192);
+    ASSERT_TRUE(b);
+    ASSERT_EQ(slots[1], b->get_data());
+    // the copies outlive the buffers they came from
+    aios.clear();
+    a.reset();
+    b.reset();
+    q.shutdown();
+  }
+
+  {
+    // registration counts against RLIMIT_MEMLOCK; if it is refused the
+    // queue just keeps using ordinary buffers
+    ioring_queue_t q(16, false, false);
+    ASSERT_EQ(0, q.init(fds));
+    struct rlimit old_limit;
+    ASSERT_EQ(0, ::getrlimit(RLIMIT_MEMLOCK, &old_limit));
+    struct rlimit limit = old_limit;
+    limit.rlim_cur = 0;
+    ASSERT_EQ(0, ::setrlimit(RLIMIT_MEMLOCK, &limit));
+    int r = q.register_fixed_buffers(2, 1048576);
+    ASSERT_EQ(0, ::setrlimit(RLIMIT_MEMLOCK, &old_limit));
+    if (r < 0) {
+      // CAP_IPC_LOCK lifts the limit
+      ASSERT_FALSE(q.alloc_fixed_buffer(4096));
+    }
+    std::list<aio_t> aios;
+    aios.push_back(aio_t(nullptr, fd));
+    auto& aio = aios.back();
+    aio.bl.push_back(ceph::buffer::ptr_node::create(
+      ceph::buffer::create_small_page_aligned(8192)));
+    aio.bl.prepare_iov(&aio.iov);
+    aio.preadv(4096, 8192);
+    ASSERT_EQ(0, ioring_read(q, aios));
+    ASSERT_EQ(8192, aio.get_return_value());
+    ASSERT_EQ(pattern.substr(4096, 8192), aio.bl.to_str());
+    q.shutdown();
+  }
+  ::close(fd);
+}
+
+TEST(KernelDevice, ioring_fixed_buffer_reads) {
+  if (!ioring_queue_t::supported()) {
+    GTEST_SKIP() << "io_uring not supported";
+  }
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("bdev_ioring", "true");
+  conf.set_val("bdev_ioring_fixed_buffers", "2");
+  conf.set_val("bdev_ioring_fixed_buffer_size", "16384");
+  conf.apply_changes(nullptr);
+
+  TempBdev bdev{ 1048576 * 4 };
+  std::unique_ptr<BlockDevice> b(
+    BlockDevice::create(g_ceph_context, bdev.path, NULL, NULL,
+      [](void* handle, void* aio) {}, NULL));
+  ASSERT_EQ(0, b->open(bdev.path));
+
+  const unsigned chunk = 4096;
+  bufferlist data;
+  for (unsigned i = 0; i < 256; ++i) {
+    data.append(string(chunk, 'a' + i % 26));
+  }
+  // writes go through the registered buffers too
+  for (unsigned i = 0; i < 256; i += 4) {
+    bufferlist bl;
+    bl.substr_of(data, i * chunk, 4 * chunk);
+    ASSERT_EQ(0, b->write(i * chunk, bl, false));
+  }
+
+  // many more reads at once than there are buffers: the first take the
+  // registered ones, the rest fall back to ordinary buffers, and buffers
+  // given back on completion are lent out to the next round
+  for (unsigned round = 0; round < 4; ++round) {
+    IOContext ioc(g_ceph_context, NULL);
+    std::vector<bufferlist> bls(32);
+    for (unsigned i = 0; i < bls.size(); ++i) {
+      unsigned len = chunk << (i % 3);  // 4K, 8K, 16K
+      ASSERT_EQ(0, b->aio_read((round * 32 + i) * chunk % (192 * chunk),
+			       len, &bls[i], &ioc));
+    }
+    ASSERT_TRUE(ioc.has_pending_aios());
+    b->aio_submit(&ioc);
+    ioc.aio_wait();
+    ASSERT_EQ(0, ioc.get_return_value());
+    for (unsigned i = 0; i < bls.size(); ++i) {
+      unsigned len = chunk << (i % 3);
+      bufferlist expected;
+      expected.substr_of(data, (round * 32 + i) * chunk % (192 * chunk), len);
+      ASSERT_TRUE(expected.contents_equal(bls[i]));
+    }
+  }
+  b->close();
+
+  conf.set_val("bdev_ioring", "false");
+  conf.set_val("bdev_ioring_fixed_buffers", "0");
+  conf.rm_val("bdev_ioring_fixed_buffer_size");
+  conf.apply_changes(nullptr);
+}
+#endif
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
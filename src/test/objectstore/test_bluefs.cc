@@ -18,6 +18,8 @@
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
+#include "os/bluestore/BlueRocksEnv.h"
+#include "kv/KeyValueDB.h"
 
 std::unique_ptr<char[]> gen_buffer(uint64_t size)
 {
@@ -707,6 +709,167 @@ TEST(BlueFS, test_replay_growth) {
   fs.umount();
 }
 
+TEST(BlueFS, test_wal_ring) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false, 1048576));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  fs.set_wal_ring_size(1048576);
+  ASSERT_EQ(0, fs.mkdir("dir"));
+
+  // leave stale bytes behind in the space the ring is carved from
+  auto junk = gen_buffer(1048576);
+  BlueFS::FileWriter *h;
+  ASSERT_EQ(0, fs.open_for_write("dir", "junk", &h, false));
+  for (unsigned i = 0; i < 16; ++i) {
+    h->append(junk.get(), 1048576);
+  }
+  ASSERT_EQ(0, fs.fsync(h));
+  fs.close_writer(h);
+  ASSERT_EQ(0, fs.unlink("dir", "junk"));
+  fs.sync_metadata(false);
+
+  const uint64_t ring = 1048576;
+  uint64_t file_size;
+  utime_t mtime;
+  ASSERT_EQ(0, fs.open_for_write("dir", "000001.log", &h, false));
+  ASSERT_EQ(0, fs.stat("dir", "000001.log", &file_size, &mtime));
+  ASSERT_EQ(ring, file_size);
+
+  // appends within the ring leave the metadata alone
+  auto buf = gen_buffer(4000);
+  for (unsigned i = 0; i < 100; ++i) {
+    h->append(buf.get(), 4000);
+    ASSERT_EQ(0, fs.fsync(h));
+  }
+  utime_t mtime2;
+  ASSERT_EQ(0, fs.stat("dir", "000001.log", &file_size, &mtime2));
+  ASSERT_EQ(ring, file_size);
+  ASSERT_EQ(mtime, mtime2);
+  ASSERT_EQ(400000u, h->get_effective_write_pos());
+
+  // running past the end grows it by a whole chunk
+  for (unsigned i = 0; i < 200; ++i) {
+    h->append(buf.get(), 4000);
+  }
+  ASSERT_EQ(0, fs.fsync(h));
+  ASSERT_EQ(2 * ring, h->file->fnode.size);
+  fs.close_writer(h);
+  fs.umount();
+
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.stat("dir", "000001.log", &file_size, &mtime));
+  ASSERT_EQ(2 * ring, file_size);
+  {
+    BlueFS::FileReader *r;
+    ASSERT_EQ(0, fs.open_for_read("dir", "000001.log", &r));
+    bufferlist bl;
+    ASSERT_EQ(4000, fs.read(r, 396000, 4000, &bl, NULL));
+    ASSERT_EQ(0, memcmp(buf.get(), bl.c_str(), 4000));
+
+    // everything past the data reads back as zeros
+    uint64_t end = 300 * 4000;
+    bl.clear();
+    ASSERT_EQ((int)(2 * ring - end),
+	      fs.read(r, end, 2 * ring - end, &bl, NULL));
+    ASSERT_TRUE(bl.is_zero());
+    delete r;
+  }
+  fs.umount();
+}
+
+// Write through rocksdb with the WAL ring on, remount without flushing
+// the memtables and check that replaying the WAL gives back every key.
+static void wal_ring_replay(const std::string& kv_options)
+{
+  uint64_t size = 1048576 * 256;
+  TempBdev bdev{size};
+
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false, 1048576));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  fs.set_wal_ring_size(1048576);
+  ASSERT_EQ(0, fs.mkdir("db"));
+
+  auto junk = gen_buffer(1048576);
+  BlueFS::FileWriter *h;
+  ASSERT_EQ(0, fs.open_for_write("db", "junk", &h, false));
+  for (unsigned i = 0; i < 32; ++i) {
+    h->append(junk.get(), 1048576);
+  }
+  ASSERT_EQ(0, fs.fsync(h));
+  fs.close_writer(h);
+  ASSERT_EQ(0, fs.unlink("db", "junk"));
+  fs.sync_metadata(false);
+
+  std::map<std::string, std::string> expected;
+  {
+    std::unique_ptr<KeyValueDB> db(KeyValueDB::create(
+      g_ceph_context, "rocksdb", "db", {}, new BlueRocksEnv(&fs)));
+    ASSERT_TRUE(db);
+    ASSERT_EQ(0, db->init(kv_options));
+    std::ostringstream err;
+    ASSERT_EQ(0, db->create_and_open(err)) << err.str();
+    for (unsigned round = 0; round < 8; ++round) {
+      for (unsigned i = 0; i < 200; ++i) {
+	std::string key = stringify(i);
+	std::string value = std::string(1000, 'a' + round) + key;
+	KeyValueDB::Transaction t = db->get_transaction();
+	bufferlist bl;
+	bl.append(value);
+	t->set("P", key, bl);
+	ASSERT_EQ(0, db->submit_transaction_sync(t));
+	expected[key] = value;
+      }
+      // switch to a new (or recycled) log; the last rounds stay in it
+      if (round < 6) {
+	db->compact();
+      }
+    }
+  }
+  fs.umount();
+
+  ASSERT_EQ(0, fs.mount());
+  fs.set_wal_ring_size(1048576);
+  {
+    std::unique_ptr<KeyValueDB> db(KeyValueDB::create(
+      g_ceph_context, "rocksdb", "db", {}, new BlueRocksEnv(&fs)));
+    ASSERT_TRUE(db);
+    ASSERT_EQ(0, db->init(kv_options));
+    std::ostringstream err;
+    ASSERT_EQ(0, db->open(err)) << err.str();
+    for (auto& [key, value] : expected) {
+      bufferlist bl;
+      ASSERT_EQ(0, db->get("P", key, &bl)) << key;
+      ASSERT_EQ(value, bl.to_str()) << key;
+    }
+  }
+  fs.umount();
+}
+
+TEST(BlueFS, test_wal_ring_replay) {
+  wal_ring_replay("");
+}
+
+TEST(BlueFS, test_wal_ring_replay_recycled) {
+  wal_ring_replay("recycle_log_file_num=4,"
+		  "wal_recovery_mode=kSkipAnyCorruptedRecords");
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -8,11 +8,20 @@
 #include "common/ceph_time.h"
 #include "os/bluestore/BlueStore.h"
 #include "os/bluestore/AvlAllocator.h"
+#include "os/bluestore/CompressPipeline.h"
+#include "os/bluestore/FreelistManager.h"
+#include "os/bluestore/FastTier.h"
+#include "blk/BlockDevice.h"
+#include "kv/KeyValueDB.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "global/global_context.h"
+#include "onode_lookup_fixture.h"
 
+#include <fcntl.h>
+#include <random>
 #include <sstream>
+#include <thread>
 
 #define _STR(x) #x
 #define STRINGIFY(x) _STR(x)
@@ -334,6 +343,99 @@ TEST(bluestore_blob_t, csum_bench)
   }
 }
 
+TEST(bluestore_blob_t, csum_block_kernels)
+{
+  auto kernels = Checksummer::available_block_kernels();
+  ASSERT_FALSE(kernels.empty());
+  auto scalar = kernels.front();
+  std::cout << "testing " << kernels.size() << " implementation(s), using "
+	    << Checksummer::block_kernels().name << std::endl;
+
+  std::mt19937_64 rng(0);
+  std::vector<char> data(65536 * 20 + 7);
+  for (auto& c : data) {
+    c = rng();
+  }
+  for (size_t len : {8, 16, 20, 32, 48, 4096, 65536}) {
+    // a count that leaves a few blocks for the scalar tail
+    size_t count = std::min<size_t>((data.size() - 7) / len, 19);
+    for (uint64_t seed : {0ull, ~0ull, 0x123456789abcdefull}) {
+      std::vector<uint32_t> e32(count), r32(count);
+      std::vector<uint64_t> e64(count), r64(count);
+      // unaligned on purpose
+      const char* p = data.data() + 7;
+      scalar->xxhash32(seed, len, p, count, e32.data());
+      scalar->xxhash64(seed, len, p, count, e64.data());
+      for (auto k : kernels) {
+	k->xxhash32(seed, len, p, count, r32.data());
+	k->xxhash64(seed, len, p, count, r64.data());
+	ASSERT_EQ(e32, r32) << k->name << " len " << len;
+	ASSERT_EQ(e64, r64) << k->name << " len " << len;
+      }
+    }
+  }
+}
+
+TEST(bluestore_blob_t, verify_csum_fragmented)
+{
+  const unsigned chunk_order = 12;
+  const size_t len = 64 << chunk_order;
+  std::mt19937_64 rng(0);
+  bufferptr whole(len);
+  for (size_t i = 0; i < len; ++i) {
+    whole.c_str()[i] = rng();
+  }
+  bufferlist bl;
+  bl.append(whole);
+
+  // the same data cut at random places, so that some csum blocks span
+  // several buffers
+  bufferlist frag;
+  for (size_t off = 0; off < len; ) {
+    size_t l = std::min<size_t>(len - off, 1 + rng() % 20000);
+    frag.append(bufferptr(whole, off, l));
+    off += l;
+  }
+
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	 << std::endl;
+    bluestore_blob_t b, f;
+    b.init_csum(csum_type, chunk_order, len);
+    f.init_csum(csum_type, chunk_order, len);
+    b.calc_csum(0, bl);
+    f.calc_csum(0, frag);
+    ASSERT_EQ(b.csum_data.length(), f.csum_data.length());
+    ASSERT_EQ(0, memcmp(b.csum_data.c_str(), f.csum_data.c_str(),
+			b.csum_data.length()));
+
+    int bad_off;
+    uint64_t bad_csum;
+    ASSERT_EQ(0, b.verify_csum(0, frag, &bad_off, &bad_csum));
+    ASSERT_EQ(-1, bad_off);
+
+    if (b.get_csum_value_size() < 4) {
+      // a flipped bit might well go unnoticed
+      continue;
+    }
+    // some blocks in turn, split across two buffers
+    for (size_t bad = 0; bad < len; bad += 7 << chunk_order) {
+      bufferlist corrupt;
+      corrupt.append(whole.c_str(), len);
+      corrupt.c_str()[bad + 123] ^= 1;
+      bufferlist cfrag;
+      cfrag.substr_of(corrupt, 0, bad + 100);
+      bufferlist rest;
+      rest.substr_of(corrupt, bad + 100, len - bad - 100);
+      cfrag.claim_append(rest);
+      ASSERT_EQ(-1, b.verify_csum(0, cfrag, &bad_off, &bad_csum));
+      ASSERT_EQ((int)bad, bad_off);
+    }
+  }
+}
+
 TEST(Blob, put_ref)
 {
   {
@@ -1497,6 +1599,101 @@ TEST(GarbageCollector, BasicTest)
   }
 }
 
+TEST(OnodeSpace, concurrent_lookup)
+{
+  // Concurrent lookups of pinned onodes, two reader threads per
+  // collection, all find the onode that was added.
+  const unsigned lookups_per_thread = 10000;
+  OnodeLookupFixture f(g_ceph_context, 2, 128);
+  f.run(lookups_per_thread);
+  ASSERT_EQ(f.num_threads() * lookups_per_thread,
+            f.logger->get(l_bluestore_onode_hits));
+  ASSERT_EQ(0u, f.logger->get(l_bluestore_onode_misses));
+}
+
+TEST(OnodeSpace, encoded_tier)
+{
+  // Onodes trimmed from the decoded cache move to the encoded tier, are
+  // handed back once, and a create never picks up a stale encoding.
+  const unsigned num_onodes = 8;
+  BlueStore store(g_ceph_context, "", 4096);
+  PerfCountersBuilder plb(g_ceph_context, "onode_encoded_tier",
+                          l_bluestore_first, l_bluestore_last);
+  plb.add_u64_counter(l_bluestore_onode_hits, "onode_hits", "");
+  plb.add_u64_counter(l_bluestore_onode_misses, "onode_misses", "");
+  PerfCounters *logger = plb.create_perf_counters();
+  auto ocs = BlueStore::OnodeCacheShard::create(g_ceph_context, "lru", logger);
+  auto bcs = BlueStore::BufferCacheShard::create(g_ceph_context, "lru", NULL);
+  ocs->set_max(num_onodes * 2);
+  ocs->set_encoded_max(1 << 20);
+  auto c = ceph::make_ref<BlueStore::Collection>(&store, ocs, bcs, coll_t());
+  auto oid = [](unsigned i) {
+    return ghobject_t(hobject_t(object_t("obj" + stringify(i)), "",
+                                CEPH_NOSNAP, i, 1, ""));
+  };
+  auto encoded = [&]() {
+    uint64_t onodes = 0, bytes = 0;
+    ocs->add_encoded_stats(&onodes, &bytes);
+    return onodes;
+  };
+
+  for (unsigned i = 0; i < num_onodes; ++i) {
+    BlueStore::OnodeRef o(new BlueStore::Onode(c.get(), oid(i), ""));
+    o->exists = true;
+    o->onode.size = i;
+    c->onode_map.add(oid(i), o);
+  }
+  // one that was removed has nothing worth keeping
+  {
+    BlueStore::OnodeRef o(new BlueStore::Onode(c.get(), oid(num_onodes), ""));
+    c->onode_map.add(oid(num_onodes), o);
+  }
+  ASSERT_EQ(0u, encoded());
+
+  ocs->set_max(0);
+  ocs->trim();
+  ASSERT_EQ(num_onodes, encoded());
+  for (unsigned i = 0; i <= num_onodes; ++i) {
+    ASSERT_FALSE(c->onode_map.lookup(oid(i)));
+  }
+
+  // promote: the encoding decodes to the onode that was trimmed
+  bufferlist bl;
+  ASSERT_TRUE(c->onode_map.take_encoded(oid(3), &bl));
+  ASSERT_EQ(num_onodes - 1, encoded());
+  {
+    bluestore_onode_t on;
+    auto p = bl.front().begin_deep();
+    on.decode(p);
+    ASSERT_EQ(3u, on.size);
+  }
+  ASSERT_FALSE(c->onode_map.take_encoded(oid(3), nullptr));
+  ASSERT_FALSE(c->onode_map.take_encoded(oid(num_onodes), nullptr));
+
+  // a create drops the encoding even once the tier is switched off
+  ocs->set_encoded_max(0);
+  ocs->set_max(num_onodes * 2);
+  {
+    BlueStore::OnodeRef o = c->get_onode(oid(5), true, true);
+    ASSERT_TRUE(o);
+    ASSERT_FALSE(o->exists);
+    ASSERT_EQ(0u, o->onode.size);
+  }
+  ASSERT_EQ(num_onodes - 2, encoded());
+  ASSERT_FALSE(c->onode_map.take_encoded(oid(5), nullptr));
+
+  // with the tier off, the next trim drops what is left of it
+  ocs->trim();
+  ASSERT_EQ(0u, encoded());
+  ASSERT_FALSE(c->onode_map.take_encoded(oid(0), nullptr));
+
+  c->onode_map.clear();
+  c.reset();
+  delete ocs;
+  delete bcs;
+  delete logger;
+}
+
 TEST(BlueStoreRepairer, StoreSpaceTracker)
 {
   BlueStoreRepairer::StoreSpaceTracker bmap0;
@@ -1688,6 +1885,476 @@ TEST(bluestore_blob_t, unused)
   }
 }
 
+namespace {
+// keeps the first half of the input, optionally after a gate opens
+class HalvingCompressor : public Compressor {
+public:
+  std::atomic<unsigned> started = {0};
+  ceph::mutex lock = ceph::make_mutex("HalvingCompressor::lock");
+  ceph::condition_variable cond;
+  bool gate_open = true;
+
+  HalvingCompressor() : Compressor(COMP_ALG_NONE, "halving") {}
+  int compress(const bufferlist &in, bufferlist &out,
+	       boost::optional<int32_t> &compressor_message) override {
+    ++started;
+    {
+      std::unique_lock l(lock);
+      cond.wait(l, [this] { return gate_open; });
+    }
+    out.substr_of(in, 0, in.length() / 2);
+    return 0;
+  }
+  int decompress(const bufferlist &in, bufferlist &out,
+		 boost::optional<int32_t> compressor_message) override {
+    return -EOPNOTSUPP;
+  }
+  int decompress(bufferlist::const_iterator &p, size_t compressed_len,
+		 bufferlist &out,
+		 boost::optional<int32_t> compressor_message) override {
+    return -EOPNOTSUPP;
+  }
+  void set_gate(bool open) {
+    std::lock_guard l(lock);
+    gate_open = open;
+    cond.notify_all();
+  }
+};
+}
+
+TEST(CompressPipeline, batch)
+{
+  auto c = std::make_shared<HalvingCompressor>();
+  bufferlist bl;
+  bl.append(std::string(65536, 'a'));
+  for (unsigned threads : {0, 1, 4}) {
+    CompressPipeline pipeline(g_ceph_context);
+    pipeline.start(threads, 4);
+    std::vector<CompressPipeline::Job> jobs(16);
+    CompressPipeline::Batch batch;
+    size_t queued = 0;
+    for (auto& j : jobs) {
+      j.compressor = c;
+      j.in = &bl;
+      queued += pipeline.queue(batch, &j);
+    }
+    if (threads == 0) {
+      // nothing but the writer runs them, nothing is refused
+      ASSERT_EQ(jobs.size(), queued);
+    }
+    pipeline.wait(batch);
+    size_t done = 0;
+    for (auto& j : jobs) {
+      if (j.done) {
+	++done;
+	ASSERT_EQ(0, j.r);
+	ASSERT_EQ(bl.length() / 2, j.out.length());
+      } else {
+	ASSERT_EQ(0u, j.out.length());
+      }
+    }
+    ASSERT_EQ(queued, done);
+    pipeline.stop();
+  }
+}
+
+TEST(CompressPipeline, saturated)
+{
+  auto c = std::make_shared<HalvingCompressor>();
+  bufferlist bl;
+  bl.append(std::string(4096, 'a'));
+  CompressPipeline pipeline(g_ceph_context);
+  pipeline.start(1, 1);
+  std::vector<CompressPipeline::Job> jobs(3);
+  for (auto& j : jobs) {
+    j.compressor = c;
+    j.in = &bl;
+  }
+  CompressPipeline::Batch batch;
+  c->set_gate(false);
+  // the worker takes the first one and blocks on it
+  ASSERT_TRUE(pipeline.queue(batch, &jobs[0]));
+  while (c->started == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // which leaves room for exactly one more
+  ASSERT_TRUE(pipeline.queue(batch, &jobs[1]));
+  ASSERT_FALSE(pipeline.queue(batch, &jobs[2]));
+  c->set_gate(true);
+  pipeline.wait(batch);
+  ASSERT_TRUE(jobs[0].done);
+  ASSERT_TRUE(jobs[1].done);
+  ASSERT_FALSE(jobs[2].done);
+  pipeline.stop();
+}
+
+TEST(BlueStore, kv_sync_group_wait_time)
+{
+  using namespace std::chrono_literals;
+  const double target = 0.005;
+  const uint64_t min_batch = 8;
+  const ceph::timespan none = ceph::timespan::zero();
+
+  // disabled: no target, or a minimum batch of one
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(0, min_batch, 1, 4, 1ms));
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(-1, min_batch, 1, 4, 1ms));
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, 1, 1, 4, 1ms));
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, 0, 1, 4, 1ms));
+
+  // the batch is already big enough
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, min_batch,
+						     min_batch, 4, 1ms));
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, min_batch,
+						     2 * min_batch, 4, 1ms));
+
+  // nothing else is on its way to the batch
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, min_batch,
+						     1, 0, 1ms));
+
+  // the kv store is already slower than the target
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, min_batch,
+						     1, 4, 5ms));
+  ASSERT_EQ(none, BlueStore::kv_sync_group_wait_time(target, min_batch,
+						     1, 4, 20ms));
+
+  // otherwise wait for whatever the recent kv latency leaves of it
+  ASSERT_EQ(ceph::timespan(4ms),
+	    BlueStore::kv_sync_group_wait_time(target, min_batch, 1, 4, 1ms));
+  ASSERT_EQ(ceph::timespan(5ms),
+	    BlueStore::kv_sync_group_wait_time(target, min_batch,
+					       min_batch - 1, 1, 0ms));
+}
+
+TEST(BlueStore, deferred_policy_step)
+{
+  BlueStore::deferred_policy_sample_t s;
+  s.base_size = 65536;
+  s.min_alloc_size = 4096;
+  s.base_batch = 16;
+  s.device_latency_limit_ns = 50000000;
+  s.kv_latency_limit_ns = 20000000;
+  s.compaction_debt_limit = 1ull << 34;
+
+  uint64_t size = s.base_size;
+  int batch = s.base_batch;
+  bool device_busy, kv_busy;
+
+  // quiet: nothing moves
+  s.deferred_aio_lat_ns = 1000000;
+  s.kv_lat_ns = 1000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_FALSE(device_busy);
+  ASSERT_FALSE(kv_busy);
+  ASSERT_EQ(s.base_size, size);
+  ASSERT_EQ(s.base_batch, batch);
+
+  // compaction debt alone makes the kv store busy; the size halves each
+  // step down to min_alloc_size and no further
+  s.compaction_debt = 1ull << 35;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_TRUE(kv_busy);
+  ASSERT_FALSE(device_busy);
+  ASSERT_EQ(s.base_size / 2, size);
+  ASSERT_EQ(s.base_batch, batch);
+  for (unsigned i = 0; i < 20; ++i) {
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_GE(size, s.min_alloc_size);
+  }
+  ASSERT_EQ(s.min_alloc_size, size);
+
+  // slow kv commits keep it there
+  s.compaction_debt = 0;
+  s.kv_lat_ns = 30000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_TRUE(kv_busy);
+  ASSERT_EQ(s.min_alloc_size, size);
+
+  // recovered: it grows back by a quarter of the configured size per
+  // step and stops at the configured size
+  s.kv_lat_ns = 1000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_FALSE(kv_busy);
+  ASSERT_EQ(s.min_alloc_size + s.base_size / 4, size);
+  for (unsigned i = 0; i < 20; ++i) {
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_LE(size, s.base_size);
+  }
+  ASSERT_EQ(s.base_size, size);
+
+  // a slow device doubles the batch up to 8x the configured one
+  s.deferred_aio_lat_ns = 80000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_TRUE(device_busy);
+  ASSERT_EQ(2 * s.base_batch, batch);
+  ASSERT_EQ(s.base_size, size);
+  for (unsigned i = 0; i < 20; ++i) {
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_LE(batch, 8 * s.base_batch);
+  }
+  ASSERT_EQ(8 * s.base_batch, batch);
+
+  // and halves it back to the configured one once it recovers
+  s.deferred_aio_lat_ns = 1000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_FALSE(device_busy);
+  ASSERT_EQ(4 * s.base_batch, batch);
+  for (unsigned i = 0; i < 20; ++i) {
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_GE(batch, s.base_batch);
+  }
+  ASSERT_EQ(s.base_batch, batch);
+
+  // a configured size below min_alloc_size is its own lower bound
+  s.base_size = 2048;
+  size = s.base_size;
+  s.kv_lat_ns = 30000000;
+  BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+  ASSERT_EQ(2048u, size);
+}
+
+TEST(BlueStore, deferred_policy_batch_latency)
+{
+  BlueStore::deferred_policy_sample_t s;
+  s.base_size = 65536;
+  s.min_alloc_size = 4096;
+  s.base_batch = 16;
+  s.device_latency_limit_ns = 10000000;
+  s.kv_latency_limit_ns = 20000000;
+  s.compaction_debt_limit = 1ull << 34;
+  s.kv_lat_ns = 1000000;
+
+  uint64_t size = s.base_size;
+  int batch = s.base_batch;
+  bool device_busy, kv_busy;
+
+  // a batch takes as long as its aios one after the other; the whole
+  // batch is above the limit, each aio is not, and a larger batch must
+  // not make the device look busier
+  auto io = std::chrono::milliseconds(2);
+  for (unsigned i = 0; i < 20; ++i) {
+    s.deferred_aio_lat_ns = std::chrono::nanoseconds(
+      BlueStore::deferred_io_latency(batch * io, batch)).count();
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_FALSE(device_busy);
+    ASSERT_EQ(s.base_batch, batch);
+  }
+
+  // each aio above the limit: the batch grows to its bound and stays
+  io = std::chrono::milliseconds(20);
+  for (unsigned i = 0; i < 20; ++i) {
+    s.deferred_aio_lat_ns = std::chrono::nanoseconds(
+      BlueStore::deferred_io_latency(batch * io, batch)).count();
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_TRUE(device_busy);
+    ASSERT_LE(batch, 8 * s.base_batch);
+  }
+  ASSERT_EQ(8 * s.base_batch, batch);
+
+  // and comes back once the aios are fast again
+  io = std::chrono::milliseconds(2);
+  for (unsigned i = 0; i < 20; ++i) {
+    s.deferred_aio_lat_ns = std::chrono::nanoseconds(
+      BlueStore::deferred_io_latency(batch * io, batch)).count();
+    BlueStore::deferred_policy_step(s, &size, &batch, &device_busy, &kv_busy);
+    ASSERT_FALSE(device_busy);
+  }
+  ASSERT_EQ(s.base_batch, batch);
+
+  // a batch that submitted no aio is taken as is
+  ASSERT_EQ(std::chrono::nanoseconds(io),
+	    BlueStore::deferred_io_latency(io, 0));
+}
+
+TEST(BitmapFreelistManager, enumerate_range) {
+  string dir = "bfm_test_temp_dir." + stringify(getpid());
+  std::unique_ptr<KeyValueDB> db(
+    KeyValueDB::create(g_ceph_context, "memdb", dir));
+  FreelistManager::setup_merge_operators(db.get(), "bitmap");
+  ASSERT_EQ(0, db->create_and_open(cerr));
+  std::unique_ptr<FreelistManager> fm(
+    FreelistManager::create(g_ceph_context, "bitmap", "B"));
+
+  // a partial last key, with the blocks past the end set
+  const uint64_t block = 4096;
+  const uint64_t size = (32ull << 20) + 3 * block;
+  {
+    auto t = db->get_transaction();
+    ASSERT_EQ(0, fm->create(size, block, t));
+    // enumerate_next() wants the first block in use, as it always is
+    fm->allocate(0, block, t);
+    db->submit_transaction_sync(t);
+  }
+  ASSERT_EQ(0, fm->init(db.get(), false,
+			[](const string&, string*) { return -ENOENT; }));
+  const uint64_t gran = fm->get_enumerate_granularity();
+  ASSERT_LT(block, gran);
+
+  std::mt19937 rng(0);
+  for (unsigned round = 0; round < 20; ++round) {
+    // flip extents from a single block up to a few keys; keys end up
+    // missing, all set, all clear or mixed
+    auto t = db->get_transaction();
+    for (unsigned i = 0; i < 50; ++i) {
+      uint64_t max_len = i % 5 ? 16 * block : 4 * gran;
+      uint64_t len = (rng() % (max_len / block) + 1) * block;
+      uint64_t off = (rng() % ((size - len) / block) + 1) * block;
+      if (rng() % 2) {
+	fm->allocate(off, len, t);
+      } else {
+	fm->release(off, len, t);
+      }
+    }
+    db->submit_transaction_sync(t);
+
+    interval_set<uint64_t> all;
+    fm->enumerate_reset();
+    uint64_t offset, length;
+    while (fm->enumerate_next(db.get(), &offset, &length)) {
+      all.insert(offset, length);
+    }
+
+    // partitions that start and end anywhere within a key, each of
+    // which must see exactly its share of the serial walk
+    interval_set<uint64_t> merged;
+    for (uint64_t begin = 0, end; begin < size; begin = end) {
+      end = std::min(size, begin + (rng() % (3 * gran / block) + 1) * block);
+      interval_set<uint64_t> part;
+      ASSERT_EQ(0, fm->enumerate_range(
+        db.get(), begin, end,
+	[&](uint64_t offset, uint64_t length) {
+	  ASSERT_LE(begin, offset);
+	  ASSERT_LE(offset + length, end);
+	  part.insert(offset, length);
+	}));
+      interval_set<uint64_t> expected;
+      expected.insert(begin, end - begin);
+      expected.intersection_of(all);
+      ASSERT_EQ(expected, part);
+      merged.union_of(part);
+    }
+    ASSERT_EQ(all, merged);
+  }
+
+  fm->shutdown();
+  fm.reset();
+  db.reset();
+  ASSERT_EQ(0, ::system(("rm -rf " + dir).c_str()));
+}
+
+TEST(FastTier, promote_and_invalidate) {
+  string main_path = "fast_tier_test.main." + stringify(getpid());
+  string fast_path = "fast_tier_test.fast." + stringify(getpid());
+  auto create_file = [](const string& fn, uint64_t size) {
+    int fd = ::open(fn.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    ceph_assert(fd >= 0);
+    int r = ::ftruncate(fd, size);
+    ceph_assert(r >= 0);
+    ::close(fd);
+  };
+  create_file(main_path, 1048576ull * 64);
+  create_file(fast_path, 1048576ull * 16);
+  auto cb = [](void* handle, void* aio) {};
+  std::unique_ptr<BlockDevice> main_bdev(
+    BlockDevice::create(g_ceph_context, main_path, NULL, NULL, cb, NULL));
+  std::unique_ptr<BlockDevice> fast_bdev(
+    BlockDevice::create(g_ceph_context, fast_path, NULL, NULL, cb, NULL));
+  ASSERT_EQ(0, main_bdev->open(main_path));
+  ASSERT_EQ(0, fast_bdev->open(fast_path));
+
+  const uint64_t chunk = 65536;
+  bufferlist data;
+  for (unsigned i = 0; i < 16; ++i) {
+    data.append(string(chunk, 'a' + i));
+  }
+  ASSERT_EQ(0, main_bdev->write(0, data, false));
+
+  {
+    FastTier tier(g_ceph_context, main_bdev.get(), fast_bdev.get(),
+		  { {1048576, 4 * chunk} }, chunk, 2);
+    ASSERT_EQ(4 * chunk, tier.get_capacity());
+    tier.start();
+
+    // hot chunks get copied over in the background
+    bufferlist bl;
+    for (unsigned i = 0; i < 500; ++i) {
+      if (tier.read(chunk + 4096, 8192, &bl)) {
+	break;
+      }
+      usleep(10000);
+    }
+    ASSERT_EQ(8192u, bl.length());
+    ASSERT_EQ(string(8192, 'b'), bl.to_str());
+
+    // a range across two chunks needs both of them
+    bl.clear();
+    ASSERT_FALSE(tier.read(chunk, 2 * chunk, &bl));
+
+    // a read that raced with a rewrite is redone from the main device
+    {
+      FastTier::read_t tr;
+      ASSERT_TRUE(tier.lookup(chunk + 4096, 8192, &tr));
+      bufferlist head;
+      head.append(string(4096, 'x'));
+      bl = head;
+      IOContext ioc(g_ceph_context, NULL);
+      ASSERT_EQ(0, tier.submit_read(&tr, &bl, &ioc));
+      ioc.aio_wait();
+      ASSERT_EQ(0, ioc.get_return_value());
+      tier.invalidate(chunk, chunk);
+      bufferlist rewrite;
+      rewrite.append(string(chunk, 'B'));
+      ASSERT_EQ(0, main_bdev->write(chunk, rewrite, false));
+      uint64_t races = tier.get_perf_counters()->get(l_fast_tier_read_races);
+      ASSERT_EQ(0, tier.finish_read(tr));
+      ASSERT_EQ(races + 1,
+		tier.get_perf_counters()->get(l_fast_tier_read_races));
+      ASSERT_EQ(string(4096, 'x') + string(8192, 'B'), bl.to_str());
+      bl.clear();
+    }
+
+    // rewriting the main device drops the copy
+    tier.invalidate(chunk + 65000, 1000);
+    ASSERT_FALSE(tier.read(chunk + 4096, 8192, &bl));
+    ASSERT_EQ(0u, bl.length());
+
+    // only four slots: fill them with the first four chunks, then make
+    // the next four hot so that they push those out
+    auto all_served = [&](unsigned first) {
+      bool served = true;
+      for (unsigned c = first; c < first + 4; ++c) {
+	bl.clear();
+	served = tier.read(c * chunk, 4096, &bl) && served;
+      }
+      bl.clear();
+      return served;
+    };
+    bool served = false;
+    for (unsigned i = 0; i < 500 && !served; ++i) {
+      served = all_served(0);
+      usleep(10000);
+    }
+    ASSERT_TRUE(served);
+    PerfCounters *logger = tier.get_perf_counters();
+    uint64_t demotions = logger->get(l_fast_tier_demotions);
+
+    served = false;
+    for (unsigned i = 0; i < 500 && !served; ++i) {
+      served = all_served(4);
+      usleep(10000);
+    }
+    ASSERT_TRUE(served);
+    ASSERT_LE(demotions + 4, logger->get(l_fast_tier_demotions));
+    ASSERT_FALSE(tier.read(0, 4096, &bl));
+    ASSERT_EQ(0u, bl.length());
+    tier.stop();
+  }
+
+  main_bdev->close();
+  fast_bdev->close();
+  ::unlink(main_path.c_str());
+  ::unlink(fast_path.c_str());
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -14,7 +14,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <time.h>
 #include <sys/mount.h>
 #include "kv/KeyValueDB.h"
@@ -25,6 +27,8 @@
 #include "common/Cond.h"
 #include "common/errno.h"
 #include "include/stringify.h"
+#include "common/ceph_json.h"
+#include "common/pretty_binary.h"
 #include <gtest/gtest.h>
 
 class KVTest : public ::testing::TestWithParam<const char*> {
@@ -195,6 +199,69 @@ TEST_P(KVTest, BenchCommit) {
   fini();
 }
 
+TEST_P(KVTest, BenchConcurrentReads) {
+  const int nkeys = 10000;
+  const int ntxns = 2000;
+  const int nreaders = 4;
+  ASSERT_EQ(0, db->create_and_open(cout));
+  bufferlist data;
+  data.append(string(100, 'x'));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (int i = 0; i < nkeys; ++i) {
+      t->set("prefix", "key" + stringify(i), data);
+    }
+    db->submit_transaction_sync(t);
+  }
+  // plain memdb applies a transaction one op at a time
+  const bool atomic = string(GetParam()) != "memdb";
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> gets = 0, scanned = 0;
+  std::vector<std::thread> readers;
+  for (int r = 0; r < nreaders; ++r) {
+    readers.emplace_back([&, r] {
+      uint64_t i = r;
+      while (!stop) {
+	bufferlist bl;
+	int ret = db->get("prefix", "key" + stringify(i++ % nkeys), &bl);
+	// every key exists as of every commit; a miss saw a transaction's
+	// rmkey without the set following it
+	if (atomic) {
+	  ASSERT_EQ(0, ret);
+	}
+	++gets;
+	if (i % 16 == 0) {
+	  auto it = db->get_iterator("prefix");
+	  int n = 0;
+	  for (it->lower_bound("key" + stringify(i % nkeys));
+	       it->valid() && n < 32; it->next(), ++n) {
+	    ASSERT_EQ(100u, it->value().length());
+	  }
+	  scanned += n;
+	}
+      }
+    });
+  }
+  utime_t start = ceph_clock_now();
+  for (int i = 0; i < ntxns; ++i) {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->set("prefix", "key" + stringify(i % nkeys), data);
+    t->rmkey("prefix", "key" + stringify((i * 7) % nkeys));
+    t->set("prefix", "key" + stringify((i * 7) % nkeys), data);
+    db->submit_transaction(t);
+  }
+  utime_t dur = ceph_clock_now() - start;
+  stop = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  cout << ntxns << " commits in " << dur << " ("
+       << (ntxns / (double)dur) << "/s) with " << nreaders
+       << " readers doing " << (gets / (double)dur) << " gets/s and scanning "
+       << (scanned / (double)dur) << " keys/s" << std::endl;
+  fini();
+}
+
 struct AppendMOP : public KeyValueDB::MergeOperator {
   void merge_nonexistent(
     const char *rdata, size_t rlen, std::string *new_value) override {
@@ -349,6 +416,80 @@ TEST_P(KVTest, ShardingRMRange) {
 }
 
 
+TEST_P(KVTest, MultiGet) {
+  // with rocksdb: a sharded column family, a plain one and the default
+  const bool rocksdb = string(GetParam()) == "rocksdb";
+  ASSERT_EQ(0, db->create_and_open(cout, rocksdb ? "A(3) B" : ""));
+  const std::vector<string> prefixes = { "A", "B", "C" };
+  auto key_name = [](size_t i) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%3.3zu", i);
+    return string(key);
+  };
+  // every third key is never written and keys past 100 don't exist;
+  // some keys are read back from sst files, some deleted after that
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (auto& prefix : prefixes) {
+      for (size_t i = 0; i < 100; i++) {
+	if (i % 3 == 0) {
+	  continue;
+	}
+	bufferlist value;
+	if (i % 10 != 1) {
+	  value.append(prefix + key_name(i));
+	}
+	t->set(prefix, key_name(i), value);
+      }
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  db->compact();
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (auto& prefix : prefixes) {
+      for (size_t i = 0; i < 100; i += 7) {
+	t->rmkey(prefix, key_name(i));
+      }
+      bufferlist value;
+      value.append("new");
+      t->set(prefix, key_name(50), value);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+
+  for (auto& prefix : prefixes) {
+    std::set<string> keys;
+    for (size_t i = 0; i < 150; i++) {
+      keys.insert(key_name(i));
+    }
+    std::map<string, bufferlist> out;
+    ASSERT_EQ(0, db->get(prefix, keys, &out));
+    size_t found = 0;
+    for (auto& key : keys) {
+      bufferlist value;
+      int r = db->get(prefix, key, &value);
+      auto p = out.find(key);
+      if (r == -ENOENT) {
+	ASSERT_TRUE(p == out.end()) << prefix << " " << key;
+	continue;
+      }
+      ASSERT_EQ(0, r);
+      ASSERT_TRUE(p != out.end()) << prefix << " " << key;
+      ASSERT_EQ(_bl_to_str(value), _bl_to_str(p->second));
+      ++found;
+    }
+    ASSERT_EQ(found, out.size());
+    ASSERT_EQ("new", _bl_to_str(out[key_name(50)]));
+    ASSERT_EQ(0u, out[key_name(1)].length());
+
+    out.clear();
+    ASSERT_EQ(0, db->get(prefix, std::set<string>(), &out));
+    ASSERT_TRUE(out.empty());
+  }
+  fini();
+}
+
 TEST_P(KVTest, RocksDBColumnFamilyTest) {
   if(string(GetParam()) != "rocksdb")
     return;
@@ -451,6 +592,175 @@ TEST_P(KVTest, RocksDBIteratorTest) {
   fini();
 }
 
+TEST_P(KVTest, RocksDBTombstoneCompact) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  // the store reads these when it is created
+  fini();
+  g_ceph_context->_conf.set_val_or_die("rocksdb_tombstone_compact_threshold", "100");
+  g_ceph_context->_conf.set_val_or_die("rocksdb_tombstone_compact_interval", "0");
+  init();
+  ASSERT_EQ(0, db->init(g_conf()->bluestore_rocksdb_options));
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist bl;
+    bl.append("value");
+    for (int i = 0; i < 1000; ++i) {
+      t->set("prefix", stringify(1000 + i), bl);
+    }
+    t->set("prefix", "survivor", bl);
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (int i = 0; i < 1000; ++i) {
+      t->rmkey("prefix", stringify(1000 + i));
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    KeyValueDB::Iterator iter = db->get_iterator("prefix");
+    iter->seek_to_first();
+    ASSERT_TRUE(iter->valid());
+    ASSERT_EQ("survivor", iter->key());
+  }
+  // the range queued for compaction, as get_statistics() reports it
+  auto last_compact = [this](const string& prefix) {
+    JSONFormatter f;
+    f.open_object_section("stats");
+    db->get_statistics(&f);
+    f.close_section();
+    std::stringstream ss;
+    f.flush(ss);
+    JSONParser parser;
+    EXPECT_TRUE(parser.parse(ss.str().c_str(), ss.str().size()));
+    JSONObj *st = parser.find_obj("rocksdb_iterator_tombstones");
+    EXPECT_TRUE(st);
+    st = st ? st->find_obj(prefix) : nullptr;
+    EXPECT_TRUE(st);
+    if (!st) {
+      return make_pair(string(), string());
+    }
+    return make_pair(st->find_obj("last_compact_start")->get_data(),
+		     st->find_obj("last_compact_end")->get_data());
+  };
+  PerfCounters* logger = db->get_perf_counters();
+  ASSERT_LE(1000u, logger->get(l_rocksdb_iter_tombstones_skipped));
+  ASSERT_EQ(1u, logger->get(l_rocksdb_tombstone_compact));
+  // from the start of the prefix up to the key the seek found
+  ASSERT_EQ(make_pair(
+	      pretty_binary_string(RocksDBStore::combine_strings("prefix", "")),
+	      pretty_binary_string(
+		RocksDBStore::combine_strings("prefix", "survivor"))),
+	    last_compact("prefix"));
+
+  // a seek that runs off the end of the store is bounded by its prefix,
+  // not by the column families or prefixes after it
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist bl;
+    bl.append("value");
+    for (int i = 0; i < 1000; ++i) {
+      t->set("tail", stringify(1000 + i), bl);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (int i = 0; i < 1000; ++i) {
+      t->rmkey("tail", stringify(1000 + i));
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    KeyValueDB::Iterator iter = db->get_iterator("tail");
+    iter->seek_to_first();
+    ASSERT_FALSE(iter->valid());
+  }
+  ASSERT_EQ(2u, logger->get(l_rocksdb_tombstone_compact));
+  ASSERT_EQ(make_pair(
+	      pretty_binary_string(RocksDBStore::combine_strings("tail", "")),
+	      pretty_binary_string(
+		RocksDBStore::combine_strings("tail", "\xff\xff\xff\xff"))),
+	    last_compact("tail"));
+  fini();
+  g_ceph_context->_conf.rm_val("rocksdb_tombstone_compact_threshold");
+  g_ceph_context->_conf.rm_val("rocksdb_tombstone_compact_interval");
+}
+
+TEST_P(KVTest, RocksDBPrefixStats) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  // the store reads it when it is created
+  fini();
+  g_ceph_context->_conf.set_val_or_die("rocksdb_prefix_stats", "true");
+  init();
+  ASSERT_EQ(0, db->init(g_conf()->bluestore_rocksdb_options));
+  ASSERT_EQ(0, db->create_and_open(cout, "A(3) B"));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist bl;
+    bl.append("value");
+    for (int i = 0; i < 30; ++i) {
+      t->set("A", stringify(i), bl);
+    }
+    t->set("B", "key", bl);
+    t->set("C", "key", bl);
+    t->rmkey("C", "gone");
+    t->set("long", "key1", bl);
+    t->set("long", "key2", bl);
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    bufferlist bl;
+    ASSERT_EQ(0, db->get("C", "key", &bl));
+    std::set<string> keys = {"key", "missing"};
+    std::map<string, bufferlist> out;
+    ASSERT_EQ(0, db->get("B", keys, &out));
+    ASSERT_EQ(1u, out.size());
+    KeyValueDB::Iterator iter = db->get_iterator("A");
+    ASSERT_EQ(0, iter->seek_to_first());
+    ASSERT_TRUE(iter->valid());
+    KeyValueDB::WholeSpaceIterator wi = db->get_wholespace_iterator();
+    ASSERT_EQ(0, wi->seek_to_first("long"));
+    ASSERT_EQ(0, wi->lower_bound("long", "key2"));
+    ASSERT_TRUE(wi->valid());
+  }
+  RocksDBStore *r = static_cast<RocksDBStore*>(db.get());
+  PerfCounters *c = r->find_prefix_stats("C");
+  ASSERT_TRUE(c);
+  ASSERT_EQ(1u, c->get(l_rocksdb_prefix_gets));
+  ASSERT_EQ(5u, c->get(l_rocksdb_prefix_get_bytes));
+  ASSERT_EQ(2u, c->get(l_rocksdb_prefix_writes));
+  ASSERT_EQ(1u, c->get(l_rocksdb_prefix_submits));
+  PerfCounters *b = r->find_prefix_stats("B");
+  ASSERT_TRUE(b);
+  ASSERT_EQ(1u, b->get(l_rocksdb_prefix_gets));
+  ASSERT_EQ(5u, b->get(l_rocksdb_prefix_get_bytes));
+  ASSERT_EQ(1u, b->get(l_rocksdb_prefix_writes));
+  // the writes to A went to its shards, the seek to A as a whole
+  uint64_t writes = 0;
+  for (int i = 0; i < 3; ++i) {
+    PerfCounters *shard = r->find_prefix_stats("A-" + stringify(i));
+    ASSERT_TRUE(shard);
+    writes += shard->get(l_rocksdb_prefix_writes);
+  }
+  ASSERT_EQ(30u, writes);
+  PerfCounters *a = r->find_prefix_stats("A");
+  ASSERT_TRUE(a);
+  ASSERT_EQ(1u, a->get(l_rocksdb_prefix_seeks));
+  PerfCounters *l = r->find_prefix_stats("long");
+  ASSERT_TRUE(l);
+  ASSERT_EQ(2u, l->get(l_rocksdb_prefix_writes));
+  ASSERT_EQ(1u, l->get(l_rocksdb_prefix_submits));
+  ASSERT_EQ(2u, l->get(l_rocksdb_prefix_seeks));
+  fini();
+  g_ceph_context->_conf.rm_val("rocksdb_prefix_stats");
+}
+
 TEST_P(KVTest, RocksDBShardingIteratorTest) {
   if(string(GetParam()) != "rocksdb")
     return;
@@ -1276,7 +1586,7 @@ TEST_F(RocksDBResharding, change_reshard) {
 INSTANTIATE_TEST_SUITE_P(
   KeyValueDB,
   KVTest,
-  ::testing::Values("leveldb", "rocksdb", "memdb"));
+  ::testing::Values("leveldb", "rocksdb", "memdb", "memdb_concurrent"));
 
 INSTANTIATE_TEST_SUITE_P(
   KeyValueDB,
@@ -58,3 +58,87 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+
+TEST(ECUtil, get_want_to_read_shards)
+{
+  // 4 data chunks of 16 bytes, placed on shards 5, 0, 2 and 4
+  ECUtil::stripe_info_t s(4, 64);
+  const std::vector<int> mapping = {5, 0, 2, 4};
+
+  std::set<int> want;
+  ECUtil::get_want_to_read_shards(s, mapping, 0, 1, &want);
+  ASSERT_EQ(want, std::set<int>({5}));
+
+  // crosses a chunk boundary
+  want.clear();
+  ECUtil::get_want_to_read_shards(s, mapping, 15, 2, &want);
+  ASSERT_EQ(want, std::set<int>({5, 0}));
+
+  // crosses a stripe boundary, last chunk of one and first of the next
+  want.clear();
+  ECUtil::get_want_to_read_shards(s, mapping, 120, 16, &want);
+  ASSERT_EQ(want, std::set<int>({4, 5}));
+
+  // a stripe or more wants every data shard
+  want.clear();
+  ECUtil::get_want_to_read_shards(s, mapping, 70, 64, &want);
+  ASSERT_EQ(want, std::set<int>({5, 0, 2, 4}));
+
+  // without a mapping data chunk i is shard i
+  want.clear();
+  ECUtil::get_want_to_read_shards(s, std::vector<int>(), 40, 10, &want);
+  ASSERT_EQ(want, std::set<int>({2, 3}));
+}
+
+TEST(ECUtil, gather_read_from_shards)
+{
+  ECUtil::stripe_info_t s(4, 64);
+  const std::vector<int> mapping = {5, 0, 2, 4};
+  auto byte = [](uint64_t logical) { return (char)(logical % 251); };
+
+  // decoded data shards for the stripes [64, 192)
+  const uint64_t shard_start = 64;
+  std::map<int, bufferlist> shards;
+  for (uint64_t stripe = shard_start; stripe < 192; stripe += 64) {
+    for (unsigned i = 0; i < mapping.size(); ++i) {
+      for (uint64_t j = 0; j < 16; ++j) {
+	shards[mapping[i]].append(byte(stripe + i * 16 + j));
+      }
+    }
+  }
+  auto expect = [&](uint64_t off, uint64_t len) {
+    bufferlist bl;
+    for (uint64_t i = off; i < off + len; ++i) {
+      bl.append(byte(i));
+    }
+    return bl;
+  };
+
+  // within a chunk
+  bufferlist out;
+  ECUtil::gather_read_from_shards(s, mapping, shard_start, 66, 10,
+				  shards, &out);
+  ASSERT_TRUE(out.contents_equal(expect(66, 10)));
+
+  // across chunk and stripe boundaries
+  out.clear();
+  ECUtil::gather_read_from_shards(s, mapping, shard_start, 70, 100,
+				  shards, &out);
+  ASSERT_TRUE(out.contents_equal(expect(70, 100)));
+
+  // a read past the end of the object stops where the shards do
+  out.clear();
+  ECUtil::gather_read_from_shards(s, mapping, shard_start, 180, 40,
+				  shards, &out);
+  ASSERT_TRUE(out.contents_equal(expect(180, 12)));
+
+  // short shards, only the first of the two stripes was there to read
+  std::map<int, bufferlist> short_shards;
+  for (auto &&i: shards) {
+    short_shards[i.first].substr_of(i.second, 0, 16);
+  }
+  out.clear();
+  ECUtil::gather_read_from_shards(s, mapping, shard_start, 100, 80,
+				  short_shards, &out);
+  ASSERT_TRUE(out.contents_equal(expect(100, 28)));
+}
@@ -429,9 +429,9 @@ TEST_F(PGLogTest, rewind_divergent_log) {
     rewind_divergent_log(newhead, info, &h,
 			 dirty_info, dirty_big_info);
 
-    EXPECT_TRUE(log.objects.count(divergent));
+    EXPECT_TRUE(log.get_objects().count(divergent));
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.get_objects().count(divergent_object));
     EXPECT_EQ(2U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(newhead, info.last_update);
@@ -495,7 +495,7 @@ TEST_F(PGLogTest, rewind_divergent_log) {
 			 dirty_info, dirty_big_info);
 
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(0U, log.objects.count(divergent_object));
+    EXPECT_EQ(0U, log.get_objects().count(divergent_object));
     EXPECT_TRUE(log.empty());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_TRUE(is_dirty());
@@ -1144,7 +1144,7 @@ TEST_F(PGLogTest, merge_log) {
     }
 
     EXPECT_FALSE(missing.have_missing());
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.get_objects().count(divergent_object));
     EXPECT_EQ(3U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(log.head, info.last_update);
@@ -1163,7 +1163,7 @@ TEST_F(PGLogTest, merge_log) {
        to be divergent.
     */
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.get_objects().count(divergent_object));
     EXPECT_EQ(4U, log.log.size());
     /* DELETE entries from olog that are appended to the hed of the
        log, and the divergent version of the object is removed (added
@@ -1262,7 +1262,7 @@ TEST_F(PGLogTest, merge_log) {
     }
 
     EXPECT_FALSE(missing.have_missing());
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.get_objects().count(divergent_object));
     EXPECT_EQ(3U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(log.head, info.last_update);
@@ -1282,7 +1282,7 @@ TEST_F(PGLogTest, merge_log) {
        to be divergent.
     */
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.get_objects().count(divergent_object));
     EXPECT_EQ(4U, log.log.size());
     /* DELETE entries from olog that are appended to the hed of the
        log, and the divergent version of the object is removed (added
@@ -2233,7 +2233,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
   log.add(modify);
 
   EXPECT_TRUE(log.logged_object(oid));
-  pg_log_entry_t *entry = log.objects[oid];
+  const pg_log_entry_t *entry = log.get_latest_entry(oid);
   EXPECT_EQ(modify.op, entry->op);
   EXPECT_EQ(modify.version, entry->version);
   EXPECT_EQ(modify.prior_version, entry->prior_version);
@@ -2247,7 +2247,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
   log.add(del);
 
   EXPECT_TRUE(log.logged_object(oid));
-  entry = log.objects[oid];
+  entry = log.get_latest_entry(oid);
   EXPECT_EQ(del.op, entry->op);
   EXPECT_EQ(del.version, entry->version);
   EXPECT_EQ(del.prior_version, entry->prior_version);
@@ -2260,7 +2260,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
 		   utime_t(20,1), -ENOENT));
 
   EXPECT_TRUE(log.logged_object(oid));
-  entry = log.objects[oid];
+  entry = log.get_latest_entry(oid);
   EXPECT_EQ(del.op, entry->op);
   EXPECT_EQ(del.version, entry->version);
   EXPECT_EQ(del.prior_version, entry->prior_version);
@@ -2452,9 +2452,9 @@ public:
   }
 
   void check_index() {
-    EXPECT_EQ(log.dups.size(), log.dup_index.size());
+    EXPECT_EQ(log.dups.size(), log.get_dup_index().size());
     for (auto& i : log.dups) {
-      EXPECT_EQ(1u, log.dup_index.count(i.reqid));
+      EXPECT_EQ(1u, log.get_dup_index().count(i.reqid));
     }
   }
 
@@ -2828,7 +2828,7 @@ TEST_F(PGLogTrimTest, TestTrimAll)
 {
   SetUp(20);
   PGLog::IndexedLog log;
-  EXPECT_EQ(0u, log.dup_index.size()); // Sanity check
+  EXPECT_EQ(0u, log.get_dup_index().size()); // Sanity check
   log.head = mk_evt(24, 0);
   log.skip_can_rollback_to_to_head();
   log.head = mk_evt(9, 0);
@@ -2851,7 +2851,7 @@ TEST_F(PGLogTrimTest, TestTrimAll)
   EXPECT_EQ(6u, trimmed.size());
   EXPECT_EQ(5u, log.dups.size());
   EXPECT_EQ(0u, trimmed_dups.size());
-  EXPECT_EQ(0u, log.dup_index.size()); // dup_index entry should be trimmed
+  EXPECT_EQ(0u, log.get_dup_index().size()); // dup_index entry should be trimmed
 }
 
 
@@ -2911,6 +2911,54 @@ TEST_F(PGLogTrimTest, TestGetRequest) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(PGLogTrimTest, TestLazyIndex) {
+  SetUp(20);
+  entity_name_t client = entity_name_t::CLIENT(777);
+
+  pg_log_t plog;
+  plog.tail = mk_evt(9, 0);
+  plog.log.push_back(mk_ple_mod(mk_obj(1), mk_evt(10, 100), mk_evt(8, 70),
+				osd_reqid_t(client, 8, 1)));
+  plog.log.push_back(mk_ple_mod(mk_obj(2), mk_evt(10, 101), mk_evt(8, 71),
+				osd_reqid_t(client, 8, 2)));
+  plog.head = mk_evt(10, 101);
+
+  // nothing is indexed until the log is queried
+  PGLog::IndexedLog log(plog);
+  EXPECT_EQ(0u, log.get_indexed_data());
+  EXPECT_EQ(0u, log.get_objects().size());
+  EXPECT_EQ(0u, log.get_caller_ops().size());
+
+  EXPECT_TRUE(log.logged_object(mk_obj(2)));
+  EXPECT_EQ(PGLOG_INDEXED_OBJECTS, log.get_indexed_data());
+  EXPECT_EQ(2u, log.get_objects().size());
+  EXPECT_EQ(0u, log.get_caller_ops().size());
+  ASSERT_TRUE(log.get_latest_entry(mk_obj(1)));
+  EXPECT_EQ(mk_evt(10, 100), log.get_latest_entry(mk_obj(1))->version);
+  EXPECT_FALSE(log.get_latest_entry(mk_obj(3)));
+
+  // an index once built follows the log
+  log.add(mk_ple_mod(mk_obj(3), mk_evt(11, 102), mk_evt(8, 72),
+		     osd_reqid_t(client, 8, 3)));
+  EXPECT_EQ(3u, log.get_objects().size());
+  EXPECT_EQ(0u, log.get_caller_ops().size());
+
+  // rewinding keeps what was indexed, and only that
+  log.rewind_from_head(mk_evt(10, 101));
+  EXPECT_EQ(PGLOG_INDEXED_OBJECTS, log.get_indexed_data());
+  EXPECT_EQ(2u, log.get_objects().size());
+  EXPECT_FALSE(log.logged_object(mk_obj(3)));
+
+  EXPECT_TRUE(log.logged_req(osd_reqid_t(client, 8, 1)));
+  EXPECT_EQ(2u, log.get_caller_ops().size());
+
+  log.unindex();
+  EXPECT_EQ(0u, log.get_indexed_data());
+  EXPECT_EQ(0u, log.get_objects().size());
+  EXPECT_EQ(0u, log.get_caller_ops().size());
+  EXPECT_TRUE(log.logged_req(osd_reqid_t(client, 8, 2)));
+}
+
 TEST_F(PGLogTest, _merge_object_divergent_entries) {
   {
     // Test for issue 20843
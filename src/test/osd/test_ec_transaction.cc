@@ -15,6 +15,7 @@
 #include <gtest/gtest.h>
 #include "osd/PGTransaction.h"
 #include "osd/ECTransaction.h"
+#include "erasure-code/jerasure/ErasureCodeJerasure.h"
 
 #include "test/unit.cc"
 
@@ -122,3 +123,201 @@ TEST(ectransaction, many_writes)
   ASSERT_EQ(0u, plan.to_read.size());
   ASSERT_EQ(1u, plan.will_write.size());
 }
+
+struct RollbackExtents : public ObjectModDesc::Visitor {
+  std::vector<std::pair<uint64_t, uint64_t> > extents;
+  void rollback_extents(
+    version_t gen,
+    const std::vector<std::pair<uint64_t, uint64_t> > &e) override {
+    extents.insert(extents.end(), e.begin(), e.end());
+  }
+};
+
+TEST(ectransaction, delta_write)
+{
+  ErasureCodeInterfaceRef ec(new ErasureCodeJerasureReedSolomonVandermonde);
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = "2";
+  ASSERT_EQ(0, ec->init(profile, &cerr));
+  ASSERT_TRUE(ec->supports_parity_delta());
+  const unsigned n = ec->get_chunk_count();
+  const uint64_t chunk_size = 4096;
+  const uint64_t stripe_width = 4 * chunk_size;
+  ECUtil::stripe_info_t sinfo(4, stripe_width);
+
+  // an object of two stripes, and its shards
+  bufferlist old_data;
+  for (uint64_t i = 0; i < 2 * stripe_width; ++i) {
+    old_data.append((char)(rand() & 0xff));
+  }
+  std::set<int> want;
+  for (unsigned i = 0; i < n; ++i) {
+    want.insert(i);
+  }
+  std::map<int, bufferlist> old_shards;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec, old_data, want, &old_shards));
+
+  // overwrite part of the second data chunk of the second stripe
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+  const uint64_t off = stripe_width + chunk_size + 100;
+  bufferlist update;
+  update.append(std::string(1000, 'x'));
+  PGTransactionUPtr t(new PGTransaction);
+  ObjectContextRef obc(new ObjectContext);
+  obc->obs.oi.soid = h;
+  t->add_obc(obc);
+  t->write(h, off, update.length(), update, 0);
+
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    std::move(t),
+    [&](const hobject_t &i) {
+      ECUtil::HashInfoRef ref(new ECUtil::HashInfo(n));
+      ref->set_total_chunk_size_clear_hash(2 * chunk_size);
+      ref->set_projected_total_logical_size(sinfo, 2 * stripe_width);
+      return ref;
+    },
+    &dpp,
+    ec);
+  ASSERT_EQ(1u, plan.delta_writes.count(h));
+  auto &dw = plan.delta_writes.at(h);
+  extent_set stripe;
+  stripe.insert(stripe_width, stripe_width);
+  ASSERT_EQ(stripe, dw.stripes);
+  extent_set changed_chunk;
+  changed_chunk.insert(stripe_width + chunk_size, chunk_size);
+  ASSERT_EQ(changed_chunk, dw.will_write);
+  // the changed data chunk and the parity
+  ASSERT_EQ(3u, dw.shards.size());
+
+  // what ECBackend does once it chose the delta and read the shards
+  plan.will_write[h] = dw.will_write;
+  plan.to_read.erase(h);
+  for (auto shard : dw.shards) {
+    bufferlist bl;
+    bl.substr_of(old_shards[shard], chunk_size, chunk_size);
+    dw.old_chunks[shard].insert(chunk_size, chunk_size, bl);
+  }
+
+  std::vector<pg_log_entry_t> entries(1);
+  entries[0].op = pg_log_entry_t::MODIFY;
+  entries[0].soid = h;
+  entries[0].version = eversion_t(1, 2);
+  std::map<hobject_t, extent_map> written;
+  std::map<shard_id_t, ObjectStore::Transaction> transactions;
+  for (unsigned i = 0; i < n; ++i) {
+    transactions[shard_id_t(i)];
+  }
+  std::set<hobject_t> temp_added, temp_removed;
+  ECTransaction::generate_transactions(
+    plan, ec, pg_t(1, 0), sinfo, {}, entries, &written, &transactions,
+    &temp_added, &temp_removed, &dpp);
+
+  ASSERT_EQ(plan.will_write.at(h), written[h].get_interval_set());
+
+  // every shard can roll back the whole stripe
+  RollbackExtents rollback;
+  entries[0].mod_desc.visit(&rollback);
+  ASSERT_EQ(1u, rollback.extents.size());
+  ASSERT_EQ(std::make_pair(chunk_size, chunk_size), rollback.extents[0]);
+
+  // apply the writes to the old shards; they must end up as if the new
+  // content had been encoded from scratch
+  std::map<int, bufferlist> shards = old_shards;
+  for (auto &&[shard, st] : transactions) {
+    for (auto i = st.begin(); i.have_op(); ) {
+      auto *op = i.decode_op();
+      switch (op->op) {
+      case ObjectStore::Transaction::OP_WRITE:
+	{
+	  bufferlist bl;
+	  i.decode_bl(bl);
+	  ASSERT_EQ(op->len, bl.length());
+	  bufferlist &cur = shards[shard];
+	  bufferlist out;
+	  out.substr_of(cur, 0, op->off);
+	  out.append(bl);
+	  bufferlist tail;
+	  tail.substr_of(cur, op->off + op->len,
+			 cur.length() - op->off - op->len);
+	  out.append(tail);
+	  cur = std::move(out);
+	}
+	break;
+      case ObjectStore::Transaction::OP_SETATTR:
+	{
+	  bufferlist bl;
+	  i.decode_string();
+	  i.decode_bl(bl);
+	}
+	break;
+      case ObjectStore::Transaction::OP_SETATTRS:
+	{
+	  std::map<std::string, bufferptr> aset;
+	  i.decode_attrset(aset);
+	}
+	break;
+      default:
+	break;
+      }
+    }
+  }
+  bufferlist new_data;
+  new_data.substr_of(old_data, 0, off);
+  new_data.append(update);
+  bufferlist tail;
+  tail.substr_of(old_data, off + update.length(),
+		 old_data.length() - off - update.length());
+  new_data.append(tail);
+  std::map<int, bufferlist> new_shards;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec, new_data, want, &new_shards));
+  for (unsigned i = 0; i < n; ++i) {
+    ASSERT_TRUE(new_shards[i].contents_equal(shards[i])) << "shard " << i;
+  }
+}
+
+TEST(ectransaction, delta_write_mapped)
+{
+  // jerasure encodes the chunks in shard order whatever the mapping,
+  // parity deltas computed by chunk index would not match it
+  ErasureCodeInterfaceRef ec(new ErasureCodeJerasureReedSolomonVandermonde);
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = "2";
+  profile["mapping"] = "_DD_DD";
+  ASSERT_EQ(0, ec->init(profile, &cerr));
+  ASSERT_FALSE(ec->get_chunk_mapping().empty());
+  ASSERT_FALSE(ec->supports_parity_delta());
+  const unsigned n = ec->get_chunk_count();
+  const uint64_t chunk_size = 4096;
+  const uint64_t stripe_width = 4 * chunk_size;
+  ECUtil::stripe_info_t sinfo(4, stripe_width);
+
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+  bufferlist update;
+  update.append(std::string(1000, 'x'));
+  PGTransactionUPtr t(new PGTransaction);
+  ObjectContextRef obc(new ObjectContext);
+  obc->obs.oi.soid = h;
+  t->add_obc(obc);
+  t->write(h, stripe_width + chunk_size + 100, update.length(), update, 0);
+
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    std::move(t),
+    [&](const hobject_t &i) {
+      ECUtil::HashInfoRef ref(new ECUtil::HashInfo(n));
+      ref->set_total_chunk_size_clear_hash(2 * chunk_size);
+      ref->set_projected_total_logical_size(sinfo, 2 * stripe_width);
+      return ref;
+    },
+    &dpp,
+    ec);
+  // the full stripe read-modify-write is planned, no delta
+  ASSERT_EQ(0u, plan.delta_writes.size());
+  extent_set stripe;
+  stripe.insert(stripe_width, stripe_width);
+  ASSERT_EQ(stripe, plan.to_read.at(h));
+  ASSERT_EQ(stripe, plan.will_write.at(h));
+}
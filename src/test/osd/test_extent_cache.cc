@@ -87,6 +87,34 @@ TEST(extentcache, simple_write)
   c.release_write_pin(pin);
 }
 
+TEST(extentcache, is_pinned)
+{
+  hobject_t oid;
+  hobject_t other(object_t("other"), "", CEPH_NOSNAP, 0, 0, "");
+
+  ExtentCache c;
+  ASSERT_FALSE(c.is_pinned(oid, iset_from_vector({{0, 10}})));
+
+  ExtentCache::write_pin pin;
+  c.open_write_pin(pin);
+  auto to_write = iset_from_vector({{0, 10}, {20, 4}});
+  auto must_read = c.reserve_extents_for_rmw(
+    oid, pin, to_write, extent_set());
+  ASSERT_TRUE(must_read.empty());
+
+  ASSERT_TRUE(c.is_pinned(oid, iset_from_vector({{8, 4}})));
+  ASSERT_TRUE(c.is_pinned(oid, iset_from_vector({{12, 4}, {22, 8}})));
+  ASSERT_FALSE(c.is_pinned(oid, iset_from_vector({{10, 10}})));
+  ASSERT_FALSE(c.is_pinned(oid, iset_from_vector({{24, 100}})));
+  ASSERT_FALSE(c.is_pinned(other, iset_from_vector({{0, 10}})));
+
+  auto write_map = imap_from_iset(to_write);
+  c.present_rmw_update(oid, pin, write_map);
+  c.release_write_pin(pin);
+
+  ASSERT_FALSE(c.is_pinned(oid, iset_from_vector({{0, 10}})));
+}
+
 TEST(extentcache, write_write_overlap)
 {
   hobject_t oid;
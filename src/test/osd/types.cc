@@ -2192,6 +2192,74 @@ TEST(chunk_info_test, calc_refs_inc_match) {
     mk_delta({}));
 }
 
+TEST(ObjectModDesc, encoding) {
+  struct Appends : public ObjectModDesc::Visitor {
+    std::vector<uint64_t> sizes;
+    void append(uint64_t old_size) override {
+      sizes.push_back(old_size);
+    }
+  };
+
+  // a small desc stays inside the entry, a larger one does not
+  ObjectModDesc desc;
+  desc.append(100);
+  EXPECT_EQ(0u, desc.get_heap_bytes());
+  map<string, std::optional<bufferlist>> attrs;
+  attrs[OI_ATTR] = bufferlist();
+  attrs[OI_ATTR]->append(string(200, 'x'));
+  desc.setattrs(attrs);
+  desc.append(200);
+  desc.trim_bl();
+  EXPECT_LT(0u, desc.get_heap_bytes());
+
+  // the ops are encoded as the bufferlist they used to be kept in
+  bufferlist ops;
+  {
+    ENCODE_START(1, 1, ops);
+    encode((uint8_t)ObjectModDesc::APPEND, ops);
+    encode((uint64_t)100, ops);
+    ENCODE_FINISH(ops);
+  }
+  {
+    ENCODE_START(1, 1, ops);
+    encode((uint8_t)ObjectModDesc::SETATTRS, ops);
+    encode(attrs, ops);
+    ENCODE_FINISH(ops);
+  }
+  {
+    ENCODE_START(1, 1, ops);
+    encode((uint8_t)ObjectModDesc::APPEND, ops);
+    encode((uint64_t)200, ops);
+    ENCODE_FINISH(ops);
+  }
+  bufferlist expected;
+  {
+    ENCODE_START(1, 1, expected);
+    encode(true, expected);
+    encode(false, expected);
+    encode(ops, expected);
+    ENCODE_FINISH(expected);
+  }
+  bufferlist bl;
+  encode(desc, bl);
+  EXPECT_TRUE(bl.contents_equal(expected));
+
+  ObjectModDesc decoded;
+  auto p = bl.cbegin();
+  decode(decoded, p);
+  bufferlist again;
+  encode(decoded, again);
+  EXPECT_TRUE(again.contents_equal(expected));
+
+  Appends appends;
+  decoded.visit(&appends);
+  EXPECT_EQ(std::vector<uint64_t>({100, 200}), appends.sizes);
+
+  decoded.mark_unrollbackable();
+  EXPECT_EQ(0u, decoded.get_heap_bytes());
+  EXPECT_FALSE(decoded.can_rollback());
+}
+
 /*
  * Local Variables:
  * compile-command: "cd ../.. ;
@@ -49,6 +49,7 @@ void usage(const char *pname)
     << "  destructive-repair  (use only as last resort! may corrupt healthy data)\n"
     << "  stats\n"
     << "  histogram [prefix]\n"
+    << "  bench-get <prefix> [batch-size] [num-batches]\n"
     << std::endl;
 }
 
@@ -353,6 +354,28 @@ int main(int argc, const char *argv[])
     if (argc > 4)
       prefix = url_unescape(argv[4]);
     st.build_size_histogram(prefix);
+  } else if (cmd == "bench-get") {
+    if (argc < 5) {
+      usage(argv[0]);
+      return 1;
+    }
+    string prefix(url_unescape(argv[4]));
+    size_t batch_size = 64;
+    size_t num_batches = 1000;
+    string err;
+    if (argc > 5) {
+      batch_size = strict_strtol(argv[5], 10, &err);
+    }
+    if (err.empty() && argc > 6) {
+      num_batches = strict_strtol(argv[6], 10, &err);
+    }
+    if (!err.empty()) {
+      std::cerr << "invalid argument: " << err << std::endl;
+      return 1;
+    }
+    if (st.bench_get(prefix, batch_size, num_batches) < 0) {
+      return 1;
+    }
   } else {
     std::cerr << "Unrecognized command: " << cmd << std::endl;
     return 1;
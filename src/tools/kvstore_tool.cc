@@ -4,6 +4,7 @@
 #include "kvstore_tool.h"
 
 #include <iostream>
+#include <random>
 
 #include "common/errno.h"
 #include "common/url_escape.h"
@@ -290,6 +291,87 @@ int StoreTool::build_size_histogram(const string& prefix0) const
   return 0;
 }
 
+// Compares looking keys up one by one with looking up whole batches of
+// them, on keys sampled from the given prefix
+int StoreTool::bench_get(const string& prefix, size_t batch_size,
+			 size_t num_batches)
+{
+  if (batch_size == 0 || num_batches == 0) {
+    std::cerr << "batch size and number of batches must be > 0" << std::endl;
+    return -EINVAL;
+  }
+  const size_t max_sample = 1 << 20;
+  std::vector<string> sample;
+  auto iter = db->get_iterator(prefix, KeyValueDB::ITERATOR_NOCACHE);
+  for (iter->seek_to_first();
+       iter->valid() && sample.size() < max_sample;
+       iter->next()) {
+    sample.push_back(iter->key());
+  }
+  if (sample.empty()) {
+    std::cerr << "no keys found in prefix " << url_escape(prefix)
+	      << std::endl;
+    return -ENOENT;
+  }
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> pick(0, sample.size() - 1);
+  std::vector<std::set<string>> batches(num_batches);
+  for (auto& batch : batches) {
+    while (batch.size() < std::min(batch_size, sample.size())) {
+      batch.insert(sample[pick(rng)]);
+    }
+  }
+
+  // every batch is read both ways; whichever goes second finds the
+  // block cache warmed by the first, so alternate which one that is
+  uint64_t found_single = 0, found_batched = 0;
+  ceph::timespan single = ceph::timespan::zero();
+  ceph::timespan batched = ceph::timespan::zero();
+  auto get_single = [&](const std::set<string>& batch) {
+    auto start = mono_clock::now();
+    for (auto& key : batch) {
+      bufferlist bl;
+      if (db->get(prefix, key, &bl) >= 0) {
+	++found_single;
+      }
+    }
+    single += mono_clock::now() - start;
+  };
+  auto get_batched = [&](const std::set<string>& batch) {
+    auto start = mono_clock::now();
+    std::map<string, bufferlist> out;
+    db->get(prefix, batch, &out);
+    found_batched += out.size();
+    batched += mono_clock::now() - start;
+  };
+  for (size_t i = 0; i < batches.size(); ++i) {
+    if (i % 2) {
+      get_batched(batches[i]);
+      get_single(batches[i]);
+    } else {
+      get_single(batches[i]);
+      get_batched(batches[i]);
+    }
+  }
+
+  std::unique_ptr<Formatter> f(
+    Formatter::create("json-pretty", "json-pretty", "json-pretty"));
+  f->open_object_section("bench_get");
+  f->dump_string("prefix", url_escape(prefix));
+  f->dump_unsigned("sampled_keys", sample.size());
+  f->dump_unsigned("batch_size", batch_size);
+  f->dump_unsigned("batches", num_batches);
+  f->dump_unsigned("found_single", found_single);
+  f->dump_unsigned("found_batched", found_batched);
+  f->dump_float("single_seconds", std::chrono::duration<double>(single).count());
+  f->dump_float("batched_seconds", std::chrono::duration<double>(batched).count());
+  f->close_section();
+  f->flush(std::cout);
+  std::cout << std::endl;
+  return found_single == found_batched ? 0 : -EIO;
+}
+
 int StoreTool::copy_store_to(const string& type, const string& other_path,
                              const int num_keys_per_tx,
                              const string& other_type)
@@ -78,4 +78,6 @@ public:
 
   int print_stats() const;
   int build_size_histogram(const string& prefix) const;
+  int bench_get(const std::string& prefix, size_t batch_size,
+		size_t num_batches);
 };